@@ -16,6 +16,8 @@
 #define L_CPR_VALUE             "label_6"
 #define ENCODDER_POLARITY       "checkBox_2"
 #define SET_AZIMUTH_CPR         "pushButton_6"
+#define CALIBRATE_CPR           "calibrateCPR"
+#define CALIBRATE_CPR_STATUS    "calibrateStatus"
 #define IS_AT_HOME              "isAtHome"
 
 // Homing
@@ -36,6 +38,7 @@
 #define LEARN_AZIMUTH_CPR_RIGHT_CLICKED "on_pushButton_clicked"
 #define LEARN_AZIMUTH_CPR_LEFT_CLICKED  "on_pushButton_5_clicked"
 #define SET_CPR_FROM_GAUGED             "on_pushButton_6_clicked"
+#define CALIBRATE_CPR_CLICKED           "on_calibrateCPR_clicked"
 #define DIAG_CKICKED        "on_pushButton_2_clicked"
 #define SHUTTER_CKICKED     "on_pushButton_3_clicked"
 #define TIMEOUTS_CKICKED    "on_pushButton_4_clicked"
@@ -112,6 +115,25 @@
 #define SHUT_TEMPERATURE	"label_16"
 #define NB_REF_LINK_ERROR	"label_20"
 #define RF_LINK_ERROR_CLEAR	"pushButton_3"
+#define SHUT_BATTERY_STATUS	"label_22"
+// History, one stats and one sparkline label per telemetry channel
+#define DIAG_HISTORY_WINDOW		"comboBox"
+#define AZ_SUPPLY_HISTORY		"label_25"
+#define AZ_SUPPLY_SPARK			"label_26"
+#define SHUT_SUPPLY_HISTORY		"label_28"
+#define SHUT_SUPPLY_SPARK		"label_29"
+#define AZ_MOTOR_HISTORY		"label_31"
+#define AZ_MOTOR_SPARK			"label_32"
+#define SHUT_MOTOR_HISTORY		"label_34"
+#define SHUT_MOTOR_SPARK		"label_35"
+#define AZ_TEMP_HISTORY			"label_37"
+#define AZ_TEMP_SPARK			"label_38"
+#define SHUT_TEMP_HISTORY		"label_40"
+#define SHUT_TEMP_SPARK			"label_41"
+#define LINK_ERRORS_HISTORY		"label_43"
+#define LINK_ERRORS_SPARK		"label_44"
+#define COMMANDS_HISTORY		"label_46"
+#define ROUND_TRIP_HISTORY		"label_48"
 // Cancel/Ok
 #define DIAG_BUTTON_OK		"pushButtonOK"
 //
@@ -0,0 +1,82 @@
+//
+//  adcbench.cpp
+//  ATCL Dome X2 plugin
+//
+//  Benchmark of the batch ADC conversions, every SIMD level the CPU supports is checked against the scalar code.
+//  usage : adcbench [samples] [passes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+#include "adcconvert.h"
+
+static const char *s_szConversionNames[ADC_CONVERSION_COUNT] = {"raw", "supply volts", "motor amps", "temp C"};
+
+int main(int argc, char *argv[])
+{
+    size_t nSamples = 4000000;
+    int nPasses = 10;
+    int nConversion;
+    int nLevel;
+    int nPass;
+    int nErrors = 0;
+    size_t i;
+    double dSeconds;
+    double dBest;
+    std::vector<int32_t> Raw;
+    std::vector<double> Reference;
+    std::vector<double> Values;
+    std::chrono::steady_clock::time_point Start;
+
+    if(argc > 1)
+        nSamples = (size_t)atol(argv[1]);
+    if(argc > 2)
+        nPasses = atoi(argv[2]);
+    if(!nSamples || nPasses < 1) {
+        fprintf(stderr, "usage : %s [samples] [passes]\n", argv[0]);
+        return 1;
+    }
+
+    // 10 bit samples, odd count to exercise the tails
+    nSamples |= 1;
+    Raw.resize(nSamples);
+    Reference.resize(nSamples);
+    Values.resize(nSamples);
+    srand(1);
+    for(i = 0; i < nSamples; i++)
+        Raw[i] = rand() % 1024;
+
+    printf("%zu samples, best of %d passes, CPU supports %s\n", nSamples, nPasses,
+           CAdcConvert::simdLevelName(CAdcConvert::getSupportedSimdLevel()));
+
+    for(nConversion = 0; nConversion < ADC_CONVERSION_COUNT; nConversion++) {
+        for(i = 0; i < nSamples; i++)
+            Reference[i] = CAdcConvert::convert(nConversion, Raw[i]);
+
+        for(nLevel = ADC_SIMD_SCALAR; nLevel <= CAdcConvert::getSupportedSimdLevel(); nLevel++) {
+            CAdcConvert::setSimdLevel(nLevel);
+            dBest = 1e9;
+            for(nPass = 0; nPass < nPasses; nPass++) {
+                Start = std::chrono::steady_clock::now();
+                CAdcConvert::convert(nConversion, Raw.data(), Values.data(), nSamples);
+                dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+                if(dSeconds < dBest)
+                    dBest = dSeconds;
+            }
+            // must be bit identical to the single sample conversion
+            if(memcmp(Values.data(), Reference.data(), nSamples * sizeof(double))) {
+                printf("%-14s %-7s MISMATCH\n", s_szConversionNames[nConversion], CAdcConvert::simdLevelName(nLevel));
+                nErrors++;
+                continue;
+            }
+            printf("%-14s %-7s %8.1f Msamples/s\n", s_szConversionNames[nConversion], CAdcConvert::simdLevelName(nLevel),
+                   nSamples / dBest / 1e6);
+        }
+    }
+    CAdcConvert::setSimdLevel(ADC_SIMD_AUTO);
+
+    return nErrors ? 1 : 0;
+}
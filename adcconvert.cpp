@@ -0,0 +1,218 @@
+//
+//  adcconvert.cpp
+//  ATCL Dome X2 plugin
+//
+//  Raw ADC value to engineering units conversions, scalar and SIMD.
+//  The SIMD kernels do the same double precision operations in the same order as the scalar code
+//  (no reciprocal or fused multiply-add) so the results don't depend on the CPU.
+
+#include "adcconvert.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ADC_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ADC_TARGET_SSE2
+#define ADC_TARGET_AVX2
+#else
+#define ADC_TARGET_SSE2 __attribute__((target("sse2")))
+#define ADC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static const AdcConversion s_Conversions[ADC_CONVERSION_COUNT] = {
+    {1.0, 1.0, 0.0, 1.0, false},                                                // ADC_RAW
+    {1.0, SUPPLY_VOLTS_PER_TICK, 0.0, 1.0, false},                              // ADC_SUPPLY_VOLTS
+    {ADC_FULL_SCALE, ADC_REF_VOLTS, MOTOR_ZERO_VOLTS, MOTOR_VOLTS_PER_AMP, true},  // ADC_MOTOR_AMPS
+    {ADC_FULL_SCALE, ADC_REF_VOLTS, TEMP_ZERO_VOLTS, TEMP_VOLTS_PER_DEG, false}    // ADC_TEMP_DEGC
+};
+
+static std::atomic<int> s_nSimdLevel(ADC_SIMD_AUTO);
+
+const AdcConversion &CAdcConvert::getConversion(int nConversion)
+{
+    if(nConversion < 0 || nConversion >= ADC_CONVERSION_COUNT)
+        nConversion = ADC_RAW;
+    return s_Conversions[nConversion];
+}
+
+int CAdcConvert::channelConversion(int nTelemetryChannel)
+{
+    switch(nTelemetryChannel) {
+        case TLM_AZ_SUPPLY:
+        case TLM_SHUTTER_SUPPLY:
+            return ADC_SUPPLY_VOLTS;
+        case TLM_AZ_MOTOR:
+        case TLM_SHUTTER_MOTOR:
+            return ADC_MOTOR_AMPS;
+        case TLM_AZ_TEMP:
+        case TLM_SHUTTER_TEMP:
+            return ADC_TEMP_DEGC;
+        default:
+            return ADC_RAW;
+    }
+}
+
+double CAdcConvert::convert(int nConversion, int32_t nRaw)
+{
+    const AdcConversion &Conv = getConversion(nConversion);
+    double dValue;
+
+    dValue = (double)nRaw / Conv.dFullScale * Conv.dRefVolts;
+    dValue = (dValue - Conv.dZero) / Conv.dSlope;
+    if(Conv.bClamp && dValue < 0.0)
+        dValue = 0.0;
+    return dValue;
+}
+
+static void convertScalar(const AdcConversion &Conv, const int32_t *pRaw, double *pValues, size_t nCount)
+{
+    size_t i;
+    double dValue;
+
+    for(i = 0; i < nCount; i++) {
+        dValue = (double)pRaw[i] / Conv.dFullScale * Conv.dRefVolts;
+        dValue = (dValue - Conv.dZero) / Conv.dSlope;
+        if(Conv.bClamp && dValue < 0.0)
+            dValue = 0.0;
+        pValues[i] = dValue;
+    }
+}
+
+#ifdef ADC_X86
+ADC_TARGET_SSE2 static void convertSSE2(const AdcConversion &Conv, const int32_t *pRaw, double *pValues, size_t nCount)
+{
+    size_t i = 0;
+    __m128d vFullScale = _mm_set1_pd(Conv.dFullScale);
+    __m128d vRefVolts = _mm_set1_pd(Conv.dRefVolts);
+    __m128d vZero = _mm_set1_pd(Conv.dZero);
+    __m128d vSlope = _mm_set1_pd(Conv.dSlope);
+    __m128d vNull = _mm_setzero_pd();
+    __m128d v;
+
+    for(; i + 2 <= nCount; i += 2) {
+        v = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(pRaw + i)));
+        v = _mm_mul_pd(_mm_div_pd(v, vFullScale), vRefVolts);
+        v = _mm_div_pd(_mm_sub_pd(v, vZero), vSlope);
+        // same as the scalar "if < 0 then 0", -0.0 stays -0.0
+        if(Conv.bClamp)
+            v = _mm_andnot_pd(_mm_cmplt_pd(v, vNull), v);
+        _mm_storeu_pd(pValues + i, v);
+    }
+    convertScalar(Conv, pRaw + i, pValues + i, nCount - i);
+}
+
+ADC_TARGET_AVX2 static void convertAVX2(const AdcConversion &Conv, const int32_t *pRaw, double *pValues, size_t nCount)
+{
+    size_t i = 0;
+    __m256d vFullScale = _mm256_set1_pd(Conv.dFullScale);
+    __m256d vRefVolts = _mm256_set1_pd(Conv.dRefVolts);
+    __m256d vZero = _mm256_set1_pd(Conv.dZero);
+    __m256d vSlope = _mm256_set1_pd(Conv.dSlope);
+    __m256d vNull = _mm256_setzero_pd();
+    __m256d v1, v2;
+
+    // two independent chains to hide the division latency
+    for(; i + 8 <= nCount; i += 8) {
+        v1 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(pRaw + i)));
+        v2 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(pRaw + i + 4)));
+        v1 = _mm256_mul_pd(_mm256_div_pd(v1, vFullScale), vRefVolts);
+        v2 = _mm256_mul_pd(_mm256_div_pd(v2, vFullScale), vRefVolts);
+        v1 = _mm256_div_pd(_mm256_sub_pd(v1, vZero), vSlope);
+        v2 = _mm256_div_pd(_mm256_sub_pd(v2, vZero), vSlope);
+        if(Conv.bClamp) {
+            v1 = _mm256_andnot_pd(_mm256_cmp_pd(v1, vNull, _CMP_LT_OQ), v1);
+            v2 = _mm256_andnot_pd(_mm256_cmp_pd(v2, vNull, _CMP_LT_OQ), v2);
+        }
+        _mm256_storeu_pd(pValues + i, v1);
+        _mm256_storeu_pd(pValues + i + 4, v2);
+    }
+    for(; i + 4 <= nCount; i += 4) {
+        v1 = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(pRaw + i)));
+        v1 = _mm256_mul_pd(_mm256_div_pd(v1, vFullScale), vRefVolts);
+        v1 = _mm256_div_pd(_mm256_sub_pd(v1, vZero), vSlope);
+        if(Conv.bClamp)
+            v1 = _mm256_andnot_pd(_mm256_cmp_pd(v1, vNull, _CMP_LT_OQ), v1);
+        _mm256_storeu_pd(pValues + i, v1);
+    }
+    convertScalar(Conv, pRaw + i, pValues + i, nCount - i);
+}
+#endif
+
+int CAdcConvert::getSupportedSimdLevel()
+{
+#ifdef ADC_X86
+#if defined(_MSC_VER)
+    static const int nSupported = [] {
+        int nInfo[4];
+        bool bAvx;
+
+        __cpuid(nInfo, 1);
+        if(!(nInfo[3] & (1 << 26)))
+            return (int)ADC_SIMD_SCALAR;
+        // AVX and the OS saves the YMM registers
+        bAvx = (nInfo[2] & (1 << 27)) && (nInfo[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+        __cpuidex(nInfo, 7, 0);
+        return (int)((bAvx && (nInfo[1] & (1 << 5))) ? ADC_SIMD_AVX2 : ADC_SIMD_SSE2);
+    }();
+#else
+    static const int nSupported = __builtin_cpu_supports("avx2") ? ADC_SIMD_AVX2 :
+                                  (__builtin_cpu_supports("sse2") ? ADC_SIMD_SSE2 : ADC_SIMD_SCALAR);
+#endif
+    return nSupported;
+#else
+    return ADC_SIMD_SCALAR;
+#endif
+}
+
+int CAdcConvert::getSimdLevel()
+{
+    int nLevel = s_nSimdLevel;
+
+    if(nLevel == ADC_SIMD_AUTO || nLevel > getSupportedSimdLevel())
+        nLevel = getSupportedSimdLevel();
+    return nLevel;
+}
+
+// returns the level that will actually be used
+int CAdcConvert::setSimdLevel(int nLevel)
+{
+    s_nSimdLevel = nLevel;
+    return getSimdLevel();
+}
+
+const char *CAdcConvert::simdLevelName(int nLevel)
+{
+    switch(nLevel) {
+        case ADC_SIMD_SCALAR:
+            return "scalar";
+        case ADC_SIMD_SSE2:
+            return "SSE2";
+        case ADC_SIMD_AVX2:
+            return "AVX2";
+        default:
+            return "auto";
+    }
+}
+
+void CAdcConvert::convert(int nConversion, const int32_t *pRaw, double *pValues, size_t nCount)
+{
+    const AdcConversion &Conv = getConversion(nConversion);
+
+    switch(getSimdLevel()) {
+#ifdef ADC_X86
+        case ADC_SIMD_AVX2:
+            convertAVX2(Conv, pRaw, pValues, nCount);
+            break;
+        case ADC_SIMD_SSE2:
+            convertSSE2(Conv, pRaw, pValues, nCount);
+            break;
+#endif
+        default:
+            convertScalar(Conv, pRaw, pValues, nCount);
+            break;
+    }
+}
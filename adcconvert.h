@@ -0,0 +1,58 @@
+//
+//  adcconvert.h
+//  ATCL Dome X2 plugin
+//
+//  Raw ADC value to engineering units conversions.
+//  The single sample getters in CDomePro and the batch conversion used on stored telemetry share the same
+//  constants and the same operation order, so both give bit identical results.
+//  The batch conversion uses SSE2 or AVX2 when the CPU has it, with a scalar fallback.
+
+#ifndef __ADC_CONVERT__
+#define __ADC_CONVERT__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "telemetryring.h"
+
+// 10 bit ADCs on 3.3V
+#define ADC_FULL_SCALE          1023.0
+#define ADC_REF_VOLTS           3.3
+// supply voltage divider
+#define SUPPLY_VOLTS_PER_TICK   0.00812763
+// motor current sensor : 1.721V at 0A, 68.847 mV/A
+#define MOTOR_ZERO_VOLTS        1.721
+#define MOTOR_VOLTS_PER_AMP     0.068847
+// temperature sensor : 0.5V at 0C, 10mV/C
+#define TEMP_ZERO_VOLTS         0.5
+#define TEMP_VOLTS_PER_DEG      0.01
+
+enum AdcConversions {ADC_RAW = 0, ADC_SUPPLY_VOLTS, ADC_MOTOR_AMPS, ADC_TEMP_DEGC, ADC_CONVERSION_COUNT};
+enum AdcSimdLevels {ADC_SIMD_AUTO = -1, ADC_SIMD_SCALAR = 0, ADC_SIMD_SSE2, ADC_SIMD_AVX2};
+
+// value = ((raw / dFullScale * dRefVolts) - dZero) / dSlope, clamped at 0 if bClamp
+typedef struct {
+    double  dFullScale;
+    double  dRefVolts;
+    double  dZero;
+    double  dSlope;
+    bool    bClamp;
+} AdcConversion;
+
+class CAdcConvert
+{
+public:
+    static double   convert(int nConversion, int32_t nRaw);
+    static void     convert(int nConversion, const int32_t *pRaw, double *pValues, size_t nCount);
+
+    static const AdcConversion &getConversion(int nConversion);
+    static int      channelConversion(int nTelemetryChannel);
+
+    // what the batch conversion uses, ADC_SIMD_AUTO picks the best the CPU supports
+    static int      getSimdLevel();
+    static int      setSimdLevel(int nLevel);
+    static int      getSupportedSimdLevel();
+    static const char *simdLevelName(int nLevel);
+};
+
+#endif
@@ -0,0 +1,323 @@
+//
+//  diaghistory.cpp
+//  ATCL Dome X2 plugin
+//
+//  In memory history for the diagnostic dialog.
+
+#include "diaghistory.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static const char *s_szSparkLevels[8] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+
+CDiagHistory::CDiagHistory()
+{
+    m_nVersion = 0;
+    clear();
+}
+
+void CDiagHistory::clear()
+{
+    int i, j;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        for(j = 0; j < DIAG_BUCKET_COUNT; j++)
+            m_Buckets[i][j].nIndex = -1;
+        m_bHasLast[i] = false;
+        m_bHasCount[i] = false;
+    }
+    for(j = 0; j < DIAG_BUCKET_COUNT; j++)
+        m_Commands[j].nIndex = -1;
+    m_nVersion++;
+}
+
+int64_t CDiagHistory::bucketIndex(double dTime)
+{
+    return (int64_t)floor(dTime / DIAG_BUCKET_SECONDS);
+}
+
+// dRtt in seconds
+int CDiagHistory::rttBin(double dRtt)
+{
+    if(dRtt <= DIAG_RTT_FIRST_BIN)
+        return 0;
+    return std::min(1 + (int)floor(log(dRtt / DIAG_RTT_FIRST_BIN) / log(DIAG_RTT_BIN_RATIO)), DIAG_RTT_BINS - 1);
+}
+
+double CDiagHistory::rttBinEdge(int nBin)
+{
+    return DIAG_RTT_FIRST_BIN * pow(DIAG_RTT_BIN_RATIO, nBin);
+}
+
+int CDiagHistory::windowBuckets(double dWindow)
+{
+    int nBuckets;
+
+    nBuckets = (int)ceil(dWindow / DIAG_BUCKET_SECONDS);
+    return std::min(std::max(nBuckets, 1), DIAG_BUCKET_COUNT);
+}
+
+// called with m_Mutex held
+void CDiagHistory::addValue(int nChannel, double dTime, double dValue)
+{
+    int64_t nIndex;
+    Bucket *pBucket;
+
+    nIndex = bucketIndex(dTime);
+    pBucket = &m_Buckets[nChannel][nIndex % DIAG_BUCKET_COUNT];
+    if(pBucket->nIndex != nIndex) {
+        // older samples than the bucket (clock going back) are dropped
+        if(pBucket->nIndex > nIndex)
+            return;
+        pBucket->nIndex = nIndex;
+        pBucket->nCount = 0;
+        pBucket->dMin = dValue;
+        pBucket->dMax = dValue;
+        pBucket->dSum = 0.0;
+    }
+    pBucket->nCount++;
+    pBucket->dMin = std::min(pBucket->dMin, dValue);
+    pBucket->dMax = std::max(pBucket->dMax, dValue);
+    pBucket->dSum += dValue;
+    m_nVersion++;
+}
+
+void CDiagHistory::addSample(int nChannel, double dTime, double dValue)
+{
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    addValue(nChannel, dTime, dValue);
+    m_bHasLast[nChannel] = true;
+    m_dLast[nChannel] = dValue;
+    m_dLastTime[nChannel] = dTime;
+}
+
+void CDiagHistory::addCounter(int nChannel, double dTime, int nCount)
+{
+    int nIncrease;
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_bHasCount[nChannel])
+        nIncrease = 0;
+    else if(nCount < m_nLastCount[nChannel])
+        nIncrease = nCount;
+    else
+        nIncrease = nCount - m_nLastCount[nChannel];
+    m_bHasCount[nChannel] = true;
+    m_nLastCount[nChannel] = nCount;
+
+    addValue(nChannel, dTime, (double)nIncrease);
+    m_bHasLast[nChannel] = true;
+    m_dLast[nChannel] = (double)nCount;
+    m_dLastTime[nChannel] = dTime;
+}
+
+// dRtt in seconds, ignored when the command failed
+void CDiagHistory::addCommand(double dTime, double dRtt, bool bOk)
+{
+    int64_t nIndex;
+    CommandBucket *pBucket;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nIndex = bucketIndex(dTime);
+    pBucket = &m_Commands[nIndex % DIAG_BUCKET_COUNT];
+    if(pBucket->nIndex != nIndex) {
+        if(pBucket->nIndex > nIndex)
+            return;
+        pBucket->nIndex = nIndex;
+        pBucket->nCommands = 0;
+        pBucket->nFailed = 0;
+        memset(pBucket->nRtt, 0, sizeof(pBucket->nRtt));
+        pBucket->dRttMax = 0.0;
+    }
+    pBucket->nCommands++;
+    if(!bOk)
+        pBucket->nFailed++;
+    else {
+        pBucket->nRtt[rttBin(dRtt)]++;
+        pBucket->dRttMax = std::max(pBucket->dRttMax, dRtt);
+    }
+    m_nVersion++;
+}
+
+bool CDiagHistory::getSummary(int nChannel, double dNow, double dWindow, DiagSummary &Summary)
+{
+    int64_t nLast;
+    int64_t nFirst;
+    int i;
+    const Bucket *pBucket;
+
+    memset(&Summary, 0, sizeof(DiagSummary));
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nLast = bucketIndex(dNow);
+    nFirst = nLast - windowBuckets(dWindow) + 1;
+    for(i = 0; i < DIAG_BUCKET_COUNT; i++) {
+        pBucket = &m_Buckets[nChannel][i];
+        if(pBucket->nIndex < nFirst || pBucket->nIndex > nLast || !pBucket->nCount)
+            continue;
+        if(!Summary.nCount) {
+            Summary.dMin = pBucket->dMin;
+            Summary.dMax = pBucket->dMax;
+        }
+        Summary.nCount += pBucket->nCount;
+        Summary.dMin = std::min(Summary.dMin, pBucket->dMin);
+        Summary.dMax = std::max(Summary.dMax, pBucket->dMax);
+        Summary.dSum += pBucket->dSum;
+    }
+    if(Summary.nCount)
+        Summary.dMean = Summary.dSum / Summary.nCount;
+    Summary.bHasLast = m_bHasLast[nChannel];
+    Summary.dLast = m_dLast[nChannel];
+    Summary.dLastTime = m_dLastTime[nChannel];
+    return Summary.nCount != 0;
+}
+
+// The percentiles are the upper edge of the histogram bin they fall in (a bin is 20 % wide), never more
+// than the largest round trip seen.
+void CDiagHistory::getLinkSummary(double dNow, double dWindow, DiagLinkSummary &Summary)
+{
+    int64_t nLast;
+    int64_t nFirst;
+    int i;
+    int j;
+    int nTotal = 0;
+    int nCumulated = 0;
+    int nRank[3];
+    double *pdRank[3];
+    uint32_t nRtt[DIAG_RTT_BINS];
+
+    memset(&Summary, 0, sizeof(DiagLinkSummary));
+    memset(nRtt, 0, sizeof(nRtt));
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        nLast = bucketIndex(dNow);
+        nFirst = nLast - windowBuckets(dWindow) + 1;
+        for(i = 0; i < DIAG_BUCKET_COUNT; i++) {
+            if(m_Commands[i].nIndex < nFirst || m_Commands[i].nIndex > nLast)
+                continue;
+            Summary.nCommands += m_Commands[i].nCommands;
+            Summary.nFailed += m_Commands[i].nFailed;
+            for(j = 0; j < DIAG_RTT_BINS; j++)
+                nRtt[j] += m_Commands[i].nRtt[j];
+            Summary.dRttMax = std::max(Summary.dRttMax, m_Commands[i].dRttMax * 1000.0);
+        }
+    }
+    for(j = 0; j < DIAG_RTT_BINS; j++)
+        nTotal += (int)nRtt[j];
+    if(!nTotal)
+        return;
+
+    // nearest rank
+    Summary.nRtt = nTotal;
+    nRank[0] = (int)ceil(0.50 * nTotal);
+    nRank[1] = (int)ceil(0.90 * nTotal);
+    nRank[2] = (int)ceil(0.99 * nTotal);
+    pdRank[0] = &Summary.dRttP50;
+    pdRank[1] = &Summary.dRttP90;
+    pdRank[2] = &Summary.dRttP99;
+    for(i = 0, j = 0; j < DIAG_RTT_BINS && i < 3; j++) {
+        nCumulated += (int)nRtt[j];
+        while(i < 3 && nCumulated >= nRank[i]) {
+            *pdRank[i] = j == DIAG_RTT_BINS - 1 ? Summary.dRttMax : std::min(rttBinEdge(j) * 1000.0, Summary.dRttMax);
+            i++;
+        }
+    }
+}
+
+void CDiagHistory::getSparkline(int nChannel, double dNow, double dWindow, char *pszSpark, int nMaxLen)
+{
+    int64_t nLast;
+    int64_t nFirst;
+    int64_t nIndex;
+    int nBuckets;
+    int nPerPoint;
+    int nPoints;
+    int i, j;
+    int nLevel;
+    const Bucket *pBucket;
+    double dSum[DIAG_SPARK_WIDTH];
+    int nCount[DIAG_SPARK_WIDTH];
+    double dValue[DIAG_SPARK_WIDTH];
+    bool bHas[DIAG_SPARK_WIDTH];
+    bool bCounter;
+    double dMin = 0.0;
+    double dMax = 0.0;
+    bool bAny = false;
+    size_t nLen = 0;
+
+    if(nMaxLen <= 0)
+        return;
+    pszSpark[0] = 0;
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return;
+
+    nBuckets = windowBuckets(dWindow);
+    nPerPoint = (nBuckets + DIAG_SPARK_WIDTH - 1) / DIAG_SPARK_WIDTH;
+    nPoints = (nBuckets + nPerPoint - 1) / nPerPoint;
+    for(i = 0; i < nPoints; i++) {
+        dSum[i] = 0.0;
+        nCount[i] = 0;
+    }
+    bCounter = nChannel == TLM_LINK_ERRORS;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        nLast = bucketIndex(dNow);
+        nFirst = nLast - nPoints * nPerPoint + 1;
+        for(nIndex = nFirst; nIndex <= nLast; nIndex++) {
+            if(nIndex < 0)
+                continue;
+            pBucket = &m_Buckets[nChannel][nIndex % DIAG_BUCKET_COUNT];
+            if(pBucket->nIndex != nIndex || !pBucket->nCount)
+                continue;
+            j = (int)((nIndex - nFirst) / nPerPoint);
+            dSum[j] += pBucket->dSum;
+            nCount[j] += pBucket->nCount;
+        }
+    }
+
+    for(i = 0; i < nPoints; i++) {
+        bHas[i] = nCount[i] != 0;
+        if(!bHas[i])
+            continue;
+        dValue[i] = bCounter ? dSum[i] : dSum[i] / nCount[i];
+        dMin = bAny ? std::min(dMin, dValue[i]) : dValue[i];
+        dMax = bAny ? std::max(dMax, dValue[i]) : dValue[i];
+        bAny = true;
+    }
+    // no errors at all should stay flat at the bottom
+    if(bCounter)
+        dMin = 0.0;
+
+    for(i = 0; i < nPoints; i++) {
+        if(!bHas[i]) {
+            if(nLen + 1 >= (size_t)nMaxLen)
+                break;
+            pszSpark[nLen++] = ' ';
+            continue;
+        }
+        nLevel = dMax > dMin ? (int)floor((dValue[i] - dMin) / (dMax - dMin) * 7.0 + 0.5) : 0;
+        if(nLen + strlen(s_szSparkLevels[nLevel]) >= (size_t)nMaxLen)
+            break;
+        memcpy(pszSpark + nLen, s_szSparkLevels[nLevel], strlen(s_szSparkLevels[nLevel]));
+        nLen += strlen(s_szSparkLevels[nLevel]);
+    }
+    pszSpark[nLen] = 0;
+}
+
+uint32_t CDiagHistory::getVersion()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_nVersion;
+}
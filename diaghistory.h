@@ -0,0 +1,104 @@
+//
+//  diaghistory.h
+//  ATCL Dome X2 plugin
+//
+//  In memory history for the diagnostic dialog : per minute min/max/sum of the telemetry channels (supply
+//  voltages, motor currents, temperatures, RF link errors) and per minute histograms of the serial command
+//  round trip times, so the percentiles cover the whole window whatever the command rate.
+//  CDomePro feeds it from the reads it does anyway (telemetry files, TheSkyX and dialog calls), so showing
+//  it never costs a serial exchange.
+//  Times are seconds from any monotonic clock, the same one for the adds and the queries.
+//  This doesn't depend on the X2 interfaces.
+
+#ifndef __DIAG_HISTORY__
+#define __DIAG_HISTORY__
+
+#include <stdint.h>
+#include <mutex>
+
+#include "telemetryring.h"
+
+#define DIAG_BUCKET_SECONDS     60.0
+#define DIAG_BUCKET_COUNT       60          // an hour of history
+#define DIAG_RTT_BINS           48          // round trip time histogram bins, log spaced
+#define DIAG_RTT_FIRST_BIN      0.001       // seconds, upper edge of the first bin
+#define DIAG_RTT_BIN_RATIO      1.2         // upper edge of a bin over the previous one, the last bin has no upper edge
+#define DIAG_SPARK_WIDTH        20          // max sparkline points, buckets are merged beyond that
+#define DIAG_SPARK_SIZE         (DIAG_SPARK_WIDTH * 3 + 1)  // UTF-8 block elements are 3 bytes
+
+typedef struct {
+    int     nCount;         // samples in the window
+    double  dMin;
+    double  dMax;
+    double  dMean;
+    double  dSum;           // total increase for the counters
+    bool    bHasLast;
+    double  dLast;          // last sample, even if older than the window
+    double  dLastTime;
+} DiagSummary;
+
+typedef struct {
+    uint32_t    nCommands;
+    uint32_t    nFailed;    // no answer, NACK or write error
+    int         nRtt;       // round trip samples in the window
+    double      dRttP50;    // milliseconds
+    double      dRttP90;
+    double      dRttP99;
+    double      dRttMax;
+} DiagLinkSummary;
+
+class CDiagHistory
+{
+public:
+    CDiagHistory();
+
+    void        clear();
+    // nChannel is a TelemetryChannels
+    void        addSample(int nChannel, double dTime, double dValue);
+    // running counter (RF link errors), the increase since the previous count is stored, a lower count means it was cleared
+    void        addCounter(int nChannel, double dTime, int nCount);
+    void        addCommand(double dTime, double dRtt, bool bOk);
+
+    // the window is rounded up to whole buckets, including the current one
+    bool        getSummary(int nChannel, double dNow, double dWindow, DiagSummary &Summary);
+    void        getLinkSummary(double dNow, double dWindow, DiagLinkSummary &Summary);
+    // bucket means (sums for the counters) scaled over the window min/max, a space for the empty buckets
+    void        getSparkline(int nChannel, double dNow, double dWindow, char *pszSpark, int nMaxLen);
+    // changes with every add, readers only redraw when it moved
+    uint32_t    getVersion();
+
+protected:
+    typedef struct {
+        int64_t     nIndex;         // minute number, -1 when unused
+        int         nCount;
+        double      dMin;
+        double      dMax;
+        double      dSum;
+    } Bucket;
+
+    typedef struct {
+        int64_t     nIndex;
+        uint32_t    nCommands;
+        uint32_t    nFailed;
+        uint32_t    nRtt[DIAG_RTT_BINS];
+        double      dRttMax;
+    } CommandBucket;
+
+    int64_t     bucketIndex(double dTime);
+    static int      rttBin(double dRtt);
+    static double   rttBinEdge(int nBin);
+    int         windowBuckets(double dWindow);
+    void        addValue(int nChannel, double dTime, double dValue);
+
+    std::mutex      m_Mutex;
+    uint32_t        m_nVersion;
+    Bucket          m_Buckets[TLM_CHANNEL_COUNT][DIAG_BUCKET_COUNT];
+    bool            m_bHasLast[TLM_CHANNEL_COUNT];
+    double          m_dLast[TLM_CHANNEL_COUNT];
+    double          m_dLastTime[TLM_CHANNEL_COUNT];
+    bool            m_bHasCount[TLM_CHANNEL_COUNT];
+    int             m_nLastCount[TLM_CHANNEL_COUNT];
+    CommandBucket   m_Commands[DIAG_BUCKET_COUNT];
+};
+
+#endif
@@ -0,0 +1,261 @@
+//
+//  dombroker.cpp
+//  ATCL Dome X2 plugin
+//
+//  Dome broker daemon, owns the DomePro2 serial port and serves the local clients (see domebroker.h).
+//  usage : dombroker [-s socket] [-t cache_ttl] [-a alpaca_port] [-v] serial_port
+//  The plugin uses it when "Broker" is set in its ini file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "domebroker.h"
+#include "domealpaca.h"
+
+static std::atomic<bool> s_bRunning(true);
+
+static void onSignal(int nSignal)
+{
+    (void)nSignal;
+    s_bRunning = false;
+}
+
+static void usage(const char *pszName)
+{
+    fprintf(stderr, "usage : %s [-s socket] [-t cache_ttl] [-a alpaca_port] [-v] serial_port\n", pszName);
+    fprintf(stderr, "  -s : socket path (default %s)\n", BROKER_DEFAULT_SOCKET);
+    fprintf(stderr, "  -t : seconds a read answer is shared between clients (default %.2f)\n", BROKER_CACHE_TTL);
+    fprintf(stderr, "  -a : also serve the dome as an Alpaca device on 127.0.0.1 (default port %d)\n", ALPACA_DEFAULT_PORT);
+    fprintf(stderr, "  -v : log the driver messages and print the broker stats every minute\n");
+}
+
+class CStdoutLogger : public LoggerInterface
+{
+public:
+    virtual int out(const char *szLogThis) { fputs(szLogThis, stdout); fflush(stdout); return 0; };
+};
+
+// 8N1 serial port, the only settings CDomePro asks for
+class CPosixSerial : public SerXInterface
+{
+public:
+    CPosixSerial() { m_nFd = -1; };
+    virtual ~CPosixSerial() { close(); };
+
+    virtual int open(const char *pszPort, const unsigned long &dwBaudRate = 9600, const Parity &parity = B_NOPARITY, const char *pszSessionPrefix = 0)
+    {
+        struct termios Tty;
+        speed_t nSpeed;
+
+        (void)parity;
+        (void)pszSessionPrefix;
+        close();
+        switch(dwBaudRate) {
+            case 9600:  nSpeed = B9600; break;
+            case 19200: nSpeed = B19200; break;
+            case 38400: nSpeed = B38400; break;
+            case 57600: nSpeed = B57600; break;
+            default:    nSpeed = B115200; break;
+        }
+        m_nFd = ::open(pszPort, O_RDWR | O_NOCTTY);
+        if(m_nFd < 0)
+            return ERR_COMMNOLINK;
+        if(tcgetattr(m_nFd, &Tty) != 0) {
+            close();
+            return ERR_COMMNOLINK;
+        }
+        cfmakeraw(&Tty);
+        cfsetispeed(&Tty, nSpeed);
+        cfsetospeed(&Tty, nSpeed);
+        Tty.c_cflag |= (CLOCAL | CREAD);
+        Tty.c_cflag &= ~(PARENB | CSTOPB | CRTSCTS);
+        Tty.c_cc[VMIN] = 0;
+        Tty.c_cc[VTIME] = 0;
+        if(tcsetattr(m_nFd, TCSANOW, &Tty) != 0) {
+            close();
+            return ERR_COMMNOLINK;
+        }
+        return SB_OK;
+    };
+
+    virtual int close()
+    {
+        if(m_nFd >= 0)
+            ::close(m_nFd);
+        m_nFd = -1;
+        return SB_OK;
+    };
+
+    virtual bool isConnected(void) const { return m_nFd >= 0; };
+    virtual int flushTx(void) { return m_nFd >= 0 && tcdrain(m_nFd) == 0 ? SB_OK : ERR_NOLINK; };
+    virtual int purgeTxRx(void) { return m_nFd >= 0 && tcflush(m_nFd, TCIOFLUSH) == 0 ? SB_OK : ERR_NOLINK; };
+
+    virtual int waitForBytesRx(const int &nNumBytes, const int &nTimeOutMs)
+    {
+        int nWaiting = 0;
+        std::chrono::steady_clock::time_point End = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeOutMs);
+
+        while(bytesWaitingRx(nWaiting) == SB_OK && nWaiting < nNumBytes) {
+            if(std::chrono::steady_clock::now() >= End)
+                return ERR_CMDFAILED;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return nWaiting >= nNumBytes ? SB_OK : ERR_NOLINK;
+    };
+
+    virtual int readFile(void *lpBuffer, const unsigned long dwTotalBytesToRead, unsigned long &dwBytesRead, const unsigned long &dwTimeOut = 1000)
+    {
+        struct pollfd Poll;
+        ssize_t nRead;
+        std::chrono::steady_clock::time_point End = std::chrono::steady_clock::now() + std::chrono::milliseconds(dwTimeOut);
+        int nLeft;
+
+        dwBytesRead = 0;
+        if(m_nFd < 0)
+            return ERR_NOLINK;
+        while(dwBytesRead < dwTotalBytesToRead) {
+            nLeft = (int)std::chrono::duration_cast<std::chrono::milliseconds>(End - std::chrono::steady_clock::now()).count();
+            if(nLeft <= 0)
+                break;
+            Poll.fd = m_nFd;
+            Poll.events = POLLIN;
+            Poll.revents = 0;
+            if(poll(&Poll, 1, nLeft) <= 0)
+                continue;
+            nRead = ::read(m_nFd, (char *)lpBuffer + dwBytesRead, dwTotalBytesToRead - dwBytesRead);
+            if(nRead < 0)
+                return ERR_NOLINK;
+            dwBytesRead += (unsigned long)nRead;
+        }
+        return SB_OK;
+    };
+
+    virtual int writeFile(void *lpBuffer, const unsigned long &dwBytesToWrite, unsigned long &dwBytesWritten)
+    {
+        ssize_t nWritten;
+
+        dwBytesWritten = 0;
+        if(m_nFd < 0)
+            return ERR_NOLINK;
+        while(dwBytesWritten < dwBytesToWrite) {
+            nWritten = ::write(m_nFd, (const char *)lpBuffer + dwBytesWritten, dwBytesToWrite - dwBytesWritten);
+            if(nWritten <= 0)
+                return ERR_NOLINK;
+            dwBytesWritten += (unsigned long)nWritten;
+        }
+        return SB_OK;
+    };
+
+    virtual int bytesWaitingRx(int &nBytesWaiting)
+    {
+        struct pollfd Poll;
+
+        nBytesWaiting = 0;
+        if(m_nFd < 0)
+            return ERR_NOLINK;
+        Poll.fd = m_nFd;
+        Poll.events = POLLIN;
+        Poll.revents = 0;
+        // the exact count isn't portable, at least one byte is enough for CDomePro
+        if(poll(&Poll, 1, 0) > 0 && (Poll.revents & POLLIN))
+            nBytesWaiting = 1;
+        return SB_OK;
+    };
+
+protected:
+    int     m_nFd;
+};
+
+int main(int argc, char *argv[])
+{
+    int nErr;
+    int i;
+    int nSeconds = 0;
+    int nAlpacaPort = 0;
+    bool bVerbose = false;
+    double dCacheTTL = BROKER_CACHE_TTL;
+    const char *pszSocket = BROKER_DEFAULT_SOCKET;
+    const char *pszPort = NULL;
+    CPosixSerial Serial;
+    CStdoutLogger Logger;
+    CDomePro DomePro;
+    BrokerStats Stats;
+
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            pszSocket = argv[++i];
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            dCacheTTL = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-a") && i + 1 < argc)
+            nAlpacaPort = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-v"))
+            bVerbose = true;
+        else if(!pszPort && argv[i][0] != '-')
+            pszPort = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!pszPort) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    DomePro.SetSerxPointer(&Serial);
+    DomePro.setLogger(&Logger);
+    DomePro.setDebugLog(bVerbose);
+    nErr = DomePro.Connect(pszPort);
+    if(nErr) {
+        fprintf(stderr, "Error connecting to the dome on %s (%d)\n", pszPort, nErr);
+        return 1;
+    }
+
+    CDomeBroker Broker(DomePro);
+    nErr = Broker.start(pszSocket, dCacheTTL);
+    if(nErr) {
+        fprintf(stderr, "Error opening %s (%d)\n", pszSocket, nErr);
+        DomePro.Disconnect();
+        return 1;
+    }
+    printf("dombroker : dome on %s, clients on %s\n", pszPort, pszSocket);
+
+    CDomeAlpaca Alpaca(DomePro);
+    if(nAlpacaPort) {
+        nErr = Alpaca.start(nAlpacaPort);
+        if(nErr)
+            fprintf(stderr, "Error opening the Alpaca port %d (%d)\n", nAlpacaPort, nErr);
+        else
+            printf("dombroker : Alpaca dome on http://127.0.0.1:%d/api/v1/dome/0/\n", nAlpacaPort);
+    }
+    fflush(stdout);
+
+    while(s_bRunning) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if(!bVerbose || ++nSeconds % 60)
+            continue;
+        Broker.getStats(Stats);
+        printf("dombroker : %u clients, %llu requests, %llu cached, %llu shared, %llu sent, %llu rejected\n",
+               Stats.nClients, (unsigned long long)Stats.nRequests, (unsigned long long)Stats.nCacheHits,
+               (unsigned long long)Stats.nCoalesced, (unsigned long long)Stats.nSerialCommands, (unsigned long long)Stats.nRejected);
+        fflush(stdout);
+    }
+
+    Alpaca.stop();
+    Broker.stop();
+    DomePro.Disconnect();
+    return 0;
+}
@@ -0,0 +1,793 @@
+//
+//  domealpaca.cpp
+//  ATCL Dome X2 plugin
+//
+//  ASCOM Alpaca Dome device over a CDomePro.
+//  BSD sockets only, on Windows the server isn't available.
+
+#include "domealpaca.h"
+
+#include <ctype.h>
+#include <chrono>
+
+#if !defined(SB_WIN_BUILD)
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+#if !defined(SB_WIN_BUILD) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL    0           // macOS, SO_NOSIGPIPE is set on the sockets instead
+#endif
+
+#define ALPACA_DEVICE_PATH      "/api/v1/dome/0/"
+
+#pragma mark - helpers
+
+static int alpacaShutterState(int nState)
+{
+    switch(nState) {
+        case OPEN:
+        case INTERMEDIATE:      // stopped part way, open as far as the clients are concerned
+            return ALPACA_SHUTTER_OPEN;
+        case CLOSED:
+            return ALPACA_SHUTTER_CLOSED;
+        case OPENING:
+        case SHUT_GOTO:
+            return ALPACA_SHUTTER_OPENING;
+        case CLOSING:
+            return ALPACA_SHUTTER_CLOSING;
+        default:
+            return ALPACA_SHUTTER_ERROR;
+    }
+}
+
+static const char *jsonBool(bool bValue)
+{
+    return bValue ? "true" : "false";
+}
+
+#pragma mark - CDomeAlpaca
+
+CDomeAlpaca::CDomeAlpaca(CDomePro &DomePro) : m_DomePro(DomePro)
+{
+    m_nPort = ALPACA_DEFAULT_PORT;
+    m_nListenFd = -1;
+    m_nWakePipe[0] = -1;
+    m_nWakePipe[1] = -1;
+    m_bRunning = false;
+    m_nServerTransaction = 0;
+    memset(&m_State, 0, sizeof(AlpacaDomeState));
+    memset(&m_Stats, 0, sizeof(AlpacaStats));
+    m_bWake = false;
+    m_bFullRefresh = true;
+    m_nSubscription = 0;
+}
+
+CDomeAlpaca::~CDomeAlpaca()
+{
+    stop();
+}
+
+double CDomeAlpaca::now()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int CDomeAlpaca::start(int nPort)
+{
+#if defined(SB_WIN_BUILD)
+    return ERR_NOLINK;
+#else
+    struct sockaddr_in Addr;
+    int nOn = 1;
+    DomeEvent Event;
+
+    stop();
+    m_nPort = nPort;
+    if(pipe(m_nWakePipe) != 0)
+        return ERR_NOLINK;
+    m_nListenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(m_nListenFd < 0) {
+        stop();
+        return ERR_NOLINK;
+    }
+    setsockopt(m_nListenFd, SOL_SOCKET, SO_REUSEADDR, &nOn, sizeof(nOn));
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_port = htons((uint16_t)nPort);
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(m_nListenFd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0 || listen(m_nListenFd, 16) != 0) {
+        stop();
+        return ERR_NOLINK;
+    }
+
+    // events left from a previous run
+    while(m_EventQueue.pop(Event))
+        ;
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_bWake = false;
+        m_bFullRefresh = true;
+    }
+    m_nSubscription = m_DomePro.subscribeEventQueue(&m_EventQueue, DOME_EVT_MASK(DOME_EVT_MOVE_MODE) | DOME_EVT_MASK(DOME_EVT_LIMIT) | DOME_EVT_MASK(DOME_EVT_SHUTTER_STATE));
+    m_bRunning = true;
+    m_RefreshThread = std::thread(&CDomeAlpaca::refreshThread, this);
+    m_ListenThread = std::thread(&CDomeAlpaca::listenThread, this);
+    return SB_OK;
+#endif
+}
+
+void CDomeAlpaca::stop()
+{
+#if !defined(SB_WIN_BUILD)
+    size_t i;
+    ssize_t nWritten;
+
+    m_bRunning = false;
+    if(m_nWakePipe[1] >= 0) {
+        nWritten = write(m_nWakePipe[1], "x", 1);
+        (void)nWritten;
+    }
+    wakeRefresh();
+    if(m_ListenThread.joinable())
+        m_ListenThread.join();
+    if(m_RefreshThread.joinable())
+        m_RefreshThread.join();
+    if(m_nSubscription) {
+        m_DomePro.unsubscribeEvents(m_nSubscription);
+        m_nSubscription = 0;
+    }
+
+    for(i = 0; i < m_Clients.size(); i++)
+        ::close(m_Clients[i].nFd);
+    m_Clients.clear();
+    if(m_nListenFd >= 0)
+        ::close(m_nListenFd);
+    m_nListenFd = -1;
+    for(i = 0; i < 2; i++) {
+        if(m_nWakePipe[i] >= 0)
+            ::close(m_nWakePipe[i]);
+        m_nWakePipe[i] = -1;
+    }
+#endif
+}
+
+void CDomeAlpaca::getState(AlpacaDomeState &State)
+{
+    std::lock_guard<std::mutex> lock(m_StateMutex);
+    State = m_State;
+}
+
+void CDomeAlpaca::getStats(AlpacaStats &Stats)
+{
+    std::lock_guard<std::mutex> lock(m_StateMutex);
+    Stats = m_Stats;
+}
+
+#pragma mark - state cache
+
+void CDomeAlpaca::wakeRefresh()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_bWake = true;
+    }
+    m_WakeCond.notify_one();
+}
+
+// the only place reading the dome for the GETs
+void CDomeAlpaca::refreshThread()
+{
+    bool bFull = true;
+    bool bMoving;
+    double dAz;
+    double dPeriod;
+    DomeEvent Event;
+
+    while(m_bRunning) {
+        if(!m_DomePro.IsConnected()) {
+            while(m_EventQueue.pop(Event))
+                ;
+            std::lock_guard<std::mutex> lock(m_StateMutex);
+            m_State.bConnected = false;
+            m_State.bAzMoving = false;
+            bFull = true;
+        }
+        else {
+            if(bFull) {
+                refreshAll();
+                bFull = false;
+            }
+            applyEvents();
+            dAz = m_DomePro.getCurrentAz();
+            std::lock_guard<std::mutex> lock(m_StateMutex);
+            m_State.dAz = dAz;
+            m_State.dTime = now();
+            m_Stats.nRefreshes++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_StateMutex);
+            bMoving = m_State.bAzMoving || m_State.nShutterState == ALPACA_SHUTTER_OPENING || m_State.nShutterState == ALPACA_SHUTTER_CLOSING;
+        }
+        dPeriod = bMoving ? ALPACA_MOVING_PERIOD : ALPACA_IDLE_PERIOD;
+        std::unique_lock<std::mutex> lock(m_WakeMutex);
+        m_WakeCond.wait_for(lock, std::chrono::milliseconds((int)(dPeriod * 1000.0)), [this]{ return m_bWake || !m_bRunning; });
+        m_bWake = false;
+        if(m_bFullRefresh)
+            bFull = true;
+        m_bFullRefresh = false;
+    }
+}
+
+// everything once, after that the events keep the cache up to date
+void CDomeAlpaca::refreshAll()
+{
+    bool bMoving = false;
+    bool bAtHome = false;
+    bool bAtPark = false;
+    bool bHasShutter;
+    int nState = NOT_FITTED;
+    DomeEvent Event;
+
+    // anything queued is older than what we're about to read
+    while(m_EventQueue.pop(Event))
+        ;
+    m_DomePro.isDomeMoving(bMoving);
+    m_DomePro.isDomeAtHome(bAtHome);
+    m_DomePro.isDomeAtPark(bAtPark);
+    bHasShutter = m_DomePro.hasShutterUnit();
+    if(bHasShutter)
+        nState = m_DomePro.getCurrentShutterState();
+
+    std::lock_guard<std::mutex> lock(m_StateMutex);
+    m_State.bConnected = true;
+    m_State.bHasShutter = bHasShutter;
+    m_State.bAzMoving = bMoving;
+    m_State.bAtHome = bAtHome;
+    m_State.bAtPark = bAtPark;
+    m_State.nShutterState = alpacaShutterState(nState);
+}
+
+void CDomeAlpaca::applyEvents()
+{
+    DomeEvent Event;
+
+    std::lock_guard<std::mutex> lock(m_StateMutex);
+    while(m_EventQueue.pop(Event)) {
+        m_Stats.nEvents++;
+        switch(Event.nType) {
+            case DOME_EVT_MOVE_MODE:
+                m_State.bAzMoving = Event.nValue != FIXED && Event.nValue != AZ_TO;
+                break;
+            case DOME_EVT_LIMIT:
+                if(Event.nLimit == BitAtHome)
+                    m_State.bAtHome = Event.nValue != 0;
+                else if(Event.nLimit == BitAtPark)
+                    m_State.bAtPark = Event.nValue != 0;
+                break;
+            case DOME_EVT_SHUTTER_STATE:
+                m_State.nShutterState = alpacaShutterState(Event.nValue);
+                break;
+        }
+    }
+}
+
+#pragma mark - HTTP
+
+void CDomeAlpaca::listenThread()
+{
+#if !defined(SB_WIN_BUILD)
+    std::vector<struct pollfd> Polls;
+    Client Cli;
+    size_t i;
+    int nFd;
+    int nOn = 1;
+
+    while(m_bRunning) {
+        Polls.resize(2 + m_Clients.size());
+        Polls[0].fd = m_nListenFd;
+        Polls[1].fd = m_nWakePipe[0];
+        for(i = 0; i < m_Clients.size(); i++)
+            Polls[2 + i].fd = m_Clients[i].nFd;
+        for(i = 0; i < Polls.size(); i++) {
+            Polls[i].events = POLLIN;
+            Polls[i].revents = 0;
+        }
+        if(poll(Polls.data(), Polls.size(), 1000) <= 0)
+            continue;
+
+        if(Polls[0].revents & POLLIN) {
+            nFd = accept(m_nListenFd, NULL, NULL);
+            if(nFd >= 0 && m_Clients.size() >= ALPACA_MAX_CLIENTS)
+                ::close(nFd);
+            else if(nFd >= 0) {
+#if defined(SO_NOSIGPIPE)
+                setsockopt(nFd, SOL_SOCKET, SO_NOSIGPIPE, &nOn, sizeof(nOn));
+#endif
+                setsockopt(nFd, IPPROTO_TCP, TCP_NODELAY, &nOn, sizeof(nOn));
+                Cli.nFd = nFd;
+                Cli.Rx.clear();
+                m_Clients.push_back(Cli);
+            }
+        }
+
+        // newly accepted clients are polled next time
+        for(i = Polls.size() - 2; i-- > 0; ) {
+            if(!Polls[2 + i].revents)
+                continue;
+            if(readClient(m_Clients[i]))
+                continue;
+            ::close(m_Clients[i].nFd);
+            m_Clients.erase(m_Clients.begin() + i);
+        }
+        std::lock_guard<std::mutex> lock(m_StateMutex);
+        m_Stats.nClients = (uint32_t)m_Clients.size();
+    }
+#endif
+}
+
+// false when the connection must be closed
+bool CDomeAlpaca::readClient(Client &Cli)
+{
+#if defined(SB_WIN_BUILD)
+    return false;
+#else
+    char Buffer[2048];
+    ssize_t nRead;
+    size_t nHeaderEnd;
+    size_t nLineEnd;
+    size_t nPos;
+    size_t nLength;
+    std::string sLine;
+    std::string sName;
+    std::string sValue;
+    std::string sVersion;
+    std::string sConnection;
+    Request Req;
+
+    nRead = recv(Cli.nFd, Buffer, sizeof(Buffer), 0);
+    if(nRead < 0 && (errno == EINTR || errno == EAGAIN))
+        return true;
+    if(nRead <= 0)
+        return false;
+    Cli.Rx.append(Buffer, (size_t)nRead);
+
+    while(true) {
+        nHeaderEnd = Cli.Rx.find("\r\n\r\n");
+        if(nHeaderEnd == std::string::npos)
+            return Cli.Rx.size() < ALPACA_MAX_REQUEST;
+
+        // request line
+        nLineEnd = Cli.Rx.find("\r\n");
+        sLine = Cli.Rx.substr(0, nLineEnd);
+        Req.Params.clear();
+        nPos = sLine.find(' ');
+        if(nPos == std::string::npos)
+            return false;
+        Req.sMethod = sLine.substr(0, nPos);
+        sLine.erase(0, nPos + 1);
+        nPos = sLine.find(' ');
+        sVersion = nPos == std::string::npos ? "" : sLine.substr(nPos + 1);
+        sLine = sLine.substr(0, nPos);
+        nPos = sLine.find('?');
+        if(nPos != std::string::npos) {
+            parseParams(sLine.substr(nPos + 1), Req.Params);
+            sLine.erase(nPos);
+        }
+        Req.sPath = lowerCase(urlDecode(sLine));
+
+        // the headers we care about
+        nLength = 0;
+        sConnection.clear();
+        while(nLineEnd < nHeaderEnd) {
+            nPos = Cli.Rx.find("\r\n", nLineEnd + 2);
+            sLine = Cli.Rx.substr(nLineEnd + 2, nPos - nLineEnd - 2);
+            nLineEnd = nPos;
+            nPos = sLine.find(':');
+            if(nPos == std::string::npos)
+                continue;
+            sName = lowerCase(sLine.substr(0, nPos));
+            sValue = sLine.substr(nPos + 1);
+            while(!sValue.empty() && sValue[0] == ' ')
+                sValue.erase(0, 1);
+            if(sName == "content-length")
+                nLength = (size_t)strtoul(sValue.c_str(), NULL, 10);
+            else if(sName == "connection")
+                sConnection = lowerCase(sValue);
+        }
+        if(nLength > ALPACA_MAX_REQUEST)
+            return false;
+        if(Cli.Rx.size() < nHeaderEnd + 4 + nLength)
+            return true;
+        if(nLength)
+            parseParams(Cli.Rx.substr(nHeaderEnd + 4, nLength), Req.Params);
+        Cli.Rx.erase(0, nHeaderEnd + 4 + nLength);
+
+        if(sVersion == "HTTP/1.0")
+            Req.bKeepAlive = sConnection == "keep-alive";
+        else
+            Req.bKeepAlive = sConnection != "close";
+        handleRequest(Cli.nFd, Req);
+        if(!Req.bKeepAlive)
+            return false;
+    }
+#endif
+}
+
+void CDomeAlpaca::handleRequest(int nFd, const Request &Req)
+{
+    std::string sValue;
+    std::string sMessage;
+    std::string sMember;
+    int nError = ALPACA_OK;
+    char szValue[256];
+
+    {
+        std::lock_guard<std::mutex> lock(m_StateMutex);
+        m_Stats.nRequests++;
+    }
+
+    if(Req.sMethod == "GET" && Req.sPath == "/management/apiversions") {
+        sendJson(nFd, Req, "[1]", ALPACA_OK, "");
+        return;
+    }
+    if(Req.sMethod == "GET" && Req.sPath == "/management/v1/description") {
+        snprintf(szValue, sizeof(szValue), "{\"ServerName\":\"DomePro\",\"Manufacturer\":\"RTI-Zone\",\"ManufacturerVersion\":\"%.2f\",\"Location\":\"\"}", DRIVER_VERSION);
+        sendJson(nFd, Req, szValue, ALPACA_OK, "");
+        return;
+    }
+    if(Req.sMethod == "GET" && Req.sPath == "/management/v1/configureddevices") {
+        sendJson(nFd, Req, "[{\"DeviceName\":\"DomePro\",\"DeviceType\":\"Dome\",\"DeviceNumber\":0,\"UniqueID\":\"f909ae30-08fe-43c2-a7e1-0aa6f14efe34\"}]", ALPACA_OK, "");
+        return;
+    }
+    if(Req.sPath.compare(0, strlen(ALPACA_DEVICE_PATH), ALPACA_DEVICE_PATH) != 0) {
+        sendHttp(nFd, 404, "Not Found", "text/plain", "Unknown device or method", Req.bKeepAlive);
+        return;
+    }
+
+    sMember = Req.sPath.substr(strlen(ALPACA_DEVICE_PATH));
+    if(Req.sMethod == "GET")
+        handleDomeGet(sMember, sValue, nError, sMessage);
+    else if(Req.sMethod == "PUT")
+        handleDomePut(sMember, Req, nError, sMessage);
+    else {
+        sendHttp(nFd, 405, "Method Not Allowed", "text/plain", "GET or PUT only", Req.bKeepAlive);
+        return;
+    }
+
+    if(nError < 0) {
+        // unknown member or missing parameter
+        sendHttp(nFd, 400, "Bad Request", "text/plain", sMessage, Req.bKeepAlive);
+        return;
+    }
+    sendJson(nFd, Req, sValue, nError, sMessage);
+}
+
+// from the cache only, sValue is the JSON value, nError -1 for an unknown member
+void CDomeAlpaca::handleDomeGet(const std::string &sMember, std::string &sValue, int &nError, std::string &sMessage)
+{
+    AlpacaDomeState State;
+    char szValue[64];
+
+    getState(State);
+    {
+        std::lock_guard<std::mutex> lock(m_StateMutex);
+        m_Stats.nCached++;
+    }
+
+    nError = ALPACA_OK;
+    if(sMember == "connected")
+        sValue = jsonBool(State.bConnected);
+    else if(sMember == "name")
+        sValue = "\"DomePro\"";
+    else if(sMember == "description")
+        sValue = "\"Astrometric Instruments DomePro2 dome controller\"";
+    else if(sMember == "driverinfo")
+        sValue = "\"DomePro X2 plugin, Alpaca server\"";
+    else if(sMember == "driverversion") {
+        snprintf(szValue, sizeof(szValue), "\"%.2f\"", DRIVER_VERSION);
+        sValue = szValue;
+    }
+    else if(sMember == "interfaceversion") {
+        snprintf(szValue, sizeof(szValue), "%d", ALPACA_INTERFACE_VERSION);
+        sValue = szValue;
+    }
+    else if(sMember == "supportedactions")
+        sValue = "[]";
+    else if(sMember == "canfindhome" || sMember == "canpark" || sMember == "cansetazimuth" ||
+            sMember == "cansetpark" || sMember == "cansyncazimuth")
+        sValue = "true";
+    else if(sMember == "cansetaltitude" || sMember == "canslave" || sMember == "slaved")
+        sValue = "false";
+    else if(sMember == "cansetshutter")
+        sValue = jsonBool(State.bHasShutter);
+    else if(sMember == "altitude") {
+        nError = ALPACA_NOT_IMPLEMENTED;
+        sMessage = "Altitude isn't implemented";
+    }
+    else if(!State.bConnected) {
+        nError = ALPACA_NOT_CONNECTED;
+        sMessage = "The dome isn't connected";
+    }
+    else if(sMember == "azimuth") {
+        snprintf(szValue, sizeof(szValue), "%.2f", State.dAz);
+        sValue = szValue;
+    }
+    else if(sMember == "athome")
+        sValue = jsonBool(State.bAtHome);
+    else if(sMember == "atpark")
+        sValue = jsonBool(State.bAtPark);
+    else if(sMember == "slewing")
+        sValue = jsonBool(State.bAzMoving || State.nShutterState == ALPACA_SHUTTER_OPENING || State.nShutterState == ALPACA_SHUTTER_CLOSING);
+    else if(sMember == "shutterstatus") {
+        if(State.bHasShutter) {
+            snprintf(szValue, sizeof(szValue), "%d", State.nShutterState);
+            sValue = szValue;
+        }
+        else {
+            nError = ALPACA_NOT_IMPLEMENTED;
+            sMessage = "No shutter unit";
+        }
+    }
+    else {
+        nError = -1;
+        sMessage = "Unknown method " + sMember;
+    }
+}
+
+// straight to the dome, the cache is updated right away for the states the clients check next
+void CDomeAlpaca::handleDomePut(const std::string &sMember, const Request &Req, int &nError, std::string &sMessage)
+{
+    std::map<std::string, std::string>::const_iterator it;
+    AlpacaDomeState State;
+    double dAz = 0.0;
+    bool bHasAz = false;
+    int nErr = DP2_OK;
+    char *pszEnd;
+
+    getState(State);
+    nError = ALPACA_OK;
+
+    it = Req.Params.find("azimuth");
+    if(it != Req.Params.end()) {
+        dAz = strtod(it->second.c_str(), &pszEnd);
+        bHasAz = !it->second.empty() && *pszEnd == 0;
+    }
+
+    if(sMember == "connected") {
+        it = Req.Params.find("connected");
+        if(it == Req.Params.end()) {
+            nError = -1;
+            sMessage = "Missing Connected";
+        }
+        else if(lowerCase(it->second) == "true" && !m_DomePro.IsConnected()) {
+            nError = ALPACA_NOT_CONNECTED;
+            sMessage = "The dome link is opened by the host application";
+        }
+        return;
+    }
+    if(sMember == "slaved") {
+        it = Req.Params.find("slaved");
+        if(it == Req.Params.end()) {
+            nError = -1;
+            sMessage = "Missing Slaved";
+        }
+        else if(lowerCase(it->second) == "true") {
+            nError = ALPACA_NOT_IMPLEMENTED;
+            sMessage = "Slaving isn't implemented";
+        }
+        return;
+    }
+    if(sMember == "slewtoaltitude") {
+        nError = ALPACA_NOT_IMPLEMENTED;
+        sMessage = "Altitude isn't implemented";
+        return;
+    }
+    if(sMember != "abortslew" && sMember != "closeshutter" && sMember != "openshutter" && sMember != "findhome" &&
+       sMember != "park" && sMember != "setpark" && sMember != "slewtoazimuth" && sMember != "synctoazimuth") {
+        nError = -1;
+        sMessage = "Unknown method " + sMember;
+        return;
+    }
+    if((sMember == "slewtoazimuth" || sMember == "synctoazimuth") && !bHasAz) {
+        nError = -1;
+        sMessage = "Missing or invalid Azimuth";
+        return;
+    }
+    if(!m_DomePro.IsConnected()) {
+        nError = ALPACA_NOT_CONNECTED;
+        sMessage = "The dome isn't connected";
+        return;
+    }
+    if((sMember == "slewtoazimuth" || sMember == "synctoazimuth") && (dAz < 0.0 || dAz >= 360.0)) {
+        nError = ALPACA_INVALID_VALUE;
+        sMessage = "Azimuth must be between 0 and 360";
+        return;
+    }
+    if((sMember == "openshutter" || sMember == "closeshutter") && !State.bHasShutter) {
+        nError = ALPACA_NOT_IMPLEMENTED;
+        sMessage = "No shutter unit";
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_StateMutex);
+        m_Stats.nActions++;
+    }
+    if(sMember == "abortslew")
+        nErr = m_DomePro.abortCurrentCommand();
+    else if(sMember == "openshutter")
+        nErr = m_DomePro.openDomeShutters();
+    else if(sMember == "closeshutter")
+        nErr = m_DomePro.CloseDomeShutters();
+    else if(sMember == "findhome")
+        nErr = m_DomePro.goHome();
+    else if(sMember == "park")
+        nErr = m_DomePro.gotoDomePark();
+    else if(sMember == "setpark")
+        nErr = m_DomePro.setParkAz(State.dAz);
+    else if(sMember == "slewtoazimuth")
+        nErr = m_DomePro.gotoAzimuth(dAz);
+    else if(sMember == "synctoazimuth")
+        nErr = m_DomePro.syncDome(dAz, 0.0);
+
+    if(nErr) {
+        nError = ALPACA_DRIVER_ERROR;
+        sMessage = "The dome controller refused " + sMember;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_StateMutex);
+        if(sMember == "openshutter")
+            m_State.nShutterState = ALPACA_SHUTTER_OPENING;
+        else if(sMember == "closeshutter")
+            m_State.nShutterState = ALPACA_SHUTTER_CLOSING;
+        else if(sMember == "slewtoazimuth" || sMember == "park" || sMember == "findhome") {
+            m_State.bAzMoving = true;
+            m_State.bAtHome = false;
+            m_State.bAtPark = false;
+        }
+    }
+    // the abort and the sync change what the events don't tell
+    if(sMember == "abortslew" || sMember == "synctoazimuth") {
+        std::lock_guard<std::mutex> lock(m_WakeMutex);
+        m_bFullRefresh = true;
+    }
+    wakeRefresh();
+}
+
+void CDomeAlpaca::sendJson(int nFd, const Request &Req, const std::string &sValue, int nError, const std::string &sMessage)
+{
+    std::map<std::string, std::string>::const_iterator it;
+    std::string sBody;
+    unsigned long nClientTransaction = 0;
+    char szIds[128];
+
+    it = Req.Params.find("clienttransactionid");
+    if(it != Req.Params.end())
+        nClientTransaction = strtoul(it->second.c_str(), NULL, 10);
+    snprintf(szIds, sizeof(szIds), "\"ClientTransactionID\":%lu,\"ServerTransactionID\":%u,\"ErrorNumber\":%d,",
+             nClientTransaction, ++m_nServerTransaction, nError);
+
+    sBody = "{";
+    if(!sValue.empty() && !nError)
+        sBody += "\"Value\":" + sValue + ",";
+    sBody += szIds;
+    sBody += "\"ErrorMessage\":" + jsonString(sMessage) + "}";
+    sendHttp(nFd, 200, "OK", "application/json", sBody, Req.bKeepAlive);
+}
+
+void CDomeAlpaca::sendHttp(int nFd, int nStatus, const char *pszReason, const char *pszType, const std::string &sBody, bool bKeepAlive)
+{
+#if !defined(SB_WIN_BUILD)
+    char szHeader[256];
+    std::string sResponse;
+    const char *pData;
+    size_t nSize;
+    ssize_t nWritten;
+
+    snprintf(szHeader, sizeof(szHeader), "HTTP/1.1 %d %s\r\nContent-Type: %s; charset=utf-8\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+             nStatus, pszReason, pszType, (unsigned int)sBody.size(), bKeepAlive ? "keep-alive" : "close");
+    sResponse = szHeader;
+    sResponse += sBody;
+
+    // small answers, a client not reading them is dropped on its next request
+    pData = sResponse.data();
+    nSize = sResponse.size();
+    while(nSize) {
+        nWritten = send(nFd, pData, nSize, MSG_NOSIGNAL);
+        if(nWritten < 0 && errno == EINTR)
+            continue;
+        if(nWritten <= 0)
+            return;
+        pData += nWritten;
+        nSize -= (size_t)nWritten;
+    }
+#endif
+}
+
+#pragma mark - parsing
+
+// "a=1&b=2", names are case insensitive in Alpaca
+void CDomeAlpaca::parseParams(const std::string &sText, std::map<std::string, std::string> &Params)
+{
+    size_t nStart = 0;
+    size_t nEnd;
+    size_t nEqual;
+    std::string sPair;
+
+    while(nStart <= sText.size()) {
+        nEnd = sText.find('&', nStart);
+        if(nEnd == std::string::npos)
+            nEnd = sText.size();
+        sPair = sText.substr(nStart, nEnd - nStart);
+        nStart = nEnd + 1;
+        if(sPair.empty())
+            continue;
+        nEqual = sPair.find('=');
+        if(nEqual == std::string::npos)
+            Params[lowerCase(urlDecode(sPair))] = "";
+        else
+            Params[lowerCase(urlDecode(sPair.substr(0, nEqual)))] = urlDecode(sPair.substr(nEqual + 1));
+    }
+}
+
+std::string CDomeAlpaca::urlDecode(const std::string &sText)
+{
+    std::string sResult;
+    size_t i;
+    char szHex[3];
+
+    for(i = 0; i < sText.size(); i++) {
+        if(sText[i] == '+')
+            sResult += ' ';
+        else if(sText[i] == '%' && i + 2 < sText.size() && isxdigit((unsigned char)sText[i + 1]) && isxdigit((unsigned char)sText[i + 2])) {
+            szHex[0] = sText[i + 1];
+            szHex[1] = sText[i + 2];
+            szHex[2] = 0;
+            sResult += (char)strtol(szHex, NULL, 16);
+            i += 2;
+        }
+        else
+            sResult += sText[i];
+    }
+    return sResult;
+}
+
+std::string CDomeAlpaca::jsonString(const std::string &sText)
+{
+    std::string sResult = "\"";
+    size_t i;
+    char szEscape[8];
+
+    for(i = 0; i < sText.size(); i++) {
+        if(sText[i] == '"' || sText[i] == '\\') {
+            sResult += '\\';
+            sResult += sText[i];
+        }
+        else if((unsigned char)sText[i] < 0x20) {
+            snprintf(szEscape, sizeof(szEscape), "\\u%04x", (unsigned char)sText[i]);
+            sResult += szEscape;
+        }
+        else
+            sResult += sText[i];
+    }
+    return sResult + "\"";
+}
+
+std::string CDomeAlpaca::lowerCase(const std::string &sText)
+{
+    std::string sResult = sText;
+    size_t i;
+
+    for(i = 0; i < sResult.size(); i++)
+        sResult[i] = (char)tolower((unsigned char)sResult[i]);
+    return sResult;
+}
@@ -0,0 +1,139 @@
+//
+//  domealpaca.h
+//  ATCL Dome X2 plugin
+//
+//  ASCOM Alpaca Dome device (device number 0) over a CDomePro, HTTP on 127.0.0.1 only.
+//  https://ascom-standards.org/api/ for the API, only the Dome and the management calls are implemented.
+//
+//  The GETs are answered from a state cache and never go to the controller. The cache is kept by one refresh
+//  thread : it follows the CDomePro state change events (move mode, limits, shutter) and reads the azimuth
+//  through the CDomePro poll cache, every ALPACA_MOVING_PERIOD while something moves and every
+//  ALPACA_IDLE_PERIOD otherwise. Any number of Alpaca clients cost one refresh on the serial link.
+//  The PUTs (slewtoazimuth, openshutter, abortslew ...) go to the CDomePro right away and refresh the cache.
+//
+//  The link to the dome belongs to the host (TheSkyX or dombroker), PUT connected doesn't open or close it.
+//  No discovery, the clients are configured with the port.
+
+#ifndef __DOME_ALPACA__
+#define __DOME_ALPACA__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "domepro.h"
+
+#define ALPACA_DEFAULT_PORT     11111
+#define ALPACA_MOVING_PERIOD    0.5         // seconds
+#define ALPACA_IDLE_PERIOD      2.0
+#define ALPACA_MAX_CLIENTS      32
+#define ALPACA_MAX_REQUEST      8192        // request line, headers and body
+#define ALPACA_INTERFACE_VERSION 2
+
+// Alpaca error numbers
+#define ALPACA_OK                   0
+#define ALPACA_NOT_IMPLEMENTED      0x400
+#define ALPACA_INVALID_VALUE        0x401
+#define ALPACA_NOT_CONNECTED        0x407
+#define ALPACA_INVALID_OPERATION    0x40B
+#define ALPACA_DRIVER_ERROR         0x500
+
+// ASCOM ShutterState, same values as DomeProShutterState up to SHUTTER_ERROR
+enum AlpacaShutterState {ALPACA_SHUTTER_OPEN = 0, ALPACA_SHUTTER_CLOSED, ALPACA_SHUTTER_OPENING, ALPACA_SHUTTER_CLOSING, ALPACA_SHUTTER_ERROR};
+
+typedef struct {
+    bool        bConnected;
+    bool        bHasShutter;
+    double      dAz;
+    bool        bAzMoving;
+    bool        bAtHome;
+    bool        bAtPark;
+    int         nShutterState;      // AlpacaShutterState
+    double      dTime;              // last refresh, seconds since 1970
+} AlpacaDomeState;
+
+typedef struct {
+    uint32_t    nClients;
+    uint64_t    nRequests;          // HTTP requests
+    uint64_t    nCached;            // answered from the state cache
+    uint64_t    nActions;           // PUTs sent to the dome
+    uint64_t    nRefreshes;         // cache refreshes
+    uint64_t    nEvents;            // state change events applied to the cache
+} AlpacaStats;
+
+class CDomeAlpaca
+{
+public:
+    CDomeAlpaca(CDomePro &DomePro);
+    ~CDomeAlpaca();
+
+    int     start(int nPort = ALPACA_DEFAULT_PORT);
+    void    stop();
+    bool    isRunning() { return m_bRunning; };
+    int     getPort() { return m_nPort; };
+    void    getState(AlpacaDomeState &State);
+    void    getStats(AlpacaStats &Stats);
+
+protected:
+    typedef struct {
+        int                 nFd;
+        std::string         Rx;
+    } Client;
+
+    typedef struct {
+        std::string         sMethod;
+        std::string         sPath;          // lower case, without the query
+        std::map<std::string, std::string>  Params;     // lower case names, query and form body
+        bool                bKeepAlive;
+    } Request;
+
+    void    listenThread();
+    void    refreshThread();
+    void    refreshAll();
+    void    applyEvents();
+    void    wakeRefresh();
+
+    bool    readClient(Client &Cli);
+    void    handleRequest(int nFd, const Request &Req);
+    void    handleDomeGet(const std::string &sMember, std::string &sValue, int &nError, std::string &sMessage);
+    void    handleDomePut(const std::string &sMember, const Request &Req, int &nError, std::string &sMessage);
+    void    sendJson(int nFd, const Request &Req, const std::string &sValue, int nError, const std::string &sMessage);
+    void    sendHttp(int nFd, int nStatus, const char *pszReason, const char *pszType, const std::string &sBody, bool bKeepAlive);
+
+    static void     parseParams(const std::string &sText, std::map<std::string, std::string> &Params);
+    static std::string  urlDecode(const std::string &sText);
+    static std::string  jsonString(const std::string &sText);
+    static std::string  lowerCase(const std::string &sText);
+    double  now();
+
+    CDomePro            &m_DomePro;
+    int                 m_nPort;
+    int                 m_nListenFd;
+    int                 m_nWakePipe[2];
+    std::atomic<bool>   m_bRunning;
+    std::thread         m_ListenThread;
+    std::thread         m_RefreshThread;
+    std::atomic<uint32_t>   m_nServerTransaction;
+
+    // the cache and the stats
+    std::mutex          m_StateMutex;
+    AlpacaDomeState     m_State;
+    AlpacaStats         m_Stats;
+
+    // refresh thread
+    std::mutex          m_WakeMutex;
+    std::condition_variable m_WakeCond;
+    bool                m_bWake;
+    bool                m_bFullRefresh;     // guarded by m_WakeMutex
+    CDomeEventQueue     m_EventQueue;
+    int                 m_nSubscription;
+
+    std::vector<Client> m_Clients;          // only used by the listen thread
+};
+
+#endif
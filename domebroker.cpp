@@ -0,0 +1,709 @@
+//
+//  domebroker.cpp
+//  ATCL Dome X2 plugin
+//
+//  Local dome broker, server and client side.
+//  Unix domain sockets only, on Windows the broker isn't available and the client can't connect.
+
+#include "domebroker.h"
+
+#include <chrono>
+
+#if !defined(SB_WIN_BUILD)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#endif
+
+#if !defined(SB_WIN_BUILD) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL    0           // macOS, SO_NOSIGPIPE is set on the sockets instead
+#endif
+
+#pragma mark - helpers
+
+#if !defined(SB_WIN_BUILD)
+// a client or broker going away must not kill the other side with SIGPIPE
+static void noSigPipe(int nFd)
+{
+#if defined(SO_NOSIGPIPE)
+    int nOn = 1;
+
+    setsockopt(nFd, SOL_SOCKET, SO_NOSIGPIPE, &nOn, sizeof(nOn));
+#else
+    (void)nFd;
+#endif
+}
+
+// so a client that never reads can't block the thread sending to it
+static void sendTimeout(int nFd, int nTimeoutMs)
+{
+    struct timeval Timeout;
+
+    Timeout.tv_sec = nTimeoutMs / 1000;
+    Timeout.tv_usec = (nTimeoutMs % 1000) * 1000;
+    setsockopt(nFd, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout));
+}
+
+static bool writeAll(int nFd, const void *pData, size_t nSize)
+{
+    const uint8_t *pBytes = (const uint8_t *)pData;
+    ssize_t nWritten;
+
+    while(nSize) {
+        nWritten = send(nFd, pBytes, nSize, MSG_NOSIGNAL);
+        if(nWritten < 0 && errno == EINTR)
+            continue;
+        if(nWritten <= 0)
+            return false;
+        pBytes += nWritten;
+        nSize -= (size_t)nWritten;
+    }
+    return true;
+}
+
+// waits at most nTimeoutMs for the whole buffer
+static bool readAll(int nFd, void *pData, size_t nSize, int nTimeoutMs)
+{
+    uint8_t *pBytes = (uint8_t *)pData;
+    ssize_t nRead;
+    struct pollfd Poll;
+    std::chrono::steady_clock::time_point End = std::chrono::steady_clock::now() + std::chrono::milliseconds(nTimeoutMs);
+    int nLeft;
+
+    while(nSize) {
+        nLeft = (int)std::chrono::duration_cast<std::chrono::milliseconds>(End - std::chrono::steady_clock::now()).count();
+        if(nLeft <= 0)
+            return false;
+        Poll.fd = nFd;
+        Poll.events = POLLIN;
+        Poll.revents = 0;
+        if(poll(&Poll, 1, nLeft) <= 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        nRead = recv(nFd, pBytes, nSize, 0);
+        if(nRead < 0 && errno == EINTR)
+            continue;
+        if(nRead <= 0)
+            return false;
+        pBytes += nRead;
+        nSize -= (size_t)nRead;
+    }
+    return true;
+}
+#endif
+
+#pragma mark - CDomeBroker
+
+CDomeBroker::CDomeBroker(CDomePro &DomePro) : m_DomePro(DomePro)
+{
+    m_dCacheTTL = BROKER_CACHE_TTL;
+    m_nListenFd = -1;
+    m_nWakePipe[0] = -1;
+    m_nWakePipe[1] = -1;
+    m_bRunning = false;
+    memset(&m_Stats, 0, sizeof(BrokerStats));
+}
+
+CDomeBroker::~CDomeBroker()
+{
+    stop();
+}
+
+double CDomeBroker::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// kills, shutter close and park before anything else, reads last
+int CDomeBroker::commandPriority(const char *pszCmd)
+{
+    static const char *szSafety[] = {"!DX", "!DSsc;", "!DSc1;", "!DSc2;", "!DScf", "!DSgp;"};
+    size_t i;
+
+    for(i = 0; i < sizeof(szSafety) / sizeof(szSafety[0]); i++)
+        if(!strncmp(pszCmd, szSafety[i], strlen(szSafety[i])))
+            return BROKER_PRIO_SAFETY;
+    if(!strncmp(pszCmd, "!DG", 3))
+        return BROKER_PRIO_READ;
+    return BROKER_PRIO_SET;
+}
+
+int CDomeBroker::start(const char *pszSocket, double dCacheTTL)
+{
+#if defined(SB_WIN_BUILD)
+    return ERR_NOLINK;
+#else
+    struct sockaddr_un Addr;
+
+    stop();
+    m_sSocket = pszSocket ? pszSocket : BROKER_DEFAULT_SOCKET;
+    m_dCacheTTL = dCacheTTL;
+    if(m_sSocket.size() >= sizeof(Addr.sun_path))
+        return ERR_NOLINK;
+
+    if(pipe(m_nWakePipe) != 0)
+        return ERR_NOLINK;
+    m_nListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_nListenFd < 0) {
+        stop();
+        return ERR_NOLINK;
+    }
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strncpy(Addr.sun_path, m_sSocket.c_str(), sizeof(Addr.sun_path) - 1);
+    // left over by a broker that didn't exit cleanly
+    unlink(m_sSocket.c_str());
+    if(bind(m_nListenFd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0 || listen(m_nListenFd, 8) != 0) {
+        stop();
+        return ERR_NOLINK;
+    }
+
+    m_bRunning = true;
+    m_WorkerThread = std::thread(&CDomeBroker::workerThread, this);
+    m_ListenThread = std::thread(&CDomeBroker::listenThread, this);
+    return SB_OK;
+#endif
+}
+
+void CDomeBroker::stop()
+{
+#if !defined(SB_WIN_BUILD)
+    int i;
+    ssize_t nWritten;
+
+    m_bRunning = false;
+    if(m_nWakePipe[1] >= 0) {
+        // wakes the listen thread, it also checks m_bRunning every second
+        nWritten = write(m_nWakePipe[1], "x", 1);
+        (void)nWritten;
+    }
+    m_QueueCond.notify_all();
+    if(m_ListenThread.joinable())
+        m_ListenThread.join();
+    if(m_WorkerThread.joinable())
+        m_WorkerThread.join();
+
+    for(i = 0; i < (int)m_Clients.size(); i++)
+        ::close(m_Clients[i]->nFd);
+    m_Clients.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        for(i = 0; i < BROKER_PRIO_COUNT; i++)
+            m_Queue[i].clear();
+        m_PendingReads.clear();
+        m_Cache.clear();
+    }
+    if(m_nListenFd >= 0) {
+        ::close(m_nListenFd);
+        unlink(m_sSocket.c_str());
+    }
+    m_nListenFd = -1;
+    for(i = 0; i < 2; i++) {
+        if(m_nWakePipe[i] >= 0)
+            ::close(m_nWakePipe[i]);
+        m_nWakePipe[i] = -1;
+    }
+#endif
+}
+
+void CDomeBroker::getStats(BrokerStats &Stats)
+{
+    int i;
+
+    std::lock_guard<std::mutex> lock(m_QueueMutex);
+    Stats = m_Stats;
+    for(i = 0; i < BROKER_PRIO_COUNT; i++)
+        Stats.nQueued[i] = (uint32_t)m_Queue[i].size();
+}
+
+// accepts the clients and reads their messages
+void CDomeBroker::listenThread()
+{
+#if !defined(SB_WIN_BUILD)
+    std::vector<struct pollfd> Polls;
+    std::shared_ptr<Client> pClient;
+    size_t i;
+    int nFd;
+
+    while(m_bRunning) {
+        Polls.resize(2 + m_Clients.size());
+        Polls[0].fd = m_nListenFd;
+        Polls[1].fd = m_nWakePipe[0];
+        for(i = 0; i < m_Clients.size(); i++)
+            Polls[2 + i].fd = m_Clients[i]->nFd;
+        for(i = 0; i < Polls.size(); i++) {
+            Polls[i].events = POLLIN;
+            Polls[i].revents = 0;
+        }
+        if(poll(Polls.data(), Polls.size(), 1000) <= 0)
+            continue;
+
+        if(Polls[0].revents & POLLIN) {
+            nFd = accept(m_nListenFd, NULL, NULL);
+            if(nFd >= 0 && m_Clients.size() >= BROKER_MAX_CLIENTS)
+                ::close(nFd);
+            else if(nFd >= 0) {
+                noSigPipe(nFd);
+                sendTimeout(nFd, BROKER_SEND_TIMEOUT_MS);
+                pClient = std::make_shared<Client>();
+                pClient->nFd = nFd;
+                pClient->nQueued = 0;
+                pClient->bClosed = false;
+                m_Clients.push_back(pClient);
+                std::lock_guard<std::mutex> lock(m_QueueMutex);
+                m_Stats.nClients = (uint32_t)m_Clients.size();
+            }
+        }
+
+        // newly accepted clients are polled next time
+        for(i = Polls.size() - 2; i-- > 0; ) {
+            if(!Polls[2 + i].revents)
+                continue;
+            if(readClient(m_Clients[i]))
+                continue;
+            // gone, requests still queued for it are answered to nobody
+            {
+                std::lock_guard<std::mutex> lock(m_Clients[i]->WriteMutex);
+                m_Clients[i]->bClosed = true;
+                ::close(m_Clients[i]->nFd);
+            }
+            m_Clients.erase(m_Clients.begin() + i);
+            std::lock_guard<std::mutex> lock(m_QueueMutex);
+            m_Stats.nClients = (uint32_t)m_Clients.size();
+        }
+    }
+#endif
+}
+
+// false when the client must be dropped
+bool CDomeBroker::readClient(std::shared_ptr<Client> pClient)
+{
+#if defined(SB_WIN_BUILD)
+    return false;
+#else
+    uint8_t Buffer[1024];
+    ssize_t nRead;
+    BrokerHeader Header;
+    size_t nUsed = 0;
+
+    nRead = recv(pClient->nFd, Buffer, sizeof(Buffer), 0);
+    if(nRead < 0 && (errno == EINTR || errno == EAGAIN))
+        return true;
+    if(nRead <= 0)
+        return false;
+    pClient->Rx.insert(pClient->Rx.end(), Buffer, Buffer + nRead);
+
+    while(pClient->Rx.size() - nUsed >= sizeof(BrokerHeader)) {
+        memcpy(&Header, pClient->Rx.data() + nUsed, sizeof(BrokerHeader));
+        if(Header.nMagic != BROKER_MAGIC || Header.nLength > BROKER_MAX_PAYLOAD)
+            return false;
+        if(pClient->Rx.size() - nUsed < sizeof(BrokerHeader) + Header.nLength)
+            break;
+        handleMessage(pClient, Header, pClient->Rx.data() + nUsed + sizeof(BrokerHeader));
+        nUsed += sizeof(BrokerHeader) + Header.nLength;
+    }
+    pClient->Rx.erase(pClient->Rx.begin(), pClient->Rx.begin() + nUsed);
+    return true;
+#endif
+}
+
+void CDomeBroker::handleMessage(std::shared_ptr<Client> pClient, const BrokerHeader &Header, const uint8_t *pPayload)
+{
+    uint32_t nVersion;
+    DomeStatus Status;
+
+    switch(Header.nType) {
+        case BROKER_MSG_HELLO:
+            nVersion = 0;
+            if(Header.nLength >= sizeof(uint32_t))
+                memcpy(&nVersion, pPayload, sizeof(uint32_t));
+            sendResponse(pClient, Header.nId, nVersion == BROKER_VERSION ? SB_OK : ERR_CMDFAILED, "");
+            break;
+
+        case BROKER_MSG_COMMAND:
+            queueCommand(pClient, Header.nId, std::string((const char *)pPayload, Header.nLength));
+            break;
+
+        case BROKER_MSG_STATUS:
+            memset(&Status, 0, sizeof(DomeStatus));
+            m_DomePro.getStatusPage(Status);
+            sendMessage(pClient, BROKER_MSG_STATUS_REPLY, Header.nId, &Status, sizeof(DomeStatus));
+            break;
+
+        default:
+            sendResponse(pClient, Header.nId, ERR_CMDFAILED, "");
+            break;
+    }
+}
+
+// answers from the cache, joins a queued read, or queues the command
+void CDomeBroker::queueCommand(std::shared_ptr<Client> pClient, uint32_t nId, const std::string &sCmd)
+{
+    int nPriority;
+    Waiter Who;
+    std::shared_ptr<Request> pRequest;
+    std::map<std::string, CachedAnswer>::iterator itCache;
+    std::map<std::string, std::shared_ptr<Request> >::iterator itPending;
+
+    if(sCmd.size() < 4 || sCmd[0] != '!' || sCmd[sCmd.size() - 1] != ';') {
+        sendResponse(pClient, nId, ERR_CMDFAILED, "");
+        return;
+    }
+    nPriority = commandPriority(sCmd.c_str());
+    Who.pClient = pClient;
+    Who.nId = nId;
+
+    std::unique_lock<std::mutex> lock(m_QueueMutex);
+    m_Stats.nRequests++;
+    if(nPriority == BROKER_PRIO_READ) {
+        itCache = m_Cache.find(sCmd);
+        if(itCache != m_Cache.end() && (now() - itCache->second.dTime) < m_dCacheTTL) {
+            CachedAnswer Answer = itCache->second;
+            m_Stats.nCacheHits++;
+            lock.unlock();
+            sendResponse(pClient, nId, Answer.nErr, Answer.sAnswer);
+            return;
+        }
+        itPending = m_PendingReads.find(sCmd);
+        if(itPending != m_PendingReads.end()) {
+            m_Stats.nCoalesced++;
+            itPending->second->Waiters.push_back(Who);
+            return;
+        }
+    }
+    // safety commands are never refused
+    if(nPriority != BROKER_PRIO_SAFETY && pClient->nQueued >= BROKER_MAX_QUEUED) {
+        m_Stats.nRejected++;
+        lock.unlock();
+        sendResponse(pClient, nId, ERR_CMDFAILED, "");
+        return;
+    }
+    pRequest = std::make_shared<Request>();
+    pRequest->sCmd = sCmd;
+    pRequest->nPriority = nPriority;
+    pRequest->Waiters.push_back(Who);
+    pClient->nQueued++;
+    m_Queue[nPriority].push_back(pRequest);
+    if(nPriority == BROKER_PRIO_READ)
+        m_PendingReads[sCmd] = pRequest;
+    m_QueueCond.notify_one();
+}
+
+// sends the queued commands to the dome, one at a time, highest priority first
+void CDomeBroker::workerThread()
+{
+    int i;
+    int nErr;
+    char szResp[SERIAL_BUFFER_SIZE];
+    std::shared_ptr<Request> pRequest;
+    CachedAnswer Answer;
+
+    while(m_bRunning) {
+        {
+            std::unique_lock<std::mutex> lock(m_QueueMutex);
+            pRequest.reset();
+            for(i = 0; i < BROKER_PRIO_COUNT && !pRequest; i++) {
+                if(m_Queue[i].empty())
+                    continue;
+                pRequest = m_Queue[i].front();
+                m_Queue[i].pop_front();
+            }
+            if(!pRequest) {
+                m_QueueCond.wait_for(lock, std::chrono::milliseconds(500));
+                continue;
+            }
+            if(pRequest->nPriority == BROKER_PRIO_READ)
+                m_PendingReads.erase(pRequest->sCmd);
+            pRequest->Waiters[0].pClient->nQueued--;
+        }
+
+        memset(szResp, 0, SERIAL_BUFFER_SIZE);
+        nErr = m_DomePro.sendRawCommand(pRequest->sCmd.c_str(), szResp, SERIAL_BUFFER_SIZE - 1);
+        Answer.nErr = nErr;
+        Answer.sAnswer = szResp;
+        Answer.dTime = now();
+
+        {
+            std::lock_guard<std::mutex> lock(m_QueueMutex);
+            m_Stats.nSerialCommands++;
+            // anything but a read may change what the reads return
+            if(pRequest->nPriority == BROKER_PRIO_READ)
+                m_Cache[pRequest->sCmd] = Answer;
+            else
+                m_Cache.clear();
+        }
+        for(const Waiter &Who : pRequest->Waiters)
+            sendResponse(Who.pClient, Who.nId, Answer.nErr, Answer.sAnswer);
+    }
+}
+
+void CDomeBroker::sendResponse(std::shared_ptr<Client> pClient, uint32_t nId, int nErr, const std::string &sAnswer)
+{
+    uint8_t Payload[sizeof(int32_t) + BROKER_MAX_PAYLOAD];
+    int32_t nErr32 = nErr;
+    size_t nSize;
+
+    nSize = std::min(sAnswer.size(), (size_t)BROKER_MAX_PAYLOAD);
+    memcpy(Payload, &nErr32, sizeof(int32_t));
+    memcpy(Payload + sizeof(int32_t), sAnswer.data(), nSize);
+    sendMessage(pClient, BROKER_MSG_RESPONSE, nId, Payload, (uint32_t)(sizeof(int32_t) + nSize));
+}
+
+void CDomeBroker::sendMessage(std::shared_ptr<Client> pClient, uint8_t nType, uint32_t nId, const void *pPayload, uint32_t nLength)
+{
+#if !defined(SB_WIN_BUILD)
+    BrokerHeader Header;
+
+    Header.nMagic = BROKER_MAGIC;
+    Header.nType = nType;
+    Header.nReserved = 0;
+    Header.nId = nId;
+    Header.nLength = nLength;
+
+    std::lock_guard<std::mutex> lock(pClient->WriteMutex);
+    if(pClient->bClosed)
+        return;
+    // a client that doesn't read its answers times out here and is dropped by the listen thread
+    if(!writeAll(pClient->nFd, &Header, sizeof(BrokerHeader)) || !writeAll(pClient->nFd, pPayload, nLength))
+        shutdown(pClient->nFd, SHUT_RDWR);
+#endif
+}
+
+#pragma mark - CDomeBrokerSerial
+
+CDomeBrokerSerial::CDomeBrokerSerial()
+{
+    m_sSocket = BROKER_DEFAULT_SOCKET;
+    m_nFd = -1;
+    m_nNextId = 1;
+}
+
+CDomeBrokerSerial::~CDomeBrokerSerial()
+{
+    close();
+}
+
+void CDomeBrokerSerial::setSocket(const char *pszSocket)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(pszSocket && pszSocket[0])
+        m_sSocket = pszSocket;
+}
+
+const char *CDomeBrokerSerial::getSocket()
+{
+    return m_sSocket.c_str();
+}
+
+int CDomeBrokerSerial::open(const char *pszPort, const unsigned long &dwBaudRate, const Parity &parity, const char *pszSessionPrefix)
+{
+    (void)pszPort;
+    (void)dwBaudRate;
+    (void)parity;
+    (void)pszSessionPrefix;
+#if defined(SB_WIN_BUILD)
+    return ERR_NOLINK;
+#else
+    struct sockaddr_un Addr;
+    uint32_t nVersion = BROKER_VERSION;
+    int32_t nErr;
+    std::vector<uint8_t> Reply;
+
+    close();
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_sSocket.size() >= sizeof(Addr.sun_path))
+            return ERR_NOLINK;
+        m_nFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(m_nFd < 0)
+            return ERR_NOLINK;
+        noSigPipe(m_nFd);
+        memset(&Addr, 0, sizeof(Addr));
+        Addr.sun_family = AF_UNIX;
+        strncpy(Addr.sun_path, m_sSocket.c_str(), sizeof(Addr.sun_path) - 1);
+        if(connect(m_nFd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0) {
+            disconnect();
+            return ERR_NOLINK;
+        }
+    }
+    if(request(BROKER_MSG_HELLO, &nVersion, sizeof(uint32_t), BROKER_MSG_RESPONSE, Reply) != SB_OK || Reply.size() < sizeof(int32_t)) {
+        close();
+        return ERR_NOLINK;
+    }
+    memcpy(&nErr, Reply.data(), sizeof(int32_t));
+    if(nErr) {
+        close();
+        return ERR_NOLINK;
+    }
+    return SB_OK;
+#endif
+}
+
+int CDomeBrokerSerial::close()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    disconnect();
+    return SB_OK;
+}
+
+// called with m_Mutex held
+void CDomeBrokerSerial::disconnect()
+{
+#if !defined(SB_WIN_BUILD)
+    if(m_nFd >= 0)
+        ::close(m_nFd);
+#endif
+    m_nFd = -1;
+    m_sTx.clear();
+    m_Rx.clear();
+}
+
+bool CDomeBrokerSerial::isConnected(void) const
+{
+    return m_nFd >= 0;
+}
+
+// the commands are sent as soon as they are complete
+int CDomeBrokerSerial::flushTx(void)
+{
+    return SB_OK;
+}
+
+int CDomeBrokerSerial::purgeTxRx(void)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_sTx.clear();
+    m_Rx.clear();
+    return SB_OK;
+}
+
+// the whole answer is there once the command was written
+int CDomeBrokerSerial::waitForBytesRx(const int &nNumBytes, const int &nTimeOutMs)
+{
+    (void)nTimeOutMs;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return (int)m_Rx.size() >= nNumBytes ? SB_OK : ERR_CMDFAILED;
+}
+
+int CDomeBrokerSerial::readFile(void *lpBuffer, const unsigned long dwTotalBytesToRead, unsigned long &dwBytesRead, const unsigned long &dwTimeOut)
+{
+    uint8_t *pBytes = (uint8_t *)lpBuffer;
+
+    (void)dwTimeOut;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    dwBytesRead = 0;
+    if(m_nFd < 0)
+        return ERR_NOLINK;
+    while(dwBytesRead < dwTotalBytesToRead && !m_Rx.empty()) {
+        pBytes[dwBytesRead++] = m_Rx.front();
+        m_Rx.pop_front();
+    }
+    return SB_OK;
+}
+
+// Sends each complete command to the broker and queues its answer the way the controller would send it.
+// A failed command has no answer, CDomePro sees it as a timeout.
+int CDomeBrokerSerial::writeFile(void *lpBuffer, const unsigned long &dwBytesToWrite, unsigned long &dwBytesWritten)
+{
+    int nErr;
+    int32_t nCmdErr;
+    size_t nEnd;
+    std::string sCmd;
+    std::vector<uint8_t> Reply;
+
+    dwBytesWritten = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_nFd < 0)
+            return ERR_NOLINK;
+        m_sTx.append((const char *)lpBuffer, dwBytesToWrite);
+    }
+    dwBytesWritten = dwBytesToWrite;
+
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            nEnd = m_sTx.find(';');
+            if(nEnd == std::string::npos)
+                return SB_OK;
+            sCmd = m_sTx.substr(0, nEnd + 1);
+            m_sTx.erase(0, nEnd + 1);
+        }
+        nErr = request(BROKER_MSG_COMMAND, sCmd.data(), (uint32_t)sCmd.size(), BROKER_MSG_RESPONSE, Reply);
+        if(nErr)
+            return nErr;
+        if(Reply.size() < sizeof(int32_t))
+            continue;
+        memcpy(&nCmdErr, Reply.data(), sizeof(int32_t));
+        if(nCmdErr)
+            continue;
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Rx.insert(m_Rx.end(), Reply.begin() + sizeof(int32_t), Reply.end());
+        if(!(Reply.size() == sizeof(int32_t) + 1 && Reply[sizeof(int32_t)] == ATCL_ACK))
+            m_Rx.push_back(';');
+    }
+}
+
+int CDomeBrokerSerial::bytesWaitingRx(int &nBytesWaiting)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nBytesWaiting = (int)m_Rx.size();
+    return SB_OK;
+}
+
+int CDomeBrokerSerial::getStatus(DomeStatus &Status)
+{
+    int nErr;
+    std::vector<uint8_t> Reply;
+
+    nErr = request(BROKER_MSG_STATUS, NULL, 0, BROKER_MSG_STATUS_REPLY, Reply);
+    if(nErr)
+        return nErr;
+    if(Reply.size() != sizeof(DomeStatus))
+        return ERR_CMDFAILED;
+    memcpy(&Status, Reply.data(), sizeof(DomeStatus));
+    return SB_OK;
+}
+
+// one request and its answer, the connection is dropped on any protocol error
+int CDomeBrokerSerial::request(uint8_t nType, const void *pPayload, uint32_t nLength, uint8_t nReplyType, std::vector<uint8_t> &Reply)
+{
+#if defined(SB_WIN_BUILD)
+    return ERR_NOLINK;
+#else
+    BrokerHeader Header;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(m_nFd < 0)
+        return ERR_NOLINK;
+
+    Header.nMagic = BROKER_MAGIC;
+    Header.nType = nType;
+    Header.nReserved = 0;
+    Header.nId = m_nNextId++;
+    Header.nLength = nLength;
+    if(!writeAll(m_nFd, &Header, sizeof(BrokerHeader)) || (nLength && !writeAll(m_nFd, pPayload, nLength))) {
+        disconnect();
+        return ERR_NOLINK;
+    }
+
+    if(!readAll(m_nFd, &Header, sizeof(BrokerHeader), BROKER_TIMEOUT_MS) || Header.nMagic != BROKER_MAGIC ||
+       Header.nType != nReplyType || Header.nId != m_nNextId - 1 || Header.nLength > sizeof(DomeStatus) + BROKER_MAX_PAYLOAD) {
+        disconnect();
+        return ERR_NOLINK;
+    }
+    Reply.resize(Header.nLength);
+    if(Header.nLength && !readAll(m_nFd, Reply.data(), Header.nLength, BROKER_TIMEOUT_MS)) {
+        disconnect();
+        return ERR_NOLINK;
+    }
+    return SB_OK;
+#endif
+}
@@ -0,0 +1,174 @@
+//
+//  domebroker.h
+//  ATCL Dome X2 plugin
+//
+//  Local dome broker. The dombroker daemon owns the serial port through a CDomePro and serves any number of
+//  local clients (TheSkyX through this plugin, a safety daemon, scripts) over a Unix domain socket.
+//
+//  Protocol : every message is a BrokerHeader followed by nLength payload bytes, in host byte order.
+//      BROKER_MSG_HELLO     client -> broker, payload uint32 protocol version, answered by a BROKER_MSG_RESPONSE
+//      BROKER_MSG_COMMAND   client -> broker, payload one ATCL command ("!DGap;")
+//      BROKER_MSG_RESPONSE  broker -> client, payload int32 error then the controller answer without the ';'
+//                           (a single ATCL_ACK byte for a set command), nId is the one of the request
+//      BROKER_MSG_STATUS    client -> broker, empty, answered by a BROKER_MSG_STATUS_REPLY
+//      BROKER_MSG_STATUS_REPLY  broker -> client, payload DomeStatus (domestatus.h), no serial traffic
+//
+//  The broker runs the commands one at a time from a queue. Safety commands (kills, shutter close, park) go
+//  before everything else, then the other set commands, then the reads. A read that is already queued is sent
+//  once for all the clients asking for it, and the answer is reused for BROKER_CACHE_TTL until a set command
+//  runs, so the controller is polled once on behalf of everyone.
+//
+//  CDomeBrokerSerial is the client side as a SerXInterface, CDomePro uses it in place of the serial port so
+//  the plugin works the same way with or without the broker.
+
+#ifndef __DOME_BROKER__
+#define __DOME_BROKER__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "domepro.h"
+
+#define BROKER_MAGIC            0x4450      // "DP"
+#define BROKER_VERSION          1
+#define BROKER_DEFAULT_SOCKET   "/tmp/dombroker.sock"
+#define BROKER_MAX_PAYLOAD      512
+#define BROKER_CACHE_TTL        0.25        // seconds
+#define BROKER_MAX_QUEUED       32          // requests waiting per client
+#define BROKER_MAX_CLIENTS      32
+#define BROKER_TIMEOUT_MS       10000       // client side, answer to a request
+#define BROKER_SEND_TIMEOUT_MS  1000        // server side, a client that doesn't read its answers is dropped
+
+enum BrokerMessages {BROKER_MSG_HELLO = 1, BROKER_MSG_COMMAND, BROKER_MSG_RESPONSE, BROKER_MSG_STATUS, BROKER_MSG_STATUS_REPLY};
+enum BrokerPriorities {BROKER_PRIO_SAFETY = 0, BROKER_PRIO_SET, BROKER_PRIO_READ, BROKER_PRIO_COUNT};
+
+typedef struct {
+    uint16_t    nMagic;
+    uint8_t     nType;
+    uint8_t     nReserved;
+    uint32_t    nId;                // set by the client, sent back in the answer
+    uint32_t    nLength;            // payload bytes
+} BrokerHeader;
+
+typedef struct {
+    uint32_t    nClients;
+    uint64_t    nRequests;          // commands received
+    uint64_t    nCacheHits;         // answered from the cache
+    uint64_t    nCoalesced;         // answered with a read already queued for another client
+    uint64_t    nSerialCommands;    // sent to the controller
+    uint64_t    nRejected;          // client queue full
+    uint32_t    nQueued[BROKER_PRIO_COUNT];
+} BrokerStats;
+
+// server, the CDomePro must be connected to the dome
+class CDomeBroker
+{
+public:
+    CDomeBroker(CDomePro &DomePro);
+    ~CDomeBroker();
+
+    int     start(const char *pszSocket, double dCacheTTL = BROKER_CACHE_TTL);
+    void    stop();
+    void    getStats(BrokerStats &Stats);
+
+    static int  commandPriority(const char *pszCmd);
+
+protected:
+    typedef struct {
+        int                 nFd;
+        std::mutex          WriteMutex;
+        std::vector<uint8_t>    Rx;
+        int                 nQueued;    // guarded by m_QueueMutex
+        bool                bClosed;
+    } Client;
+
+    typedef struct {
+        std::shared_ptr<Client> pClient;
+        uint32_t            nId;
+    } Waiter;
+
+    typedef struct {
+        std::string         sCmd;
+        int                 nPriority;
+        std::vector<Waiter> Waiters;
+    } Request;
+
+    typedef struct {
+        int                 nErr;
+        std::string         sAnswer;
+        double              dTime;
+    } CachedAnswer;
+
+    void    listenThread();
+    void    workerThread();
+    bool    readClient(std::shared_ptr<Client> pClient);
+    void    handleMessage(std::shared_ptr<Client> pClient, const BrokerHeader &Header, const uint8_t *pPayload);
+    void    queueCommand(std::shared_ptr<Client> pClient, uint32_t nId, const std::string &sCmd);
+    void    sendResponse(std::shared_ptr<Client> pClient, uint32_t nId, int nErr, const std::string &sAnswer);
+    void    sendMessage(std::shared_ptr<Client> pClient, uint8_t nType, uint32_t nId, const void *pPayload, uint32_t nLength);
+    double  now();
+
+    CDomePro            &m_DomePro;
+    std::string         m_sSocket;
+    double              m_dCacheTTL;
+    int                 m_nListenFd;
+    int                 m_nWakePipe[2];
+    std::atomic<bool>   m_bRunning;
+    std::thread         m_ListenThread;
+    std::thread         m_WorkerThread;
+
+    // the queue, the pending reads, the cache and the stats
+    std::mutex          m_QueueMutex;
+    std::condition_variable m_QueueCond;
+    std::deque<std::shared_ptr<Request> >   m_Queue[BROKER_PRIO_COUNT];
+    std::map<std::string, std::shared_ptr<Request> >    m_PendingReads;
+    std::map<std::string, CachedAnswer>     m_Cache;
+    BrokerStats         m_Stats;
+
+    std::vector<std::shared_ptr<Client> >   m_Clients;      // only used by the listen thread
+};
+
+// client, one request at a time
+class CDomeBrokerSerial : public SerXInterface
+{
+public:
+    CDomeBrokerSerial();
+    virtual ~CDomeBrokerSerial();
+
+    void    setSocket(const char *pszSocket);
+    const char *getSocket();
+    // cached dome status from the broker
+    int     getStatus(DomeStatus &Status);
+
+    // SerXInterface, pszPort is ignored, the socket is the one from setSocket
+    virtual int     open(const char *pszPort, const unsigned long &dwBaudRate = 9600, const Parity &parity = B_NOPARITY, const char *pszSessionPrefix = 0);
+    virtual int     close();
+    virtual bool    isConnected(void) const;
+    virtual int     flushTx(void);
+    virtual int     purgeTxRx(void);
+    virtual int     waitForBytesRx(const int &nNumBytes, const int &nTimeOutMs);
+    virtual int     readFile(void *lpBuffer, const unsigned long dwTotalBytesToRead, unsigned long &dwBytesRead, const unsigned long &dwTimeOut = 1000);
+    virtual int     writeFile(void *lpBuffer, const unsigned long &dwBytesToWrite, unsigned long &dwBytesWritten);
+    virtual int     bytesWaitingRx(int &nBytesWaiting);
+
+protected:
+    int     request(uint8_t nType, const void *pPayload, uint32_t nLength, uint8_t nReplyType, std::vector<uint8_t> &Reply);
+    void    disconnect();
+
+    std::mutex          m_Mutex;
+    std::string         m_sSocket;
+    int                 m_nFd;
+    uint32_t            m_nNextId;
+    std::string         m_sTx;          // command being written
+    std::deque<uint8_t> m_Rx;           // answer being read
+};
+
+#endif
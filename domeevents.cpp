@@ -0,0 +1,267 @@
+//
+//  domeevents.cpp
+//  ATCL Dome X2 plugin
+//
+//  Dome state change events, subscriptions and lock-free event queue.
+
+#include "domeevents.h"
+
+#include <chrono>
+
+static thread_local bool s_bInDispatch = false;
+
+#pragma mark - CDomeEventQueue
+
+// the capacity is rounded up to a power of 2
+CDomeEventQueue::CDomeEventQueue(uint32_t nCapacity)
+{
+    uint32_t nSize = 2;
+
+    while(nSize < nCapacity && nSize < (1U << 30))
+        nSize <<= 1;
+    m_Events.resize(nSize);
+    m_nMask = nSize - 1;
+    m_nHead = 0;
+    m_nTail = 0;
+    m_nDropped = 0;
+}
+
+bool CDomeEventQueue::push(const DomeEvent &Event)
+{
+    uint32_t nHead = m_nHead.load(std::memory_order_relaxed);
+
+    if(nHead - m_nTail.load(std::memory_order_acquire) > m_nMask) {
+        m_nDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_Events[nHead & m_nMask] = Event;
+    m_nHead.store(nHead + 1, std::memory_order_release);
+    return true;
+}
+
+bool CDomeEventQueue::pop(DomeEvent &Event)
+{
+    uint32_t nTail = m_nTail.load(std::memory_order_relaxed);
+
+    if(nTail == m_nHead.load(std::memory_order_acquire))
+        return false;
+    Event = m_Events[nTail & m_nMask];
+    m_nTail.store(nTail + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t CDomeEventQueue::getCount()
+{
+    return m_nHead.load(std::memory_order_acquire) - m_nTail.load(std::memory_order_acquire);
+}
+
+uint32_t CDomeEventQueue::getDropped()
+{
+    return m_nDropped.load(std::memory_order_relaxed);
+}
+
+#pragma mark - CDomeEvents
+
+CDomeEvents::CDomeEvents()
+{
+    m_nNextId = 1;
+    m_nDropped = 0;
+    m_nMoveMode = -1;
+    m_nShutterState = -1;
+    m_nLimits = -1;
+}
+
+int CDomeEvents::addSubscriber(DomeEventCallback pCallback, void *pUserData, CDomeEventQueue *pQueue, uint32_t nMask)
+{
+    Subscriber Sub;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Sub.nId = m_nNextId++;
+    Sub.nMask = nMask;
+    Sub.pCallback = pCallback;
+    Sub.pUserData = pUserData;
+    Sub.pQueue = pQueue;
+    m_Subscribers.push_back(Sub);
+    return Sub.nId;
+}
+
+int CDomeEvents::subscribe(DomeEventCallback pCallback, void *pUserData, uint32_t nMask)
+{
+    if(!pCallback || !nMask)
+        return 0;
+    return addSubscriber(pCallback, pUserData, NULL, nMask);
+}
+
+int CDomeEvents::subscribeQueue(CDomeEventQueue *pQueue, uint32_t nMask)
+{
+    if(!pQueue || !nMask)
+        return 0;
+    return addSubscriber(NULL, NULL, pQueue, nMask);
+}
+
+void CDomeEvents::unsubscribe(int nId)
+{
+    size_t i;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for(i = 0; i < m_Subscribers.size(); i++) {
+            if(m_Subscribers[i].nId == nId) {
+                m_Subscribers.erase(m_Subscribers.begin() + i);
+                break;
+            }
+        }
+    }
+    // wait for the callbacks running with the old list, unless we're one of them
+    if(!s_bInDispatch) {
+        m_DispatchMutex.lock();
+        m_DispatchMutex.unlock();
+    }
+}
+
+bool CDomeEvents::hasSubscribers(uint32_t nMask)
+{
+    size_t i;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for(i = 0; i < m_Subscribers.size(); i++)
+        if(m_Subscribers[i].nMask & nMask)
+            return true;
+    return false;
+}
+
+// called with m_Mutex held
+bool CDomeEvents::publishLocked(int nType, int nValue, int nPrevious, int nLimit, double dAz)
+{
+    size_t i;
+    bool bCallback = false;
+    DomeEvent Event;
+
+    Event.nType = nType;
+    Event.dTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    Event.nValue = nValue;
+    Event.nPrevious = nPrevious;
+    Event.nLimit = nLimit;
+    Event.dAz = dAz;
+
+    for(i = 0; i < m_Subscribers.size(); i++) {
+        if(!(m_Subscribers[i].nMask & DOME_EVT_MASK(nType)))
+            continue;
+        if(m_Subscribers[i].pQueue)
+            m_Subscribers[i].pQueue->push(Event);
+        else
+            bCallback = true;
+    }
+    if(!bCallback)
+        return !m_Pending.empty();
+
+    if(m_Pending.size() >= EVT_MAX_PENDING) {
+        m_Pending.erase(m_Pending.begin());
+        m_nDropped++;
+    }
+    m_Pending.push_back(Event);
+    return true;
+}
+
+bool CDomeEvents::publish(int nType, int nValue, int nPrevious, int nLimit, double dAz)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return publishLocked(nType, nValue, nPrevious, nLimit, dAz);
+}
+
+bool CDomeEvents::setMoveMode(int nMode, int &nPrevious)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nPrevious = m_nMoveMode;
+    m_nMoveMode = nMode;
+    if(nPrevious == -1 || nPrevious == nMode)
+        return !m_Pending.empty();
+    return publishLocked(DOME_EVT_MOVE_MODE, nMode, nPrevious, 0, 0.0);
+}
+
+bool CDomeEvents::setShutterState(int nState)
+{
+    int nPrevious;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nPrevious = m_nShutterState;
+    m_nShutterState = nState;
+    if(nPrevious == -1 || nPrevious == nState)
+        return !m_Pending.empty();
+    return publishLocked(DOME_EVT_SHUTTER_STATE, nState, nPrevious, 0, 0.0);
+}
+
+// one event per bit that changed
+bool CDomeEvents::setLimits(int nLimits)
+{
+    int nChanged;
+    int nBit;
+    bool bPending;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nChanged = m_nLimits == -1 ? 0 : (m_nLimits ^ nLimits);
+    m_nLimits = nLimits;
+    bPending = !m_Pending.empty();
+    for(nBit = 0; nChanged >> nBit; nBit++) {
+        if(nChanged & (1 << nBit))
+            bPending = publishLocked(DOME_EVT_LIMIT, (nLimits >> nBit) & 1, !((nLimits >> nBit) & 1), 1 << nBit, 0.0);
+    }
+    return bPending;
+}
+
+// after a disconnection, the next readings are new references
+void CDomeEvents::reset()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_nMoveMode = -1;
+    m_nShutterState = -1;
+    m_nLimits = -1;
+}
+
+void CDomeEvents::dispatch()
+{
+    size_t i;
+    size_t j;
+    std::vector<DomeEvent> Events;
+    std::vector<Subscriber> Subscribers;
+
+    std::lock_guard<std::mutex> dispatchLock(m_DispatchMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if(m_Pending.empty())
+            return;
+        Events.swap(m_Pending);
+        Subscribers = m_Subscribers;
+    }
+
+    s_bInDispatch = true;
+    for(i = 0; i < Events.size(); i++) {
+        for(j = 0; j < Subscribers.size(); j++) {
+            if(Subscribers[j].pCallback && (Subscribers[j].nMask & DOME_EVT_MASK(Events[i].nType)))
+                Subscribers[j].pCallback(Events[i], Subscribers[j].pUserData);
+        }
+    }
+    s_bInDispatch = false;
+}
+
+uint32_t CDomeEvents::getDropped()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_nDropped;
+}
+
+const char *CDomeEvents::typeName(int nType)
+{
+    switch(nType) {
+        case DOME_EVT_MOVE_MODE:
+            return "move mode";
+        case DOME_EVT_LIMIT:
+            return "limit";
+        case DOME_EVT_SHUTTER_STATE:
+            return "shutter state";
+        case DOME_EVT_GOTO_COMPLETE:
+            return "goto complete";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,111 @@
+//
+//  domeevents.h
+//  ATCL Dome X2 plugin
+//
+//  Dome state change events.
+//  CDomePro publishes an event each time one of its reads shows a change (move mode, limit bits, shutter state)
+//  and when a goto ends, whoever did the read (TheSkyX, the dialogs or the I/O thread).
+//  Subscribers get them through a callback, called from the I/O thread with no driver lock held, or through a
+//  CDomeEventQueue they drain from their own thread without locking.
+//  This doesn't depend on the X2 interfaces.
+
+#ifndef __DOME_EVENTS__
+#define __DOME_EVENTS__
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#define EVT_QUEUE_DEFAULT_SIZE  256
+#define EVT_MAX_PENDING         1024        // events waiting for the callbacks
+
+enum DomeEventType {DOME_EVT_MOVE_MODE = 0, DOME_EVT_LIMIT, DOME_EVT_SHUTTER_STATE, DOME_EVT_GOTO_COMPLETE, DOME_EVT_BATTERY_LOW, DOME_EVT_TYPE_COUNT};
+
+#define DOME_EVT_MASK(nType)    (1U << (nType))
+#define DOME_EVT_ALL            ((1U << DOME_EVT_TYPE_COUNT) - 1)
+
+typedef struct {
+    int     nType;          // DomeEventType
+    double  dTime;          // seconds since 1970
+    int     nValue;         // move mode (DomeAzMoveMode), shutter state (DomeProShutterState), or 1 when the limit is active
+                            // or the shutter battery is low
+    int     nPrevious;      // value before the change
+    int     nLimit;         // limit bit (see the Bit* definitions in domepro.h) for DOME_EVT_LIMIT
+    double  dAz;            // dome azimuth for DOME_EVT_GOTO_COMPLETE
+} DomeEvent;
+
+// called from the I/O thread, it must not unsubscribe other subscribers or block for long
+typedef void (*DomeEventCallback)(const DomeEvent &Event, void *pUserData);
+
+// Single producer / single consumer ring. CDomeEvents pushes with its lock held (so there is only one producer
+// at a time), the subscriber pops from one thread of its own without any lock.
+// When the ring is full new events are dropped and counted.
+class CDomeEventQueue
+{
+public:
+    CDomeEventQueue(uint32_t nCapacity = EVT_QUEUE_DEFAULT_SIZE);
+
+    bool        push(const DomeEvent &Event);
+    bool        pop(DomeEvent &Event);
+    uint32_t    getCount();
+    uint32_t    getDropped();
+
+protected:
+    std::vector<DomeEvent>  m_Events;
+    uint32_t                m_nMask;
+    std::atomic<uint32_t>   m_nHead;    // next slot written
+    std::atomic<uint32_t>   m_nTail;    // next slot read
+    std::atomic<uint32_t>   m_nDropped;
+};
+
+class CDomeEvents
+{
+public:
+    CDomeEvents();
+
+    // nMask is a combination of DOME_EVT_MASK(type), returns the subscription id to unsubscribe
+    int         subscribe(DomeEventCallback pCallback, void *pUserData, uint32_t nMask);
+    int         subscribeQueue(CDomeEventQueue *pQueue, uint32_t nMask);
+    // once this returns the callback isn't running and won't be called again, the queue isn't used anymore
+    void        unsubscribe(int nId);
+    bool        hasSubscribers(uint32_t nMask = DOME_EVT_ALL);
+
+    // New readings, publish the changes. The first reading after a reset is only the reference.
+    // They return true when there are events waiting for dispatch().
+    bool        setMoveMode(int nMode, int &nPrevious);
+    bool        setShutterState(int nState);
+    bool        setLimits(int nLimits);
+    bool        publish(int nType, int nValue, int nPrevious, int nLimit, double dAz);
+    void        reset();
+
+    // calls the callbacks with the waiting events
+    void        dispatch();
+    uint32_t    getDropped();
+
+    static const char *typeName(int nType);
+
+protected:
+    typedef struct {
+        int                 nId;
+        uint32_t            nMask;
+        DomeEventCallback   pCallback;
+        void               *pUserData;
+        CDomeEventQueue    *pQueue;
+    } Subscriber;
+
+    int         addSubscriber(DomeEventCallback pCallback, void *pUserData, CDomeEventQueue *pQueue, uint32_t nMask);
+    bool        publishLocked(int nType, int nValue, int nPrevious, int nLimit, double dAz);
+
+    std::mutex              m_Mutex;
+    std::mutex              m_DispatchMutex;    // held while the callbacks run
+    std::vector<Subscriber> m_Subscribers;
+    std::vector<DomeEvent>  m_Pending;
+    int                     m_nNextId;
+    uint32_t                m_nDropped;
+    int                     m_nMoveMode;        // -1 until the first reading
+    int                     m_nShutterState;
+    int                     m_nLimits;
+};
+
+#endif
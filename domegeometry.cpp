@@ -0,0 +1,191 @@
+//
+//  domegeometry.cpp
+//  ATCL Dome X2 plugin
+//
+//  Dome / German equatorial mount geometry.
+
+#include "domegeometry.h"
+
+CDomeGeometry::CDomeGeometry()
+{
+    int i;
+    double dHa;
+
+    m_bValid = false;
+    m_bDirty = true;
+
+    m_dLatitude = 0.0;
+    m_dDomeRadius = 0.0;
+    m_dMountEast = 0.0;
+    m_dMountNorth = 0.0;
+    m_dMountUp = 0.0;
+    m_dGemOffset = 0.0;
+    m_nPierSide = PIER_SIDE_COUNT;
+
+    for(i = 0; i < GEOM_HA_COUNT; i++) {
+        dHa = (-12.0 + i * GEOM_HA_STEP) * 15.0 * M_PI / 180.0;
+        m_dSinHa[i] = sin(dHa);
+        m_dCosHa[i] = cos(dHa);
+    }
+}
+
+CDomeGeometry::~CDomeGeometry()
+{
+}
+
+void CDomeGeometry::setGeometry(double dDomeRadius, double dMountEast, double dMountNorth, double dMountUp, double dGemOffset)
+{
+    m_dDomeRadius = dDomeRadius;
+    m_dMountEast = dMountEast;
+    m_dMountNorth = dMountNorth;
+    m_dMountUp = dMountUp;
+    m_dGemOffset = dGemOffset;
+    m_bDirty = true;
+}
+
+void CDomeGeometry::setLatitude(double dLatitude)
+{
+    if(dLatitude == m_dLatitude && !m_bDirty)
+        return;
+    m_dLatitude = dLatitude;
+    m_bDirty = true;
+}
+
+// East of the meridian the tube is on the west side of the pier.
+// Within GEOM_PIER_HYSTERESIS of the meridian we keep the last side so the slit doesn't jump back and forth
+// while tracking through HA=0 (the mount doesn't flip exactly on the meridian either).
+int CDomeGeometry::pierSideForHa(double dHa)
+{
+    int nSide;
+
+    nSide = pierSideForHa(dHa, m_nPierSide);
+    // inside the band it's the same side, or a guess when there is none yet
+    if(fabs(dHa) >= GEOM_PIER_HYSTERESIS)
+        m_nPierSide = nSide;
+    return nSide;
+}
+
+// same without keeping the result, nLastSide is PIER_SIDE_COUNT if there is no previous side
+int CDomeGeometry::pierSideForHa(double dHa, int nLastSide)
+{
+    if(dHa >= GEOM_PIER_HYSTERESIS)
+        return PIER_EAST;
+    if(dHa <= -GEOM_PIER_HYSTERESIS)
+        return PIER_WEST;
+    if(nLastSide == PIER_SIDE_COUNT)
+        return (dHa >= 0.0) ? PIER_EAST : PIER_WEST;
+    return nLastSide;
+}
+
+//
+// Compute the dome azimuth for one Dec row of HA values.
+// Pointing vector and GEM offset are computed in the equatorial frame (X toward HA=0 on the equator,
+// Y toward HA=-6h, Z toward the pole) and rotated to the local East/North/Up frame, then the optical axis
+// is intersected with the dome sphere.
+// This only runs when the geometry changes, so it is plain scalar code. The HA trig is precomputed as it
+// doesn't depend on the geometry.
+//
+void CDomeGeometry::computeAzimuths(double dDec, int nPierSide, const double *pdSinHa, const double *pdCosHa, int nCount, float *pfAz)
+{
+    int i;
+    double dSinLat = sin(m_dLatitude * M_PI / 180.0);
+    double dCosLat = cos(m_dLatitude * M_PI / 180.0);
+    double dSinDec = sin(dDec * M_PI / 180.0);
+    double dCosDec = cos(dDec * M_PI / 180.0);
+    double dOffset = (nPierSide == PIER_EAST ? 1.0 : -1.0) * m_dGemOffset;
+    double dR2 = m_dDomeRadius * m_dDomeRadius;
+    double dPx, dPy, dPz;
+    double dOx, dOy, dOz;
+    double dB, dC, dT;
+    double dAz;
+
+    for(i = 0; i < nCount; i++) {
+        // pointing direction
+        dPx = -dCosDec * pdSinHa[i];
+        dPy = -dSinLat * dCosDec * pdCosHa[i] + dCosLat * dSinDec;
+        dPz = dCosLat * dCosDec * pdCosHa[i] + dSinLat * dSinDec;
+        // optical axis origin, along the Dec axis from the mount axis intersection
+        dOx = dOffset * pdCosHa[i] + m_dMountEast;
+        dOy = -dSinLat * dOffset * pdSinHa[i] + m_dMountNorth;
+        dOz = dCosLat * dOffset * pdSinHa[i] + m_dMountUp;
+        // ray / sphere intersection, the origin is inside the dome so there is always one positive solution
+        dB = dOx * dPx + dOy * dPy + dOz * dPz;
+        dC = dOx * dOx + dOy * dOy + dOz * dOz - dR2;
+        dT = -dB + sqrt(dB * dB - dC);
+        dAz = atan2(dOx + dT * dPx, dOy + dT * dPy) * 180.0 / M_PI;
+        pfAz[i] = (float)(dAz < 0 ? dAz + 360.0 : dAz);
+    }
+}
+
+void CDomeGeometry::rebuildLUT()
+{
+    int nSide;
+    int j;
+
+    m_bValid = false;
+    if(m_dDomeRadius <= 0.0)
+        return;
+
+    m_LUT.resize(PIER_SIDE_COUNT * GEOM_DEC_COUNT * GEOM_HA_COUNT);
+    for(nSide = 0; nSide < PIER_SIDE_COUNT; nSide++) {
+        for(j = 0; j < GEOM_DEC_COUNT; j++) {
+            computeAzimuths(-90.0 + j * GEOM_DEC_STEP, nSide, m_dSinHa, m_dCosHa, GEOM_HA_COUNT, &m_LUT[(nSide * GEOM_DEC_COUNT + j) * GEOM_HA_COUNT]);
+        }
+    }
+    m_bDirty = false;
+    m_bValid = true;
+}
+
+double CDomeGeometry::computeDomeAzimuth(double dHa, double dDec, int nPierSide)
+{
+    double dSinHa = sin(dHa * 15.0 * M_PI / 180.0);
+    double dCosHa = cos(dHa * 15.0 * M_PI / 180.0);
+    float fAz;
+
+    computeAzimuths(dDec, nPierSide, &dSinHa, &dCosHa, 1, &fAz);
+    return fAz;
+}
+
+double CDomeGeometry::domeAzimuth(double dHa, double dDec, int nPierSide)
+{
+    int i, j;
+    double dX, dY;
+    double dFx, dFy;
+    double dA00, dA01, dA10, dA11;
+    double dAz;
+    const float *pfRow;
+
+    if(m_bDirty)
+        rebuildLUT();
+    if(!m_bValid)
+        return -1;
+
+    while (dHa < -12.0) dHa += 24.0;
+    while (dHa >= 12.0) dHa -= 24.0;
+    if(dDec > 90.0) dDec = 90.0;
+    if(dDec < -90.0) dDec = -90.0;
+
+    dX = (dHa + 12.0) / GEOM_HA_STEP;
+    dY = (dDec + 90.0) / GEOM_DEC_STEP;
+    i = (int)floor(dX);
+    j = (int)floor(dY);
+    if(i > GEOM_HA_COUNT - 2) i = GEOM_HA_COUNT - 2;
+    if(j > GEOM_DEC_COUNT - 2) j = GEOM_DEC_COUNT - 2;
+    dFx = dX - i;
+    dFy = dY - j;
+
+    pfRow = &m_LUT[(nPierSide * GEOM_DEC_COUNT + j) * GEOM_HA_COUNT];
+    dA00 = pfRow[i];
+    dA10 = pfRow[i + 1];
+    dA01 = pfRow[i + GEOM_HA_COUNT];
+    dA11 = pfRow[i + 1 + GEOM_HA_COUNT];
+    // unwrap the corners around the first one so we don't interpolate across 0/360
+    dA10 = dA00 + remainder(dA10 - dA00, 360.0);
+    dA01 = dA00 + remainder(dA01 - dA00, 360.0);
+    dA11 = dA00 + remainder(dA11 - dA00, 360.0);
+
+    dAz = (dA00 * (1 - dFx) + dA10 * dFx) * (1 - dFy) + (dA01 * (1 - dFx) + dA11 * dFx) * dFy;
+    while (dAz < 0) dAz += 360;
+    while (dAz >= 360) dAz -= 360;
+    return dAz;
+}
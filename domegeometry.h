@@ -0,0 +1,76 @@
+//
+//  domegeometry.h
+//  ATCL Dome X2 plugin
+//
+//  Dome / German equatorial mount geometry.
+//  Converts the telescope pointing (HA/Dec and pier side) to the dome azimuth the slit needs to be at.
+//  The conversion is precomputed in a lookup table when the parameters change and bilinearly
+//  interpolated at run time.
+
+#ifndef __DOME_GEOMETRY__
+#define __DOME_GEOMETRY__
+
+#include <math.h>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// LUT resolution
+#define GEOM_HA_STEP    0.1     // hours
+#define GEOM_DEC_STEP   1.0     // degrees
+#define GEOM_HA_COUNT   241     // -12h .. +12h
+#define GEOM_DEC_COUNT  181     // -90 .. +90
+
+#define GEOM_PIER_HYSTERESIS    0.25    // hours around the meridian where the pier side is kept
+
+enum PierSide {PIER_EAST = 0, PIER_WEST, PIER_SIDE_COUNT};
+
+class CDomeGeometry
+{
+public:
+    CDomeGeometry();
+    ~CDomeGeometry();
+
+    // dome radius and mount position are in meters, the mount position is the intersection of the RA and Dec axis
+    // relative to the center of the dome sphere (X = East, Y = North, Z = Up).
+    void    setGeometry(double dDomeRadius, double dMountEast, double dMountNorth, double dMountUp, double dGemOffset);
+    void    setLatitude(double dLatitude);
+    double  getLatitude() { return m_dLatitude; };
+    bool    isValid() { return m_bValid; };
+
+    // direct (slow) computation, used to fill the LUT.
+    double  computeDomeAzimuth(double dHa, double dDec, int nPierSide);
+    // table lookup, HA in hours, Dec in degrees.
+    double  domeAzimuth(double dHa, double dDec, int nPierSide);
+    // the real-time lookup keeps the side for the hysteresis, the projections pass it in and change nothing
+    int     pierSideForHa(double dHa);
+    int     pierSideForHa(double dHa, int nLastSide);
+    int     getPierSide() { return m_nPierSide; };
+
+    void    rebuildLUT();
+
+protected:
+    void    computeAzimuths(double dDec, int nPierSide, const double *pdSinHa, const double *pdCosHa, int nCount, float *pfAz);
+
+    bool                m_bValid;
+    bool                m_bDirty;
+
+    double              m_dLatitude;
+    double              m_dDomeRadius;
+    double              m_dMountEast;
+    double              m_dMountNorth;
+    double              m_dMountUp;
+    double              m_dGemOffset;
+    int                 m_nPierSide;    // last side returned by pierSideForHa, PIER_SIDE_COUNT if none yet
+
+    // sin/cos of the HA grid, they don't depend on the geometry so they're computed once.
+    double              m_dSinHa[GEOM_HA_COUNT];
+    double              m_dCosHa[GEOM_HA_COUNT];
+
+    // [pier side][dec][ha]
+    std::vector<float>  m_LUT;
+};
+
+#endif
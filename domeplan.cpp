@@ -0,0 +1,94 @@
+//
+//  domeplan.cpp
+//  ATCL Dome X2 plugin
+//
+//  Command line front end for the observation plan dome rotation optimizer.
+//  usage : domeplan [-m model_file] [-s speed] [-a accel] [-z start_az] [-t start_time] targets_file [plan_file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "domeplanner.h"
+
+static void usage(const char *pszName)
+{
+    fprintf(stderr, "usage : %s [-m model_file] [-s speed] [-a accel] [-z start_az] [-t start_time] targets_file [plan_file]\n", pszName);
+    fprintf(stderr, "  model_file : rotation model measured by the plugin (DomeProRotation.txt in the home directory)\n");
+    fprintf(stderr, "  speed in degrees/s, accel in degrees/s^2, used until the model has enough measured moves, times in seconds.\n");
+    fprintf(stderr, "  targets_file : one target per line \"name earliest latest duration az_min az_max\"\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int nErr;
+    int i;
+    double dSpeed = 0.0;
+    double dAccel = 0.0;
+    double dStartAz = 0.0;
+    double dStartTime = 0.0;
+    const char *pszModel = NULL;
+    const char *pszTargets = NULL;
+    const char *pszPlan = NULL;
+    std::vector<DomePlanTarget> Targets;
+    std::vector<DomePlanStep> Plan;
+    CDomeRotationModel Model;
+    CDomePlanner Planner;
+
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-m") && i + 1 < argc)
+            pszModel = argv[++i];
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            dSpeed = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-a") && i + 1 < argc)
+            dAccel = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-z") && i + 1 < argc)
+            dStartAz = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            dStartTime = atof(argv[++i]);
+        else if(!pszTargets)
+            pszTargets = argv[i];
+        else if(!pszPlan)
+            pszPlan = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!pszTargets || dSpeed < 0.0 || dAccel < 0.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    nErr = CDomePlanner::readTargets(pszTargets, Targets);
+    if(nErr) {
+        fprintf(stderr, "Error reading %s (%d)\n", pszTargets, nErr);
+        return 1;
+    }
+
+    if(pszModel) {
+        nErr = Model.readFile(pszModel);
+        if(nErr) {
+            fprintf(stderr, "Error reading %s (%d)\n", pszModel, nErr);
+            return 1;
+        }
+    }
+    // 0 keeps the model's own
+    Model.setDefaults(dSpeed, dAccel);
+    fprintf(stderr, "rotation speed %.2f deg/s, accel %.2f deg/s^2, %d measured moves\n", Model.getSpeed(), Model.getAccel(), Model.getSampleCount());
+    Planner.setRotationModel(Model);
+    nErr = Planner.plan(Targets, dStartAz, dStartTime, Plan);
+    if(nErr) {
+        fprintf(stderr, "Planning failed (%d)\n", nErr);
+        return 1;
+    }
+
+    nErr = CDomePlanner::writePlan(pszPlan, Targets, Plan);
+    if(nErr) {
+        fprintf(stderr, "Error writing %s (%d)\n", pszPlan, nErr);
+        return 1;
+    }
+    fprintf(stderr, "%d/%d targets scheduled, total rotation time %.1f s\n", (int)Plan.size(), (int)Targets.size(), Planner.getTotalMoveTime());
+
+    return 0;
+}
@@ -0,0 +1,514 @@
+//
+//  domeplanner.cpp
+//  ATCL Dome X2 plugin
+//
+//  Observation plan dome rotation optimizer.
+
+#include "domeplanner.h"
+
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+
+#pragma mark - rotation model
+
+CDomeRotationModel::CDomeRotationModel()
+{
+    m_dDefaultSpeed = 3.0;
+    m_dDefaultAccel = 1.0;
+    m_nSamples = 0;
+    m_dSumD = 0.0;
+    m_dSumT = 0.0;
+    m_dSumDD = 0.0;
+    m_dSumDT = 0.0;
+}
+
+void CDomeRotationModel::setDefaults(double dSpeed, double dAccel)
+{
+    if(dSpeed > 0.0)
+        m_dDefaultSpeed = dSpeed;
+    if(dAccel > 0.0)
+        m_dDefaultAccel = dAccel;
+}
+
+void CDomeRotationModel::addSample(double dDistance, double dSeconds)
+{
+    // short moves never reach the cruise speed and would bias the fit
+    if(dDistance < PLAN_MIN_SAMPLE_DIST || dSeconds <= 0.0)
+        return;
+    m_nSamples++;
+    m_dSumD += dDistance;
+    m_dSumT += dSeconds;
+    m_dSumDD += dDistance * dDistance;
+    m_dSumDT += dDistance * dSeconds;
+}
+
+// for a trapezoidal profile covering d degrees : t = d/v + v/a
+// so a linear fit of t against d gives 1/v as the slope and v/a as the intercept.
+double CDomeRotationModel::getSpeed()
+{
+    double dDenom;
+    double dSlope;
+
+    if(m_nSamples < PLAN_MIN_SAMPLES)
+        return m_dDefaultSpeed;
+
+    dDenom = m_nSamples * m_dSumDD - m_dSumD * m_dSumD;
+    if(dDenom <= 0.0)
+        return m_dDefaultSpeed;
+    dSlope = (m_nSamples * m_dSumDT - m_dSumD * m_dSumT) / dDenom;
+    if(dSlope <= 0.0)
+        return m_dDefaultSpeed;
+    return 1.0 / dSlope;
+}
+
+double CDomeRotationModel::getAccel()
+{
+    double dDenom;
+    double dSlope;
+    double dIntercept;
+
+    if(m_nSamples < PLAN_MIN_SAMPLES)
+        return m_dDefaultAccel;
+
+    dDenom = m_nSamples * m_dSumDD - m_dSumD * m_dSumD;
+    if(dDenom <= 0.0)
+        return m_dDefaultAccel;
+    dSlope = (m_nSamples * m_dSumDT - m_dSumD * m_dSumT) / dDenom;
+    dIntercept = (m_dSumT - dSlope * m_dSumD) / m_nSamples;
+    if(dSlope <= 0.0 || dIntercept <= 0.0)
+        return m_dDefaultAccel;
+    return (1.0 / dSlope) / dIntercept;
+}
+
+double CDomeRotationModel::moveTime(double dDistance)
+{
+    double dSpeed = getSpeed();
+    double dAccel = getAccel();
+
+    if(dDistance <= 0.0)
+        return 0.0;
+    // triangular profile if we can't reach the cruise speed
+    if(dDistance < dSpeed * dSpeed / dAccel)
+        return 2.0 * sqrt(dDistance / dAccel);
+    return dDistance / dSpeed + dSpeed / dAccel;
+}
+
+// one line : default_speed default_accel samples sum_d sum_t sum_dd sum_dt
+int CDomeRotationModel::writeFile(const char *pszFile)
+{
+    FILE *pFile;
+
+    pFile = fopen(pszFile, "w");
+    if(!pFile)
+        return PLAN_FILE_ERROR;
+    fprintf(pFile, "# DomePro rotation model, measured speed %.4f deg/s, accel %.4f deg/s^2\n", getSpeed(), getAccel());
+    fprintf(pFile, "# default_speed default_accel samples sum_d sum_t sum_dd sum_dt\n");
+    fprintf(pFile, "%.6f %.6f %d %.6f %.6f %.6f %.6f\n", m_dDefaultSpeed, m_dDefaultAccel, m_nSamples, m_dSumD, m_dSumT, m_dSumDD, m_dSumDT);
+    fclose(pFile);
+    return PLAN_OK;
+}
+
+int CDomeRotationModel::readFile(const char *pszFile)
+{
+    FILE *pFile;
+    char szLine[1024];
+    int nErr = PLAN_PARSE_ERROR;
+    int nSamples;
+    double dSpeed, dAccel;
+    double dSumD, dSumT, dSumDD, dSumDT;
+
+    pFile = fopen(pszFile, "r");
+    if(!pFile)
+        return PLAN_FILE_ERROR;
+
+    while(fgets(szLine, sizeof(szLine), pFile)) {
+        if(szLine[0] == '#')
+            continue;
+        if(sscanf(szLine, "%lf %lf %d %lf %lf %lf %lf", &dSpeed, &dAccel, &nSamples, &dSumD, &dSumT, &dSumDD, &dSumDT) != 7 || nSamples < 0)
+            break;
+        setDefaults(dSpeed, dAccel);
+        m_nSamples = nSamples;
+        m_dSumD = dSumD;
+        m_dSumT = dSumT;
+        m_dSumDD = dSumDD;
+        m_dSumDT = dSumDT;
+        nErr = PLAN_OK;
+        break;
+    }
+    fclose(pFile);
+    return nErr;
+}
+
+#pragma mark - planner
+
+CDomePlanner::CDomePlanner()
+{
+    m_pTargets = NULL;
+    m_dStartAz = 0.0;
+    m_dStartTime = 0.0;
+    m_dTotalMoveTime = 0.0;
+}
+
+int CDomePlanner::plan(const std::vector<DomePlanTarget> &Targets, double dStartAz, double dStartTime, std::vector<DomePlanStep> &Plan)
+{
+    std::vector<int> Order;
+    double dEndTime;
+
+    Plan.clear();
+    m_dTotalMoveTime = 0.0;
+    if(Targets.empty())
+        return PLAN_NO_TARGET;
+
+    m_pTargets = &Targets;
+    m_dStartAz = dStartAz;
+    m_dStartTime = dStartTime;
+
+    if(Targets.size() <= PLAN_EXACT_MAX)
+        planExact(Order);
+    else {
+        planGreedy(Order);
+        improve(Order);
+    }
+
+    evaluate(Order, &Plan, m_dTotalMoveTime, dEndTime);
+    m_pTargets = NULL;
+    return PLAN_OK;
+}
+
+// closest dome azimuth to dFromAz that keeps the target in the slit
+double CDomePlanner::closestAzInRange(double dFromAz, const DomePlanTarget &Target)
+{
+    double dSpan;
+    double dOffset;
+
+    // full circle
+    if(Target.dAzMin == Target.dAzMax || fabs(Target.dAzMax - Target.dAzMin) >= 360.0)
+        return dFromAz;
+
+    dSpan = fmod(Target.dAzMax - Target.dAzMin + 360.0, 360.0);
+    dOffset = fmod(dFromAz - Target.dAzMin + 360.0, 360.0);
+    if(dOffset <= dSpan)
+        return dFromAz;
+    // outside of the range, go to the nearest edge
+    if(fabs(remainder(dFromAz - Target.dAzMin, 360.0)) <= fabs(remainder(dFromAz - Target.dAzMax, 360.0)))
+        return Target.dAzMin;
+    return Target.dAzMax;
+}
+
+// more targets scheduled first, then less rotation, then an earlier end.
+bool CDomePlanner::isBetter(int nCount, double dMoveTime, double dEndTime, int nBestCount, double dBestMoveTime, double dBestEndTime)
+{
+    if(nCount != nBestCount)
+        return nCount > nBestCount;
+    if(fabs(dMoveTime - dBestMoveTime) > 1e-6)
+        return dMoveTime < dBestMoveTime;
+    return dEndTime < dBestEndTime;
+}
+
+// Walk the order, each target is observed as soon as the dome gets there and its window opens.
+// Targets that can't be started before the end of their window are skipped.
+int CDomePlanner::evaluate(const std::vector<int> &Order, std::vector<DomePlanStep> *pPlan, double &dMoveTime, double &dEndTime)
+{
+    int nCount = 0;
+    double dAz = m_dStartAz;
+    double dTime = m_dStartTime;
+    DomePlanStep Step;
+    std::vector<int>::const_iterator it;
+
+    dMoveTime = 0.0;
+    for(it = Order.begin(); it != Order.end(); ++it) {
+        const DomePlanTarget &Target = (*m_pTargets)[*it];
+        Step.nTarget = *it;
+        Step.dDomeAz = closestAzInRange(dAz, Target);
+        Step.dMoveTime = m_Model.moveTime(fabs(remainder(Step.dDomeAz - dAz, 360.0)));
+        Step.dStart = std::max(dTime + Step.dMoveTime, Target.dEarliest);
+        if(Step.dStart > Target.dLatest)
+            continue;
+        Step.dEnd = Step.dStart + Target.dDuration;
+
+        dMoveTime += Step.dMoveTime;
+        dAz = Step.dDomeAz;
+        dTime = Step.dEnd;
+        nCount++;
+        if(pPlan)
+            pPlan->push_back(Step);
+    }
+    dEndTime = dTime;
+    return nCount;
+}
+
+// Dynamic programming over the subsets of targets (state = targets done + last target).
+// A single best partial schedule per state isn't enough : less rotation can mean a later end that misses
+// a window further on, and the dome azimuth depends on the path. So each state keeps its Pareto set of
+// partial schedules, one only replaces another when it ends at the same azimuth with no more rotation
+// and no later end. This finds the best order for the evaluate() model.
+void CDomePlanner::planExact(std::vector<int> &Order)
+{
+    typedef struct {
+        double  dMoveTime;
+        double  dEndTime;
+        double  dAz;
+        int     nParent;        // parent state
+        int     nParentIndex;   // index in the parent state Pareto set
+    } PlanState;
+
+    int nTargets = (int)m_pTargets->size();
+    int nStates = 1 << nTargets;
+    int nMask, nNextMask;
+    int i, j, k;
+    int nFrom, nFromCount;
+    int nCount, nBestCount;
+    int nBestState, nBestIndex;
+    bool bDominated;
+    double dFromAz, dFromTime, dFromMove;
+    double dAz, dMove, dStart, dEnd;
+    double dBestMove = PLAN_UNREACHABLE;
+    double dBestEnd = PLAN_UNREACHABLE;
+    PlanState NewState;
+    std::vector< std::vector<PlanState> > States(nStates * nTargets);
+    std::vector<bool> Used(nTargets, false);
+
+    // a state's set is complete before it's expanded as all its writes come from smaller masks,
+    // so the parent indices don't move once they're used.
+    for(nMask = 0; nMask < nStates; nMask++) {
+        for(i = -1; i < nTargets; i++) {
+            nFromCount = 1;
+            if(nMask == 0) {
+                // from the start position, only once.
+                if(i != -1)
+                    break;
+            }
+            else {
+                if(i == -1 || !(nMask & (1 << i)))
+                    continue;
+                nFromCount = (int)States[nMask * nTargets + i].size();
+            }
+            for(nFrom = 0; nFrom < nFromCount; nFrom++) {
+                if(nMask == 0) {
+                    dFromAz = m_dStartAz;
+                    dFromTime = m_dStartTime;
+                    dFromMove = 0.0;
+                }
+                else {
+                    const PlanState &From = States[nMask * nTargets + i][nFrom];
+                    dFromAz = From.dAz;
+                    dFromTime = From.dEndTime;
+                    dFromMove = From.dMoveTime;
+                }
+                for(j = 0; j < nTargets; j++) {
+                    if(nMask & (1 << j))
+                        continue;
+                    const DomePlanTarget &Target = (*m_pTargets)[j];
+                    dAz = closestAzInRange(dFromAz, Target);
+                    dMove = m_Model.moveTime(fabs(remainder(dAz - dFromAz, 360.0)));
+                    dStart = std::max(dFromTime + dMove, Target.dEarliest);
+                    if(dStart > Target.dLatest)
+                        continue;
+                    dEnd = dStart + Target.dDuration;
+                    dMove += dFromMove;
+
+                    nNextMask = nMask | (1 << j);
+                    std::vector<PlanState> &Next = States[nNextMask * nTargets + j];
+                    bDominated = false;
+                    for(k = 0; k < (int)Next.size() && !bDominated; k++)
+                        bDominated = fabs(Next[k].dAz - dAz) < 1e-9 && Next[k].dMoveTime <= dMove + 1e-6 && Next[k].dEndTime <= dEnd;
+                    if(bDominated)
+                        continue;
+                    for(k = 0; k < (int)Next.size(); ) {
+                        if(fabs(Next[k].dAz - dAz) < 1e-9 && dMove <= Next[k].dMoveTime + 1e-6 && dEnd <= Next[k].dEndTime)
+                            Next.erase(Next.begin() + k);
+                        else
+                            k++;
+                    }
+                    NewState.dMoveTime = dMove;
+                    NewState.dEndTime = dEnd;
+                    NewState.dAz = dAz;
+                    NewState.nParent = nMask ? (nMask * nTargets + i) : -1;
+                    NewState.nParentIndex = nFrom;
+                    Next.push_back(NewState);
+                }
+            }
+        }
+    }
+
+    // best final state
+    nBestCount = 0;
+    nBestState = -1;
+    nBestIndex = -1;
+    for(i = 0; i < nStates * nTargets; i++) {
+        nCount = 0;
+        for(nMask = i / nTargets; nMask; nMask &= nMask - 1)
+            nCount++;
+        for(k = 0; k < (int)States[i].size(); k++) {
+            if(nBestState == -1 || isBetter(nCount, States[i][k].dMoveTime, States[i][k].dEndTime, nBestCount, dBestMove, dBestEnd)) {
+                nBestState = i;
+                nBestIndex = k;
+                nBestCount = nCount;
+                dBestMove = States[i][k].dMoveTime;
+                dBestEnd = States[i][k].dEndTime;
+            }
+        }
+    }
+
+    Order.clear();
+    for(i = nBestState, k = nBestIndex; i != -1; ) {
+        const PlanState &State = States[i][k];
+        Order.push_back(i % nTargets);
+        Used[i % nTargets] = true;
+        i = State.nParent;
+        k = State.nParentIndex;
+    }
+    std::reverse(Order.begin(), Order.end());
+    // whatever couldn't be scheduled goes at the end, evaluate() will skip it.
+    for(j = 0; j < nTargets; j++)
+        if(!Used[j])
+            Order.push_back(j);
+}
+
+// Pick the target we can start the earliest, then the one that needs the less rotation.
+void CDomePlanner::planGreedy(std::vector<int> &Order)
+{
+    int nTargets = (int)m_pTargets->size();
+    int j;
+    int nBest;
+    double dAz = m_dStartAz;
+    double dTime = m_dStartTime;
+    double dNewAz, dMove, dStart;
+    double dBestAz = 0.0, dBestMove = 0.0, dBestStart = 0.0;
+    std::vector<bool> Used(nTargets, false);
+
+    Order.clear();
+    while(true) {
+        nBest = -1;
+        for(j = 0; j < nTargets; j++) {
+            if(Used[j])
+                continue;
+            const DomePlanTarget &Target = (*m_pTargets)[j];
+            dNewAz = closestAzInRange(dAz, Target);
+            dMove = m_Model.moveTime(fabs(remainder(dNewAz - dAz, 360.0)));
+            dStart = std::max(dTime + dMove, Target.dEarliest);
+            if(dStart > Target.dLatest)
+                continue;
+            if(nBest == -1 || dStart < dBestStart || (dStart == dBestStart && dMove < dBestMove)) {
+                nBest = j;
+                dBestAz = dNewAz;
+                dBestMove = dMove;
+                dBestStart = dStart;
+            }
+        }
+        if(nBest == -1)
+            break;
+        Used[nBest] = true;
+        Order.push_back(nBest);
+        dAz = dBestAz;
+        dTime = dBestStart + (*m_pTargets)[nBest].dDuration;
+    }
+
+    for(j = 0; j < nTargets; j++)
+        if(!Used[j])
+            Order.push_back(j);
+}
+
+// local search : 2-opt segment reversal and single target relocation until nothing improves.
+void CDomePlanner::improve(std::vector<int> &Order)
+{
+    int nSize = (int)Order.size();
+    int i, j;
+    int nPass;
+    int nCount, nBestCount;
+    bool bImproved = true;
+    double dMove, dEnd;
+    double dBestMove, dBestEnd;
+    std::vector<int> Candidate;
+
+    nBestCount = evaluate(Order, NULL, dBestMove, dBestEnd);
+
+    for(nPass = 0; bImproved && nPass < 50; nPass++) {
+        bImproved = false;
+        for(i = 0; i < nSize - 1; i++) {
+            for(j = i + 1; j < nSize; j++) {
+                Candidate = Order;
+                std::reverse(Candidate.begin() + i, Candidate.begin() + j + 1);
+                nCount = evaluate(Candidate, NULL, dMove, dEnd);
+                if(isBetter(nCount, dMove, dEnd, nBestCount, dBestMove, dBestEnd)) {
+                    Order.swap(Candidate);
+                    nBestCount = nCount;
+                    dBestMove = dMove;
+                    dBestEnd = dEnd;
+                    bImproved = true;
+                    continue;
+                }
+
+                Candidate = Order;
+                Candidate.insert(Candidate.begin() + j + 1, Candidate[i]);
+                Candidate.erase(Candidate.begin() + i);
+                nCount = evaluate(Candidate, NULL, dMove, dEnd);
+                if(isBetter(nCount, dMove, dEnd, nBestCount, dBestMove, dBestEnd)) {
+                    Order.swap(Candidate);
+                    nBestCount = nCount;
+                    dBestMove = dMove;
+                    dBestEnd = dEnd;
+                    bImproved = true;
+                }
+            }
+        }
+    }
+}
+
+#pragma mark - plan files
+
+// one target per line : name earliest latest duration azMin azMax
+// empty lines and lines starting with # are ignored.
+int CDomePlanner::readTargets(const char *pszFile, std::vector<DomePlanTarget> &Targets)
+{
+    FILE *pFile;
+    char szLine[1024];
+    char szName[256];
+    int nFields;
+    DomePlanTarget Target;
+
+    Targets.clear();
+    pFile = fopen(pszFile, "r");
+    if(!pFile)
+        return PLAN_FILE_ERROR;
+
+    while(fgets(szLine, sizeof(szLine), pFile)) {
+        if(szLine[0] == '#' || strspn(szLine, " \t\r\n") == strlen(szLine))
+            continue;
+        nFields = sscanf(szLine, "%255s %lf %lf %lf %lf %lf", szName, &Target.dEarliest, &Target.dLatest, &Target.dDuration, &Target.dAzMin, &Target.dAzMax);
+        if(nFields != 6) {
+            fclose(pFile);
+            return PLAN_PARSE_ERROR;
+        }
+        Target.sName = szName;
+        Targets.push_back(Target);
+    }
+    fclose(pFile);
+
+    return Targets.empty() ? PLAN_NO_TARGET : PLAN_OK;
+}
+
+int CDomePlanner::writePlan(const char *pszFile, const std::vector<DomePlanTarget> &Targets, const std::vector<DomePlanStep> &Plan)
+{
+    FILE *pFile;
+    size_t i;
+    std::vector<bool> Scheduled(Targets.size(), false);
+
+    pFile = pszFile ? fopen(pszFile, "w") : stdout;
+    if(!pFile)
+        return PLAN_FILE_ERROR;
+
+    fprintf(pFile, "# name start end dome_az move_time\n");
+    for(i = 0; i < Plan.size(); i++) {
+        fprintf(pFile, "%s %.1f %.1f %.2f %.1f\n", Targets[Plan[i].nTarget].sName.c_str(), Plan[i].dStart, Plan[i].dEnd, Plan[i].dDomeAz, Plan[i].dMoveTime);
+        Scheduled[Plan[i].nTarget] = true;
+    }
+    for(i = 0; i < Targets.size(); i++)
+        if(!Scheduled[i])
+            fprintf(pFile, "# not scheduled : %s\n", Targets[i].sName.c_str());
+
+    if(pFile != stdout)
+        fclose(pFile);
+    return PLAN_OK;
+}
@@ -0,0 +1,99 @@
+//
+//  domeplanner.h
+//  ATCL Dome X2 plugin
+//
+//  Observation plan dome rotation optimizer.
+//  Given a list of targets with a time window and the dome azimuth range that keeps them in the slit,
+//  find the order and dome azimuth for each target that minimize the total rotation time.
+//  This doesn't depend on the X2 interfaces so it can also be used by the domeplan command line tool.
+
+#ifndef __DOME_PLANNER__
+#define __DOME_PLANNER__
+
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define PLAN_MIN_SAMPLE_DIST    20.0    // degrees, shorter moves don't reach full speed
+#define PLAN_MIN_SAMPLES        3
+#define PLAN_EXACT_MAX          12      // exact search up to this number of targets
+#define PLAN_UNREACHABLE        1e12
+
+enum DomePlanErrors {PLAN_OK = 0, PLAN_NO_TARGET, PLAN_FILE_ERROR, PLAN_PARSE_ERROR};
+
+// Times are in seconds (any epoch as long as it's the same for all targets).
+// The azimuth range goes clockwise from dAzMin to dAzMax (it can wrap around 0), dAzMin == dAzMax is any azimuth.
+typedef struct {
+    std::string sName;
+    double      dEarliest;      // earliest start
+    double      dLatest;        // latest start
+    double      dDuration;
+    double      dAzMin;
+    double      dAzMax;
+} DomePlanTarget;
+
+typedef struct {
+    int         nTarget;        // index in the target list
+    double      dDomeAz;
+    double      dMoveTime;      // rotation time to get there from the previous step
+    double      dStart;
+    double      dEnd;
+} DomePlanStep;
+
+// rotation model measured from past gotos : trapezoidal speed profile
+class CDomeRotationModel
+{
+public:
+    CDomeRotationModel();
+
+    void    setDefaults(double dSpeed, double dAccel);
+    void    addSample(double dDistance, double dSeconds);
+    int     getSampleCount() { return m_nSamples; };
+    double  getSpeed();
+    double  getAccel();
+    double  moveTime(double dDistance);
+
+    // the defaults and the fit sums, so the measured model carries over to the next session and to domeplan
+    int     writeFile(const char *pszFile);
+    int     readFile(const char *pszFile);
+
+protected:
+    double  m_dDefaultSpeed;
+    double  m_dDefaultAccel;
+    // least square fit of t = d/v + v/a on the long moves
+    int     m_nSamples;
+    double  m_dSumD;
+    double  m_dSumT;
+    double  m_dSumDD;
+    double  m_dSumDT;
+};
+
+class CDomePlanner
+{
+public:
+    CDomePlanner();
+
+    void    setRotationModel(const CDomeRotationModel &Model) { m_Model = Model; };
+    int     plan(const std::vector<DomePlanTarget> &Targets, double dStartAz, double dStartTime, std::vector<DomePlanStep> &Plan);
+    double  getTotalMoveTime() { return m_dTotalMoveTime; };
+
+    static int  readTargets(const char *pszFile, std::vector<DomePlanTarget> &Targets);
+    static int  writePlan(const char *pszFile, const std::vector<DomePlanTarget> &Targets, const std::vector<DomePlanStep> &Plan);
+
+protected:
+    double  closestAzInRange(double dFromAz, const DomePlanTarget &Target);
+    int     evaluate(const std::vector<int> &Order, std::vector<DomePlanStep> *pPlan, double &dMoveTime, double &dEndTime);
+    bool    isBetter(int nCount, double dMoveTime, double dEndTime, int nBestCount, double dBestMoveTime, double dBestEndTime);
+    void    planExact(std::vector<int> &Order);
+    void    planGreedy(std::vector<int> &Order);
+    void    improve(std::vector<int> &Order);
+
+    CDomeRotationModel  m_Model;
+    const std::vector<DomePlanTarget>   *m_pTargets;
+    double  m_dStartAz;
+    double  m_dStartTime;
+    double  m_dTotalMoveTime;
+};
+
+#endif
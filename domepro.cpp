@@ -7,15 +7,39 @@
 
 #include "domepro.h"
 
+thread_local char CDomePro::m_szLogBuffer[DP2_LOG_BUFFER_SIZE];
+
+// where the data files go, the temp directory if the home directory isn't set.
+static std::string dataDirectory()
+{
+    const char *pszDir;
+#if defined(SB_WIN_BUILD)
+    const char *pszPath = getenv("HOMEPATH");
+
+    pszDir = getenv("HOMEDRIVE");
+    if(pszDir && pszPath)
+        return std::string(pszDir) + pszPath + "\\";
+    pszDir = getenv("TEMP");
+    return std::string(pszDir ? pszDir : "C:\\Windows\\Temp") + "\\";
+#else
+    pszDir = getenv("HOME");
+    if(!pszDir)
+        pszDir = getenv("TMPDIR");
+    return std::string(pszDir ? pszDir : "/tmp") + "/";
+#endif
+}
+
 CDomePro::CDomePro()
 {
     // set some sane values
     m_bDebugLog = true;
 
     m_pSerx = NULL;
+    m_pTheSkyX = NULL;
     m_bIsConnected = false;
 
     m_nNbStepPerRev = 0;
+    m_nNbStepPerRev_save = 0;
 
     m_dHomeAz = 0;
     m_dParkAz = 0;
@@ -38,22 +62,107 @@ CDomePro::CDomePro()
     m_nRightCPR = 0;
 
     m_bShutterGotoEnabled = false;
-    
+
+    m_bPredictiveSlaving = false;
+    m_bTracking = false;
+    m_nSlaveRun = 0;
+    m_dSlitWidth = 20.0;
+    m_dSlavingLeadTime = 60.0;
+    m_dAzRotationSpeed = 3.0;
+    m_bTimingGoto = false;
+    m_dGotoStartTime = 0.0;
+    m_dGotoStartAz = 0.0;
+    m_dLatitude = 0.0;
+    m_dTrackHa = 0.0;
+    m_dTrackDec = 0.0;
+    m_dTrackTime = 0.0;
+    m_dNextMoveTime = 0.0;
+    m_dNextMoveAz = 0.0;
+
+    m_bUseGeometry = false;
+
+    m_bIoThreadRunning = false;
+    m_bWake = false;
+    m_Op.nOperation = OP_NONE;
+    m_Op.nState = OP_STATE_IDLE;
+    m_Op.nRun = 0;
+    m_Op.nTries = 0;
+    m_Op.nError = DP2_OK;
+    m_Op.dStateTime = 0.0;
+    m_Op.dDeadline = 0.0;
+
+    memset(&m_Drift, 0, sizeof(HomeDriftMonitor));
+    m_Drift.bEnabled = true;
+    m_Drift.bCorrect = false;
+    m_Drift.dThreshold = DRIFT_THRESHOLD;
+
+    memset(&m_Slip, 0, sizeof(SlipDetector));
+    m_Slip.bEnabled = false;
+    m_Slip.dThreshold = SLIP_THRESHOLD;
+
+    m_bAzRotating = false;
+    m_dAzRotationStart = 0;
+    memset(&m_Current, 0, sizeof(CurrentAnalyzer));
+    m_Current.bEnabled = false;
+    for(int i = 0; i < DRIFT_DIR_COUNT; i++)
+        m_CurrentBins[i].assign(CURRENT_BIN_COUNT, CurrentBin());
+
+    m_bTelemetryEnabled = false;
+    m_bTelemetryArchive = false;
+    m_bTelemetryChanged = false;
+    m_nTelemetryRecords = TLM_DEFAULT_CAPACITY;
+    for(int i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        m_dTelemetryPeriod[i] = (i == TLM_AZ_MOTOR || i == TLM_SHUTTER_MOTOR) ? TLM_FAST_PERIOD : TLM_SLOW_PERIOD;
+        m_dTelemetryLast[i] = 0;
+    }
+    memset(&m_TelemetryRecord, 0, sizeof(TelemetryRecord));
+    m_bDiagHistory = true;
+    m_bDiagSampling = false;
+    m_nUnsupported = 0;
+
+    memset(&m_Poll, 0, sizeof(PollScheduler));
+    m_Poll.dAzFastPeriod = POLL_AZ_FAST_PERIOD;
+    m_Poll.dAzSlowPeriod = POLL_AZ_SLOW_PERIOD;
+    m_Poll.dShutterFastPeriod = POLL_SHUTTER_FAST_PERIOD;
+    m_Poll.dShutterSlowPeriod = POLL_SHUTTER_SLOW_PERIOD;
+    m_Poll.nShutterBackoff = 1;
+    m_Poll.nAzMode = FIXED;
+    m_Poll.nShutterState = CLOSED;
+    m_bBackgroundPolls = true;
+
+    m_dLastEventPoll = 0.0;
+    m_bStatusPage = false;
+    m_sStatusPageName = STATUS_DEFAULT_NAME;
+
+    m_nShutterMove = SHUT_MOVE_NONE;
+    memset(&m_Battery, 0, sizeof(ShutterBattery));
+    m_Battery.bEnabled = true;
+    m_Battery.dCapacityWh = BATT_CAPACITY_WH;
+    m_Battery.dFullVolts = BATT_FULL_VOLTS;
+    m_Battery.dEmptyVolts = BATT_EMPTY_VOLTS;
+    m_Battery.dAlertCycles = BATT_ALERT_CYCLES;
+    m_Battery.dCyclesLeft = -1.0;
+    m_sTelemetryFile = dataDirectory() + "DomeProTelemetry.dat";
+    m_sTelemetryArchiveFile = dataDirectory() + "DomeProTelemetry.tla";
+    m_sCurrentFile = dataDirectory() + "DomeProCurrent.txt";
+    m_sBatteryFile = dataDirectory() + "DomeProBattery.txt";
+    // the rotation model measured in the previous sessions, also read by domeplan
+    m_sRotationFile = dataDirectory() + "DomeProRotation.txt";
+    if(m_RotationModel.readFile(m_sRotationFile.c_str()) == PLAN_OK)
+        m_dAzRotationSpeed = m_RotationModel.getSpeed();
+
+    m_nCprCalPasses = CPR_CAL_PASSES;
+    m_dCprCalMaxSigma = CPR_CAL_MAX_SIGMA;
+    memset(&m_CprCal, 0, sizeof(CprCalibration));
+    memset(&m_Settings, 0, sizeof(DomeSettings));
+    m_nModel = 0;
+    m_pModelPolicy = &modelPolicy(0);
+
     memset(m_szFirmwareVersion,0,SERIAL_BUFFER_SIZE);
     memset(m_szLogBuffer,0,DP2_LOG_BUFFER_SIZE);
 
 #ifdef ATCL_DEBUG
-#if defined(SB_WIN_BUILD)
-    m_sLogfilePath = getenv("HOMEDRIVE");
-    m_sLogfilePath += getenv("HOMEPATH");
-    m_sLogfilePath += "\\DomeProLog.txt";
-#elif defined(SB_LINUX_BUILD)
-    m_sLogfilePath = getenv("HOME");
-    m_sLogfilePath += "/DomeProLog.txt";
-#elif defined(SB_MAC_BUILD)
-    m_sLogfilePath = getenv("HOME");
-    m_sLogfilePath += "/DomeProLog.txt";
-#endif
+    m_sLogfilePath = dataDirectory() + "DomeProLog.txt";
     Logfile = fopen(m_sLogfilePath.c_str(), "w");
 #endif
 
@@ -70,6 +179,7 @@ CDomePro::CDomePro()
 
 CDomePro::~CDomePro()
 {
+    stopIoThread();
 #ifdef	ATCL_DEBUG
     if (Logfile)
         fclose(Logfile);
@@ -82,6 +192,8 @@ int CDomePro::Connect(const char *pszPort)
 {
     int nErr;
     int nState;
+    double dParkAz;
+    char szModel[SERIAL_BUFFER_SIZE];
 
     if(!m_pSerx)
         return ERR_COMMNOLINK;
@@ -101,6 +213,16 @@ int CDomePro::Connect(const char *pszPort)
         return nErr;
     }
     m_bIsConnected = true;
+    // new session, new history
+    m_DiagHistory.clear();
+
+    if(m_bStatusPage) {
+        nErr = m_StatusPage.create(m_sStatusPageName.c_str());
+        if (m_bDebugLog) {
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::Connect] status page %s : %d\n", m_sStatusPageName.c_str(), nErr);
+            m_pLogger->out(m_szLogBuffer);
+        }
+    }
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
     ltime = time(NULL);
@@ -143,6 +265,7 @@ int CDomePro::Connect(const char *pszPort)
 
         m_bIsConnected = false;
         m_pSerx->close();
+        m_StatusPage.close();
         return ERR_COMMNOLINK;
     }
 
@@ -160,58 +283,95 @@ int CDomePro::Connect(const char *pszPort)
 #endif
 
 
-    // get dome home az and park az
-    setDomeHomeAzimuth(0); // we need to make sure we manage the offset to the Home position
-    setDomeParkAzimuth(0);
+    // the dialogs enable their controls by model type, everything applies if we can't tell
+    m_pModelPolicy = &modelPolicy(0);
+    nErr = getModel(szModel, SERIAL_BUFFER_SIZE);
+    if(!nErr) {
+        std::lock_guard<std::mutex> lock(m_SettingsMutex);
+        snprintf(m_Settings.szModel, SERIAL_BUFFER_SIZE, "%s", szModel);
+        m_Settings.dValue[SETTING_MODEL] = m_nModel;
+        m_Settings.nValid |= SETTING_BIT(SETTING_MODEL);
+    }
+
+    // once per firmware version
+    probeCapabilities();
+
+    // a roll-off roof has no azimuth, its state and limits are all we need
+    if(getModelPolicy().bAzimuth) {
+        // get dome home az and park az
+        setDomeHomeAzimuth(0); // we need to make sure we manage the offset to the Home position
+        setDomeParkAzimuth(0);
     
-    getDomeAzCPR(m_nNbStepPerRev);
-    getDomeParkAz(m_dParkAz);
-    getDomeAzCoast(m_dAzCoast);
+        getDomeAzCPR(m_nNbStepPerRev);
+        getDomeParkAz(m_dParkAz);
+        getDomeAzCoast(m_dAzCoast);
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
-    ltime = time(NULL);
-    timestamp = asctime(localtime(&ltime));
-    timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] [CDomePro::Connect] m_nNbStepPerRev = %d\n", timestamp, m_nNbStepPerRev);
-    fprintf(Logfile, "[%s] [CDomePro::Connect] m_dHomeAz = %3.2f\n", timestamp, m_dHomeAz);
-    fprintf(Logfile, "[%s] [CDomePro::Connect] m_dParkAz = %3.2f\n", timestamp, m_dParkAz);
-    fflush(Logfile);
+        ltime = time(NULL);
+        timestamp = asctime(localtime(&ltime));
+        timestamp[strlen(timestamp) - 1] = 0;
+        fprintf(Logfile, "[%s] [CDomePro::Connect] m_nNbStepPerRev = %d\n", timestamp, m_nNbStepPerRev);
+        fprintf(Logfile, "[%s] [CDomePro::Connect] m_dHomeAz = %3.2f\n", timestamp, m_dHomeAz);
+        fprintf(Logfile, "[%s] [CDomePro::Connect] m_dParkAz = %3.2f\n", timestamp, m_dParkAz);
+        fflush(Logfile);
 #endif
 
 
-    // Check if the dome is at park
-    getDomeLimits();
-    if(m_nAtParkSate == ACTIVE) {
-        nErr = getDomeParkAz(m_dCurrentAzPosition);
-        if(!nErr)
-            syncDome(m_dCurrentAzPosition, m_dCurrentElPosition);
+        // Check if the dome is at park
+        getDomeLimits();
+        if(m_nAtParkSate == ACTIVE) {
+            nErr = getDomeParkAz(dParkAz);
+            if(!nErr)
+                syncDome(dParkAz, m_dCurrentElPosition);
+        }
     }
 
     nErr = getDomeShutterStatus(nState);
+    // the roof closed is the park position
+    if(!nErr && !getModelPolicy().bAzimuth) {
+        m_bParked = (nState == CLOSED);
+        m_dCurrentElPosition = (nState == OPEN) ? 90.0 : 0.0;
+    }
     nErr = getDomeLimits();
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
     timestamp[strlen(timestamp) - 1] = 0;
-    fprintf(Logfile, "[%s] [CDomePro::Connect] m_dCurrentAzPosition : %3.2f\n", timestamp, m_dCurrentAzPosition);
+    fprintf(Logfile, "[%s] [CDomePro::Connect] m_dCurrentAzPosition : %3.2f\n", timestamp, m_dCurrentAzPosition.load());
     fflush(Logfile);
 #endif
 
     if(nState != NOT_FITTED )
         m_bHasShutter = true;
+    m_StatusPage.setConnected(true, m_bHasShutter);
 
+    startIoThread();
     return SB_OK;
 }
 
 
 void CDomePro::Disconnect()
 {
-    if(m_bIsConnected) {
-        m_pSerx->purgeTxRx();
-        m_pSerx->close();
+    stopIoThread();
+    {
+        // let a command from another thread finish first
+        std::lock_guard<std::mutex> lock(m_IoMutex);
+        if(m_bIsConnected) {
+            m_pSerx->purgeTxRx();
+            m_pSerx->close();
+        }
+        m_bIsConnected = false;
     }
-    m_bIsConnected = false;
+    invalidatePoll();
+    {
+        // keep the last known values for the next dialog
+        std::lock_guard<std::mutex> lock(m_SettingsMutex);
+        m_Settings.nPending = 0;
+    }
+    m_Events.reset();
+    m_StatusPage.setConnected(false, m_bHasShutter);
+    m_StatusPage.close();
 }
 
 
@@ -226,15 +386,23 @@ int CDomePro::syncDome(double dAz, double dEl)
         return NOT_CONNECTED;
 
     m_dCurrentAzPosition = dAz;
+    // nothing to calibrate on a roll-off roof
+    if(!getModelPolicy().bAzimuth)
+        return nErr;
+
     AzToTicks(dAz, nPos);
     nErr = calibrateDomeAzimuth(nPos);
+    {
+        std::lock_guard<std::mutex> lock(m_EngineMutex);
+        resetDriftMonitor();
+        m_Slip.bHasBaseline = false;
+    }
     return nErr;
 }
 
 int CDomePro::gotoDomePark(void)
 {
     int nErr = DP2_OK;
-    char szResp[SERIAL_BUFFER_SIZE];
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
@@ -242,7 +410,12 @@ int CDomePro::gotoDomePark(void)
     if(m_bCalibrating)
         return nErr;
 
-    nErr = domeCommand("!DSgp;", szResp, SERIAL_BUFFER_SIZE);
+    m_bTracking = false;
+    // a roll-off roof parks closed
+    if(!getModelPolicy().bAzimuth)
+        return CloseDomeShutters();
+
+    nErr = startOperation(OP_PARKING);
 
     return nErr;
 }
@@ -250,6 +423,10 @@ int CDomePro::gotoDomePark(void)
 int CDomePro::unparkDome()
 {
     m_bParked = false;
+    // and unparks open
+    if(!getModelPolicy().bAzimuth)
+        return openDomeShutters();
+
     m_dCurrentAzPosition = m_dParkAz;
 
     syncDome(m_dCurrentAzPosition, m_dCurrentElPosition);
@@ -261,10 +438,21 @@ int CDomePro::gotoAzimuth(double dNewAz)
 
     int nErr = DP2_OK;
     int nPos;
+    double dStartAz;
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
+    // nothing rotates, isGoToComplete says done right away
+    if(!getModelPolicy().bAzimuth) {
+        std::lock_guard<std::mutex> lock(m_GotoMutex);
+        m_dGotoAz = dNewAz;
+        return nErr;
+    }
+
     AzToTicks(dNewAz, nPos);
+    // where the move really starts from, m_dCurrentAzPosition can be from long ago
+    if(pollAzPosition(dStartAz))
+        dStartAz = m_dCurrentAzPosition;
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
     ltime = time(NULL);
@@ -276,8 +464,13 @@ int CDomePro::gotoAzimuth(double dNewAz)
 #endif
 
     nErr = goToDomeAzimuth(nPos);
+    std::lock_guard<std::mutex> lock(m_GotoMutex);
     m_dGotoAz = dNewAz;
     m_nGotoTries = 0;
+    // time the move to measure the rotation speed
+    m_bTimingGoto = (nErr == DP2_OK);
+    m_dGotoStartTime = getTimeStamp();
+    m_dGotoStartAz = dStartAz;
     return nErr;
 }
 
@@ -310,6 +503,8 @@ int CDomePro::openDomeShutters()
         return SB_OK;
 
     nErr = domeCommand("!DSso;", szResp, SERIAL_BUFFER_SIZE);
+    if(!nErr)
+        armShutterBattery(SHUT_MOVE_OPEN);
     return nErr;
 }
 
@@ -325,6 +520,8 @@ int CDomePro::CloseDomeShutters()
         return SB_OK;
 
     nErr = domeCommand("!DSsc;", szResp, SERIAL_BUFFER_SIZE);
+    if(!nErr)
+        armShutterBattery(SHUT_MOVE_CLOSE);
     return nErr;
 }
 
@@ -334,9 +531,17 @@ int CDomePro::abortCurrentCommand()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
+    cancelOperation();
     m_bCalibrating = false;
+    m_bTracking = false;
+    {
+        std::lock_guard<std::mutex> lock(m_GotoMutex);
+        m_bTimingGoto = false;
+    }
 
-    nErr = killDomeAzimuthMovement();
+    nErr = DP2_OK;
+    if(getModelPolicy().bAzimuth)
+        nErr = killDomeAzimuthMovement();
     if(m_bHasShutter)
         nErr |= killDomeShutterMovement();
     return nErr;
@@ -349,11 +554,15 @@ int CDomePro::goHome()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = homeDomeAzimuth();
+    m_bTracking = false;
+    // no home on a roll-off roof, isFindHomeComplete says done right away
+    if(!getModelPolicy().bAzimuth)
+        return nErr;
+
+    nErr = startOperation(OP_HOMING);
     return nErr;
 }
 
-#pragma mark TODO : Calibrate test
 int CDomePro::learnAzimuthCprRight()
 {
     int nErr = DP2_OK;
@@ -362,10 +571,8 @@ int CDomePro::learnAzimuthCprRight()
         return NOT_CONNECTED;
 
     // get the number of CPR going right.
-    startDomeAzGaugeRight();
-
-    m_bCalibrating = true;
     m_nLearning = RIGHT;
+    nErr = startOperation(OP_LEARN_CPR_RIGHT);
     return nErr;
 }
 
@@ -376,15 +583,431 @@ int CDomePro::learnAzimuthCprLeft()
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    // get the number of CPR going right.
-    startDomeAzGaugeLeft();
-
-    m_bCalibrating = true;
+    // get the number of CPR going left.
     m_nLearning = LEFT;
+    nErr = startOperation(OP_LEARN_CPR_LEFT);
+    return nErr;
+}
+
+// alternate right and left gauging passes, then commit the mean if the spread is small enough.
+int CDomePro::calibrateAzimuthCpr()
+{
+    int nErr = DP2_OK;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(isOperationRunning())
+        return COMMAND_FAILED;
+
+    m_CprSamplesRight.clear();
+    m_CprSamplesLeft.clear();
+    memset(&m_CprCal, 0, sizeof(CprCalibration));
+    m_CprCal.nPasses = m_nCprCalPasses;
+    nErr = startOperation(OP_CALIBRATE_CPR);
+    return nErr;
+}
+
+#pragma mark - predictive slaving
+
+void CDomePro::setPredictiveSlaving(bool bEnable)
+{
+    m_bPredictiveSlaving = bEnable;
+    if(!bEnable)
+        m_bTracking = false;
+}
+
+bool CDomePro::isPredictiveSlavingEnabled()
+{
+    return m_bPredictiveSlaving;
+}
+
+void CDomePro::setSlitWidth(double dSlitWidth)
+{
+    m_dSlitWidth = dSlitWidth;
+}
+
+void CDomePro::setSlavingLeadTime(double dSeconds)
+{
+    m_dSlavingLeadTime = dSeconds;
+}
+
+void CDomePro::setAzRotationSpeed(double dDegPerSec)
+{
+    if(dDegPerSec > 0.0) {
+        std::lock_guard<std::mutex> lock(m_GotoMutex);
+        m_RotationModel.setDefaults(dDegPerSec, 0.0);
+        // the measured speed once there are enough moves
+        m_dAzRotationSpeed = m_RotationModel.getSpeed();
+    }
+}
+
+// TheSkyX asks for a new dome position, we convert it back to HA/Dec so we can follow the sidereal track
+// and only move when the beam is about to hit the slit edge.
+int CDomePro::slaveToTarget(double dAz, double dEl)
+{
+    int nErr = DP2_OK;
+    int nRun;
+    double dDomeAz;
+    double dTargetAz;
+    double dHa, dDec;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    // nothing to slave
+    if(!getModelPolicy().bAzimuth) {
+        m_bTracking = false;
+        return gotoAzimuth(dAz);
+    }
+
+    std::unique_lock<std::mutex> lock(m_EngineMutex);
+    nRun = ++m_nSlaveRun;
+
+    // nothing to track, just go there.
+    if(!m_bPredictiveSlaving || !m_pTheSkyX || dEl <= 0.0 || dEl >= 90.0) {
+        m_bTracking = false;
+        getDomeAzForPointing(dAz, dEl, dTargetAz);
+        lock.unlock();
+        return gotoAzimuth(dTargetAz);
+    }
+
+    m_dLatitude = m_pTheSkyX->latitude();
+    m_Geometry.setLatitude(m_dLatitude);
+    AltAzToHaDec(dAz, dEl, dHa, dDec);
+    m_dTrackHa = dHa;
+    m_dTrackDec = dDec;
+    m_dTrackTime = getTimeStamp();
+    m_bTracking = true;
+
+    // same as the operation engine, no serial I/O with m_EngineMutex held
+    lock.unlock();
+    nErr = getDomeAzPosition(dDomeAz);
+    if(nErr)
+        return nErr;
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::slaveToTarget] dAz = %3.2f, dEl = %3.2f, HA = %3.4f, Dec = %3.4f, RA = %3.4f\n", dAz, dEl, dHa, dDec, m_pTheSkyX->lst() - dHa);
+        m_pLogger->out(m_szLogBuffer);
+    }
+
+    if(!relockSlaving(lock, nRun))
+        return nErr;
+    updateTrackPierSide();
+
+    // still inside the slit for the lead time, no need to move now.
+    if(isBeamCovered(dDomeAz, 0, m_dSlavingLeadTime)) {
+        scheduleNextSlavingMove(dDomeAz);
+        std::lock_guard<std::mutex> gotoLock(m_GotoMutex);
+        m_dGotoAz = dDomeAz;
+        m_nGotoTries = 0;
+        return nErr;
+    }
+
+    planSlavingMove(dDomeAz, dTargetAz);
+    lock.unlock();
+    nErr = gotoAzimuth(dTargetAz);
+    if(relockSlaving(lock, nRun))
+        scheduleNextSlavingMove(dTargetAz);
+    return nErr;
+}
+
+// called periodically by the I/O thread to start the next move before the beam clips the slit.
+int CDomePro::updatePredictiveSlaving()
+{
+    int nErr = DP2_OK;
+    int nRun;
+    bool bIsMoving = false;
+    double dDomeAz;
+    double dTargetAz;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    std::unique_lock<std::mutex> lock(m_EngineMutex);
+
+    if(!m_bPredictiveSlaving || !m_bTracking || m_bCalibrating || !getModelPolicy().bAzimuth)
+        return nErr;
+
+    // don't fight homing, parking or gauging
+    if(m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED)
+        return nErr;
+
+    if(getTimeStamp() < m_dNextMoveTime)
+        return nErr;
+
+    nRun = m_nSlaveRun;
+    lock.unlock();
+    nErr = isDomeMoving(bIsMoving);
+    if(nErr || bIsMoving)
+        return nErr;
+
+    nErr = getDomeAzPosition(dDomeAz);
+    if(nErr)
+        return nErr;
+
+    if(!relockSlaving(lock, nRun))
+        return nErr;
+    updateTrackPierSide();
+    planSlavingMove(dDomeAz, dTargetAz);
+    lock.unlock();
+    nErr = gotoAzimuth(dTargetAz);
+    if(nErr)
+        return nErr;
+    if(!relockSlaving(lock, nRun))
+        return nErr;
+    scheduleNextSlavingMove(dTargetAz);
 
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::updatePredictiveSlaving] moving to %3.2f, next move in %3.0f seconds\n", dTargetAz, m_dNextMoveTime - getTimeStamp());
+        m_pLogger->out(m_szLogBuffer);
+    }
     return nErr;
 }
 
+// Returns false if a new target came in or the tracking stopped while the lock was released.
+bool CDomePro::relockSlaving(std::unique_lock<std::mutex> &lock, int nRun)
+{
+    lock.lock();
+    return m_nSlaveRun == nRun && m_bTracking;
+}
+
+int CDomePro::getNextSlavingMove(double &dSecondsToMove, double &dNextAz)
+{
+    if(!m_bPredictiveSlaving || !m_bTracking)
+        return COMMAND_FAILED;
+
+    dSecondsToMove = m_dNextMoveTime - getTimeStamp();
+    if(dSecondsToMove < 0)
+        dSecondsToMove = 0;
+    dNextAz = m_dNextMoveAz;
+    return DP2_OK;
+}
+
+void CDomePro::setDomeGeometry(bool bEnable, double dDomeRadius, double dMountEast, double dMountNorth, double dMountUp, double dGemOffset)
+{
+    m_bUseGeometry = bEnable;
+    m_Geometry.setGeometry(dDomeRadius, dMountEast, dMountNorth, dMountUp, dGemOffset);
+    if(m_pTheSkyX)
+        m_Geometry.setLatitude(m_pTheSkyX->latitude());
+    // rebuild the LUT now rather than on the first slaving request.
+    if(m_bUseGeometry)
+        m_Geometry.rebuildLUT();
+}
+
+// dAz/dEl is where the telescope is pointing, dDomeAz is where the slit needs to be.
+int CDomePro::getDomeAzForPointing(double dAz, double dEl, double &dDomeAz)
+{
+    double dHa, dDec;
+
+    dDomeAz = dAz;
+    if(!m_bUseGeometry || !m_pTheSkyX || dEl <= 0.0 || dEl > 90.0)
+        return DP2_OK;
+
+    m_dLatitude = m_pTheSkyX->latitude();
+    m_Geometry.setLatitude(m_dLatitude);
+    AltAzToHaDec(dAz, dEl, dHa, dDec);
+    dDomeAz = m_Geometry.domeAzimuth(dHa, dDec, m_Geometry.pierSideForHa(dHa));
+    if(dDomeAz < 0) { // geometry not valid
+        dDomeAz = dAz;
+        return COMMAND_FAILED;
+    }
+    return DP2_OK;
+}
+
+#pragma mark - observation plan
+
+// Order the targets and pick the dome azimuth for each to minimize the total rotation time.
+// dStartTime uses the same time base as the target windows, the plan starts from the current dome position.
+int CDomePro::planObservation(const std::vector<DomePlanTarget> &Targets, double dStartTime, std::vector<DomePlanStep> &Plan)
+{
+    int nErr;
+    double dDomeAz;
+    CDomePlanner Planner;
+
+    dDomeAz = m_dCurrentAzPosition;
+    if(m_bIsConnected)
+        getDomeAzPosition(dDomeAz);
+
+    {
+        std::lock_guard<std::mutex> lock(m_GotoMutex);
+        Planner.setRotationModel(m_RotationModel);
+    }
+    nErr = Planner.plan(Targets, dDomeAz, dStartTime, Plan);
+    if(nErr)
+        return COMMAND_FAILED;
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::planObservation] %d/%d targets scheduled, total rotation time %3.1f seconds\n", (int)Plan.size(), (int)Targets.size(), Planner.getTotalMoveTime());
+        m_pLogger->out(m_szLogBuffer);
+    }
+    return DP2_OK;
+}
+
+void CDomePro::getRotationModel(double &dSpeed, double &dAccel, int &nSamples)
+{
+    std::lock_guard<std::mutex> lock(m_GotoMutex);
+    dSpeed = m_RotationModel.getSpeed();
+    dAccel = m_RotationModel.getAccel();
+    nSamples = m_RotationModel.getSampleCount();
+}
+
+double CDomePro::getTimeStamp()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// all angles in degrees, HA in hours.
+void CDomePro::HaDecToAltAz(double dHa, double dDec, double &dAz, double &dAlt)
+{
+    double dH = dHa * 15.0 * M_PI / 180.0;
+    double dD = dDec * M_PI / 180.0;
+    double dL = m_dLatitude * M_PI / 180.0;
+
+    dAlt = asin(sin(dD) * sin(dL) + cos(dD) * cos(dL) * cos(dH)) * 180.0 / M_PI;
+    dAz = atan2(-sin(dH) * cos(dD), sin(dD) * cos(dL) - cos(dD) * sin(dL) * cos(dH)) * 180.0 / M_PI;
+    while (dAz < 0) dAz += 360;
+    while (dAz >= 360) dAz -= 360;
+}
+
+void CDomePro::AltAzToHaDec(double dAz, double dAlt, double &dHa, double &dDec)
+{
+    double dZ = dAz * M_PI / 180.0;
+    double dA = dAlt * M_PI / 180.0;
+    double dL = m_dLatitude * M_PI / 180.0;
+
+    dDec = asin(sin(dA) * sin(dL) + cos(dA) * cos(dL) * cos(dZ)) * 180.0 / M_PI;
+    dHa = atan2(-sin(dZ) * cos(dA), sin(dA) * cos(dL) - cos(dA) * sin(dL) * cos(dZ)) * 180.0 / M_PI / 15.0;
+}
+
+// half of the slit opening in azimuth degrees at a given altitude, the slit gets "wider" in azimuth toward the zenith.
+double CDomePro::slitHalfWidthAt(double dAlt)
+{
+    double dRatio;
+    double dCosAlt = cos(dAlt * M_PI / 180.0);
+
+    dRatio = sin(m_dSlitWidth / 2.0 * M_PI / 180.0);
+    if(dRatio >= dCosAlt)
+        return 180.0;
+    return asin(dRatio / dCosAlt) * 180.0 / M_PI;
+}
+
+// HA of the telescope dSeconds after the last target we got.
+double CDomePro::trackHa(double dSeconds)
+{
+    return m_dTrackHa + (getTimeStamp() - m_dTrackTime + dSeconds) * SIDEREAL_RATE / 3600.0 / 15.0;
+}
+
+// where will the telescope be dSeconds after the last target we got.
+void CDomePro::trackAzAlt(double dSeconds, double &dAz, double &dAlt)
+{
+    HaDecToAltAz(trackHa(dSeconds), m_dTrackDec, dAz, dAlt);
+}
+
+// same but where the dome needs to be for that position when we know the geometry.
+// This is a projection, the pier side hysteresis is only updated by updateTrackPierSide.
+void CDomePro::trackDomeAz(double dSeconds, double &dDomeAz, double &dAlt)
+{
+    double dHa;
+
+    if(!m_bUseGeometry || !m_Geometry.isValid()) {
+        trackAzAlt(dSeconds, dDomeAz, dAlt);
+        return;
+    }
+
+    dHa = trackHa(dSeconds);
+    HaDecToAltAz(dHa, m_dTrackDec, dDomeAz, dAlt);
+    dDomeAz = m_Geometry.domeAzimuth(dHa, m_dTrackDec, m_Geometry.pierSideForHa(dHa, m_Geometry.getPierSide()));
+}
+
+// the pier side where the telescope is now, before projecting the track from it.
+void CDomePro::updateTrackPierSide()
+{
+    if(m_bUseGeometry && m_Geometry.isValid())
+        m_Geometry.pierSideForHa(trackHa(0));
+}
+
+bool CDomePro::isBeamCovered(double dDomeAz, double dFrom, double dTo)
+{
+    double dT;
+    double dAz, dAlt;
+    double dDelta;
+
+    for(dT = dFrom; ; dT += SLAVING_STEP) {
+        if(dT > dTo)
+            dT = dTo;
+        trackDomeAz(dT, dAz, dAlt);
+        dDelta = fabs(remainder(dAz - dDomeAz, 360.0));
+        if(dDelta > slitHalfWidthAt(dAlt) - SLAVING_MARGIN)
+            return false;
+        if(dT >= dTo)
+            break;
+    }
+    return true;
+}
+
+// Find the dome azimuth that keeps the beam inside the slit for as long as possible once we get there.
+void CDomePro::planSlavingMove(double dDomeAz, double &dTargetAz)
+{
+    double dT;
+    double dArrival;
+    double dAz, dAlt;
+    double dRef;
+    double dRel;
+    double dMin, dMax;
+    double dHalfWidth;
+    double dMinHalfWidth = 180.0;
+    double dCenter;
+
+    trackDomeAz(0, dAz, dAlt);
+    dArrival = fabs(remainder(dAz - dDomeAz, 360.0)) / m_dAzRotationSpeed;
+    trackDomeAz(dArrival, dRef, dAlt);
+
+    dMin = 0;
+    dMax = 0;
+    dCenter = 0;
+    for(dT = dArrival; dT <= dArrival + SLAVING_HORIZON; dT += SLAVING_STEP) {
+        trackDomeAz(dT, dAz, dAlt);
+        if(dAlt <= 0)
+            break;
+        dRel = remainder(dAz - dRef, 360.0);
+        dHalfWidth = slitHalfWidthAt(dAlt) - SLAVING_MARGIN;
+        if(dHalfWidth < dMinHalfWidth)
+            dMinHalfWidth = dHalfWidth;
+        if(dRel < dMin)
+            dMin = dRel;
+        if(dRel > dMax)
+            dMax = dRel;
+        if((dMax - dMin) > 2 * dMinHalfWidth)
+            break;
+        dCenter = (dMin + dMax) / 2.0;
+    }
+
+    dTargetAz = dRef + dCenter;
+    while (dTargetAz < 0) dTargetAz += 360;
+    while (dTargetAz >= 360) dTargetAz -= 360;
+}
+
+// When will the beam leave the slit if the dome stays at dDomeAz, the next move has to start early
+// enough to get to the following position before that.
+void CDomePro::scheduleNextSlavingMove(double dDomeAz)
+{
+    double dT;
+    double dAz, dAlt;
+    double dTravel;
+
+    for(dT = 0; dT < SLAVING_HORIZON; dT += SLAVING_STEP) {
+        if(!isBeamCovered(dDomeAz, dT, dT))
+            break;
+    }
+
+    trackDomeAz(dT, dAz, dAlt);
+    // we'll be going about as far past the beam as it is from us now.
+    dTravel = 2 * fabs(remainder(dAz - dDomeAz, 360.0)) / m_dAzRotationSpeed;
+    m_dNextMoveAz = dAz;
+    m_dNextMoveTime = getTimeStamp() + dT - dTravel - SLAVING_STEP;
+}
+
 #pragma mark - dome controller informations
 
 int CDomePro::getFirmwareVersion(char *pszVersion, int nStrMaxLen)
@@ -424,23 +1047,8 @@ int CDomePro::getModel(char *pszModel, int nStrMaxLen)
         return nErr;
 
     m_nModel = (int)strtoul(szResp, NULL, 16);
-    switch(m_nModel) {
-        case CLASSIC_DOME :
-            strncpy(pszModel, "DomePro2-d", nStrMaxLen);
-            break;
-
-        case CLAMSHELL :
-            strncpy(pszModel, "DomePro2-c", nStrMaxLen);
-            break;
-
-        case ROR :
-            strncpy(pszModel, "DomePro2-r", nStrMaxLen);
-            break;
-
-        default:
-            strncpy(pszModel, "Unknown", nStrMaxLen);
-            break;
-    }
+    m_pModelPolicy = &modelPolicy(m_nModel);
+    strncpy(pszModel, m_pModelPolicy.load()->pszName, nStrMaxLen);
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
     ltime = time(NULL);
@@ -459,6 +1067,32 @@ int CDomePro::getModelType()
     return m_nModel;
 }
 
+// the clamshell leaves aren't sequenced, a roll-off roof neither rotates nor has a second shutter
+static const DomeModelPolicy s_ModelPolicies[] = {
+    // model        name            azimuth telemetry                                       settings
+    {CLASSIC_DOME,  "DomePro2-d",   true,   TLM_ALL_CHANNELS,                               SETTINGS_ALL},
+    {CLAMSHELL,     "DomePro2-c",   true,   TLM_ALL_CHANNELS,                               SETTINGS_ALL & ~SETTINGS_SEQUENCING},
+    {ROR,           "DomePro2-r",   false,  TLM_ALL_CHANNELS & ~(1 << TLM_AZ_MOTOR),        SETTINGS_ALL & ~(SETTINGS_AZIMUTH | SETTINGS_SHUTTER2)},
+    // unknown model, don't skip anything
+    {0,             "Unknown",      true,   TLM_ALL_CHANNELS,                               SETTINGS_ALL},
+};
+
+const DomeModelPolicy &CDomePro::modelPolicy(int nModel)
+{
+    size_t i;
+
+    for(i = 0; i < sizeof(s_ModelPolicies) / sizeof(DomeModelPolicy) - 1; i++) {
+        if(s_ModelPolicies[i].nModel == nModel)
+            return s_ModelPolicies[i];
+    }
+    return s_ModelPolicies[i];
+}
+
+const DomeModelPolicy &CDomePro::getModelPolicy()
+{
+    return *m_pModelPolicy;
+}
+
 int CDomePro::getModuleType(int &nModuleType)
 {
     int nErr;
@@ -615,13 +1249,23 @@ bool CDomePro::hasShutterUnit() {
 int CDomePro::isGoToComplete(bool &bComplete)
 {
     int nErr = 0;
+    int nMode;
     double dDomeAz = 0;
+    double dGotoAz;
     bool bIsMoving = false;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = isDomeMoving(bIsMoving);
+    // nothing rotates
+    if(!getModelPolicy().bAzimuth) {
+        bComplete = true;
+        return nErr;
+    }
+
+    nErr = pollAzMoveMode(nMode);
+    if(!nErr)
+        bIsMoving = (nMode != FIXED && nMode != AZ_TO);
     if(nErr) {
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
         ltime = time(NULL);
@@ -632,7 +1276,7 @@ int CDomePro::isGoToComplete(bool &bComplete)
         return nErr;
         }
 
-    getDomeAzPosition(dDomeAz);
+    pollAzPosition(dDomeAz);
 
     if(bIsMoving) {
         bComplete = false;
@@ -650,7 +1294,9 @@ int CDomePro::isGoToComplete(bool &bComplete)
     fflush(Logfile);
 #endif
 
-    if ((floor(m_dGotoAz) <= floor(dDomeAz)+m_dAzCoast) && (floor(m_dGotoAz) >= floor(dDomeAz)-m_dAzCoast)) {
+    std::unique_lock<std::mutex> lock(m_GotoMutex);
+    dGotoAz = m_dGotoAz;
+    if ((floor(dGotoAz) <= floor(dDomeAz)+m_dAzCoast) && (floor(dGotoAz) >= floor(dDomeAz)-m_dAzCoast)) {
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
         ltime = time(NULL);
         timestamp = asctime(localtime(&ltime));
@@ -659,17 +1305,25 @@ int CDomePro::isGoToComplete(bool &bComplete)
 #endif
         bComplete = true;
         m_nGotoTries = 0;
+        if(m_bTimingGoto) {
+            m_bTimingGoto = false;
+            m_RotationModel.addSample(fabs(remainder(dDomeAz - m_dGotoStartAz, 360.0)), getTimeStamp() - m_dGotoStartTime);
+            if(m_RotationModel.getSampleCount() >= PLAN_MIN_SAMPLES)
+                m_dAzRotationSpeed = m_RotationModel.getSpeed();
+        }
     }
     else {
         // we're not moving and we're not at the final destination !!!
         if (m_bDebugLog) {
-            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::isGoToComplete] domeAz = %f, mGotoAz = %f\n", ceil(dDomeAz), ceil(m_dGotoAz));
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::isGoToComplete] domeAz = %f, mGotoAz = %f\n", ceil(dDomeAz), ceil(dGotoAz));
             m_pLogger->out(m_szLogBuffer);
         }
         if(m_nGotoTries == 0) {
             bComplete = false;
             m_nGotoTries = 1;
-            gotoAzimuth(m_dGotoAz);
+            // not across the command
+            lock.unlock();
+            gotoAzimuth(dGotoAz);
         }
         else {
             m_nGotoTries = 0;
@@ -716,7 +1370,7 @@ int CDomePro::isOpenComplete(bool &bComplete)
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = getDomeShutterStatus(nState);
+    nErr = pollShutterStatus(nState);
     if(nErr)
         return ERR_CMDFAILED;
     if(nState == OPEN){
@@ -741,7 +1395,7 @@ int CDomePro::isCloseComplete(bool &bComplete)
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    err = getDomeShutterStatus(nState);
+    err = pollShutterStatus(nState);
     if(err)
         return ERR_CMDFAILED;
     if(nState == CLOSED){
@@ -749,201 +1403,2352 @@ int CDomePro::isCloseComplete(bool &bComplete)
         bComplete = true;
         m_dCurrentElPosition = 0.0;
     }
-    else {
-        m_bShutterOpened = true;
-        bComplete = false;
-        m_dCurrentElPosition = 90.0;
+    else {
+        m_bShutterOpened = true;
+        bComplete = false;
+        m_dCurrentElPosition = 90.0;
+    }
+
+    return err;
+}
+
+
+int CDomePro::isParkComplete(bool &bComplete)
+{
+    int nErr;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    // the roof status only
+    if(!getModelPolicy().bAzimuth) {
+        nErr = isCloseComplete(bComplete);
+        if(!nErr && bComplete)
+            m_bParked = true;
+        return nErr;
+    }
+
+    return isOperationComplete(OP_PARKING, bComplete);
+}
+
+int CDomePro::isUnparkComplete(bool &bComplete)
+{
+    int nErr = 0;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    m_bParked = false;
+    if(!getModelPolicy().bAzimuth)
+        return isOpenComplete(bComplete);
+
+    bComplete = true;
+
+    return nErr;
+}
+
+int CDomePro::isFindHomeComplete(bool &bComplete)
+{
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    if(!getModelPolicy().bAzimuth) {
+        bComplete = true;
+        return DP2_OK;
+    }
+
+    return isOperationComplete(OP_HOMING, bComplete);
+}
+
+
+int CDomePro::isLearningCPRComplete(bool &bComplete)
+{
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    return isOperationComplete(m_nLearning == RIGHT ? OP_LEARN_CPR_RIGHT : OP_LEARN_CPR_LEFT, bComplete);
+}
+
+int CDomePro::isCalibratingCPRComplete(bool &bComplete)
+{
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    return isOperationComplete(OP_CALIBRATE_CPR, bComplete);
+}
+
+int CDomePro::isPassingHomeComplete(bool &bComplete)
+{
+    int nErr = DP2_OK;
+    bComplete = false;
+    nErr = getDomeLimits();
+    if(nErr) {
+        return nErr;
+    }
+    if(m_nAtHomeSwitchState != ACTIVE)
+        bComplete = true;
+
+    return nErr;
+}
+
+
+#pragma mark - I/O thread and operation engine
+
+void CDomePro::startIoThread()
+{
+    if(m_bIoThreadRunning)
+        return;
+    m_bIoThreadRunning = true;
+    m_IoThread = std::thread(&CDomePro::ioThread, this);
+}
+
+void CDomePro::stopIoThread()
+{
+    if(!m_bIoThreadRunning)
+        return;
+    m_bIoThreadRunning = false;
+    wakeIoThread();
+    if(m_IoThread.joinable())
+        m_IoThread.join();
+}
+
+void CDomePro::wakeIoThread()
+{
+    std::lock_guard<std::mutex> lock(m_WakeMutex);
+    m_bWake = true;
+    m_WakeCond.notify_one();
+}
+
+// Runs the operation engine as fast as the hardware allows while an operation is in progress
+// and keeps the predictive slaving going, so none of this depends on TheSkyX or the dialog timer.
+void CDomePro::ioThread()
+{
+    bool bBusy;
+    bool bRotating;
+    int nPeriod;
+
+    {
+        std::lock_guard<std::mutex> lock(m_EngineMutex);
+        resetDriftMonitor();
+        m_bTelemetryChanged = true;
+        // keep the current baseline across sessions
+        if(m_Current.bEnabled)
+            readCurrentBaseline(m_sCurrentFile.c_str());
+        if(m_Battery.bEnabled)
+            readShutterBatteryHistory(m_sBatteryFile.c_str());
+    }
+    while(m_bIoThreadRunning) {
+        bBusy = runOperationStep();
+        bRotating = pollAzRotation();
+        updateDriftMonitor(bRotating);
+        updateSlipDetector(bRotating);
+        updateCurrentAnalyzer(bRotating);
+        updatePredictiveSlaving();
+        updateTelemetry();
+        if(updateSettings())
+            bBusy = true;
+        if(updateShutterBattery())
+            bBusy = true;
+        updatePollRates();
+        updateLastState();
+        updateEvents(bRotating);
+
+        nPeriod = bRotating ? DRIFT_POLL_MS : (bBusy ? OP_FAST_POLL_MS : OP_SLOW_POLL_MS);
+        std::unique_lock<std::mutex> lock(m_WakeMutex);
+        m_WakeCond.wait_for(lock, std::chrono::milliseconds(nPeriod), [this]{ return m_bWake || !m_bIoThreadRunning; });
+        m_bWake = false;
+    }
+    m_TelemetryRing.close();
+    m_TelemetryArchive.close();
+    if(m_Current.bEnabled && m_Current.nSamples)
+        writeCurrentReport(m_sCurrentFile.c_str());
+    {
+        std::lock_guard<std::mutex> lock(m_GotoMutex);
+        if(m_RotationModel.getSampleCount())
+            m_RotationModel.writeFile(m_sRotationFile.c_str());
+    }
+}
+
+int CDomePro::startOperation(int nOperation)
+{
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    // they all move the dome in azimuth
+    if(!getModelPolicy().bAzimuth)
+        return NOT_SUPPORTED;
+
+    {
+        std::lock_guard<std::mutex> lock(m_EngineMutex);
+        if(m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED) {
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::startOperation] operation %d still running, can't start %d\n", m_Op.nOperation, nOperation);
+                m_pLogger->out(m_szLogBuffer);
+            }
+            return COMMAND_FAILED;
+        }
+        m_Op.nOperation = nOperation;
+        m_Op.nRun++;
+        m_Op.nTries = 0;
+        m_Op.nError = DP2_OK;
+        setOperationState(OP_STATE_START, 0);
+    }
+    wakeIoThread();
+    return DP2_OK;
+}
+
+void CDomePro::cancelOperation()
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    if(m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED) {
+        m_Op.nRun++;
+        failOperation(ERR_CMDFAILED);
+    }
+}
+
+int CDomePro::getOperationStatus(int &nOperation, int &nState)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    nOperation = m_Op.nOperation;
+    nState = m_Op.nState;
+    return m_Op.nError;
+}
+
+bool CDomePro::isOperationRunning()
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    return (m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED);
+}
+
+int CDomePro::isOperationComplete(int nOperation, bool &bComplete)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+
+    bComplete = false;
+    // something else was started since
+    if(m_Op.nOperation != nOperation)
+        return ERR_CMDFAILED;
+
+    if(m_Op.nState == OP_STATE_FAILED)
+        return m_Op.nError;
+
+    bComplete = (m_Op.nState == OP_STATE_DONE);
+    return DP2_OK;
+}
+
+// must be called with m_EngineMutex held
+void CDomePro::setOperationState(int nState, double dTimeout)
+{
+    m_Op.nState = nState;
+    m_Op.dStateTime = getTimeStamp();
+    m_Op.dDeadline = m_Op.dStateTime + dTimeout;
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::setOperationState] operation %d, state %d, try %d\n", m_Op.nOperation, nState, m_Op.nTries);
+        m_pLogger->out(m_szLogBuffer);
+    }
+}
+
+void CDomePro::retryOperation(int nErr)
+{
+    m_Op.nTries++;
+    if(m_Op.nTries >= OP_MAX_TRIES) {
+        failOperation(nErr);
+        return;
+    }
+    setOperationState(OP_STATE_START, 0);
+}
+
+void CDomePro::failOperation(int nErr)
+{
+    m_Op.nError = nErr ? nErr : ERR_CMDFAILED;
+    m_bCalibrating = false;
+    setOperationState(OP_STATE_FAILED, 0);
+}
+
+bool CDomePro::isStateTimedOut()
+{
+    return getTimeStamp() > m_Op.dDeadline;
+}
+
+// the controller takes a moment to report the new move mode after a command.
+bool CDomePro::isStateSettled()
+{
+    return (getTimeStamp() - m_Op.dStateTime) > OP_SETTLE_TIME;
+}
+
+// Returns true while an operation is in progress.
+// Errors while polling are tolerated until the state times out (the link can hiccup), errors on
+// the commands themselves go through the retry policy.
+bool CDomePro::runOperationStep()
+{
+    std::unique_lock<std::mutex> lock(m_EngineMutex);
+
+    if(!m_bIsConnected)
+        return false;
+
+    switch(m_Op.nState) {
+        case OP_STATE_IDLE:
+        case OP_STATE_DONE:
+        case OP_STATE_FAILED:
+            return false;
+        default:
+            break;
+    }
+
+    switch(m_Op.nOperation) {
+        case OP_HOMING:
+            stepHoming(lock);
+            break;
+        case OP_PARKING:
+            stepParking(lock);
+            break;
+        case OP_LEARN_CPR_RIGHT:
+        case OP_LEARN_CPR_LEFT:
+        case OP_CALIBRATE_CPR:
+            stepLearnCpr(lock);
+            break;
+        default:
+            failOperation(INVALID_COMMAND);
+            break;
+    }
+
+    return (m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED);
+}
+
+// The steps release m_EngineMutex around the serial I/O so the X2 calls don't wait on the link.
+// Returns false if the operation was cancelled or restarted meanwhile, the step stops there.
+bool CDomePro::relockOperation(std::unique_lock<std::mutex> &lock, int nRun)
+{
+    lock.lock();
+    return m_Op.nRun == nRun;
+}
+
+void CDomePro::stepHoming(std::unique_lock<std::mutex> &lock)
+{
+    int nErr;
+    int nMoveErr;
+    int nRun = m_Op.nRun;
+    bool bIsMoving = false;
+    bool bIsAtHome = false;
+    double dAz;
+
+    switch(m_Op.nState) {
+        case OP_STATE_START:
+            m_bHomed = false;
+            lock.unlock();
+            nErr = homeDomeAzimuth();
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr) {
+                retryOperation(nErr);
+                break;
+            }
+            setOperationState(OP_STATE_WAIT, OP_HOMING_TIMEOUT);
+            break;
+
+        case OP_STATE_WAIT:
+            if(!isStateSettled())
+                break;
+            lock.unlock();
+            nMoveErr = isDomeMoving(bIsMoving);
+            nErr = DP2_OK;
+            if(!nMoveErr && !bIsMoving)
+                nErr = isDomeAtHome(bIsAtHome);
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nMoveErr || bIsMoving) {
+                if(isStateTimedOut()) {
+                    lock.unlock();
+                    killDomeAzimuthMovement();
+                    if(relockOperation(lock, nRun))
+                        retryOperation(ERR_CMDFAILED);
+                }
+                break;
+            }
+            if(nErr)
+                break;
+
+            if(bIsAtHome) {
+                m_bHomed = true;
+                // fresh encoder reference, learn the switch edges again
+                resetDriftMonitor();
+                setOperationState(OP_STATE_DONE, 0);
+                break;
+            }
+            // did we just pass home
+            dAz = m_dCurrentAzPosition;
+            if ((ceil(dAz) <= ceil(m_dHomeAz)+m_dAzCoast) && (ceil(dAz) >= ceil(m_dHomeAz)-m_dAzCoast)) {
+                // back out a bit
+                lock.unlock();
+                nErr = gotoAzimuth(m_dHomeAz);
+                if(!relockOperation(lock, nRun))
+                    break;
+                if(nErr) {
+                    retryOperation(nErr);
+                    break;
+                }
+                setOperationState(OP_STATE_BACK_OUT, OP_HOMING_TIMEOUT);
+                break;
+            }
+            // we're not moving and we're not at the home position !!!
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::stepHoming] Not moving and not at home !!!\n");
+                m_pLogger->out(m_szLogBuffer);
+            }
+            retryOperation(ERR_CMDFAILED);
+            if(m_Op.nState == OP_STATE_FAILED)
+                m_bParked = false;
+            break;
+
+        case OP_STATE_BACK_OUT:
+            if(!isStateSettled())
+                break;
+            lock.unlock();
+            nErr = isDomeMoving(bIsMoving);
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr || bIsMoving) {
+                if(isStateTimedOut()) {
+                    lock.unlock();
+                    killDomeAzimuthMovement();
+                    if(relockOperation(lock, nRun))
+                        failOperation(ERR_CMDFAILED);
+                }
+                break;
+            }
+            setOperationState(OP_STATE_DONE, 0);
+            break;
+
+        default:
+            failOperation(INVALID_COMMAND);
+            break;
+    }
+}
+
+void CDomePro::stepParking(std::unique_lock<std::mutex> &lock)
+{
+    int nErr;
+    int nRun = m_Op.nRun;
+    int nMode = NONE;
+    double dDomeAz = 0;
+    bool bIsMoving = false;
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    switch(m_Op.nState) {
+        case OP_STATE_START:
+            m_bParked = false;
+            lock.unlock();
+            nErr = domeCommand("!DSgp;", szResp, SERIAL_BUFFER_SIZE);
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr) {
+                retryOperation(nErr);
+                break;
+            }
+            setOperationState(OP_STATE_WAIT, OP_PARKING_TIMEOUT);
+            break;
+
+        case OP_STATE_WAIT:
+            if(!isStateSettled())
+                break;
+            lock.unlock();
+            nErr = getDomeAzMoveMode(nMode);
+            if(!nErr && nMode != PARKING)
+                nErr = isDomeMoving(bIsMoving);
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr || nMode == PARKING || bIsMoving) {
+                if(isStateTimedOut()) {
+                    lock.unlock();
+                    killDomeAzimuthMovement();
+                    if(relockOperation(lock, nRun))
+                        retryOperation(ERR_CMDFAILED);
+                }
+                break;
+            }
+
+            lock.unlock();
+            nErr = getDomeAzPosition(dDomeAz);
+            if(!relockOperation(lock, nRun) || nErr)
+                break;
+            if ((floor(m_dParkAz) <= floor(dDomeAz)+1) && (floor(m_dParkAz) >= floor(dDomeAz)-1)) {
+                m_bParked = true;
+                setOperationState(OP_STATE_DONE, 0);
+                break;
+            }
+            // we're not moving and we're not at the final destination !!!
+            retryOperation(ERR_CMDFAILED);
+            if(m_Op.nState == OP_STATE_FAILED)
+                m_bHomed = false;
+            break;
+
+        default:
+            failOperation(INVALID_COMMAND);
+            break;
+    }
+}
+
+void CDomePro::stepLearnCpr(std::unique_lock<std::mutex> &lock)
+{
+    int nErr;
+    int nRun = m_Op.nRun;
+    int nMode = NONE;
+    int nSteps = 0;
+    bool bIsAtHome = false;
+    bool bCalibrating = (m_Op.nOperation == OP_CALIBRATE_CPR);
+    // calibration passes alternate, starting right
+    bool bRight = (m_Op.nOperation == OP_LEARN_CPR_RIGHT) || (bCalibrating && (m_CprCal.nDone % 2) == 0);
+
+    switch(m_Op.nState) {
+        case OP_STATE_START:
+            // the gauge readings overwrite the CPR, keep the one we started with
+            if(!bCalibrating || m_CprCal.nDone == 0)
+                m_nNbStepPerRev_save = m_nNbStepPerRev;
+            lock.unlock();
+            nErr = isDomeAtHome(bIsAtHome);
+            if(!nErr && bIsAtHome) {
+                // get off the home switch first, going the other way
+                nErr = bRight ? setDomeLeftOn() : setDomeRightOn();
+            }
+            else if(!nErr)
+                nErr = bRight ? startDomeAzGaugeRight() : startDomeAzGaugeLeft();
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr) {
+                retryOperation(nErr);
+                break;
+            }
+            if(bIsAtHome) {
+                setOperationState(OP_STATE_CLEAR_HOME, OP_CLEARING_TIMEOUT);
+                break;
+            }
+            m_bCalibrating = true;
+            setOperationState(OP_STATE_WAIT, OP_GAUGING_TIMEOUT);
+            break;
+
+        case OP_STATE_CLEAR_HOME:
+            lock.unlock();
+            nErr = isDomeAtHome(bIsAtHome);
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr || bIsAtHome) {
+                if(isStateTimedOut()) {
+                    lock.unlock();
+                    killDomeAzimuthMovement();
+                    if(relockOperation(lock, nRun))
+                        failOperation(ERR_CMDFAILED);
+                }
+                break;
+            }
+            lock.unlock();
+            killDomeAzimuthMovement();
+            nErr = bRight ? startDomeAzGaugeRight() : startDomeAzGaugeLeft();
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr) {
+                retryOperation(nErr);
+                break;
+            }
+            m_bCalibrating = true;
+            setOperationState(OP_STATE_WAIT, OP_GAUGING_TIMEOUT);
+            break;
+
+        case OP_STATE_WAIT:
+            if(!isStateSettled())
+                break;
+            lock.unlock();
+            nErr = getDomeAzMoveMode(nMode);
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr || nMode == GAUGING) {
+                if(isStateTimedOut()) {
+                    lock.unlock();
+                    killDomeAzimuthMovement();
+                    if(!relockOperation(lock, nRun))
+                        break;
+                    // restore previous value as there was an error
+                    m_nNbStepPerRev = m_nNbStepPerRev_save;
+                    failOperation(ERR_CMDFAILED);
+                }
+                break;
+            }
+            // Gauging is done. let's read the value
+            lock.unlock();
+            nErr = bRight ? getDomeAzGaugeRight(nSteps) : getDomeAzGaugeLeft(nSteps);
+            if(nErr)
+                killDomeAzimuthMovement();
+            if(!relockOperation(lock, nRun))
+                break;
+            if(nErr) {
+                // a bad calibration pass is run again
+                if(bCalibrating)
+                    retryOperation(nErr);
+                else
+                    failOperation(nErr);
+                break;
+            }
+            if(bRight)
+                m_nRightCPR = nSteps;
+            else
+                m_nLeftCPR = nSteps;
+            m_bCalibrating = false;
+            if(bCalibrating) {
+                addGaugePass(bRight, nSteps);
+                break;
+            }
+            setOperationState(OP_STATE_DONE, 0);
+            break;
+
+        default:
+            failOperation(INVALID_COMMAND);
+            break;
+    }
+}
+
+
+#pragma mark - home switch drift monitor
+
+void CDomePro::setDriftCorrection(bool bEnable, bool bCorrect, double dThreshold)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_Drift.bEnabled = bEnable;
+    m_Drift.bCorrect = bCorrect;
+    if(dThreshold > 0.0)
+        m_Drift.dThreshold = dThreshold;
+}
+
+void CDomePro::getDriftStatus(double &dDrift, int &nEdges, int &nCorrections)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    dDrift = (m_Drift.bHasDrift && m_nNbStepPerRev) ? m_Drift.dDrift * 360.0 / m_nNbStepPerRev : 0.0;
+    nEdges = m_Drift.nEdges;
+    nCorrections = m_Drift.nCorrections;
+}
+
+// must be called with m_EngineMutex held.
+// The switch edge positions are learned again on the next crossings.
+void CDomePro::resetDriftMonitor()
+{
+    int nDir;
+
+    m_Drift.bHasSample = false;
+    m_Drift.bHasDrift = false;
+    m_Drift.dDrift = 0.0;
+    for(nDir = 0; nDir < DRIFT_DIR_COUNT; nDir++)
+        m_Drift.bHasBaseline[nDir] = false;
+    if(m_bIsConnected && getDomeHomeAzimuth(m_Drift.nHomeTicks))
+        m_Drift.nHomeTicks = 0;
+}
+
+// Called by the I/O thread, returns true if the dome is rotating so we poll fast enough to catch the edges.
+// One move mode read per pass shared by the monitors below, from the poll cache and only when one of them
+// (or an event subscriber) needs it.
+bool CDomePro::pollAzRotation()
+{
+    int nErr;
+    int nMode;
+    bool bRotating;
+
+    std::unique_lock<std::mutex> lock(m_EngineMutex);
+
+    // the operations poll the dome themselves
+    if(!m_bIsConnected || !m_bBackgroundPolls || m_bCalibrating || !m_nNbStepPerRev || !getModelPolicy().bAzimuth ||
+       (!m_Drift.bEnabled && !m_Slip.bEnabled && !m_Current.bEnabled && !m_Events.hasSubscribers()) ||
+       (m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED)) {
+        m_bAzRotating = false;
+        return false;
+    }
+
+    lock.unlock();
+    nErr = pollAzMoveMode(nMode);
+    lock.lock();
+    if(nErr)
+        return m_bAzRotating;
+    bRotating = (nMode != FIXED && nMode != AZ_TO);
+    if(bRotating && !m_bAzRotating)
+        m_dAzRotationStart = getTimeStamp();
+    m_bAzRotating = bRotating;
+    return bRotating;
+}
+
+// Called by the I/O thread.
+// Each rising edge of the home switch is located between the last two position samples and compared to
+// where it was seen after the last homing (or sync) in the same direction.
+void CDomePro::updateDriftMonitor(bool bRotating)
+{
+    int nErr;
+    int nTicks;
+    int nDir;
+    double dDelta;
+    double dEdge;
+    double dError;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+
+    if(!m_bIsConnected || !m_Drift.bEnabled || m_bCalibrating || !m_nNbStepPerRev || !getModelPolicy().bAzimuth)
+        return;
+
+    // homing and gauging use the switch themselves
+    if(m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED) {
+        m_Drift.bHasSample = false;
+        return;
+    }
+
+    if(!bRotating) {
+        m_Drift.bHasSample = false;
+        if(m_Drift.bCorrect && m_Drift.bHasDrift && fabs(m_Drift.dDrift) * 360.0 / m_nNbStepPerRev > m_Drift.dThreshold)
+            correctDrift();
+        return;
+    }
+
+    nErr = getDomeLimits();
+    if(!nErr)
+        nErr = getDomeAzTicks(nTicks);
+    if(nErr) {
+        m_Drift.bHasSample = false;
+        return;
+    }
+
+    if(m_Drift.bHasSample && m_Drift.nLastSwitchState == INNACTIVE && m_nAtHomeSwitchState == ACTIVE) {
+        dDelta = remainder(nTicks - m_Drift.nLastTicks, m_nNbStepPerRev);
+        // only use edges we bracketed closely enough, an edge known to +/- the threshold can't trigger a resync
+        if(fabs(dDelta) * 360.0 / m_nNbStepPerRev <= std::min(DRIFT_MAX_BRACKET, m_Drift.dThreshold / 2.0) && dDelta != 0) {
+            nDir = dDelta > 0 ? DRIFT_RIGHT : DRIFT_LEFT;
+            dEdge = remainder(m_Drift.nLastTicks + dDelta / 2.0 - m_Drift.nHomeTicks, m_nNbStepPerRev);
+            m_Drift.nEdges++;
+            m_Drift.dLastEdgeTime = getTimeStamp();
+            if(!m_Drift.bHasBaseline[nDir]) {
+                m_Drift.dBaseline[nDir] = dEdge;
+                m_Drift.bHasBaseline[nDir] = true;
+            }
+            else {
+                dError = remainder(dEdge - m_Drift.dBaseline[nDir], m_nNbStepPerRev);
+                // the average starts from no drift, a single edge doesn't go in raw
+                m_Drift.dDrift += DRIFT_EWMA_ALPHA * (dError - m_Drift.dDrift);
+                m_Drift.bHasDrift = true;
+            }
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::updateDriftMonitor] home edge going %s at %3.1f ticks, drift = %3.1f ticks\n", nDir == DRIFT_RIGHT ? "right" : "left", dEdge, m_Drift.dDrift);
+                m_pLogger->out(m_szLogBuffer);
+            }
+        }
+    }
+    m_Drift.nLastSwitchState = m_nAtHomeSwitchState;
+    m_Drift.nLastTicks = nTicks;
+    m_Drift.bHasSample = true;
+}
+
+// The dome is stopped, shift the encoder by the measured drift.
+void CDomePro::correctDrift()
+{
+    int nErr;
+    int nTicks;
+    int nDrift;
+    int nPos;
+
+    nErr = getDomeAzTicks(nTicks);
+    if(nErr)
+        return;
+
+    nDrift = (int)floor(0.5 + m_Drift.dDrift);
+    nPos = ((nTicks - nDrift) % m_nNbStepPerRev + m_nNbStepPerRev) % m_nNbStepPerRev;
+    nErr = calibrateDomeAzimuth(nPos);
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::correctDrift] drift of %d ticks, resync from %d to %d : %d\n", nDrift, nTicks, nPos, nErr);
+        m_pLogger->out(m_szLogBuffer);
+    }
+    if(nErr)
+        return;
+
+    m_Drift.nCorrections++;
+    m_Drift.dDrift = 0.0;
+    m_Drift.bHasDrift = false;
+    // we moved the position counter on purpose
+    m_Slip.bHasBaseline = false;
+}
+
+#pragma mark - encoder slip detector
+
+void CDomePro::setSlipDetection(bool bEnable, double dThreshold)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_Slip.bEnabled = bEnable;
+    if(dThreshold > 0.0)
+        m_Slip.dThreshold = dThreshold;
+    m_Slip.bHasBaseline = false;
+}
+
+void CDomePro::getSlipEvents(std::vector<SlipEvent> &Events)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    Events = m_SlipEvents;
+}
+
+// number of slips and sum of their magnitude (degrees) per SLIP_BIN_SIZE degrees of azimuth
+void CDomePro::getSlipHistogram(std::vector<int> &Counts, std::vector<double> &Magnitudes)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    Counts.assign(m_Slip.nBinCount, m_Slip.nBinCount + SLIP_BIN_COUNT);
+    Magnitudes.assign(m_Slip.dBinMagnitude, m_Slip.dBinMagnitude + SLIP_BIN_COUNT);
+}
+
+void CDomePro::clearSlipHistory()
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_SlipEvents.clear();
+    m_Slip.nEvents = 0;
+    memset(m_Slip.nBinCount, 0, sizeof(m_Slip.nBinCount));
+    memset(m_Slip.dBinMagnitude, 0, sizeof(m_Slip.dBinMagnitude));
+}
+
+// Called by the I/O thread.
+// The diag counter counts the same encoder as the position but is never recalibrated, so the difference between
+// the two (modulo CPR) only changes if the position counter slipped. The position is read before and after the
+// diag counter and averaged so the reading stays consistent while the dome rotates.
+void CDomePro::updateSlipDetector(bool bRotating)
+{
+    int nErr;
+    int nTicks1, nTicks2;
+    int nDiag;
+    double dNow;
+    double dTicks;
+    double dOffset;
+    double dStep;
+    double dAz;
+    int nBin;
+    SlipEvent Event;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+
+    if(!m_bIsConnected || !m_Slip.bEnabled || m_bCalibrating || !m_nNbStepPerRev || !getModelPolicy().bAzimuth)
+        return;
+
+    // homing and gauging recalibrate the position counter
+    if(m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED) {
+        m_Slip.bHasBaseline = false;
+        return;
+    }
+
+    dNow = getTimeStamp();
+    if(!bRotating && m_Slip.bHasBaseline && (dNow - m_Slip.dLastCheck) < SLIP_IDLE_PERIOD)
+        return;
+    m_Slip.dLastCheck = dNow;
+
+    nErr = getDomeAzTicks(nTicks1);
+    if(!nErr)
+        nErr = getDomeAzDiagPosition(nDiag);
+    if(!nErr)
+        nErr = getDomeAzTicks(nTicks2);
+    if(nErr)
+        return;
+
+    dTicks = nTicks1 + remainder(nTicks2 - nTicks1, m_nNbStepPerRev) / 2.0;
+    dAz = m_dHomeAz + dTicks * 360.0 / m_nNbStepPerRev;
+    dAz = fmod(fmod(dAz, 360.0) + 360.0, 360.0);
+
+    if(!m_Slip.bHasBaseline) {
+        m_Slip.dBaseline = remainder(dTicks - nDiag, m_nNbStepPerRev);
+        m_Slip.dLastOffset = 0.0;
+        m_Slip.dLastAz = dAz;
+        m_Slip.bHasBaseline = true;
+        return;
+    }
+
+    dOffset = remainder(dTicks - nDiag - m_Slip.dBaseline, m_nNbStepPerRev);
+    dStep = remainder(dOffset - m_Slip.dLastOffset, m_nNbStepPerRev) * 360.0 / m_nNbStepPerRev;
+    if(fabs(dStep) >= m_Slip.dThreshold) {
+        // it happened somewhere between the last check and now
+        Event.dTime = dNow;
+        Event.dAz = fmod(m_Slip.dLastAz + remainder(dAz - m_Slip.dLastAz, 360.0) / 2.0 + 360.0, 360.0);
+        Event.dMagnitude = dStep;
+        m_SlipEvents.push_back(Event);
+        if(m_SlipEvents.size() > SLIP_MAX_EVENTS)
+            m_SlipEvents.erase(m_SlipEvents.begin());
+
+        nBin = ((int)(Event.dAz / SLIP_BIN_SIZE)) % SLIP_BIN_COUNT;
+        m_Slip.nBinCount[nBin]++;
+        m_Slip.dBinMagnitude[nBin] += fabs(dStep);
+        m_Slip.nEvents++;
+
+        if (m_bDebugLog) {
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::updateSlipDetector] Encoder slip of %3.2f deg around Az %3.1f (total %3.2f deg)\n", dStep, Event.dAz, dOffset * 360.0 / m_nNbStepPerRev);
+            m_pLogger->out(m_szLogBuffer);
+        }
+    }
+    // a slip is a jump between two checks, slow creep between the counters is followed
+    m_Slip.dLastOffset = dOffset;
+    m_Slip.dLastAz = dAz;
+}
+
+#pragma mark - motor current signature analysis
+
+void CDomePro::setCurrentAnalysis(bool bEnable, const char *pszFile)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_Current.bEnabled = bEnable;
+    if(pszFile && pszFile[0])
+        m_sCurrentFile = pszFile;
+}
+
+void CDomePro::getCurrentBins(int nDir, std::vector<CurrentBin> &Bins)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    if(nDir < 0 || nDir >= DRIFT_DIR_COUNT) {
+        Bins.clear();
+        return;
+    }
+    Bins = m_CurrentBins[nDir];
+}
+
+void CDomePro::getCurrentStatus(int &nSamples, int &nFlagged)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    nSamples = m_Current.nSamples;
+    nFlagged = m_Current.nFlagged;
+}
+
+void CDomePro::clearCurrentAnalysis()
+{
+    int i;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    for(i = 0; i < DRIFT_DIR_COUNT; i++)
+        m_CurrentBins[i].assign(CURRENT_BIN_COUNT, CurrentBin());
+    m_Current.nSamples = 0;
+    m_Current.nFlagged = 0;
+}
+
+const char *CDomePro::getCurrentReportFile()
+{
+    return m_sCurrentFile.c_str();
+}
+
+// Called by the I/O thread.
+// Samples the azimuth motor current every pass while the dome rotates at speed, the direction comes from the
+// encoder so gotos are included.
+void CDomePro::updateCurrentAnalyzer(bool bRotating)
+{
+    int nErr;
+    int nTicks;
+    int nRaw;
+    int nDir;
+    double dDelta;
+    double dAz;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+
+    if(!m_Current.bEnabled || !bRotating || (getTimeStamp() - m_dAzRotationStart) < CURRENT_SETTLE_TIME) {
+        m_Current.bHasSample = false;
+        return;
+    }
+
+    nErr = getDomeAzTicks(nTicks);
+    if(!nErr)
+        nErr = getTelemetryRaw(TLM_AZ_MOTOR, nRaw);
+    if(nErr) {
+        m_Current.bHasSample = false;
+        return;
+    }
+
+    dDelta = remainder(nTicks - m_Current.nLastTicks, m_nNbStepPerRev);
+    if(m_Current.bHasSample && dDelta != 0) {
+        nDir = dDelta > 0 ? DRIFT_RIGHT : DRIFT_LEFT;
+        dAz = m_dHomeAz + (nTicks - dDelta / 2.0) * 360.0 / m_nNbStepPerRev;
+        dAz = fmod(fmod(dAz, 360.0) + 360.0, 360.0);
+        if(!isGotoStopping(dAz))
+            addCurrentSample(nDir, dAz, m_SensorCal.toValue(TLM_AZ_MOTOR, nRaw));
+    }
+    m_Current.nLastTicks = nTicks;
+    m_Current.bHasSample = true;
+}
+
+// a goto slows down over about the same time it took to get to speed, the current isn't representative there.
+bool CDomePro::isGotoStopping(double dAz)
+{
+    int nMode;
+
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        nMode = m_Poll.nAzMode;
+    }
+    if(nMode != GOTO)
+        return false;
+    std::lock_guard<std::mutex> lock(m_GotoMutex);
+    return fabs(remainder(m_dGotoAz - dAz, 360.0)) < m_dAzRotationSpeed * CURRENT_SETTLE_TIME;
+}
+
+// Welford running mean/variance per bin. Once a bin has a baseline, spikes are counted but kept out of it and the
+// recent average is compared to it. The baseline is frozen while the bin is flagged, otherwise the samples that
+// raised the flag would pull the baseline up until it clears itself.
+void CDomePro::addCurrentSample(int nDir, double dAz, double dAmps)
+{
+    int nBin;
+    double dDelta;
+    double dSigma;
+    bool bFlagged;
+
+    nBin = ((int)(dAz / CURRENT_BIN_SIZE)) % CURRENT_BIN_COUNT;
+    CurrentBin &Bin = m_CurrentBins[nDir][nBin];
+    m_Current.nSamples++;
+
+    if(Bin.nCount >= CURRENT_MIN_BASELINE) {
+        dSigma = std::max(sqrt(Bin.dM2 / (Bin.nCount - 1)), CURRENT_MIN_SIGMA);
+        Bin.dRecent += CURRENT_RECENT_ALPHA * (dAmps - Bin.dRecent);
+        if(dAmps - Bin.dMean > CURRENT_SPIKE_SIGMA * dSigma) {
+            Bin.nSpikes++;
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::addCurrentSample] current spike %3.2f A (baseline %3.2f +/- %3.2f) at Az %3.1f going %s\n", dAmps, Bin.dMean, dSigma, dAz, nDir == DRIFT_RIGHT ? "right" : "left");
+                m_pLogger->out(m_szLogBuffer);
+            }
+        }
+        bFlagged = (Bin.dRecent - Bin.dMean) > CURRENT_FLAG_SIGMA * dSigma;
+        if(bFlagged != Bin.bFlagged) {
+            m_Current.nFlagged += bFlagged ? 1 : -1;
+            Bin.bFlagged = bFlagged;
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::addCurrentSample] Az %d-%d going %s %s : recent %3.2f A, baseline %3.2f +/- %3.2f A\n", nBin * CURRENT_BIN_SIZE, (nBin + 1) * CURRENT_BIN_SIZE, nDir == DRIFT_RIGHT ? "right" : "left", bFlagged ? "flagged" : "back to normal", Bin.dRecent, Bin.dMean, dSigma);
+                m_pLogger->out(m_szLogBuffer);
+            }
+        }
+        if(Bin.bFlagged || dAmps - Bin.dMean > CURRENT_SPIKE_SIGMA * dSigma)
+            return;
+    }
+
+    Bin.nCount++;
+    dDelta = dAmps - Bin.dMean;
+    Bin.dMean += dDelta / Bin.nCount;
+    Bin.dM2 += dDelta * (dAmps - Bin.dMean);
+    if(Bin.nCount <= CURRENT_MIN_BASELINE)
+        Bin.dRecent = Bin.dMean;
+}
+
+// One line per bin, also used to reload the baseline at the next connection.
+int CDomePro::writeCurrentReport(const char *pszFile)
+{
+    FILE *pFile;
+    int nDir;
+    int nBin;
+    double dSigma;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    pFile = fopen(pszFile, "w");
+    if(!pFile)
+        return COMMAND_FAILED;
+
+    fprintf(pFile, "# DomePro azimuth motor current per %d degrees bin\n", CURRENT_BIN_SIZE);
+    fprintf(pFile, "# dir az_from az_to samples mean_A sigma_A m2 recent_A spikes flagged\n");
+    for(nDir = 0; nDir < DRIFT_DIR_COUNT; nDir++) {
+        for(nBin = 0; nBin < CURRENT_BIN_COUNT; nBin++) {
+            const CurrentBin &Bin = m_CurrentBins[nDir][nBin];
+            if(!Bin.nCount)
+                continue;
+            dSigma = Bin.nCount > 1 ? sqrt(Bin.dM2 / (Bin.nCount - 1)) : 0.0;
+            fprintf(pFile, "%s %d %d %d %.4f %.4f %.6f %.4f %d %s\n", nDir == DRIFT_RIGHT ? "right" : "left",
+                    nBin * CURRENT_BIN_SIZE, (nBin + 1) * CURRENT_BIN_SIZE, Bin.nCount, Bin.dMean, dSigma, Bin.dM2,
+                    Bin.dRecent, Bin.nSpikes, Bin.bFlagged ? "FLAGGED" : "ok");
+        }
+    }
+    fclose(pFile);
+    return DP2_OK;
+}
+
+// called with m_EngineMutex held
+int CDomePro::readCurrentBaseline(const char *pszFile)
+{
+    FILE *pFile;
+    char szLine[SERIAL_BUFFER_SIZE * 2];
+    char szDir[16];
+    char szFlag[16];
+    int nFrom, nTo;
+    int nBin;
+    CurrentBin Bin;
+
+    pFile = fopen(pszFile, "r");
+    if(!pFile)
+        return COMMAND_FAILED;
+
+    while(fgets(szLine, sizeof(szLine), pFile)) {
+        if(szLine[0] == '#')
+            continue;
+        memset(&Bin, 0, sizeof(CurrentBin));
+        if(sscanf(szLine, "%15s %d %d %d %lf %*f %lf %lf %d %15s", szDir, &nFrom, &nTo, &Bin.nCount, &Bin.dMean, &Bin.dM2, &Bin.dRecent, &Bin.nSpikes, szFlag) != 9)
+            continue;
+        nBin = nFrom / CURRENT_BIN_SIZE;
+        if(nBin < 0 || nBin >= CURRENT_BIN_COUNT || Bin.nCount <= 0)
+            continue;
+        // flags are re-evaluated with the new samples
+        Bin.dRecent = Bin.dMean;
+        m_CurrentBins[strcmp(szDir, "left") ? DRIFT_RIGHT : DRIFT_LEFT][nBin] = Bin;
+    }
+    fclose(pFile);
+    return DP2_OK;
+}
+
+#pragma mark - telemetry sampler
+
+static const char *s_szTelemetryCmd[TLM_CHANNEL_COUNT] = {
+    "!DGva;", "!DGvs;", "!DGac;", "!DGsc;", "!DGat;", "!DGst;", "!DGle;"
+};
+
+void CDomePro::setTelemetry(bool bEnable, const char *pszFile, int nRecords)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_bTelemetryEnabled = bEnable;
+    if(pszFile && pszFile[0])
+        m_sTelemetryFile = pszFile;
+    if(nRecords > 0)
+        m_nTelemetryRecords = nRecords;
+    m_bTelemetryChanged = true;
+}
+
+// 0 or less to stop sampling a channel
+void CDomePro::setTelemetryPeriod(int nChannel, double dSeconds)
+{
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return;
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_dTelemetryPeriod[nChannel] = dSeconds;
+}
+
+const char *CDomePro::getTelemetryFile()
+{
+    return m_sTelemetryFile.c_str();
+}
+
+void CDomePro::setTelemetryArchive(bool bEnable, const char *pszFile)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_bTelemetryArchive = bEnable;
+    if(pszFile && pszFile[0])
+        m_sTelemetryArchiveFile = pszFile;
+    m_bTelemetryChanged = true;
+}
+
+const char *CDomePro::getTelemetryArchiveFile()
+{
+    return m_sTelemetryArchiveFile.c_str();
+}
+
+// used at the next connection
+void CDomePro::setStatusPage(bool bEnable, const char *pszName)
+{
+    m_bStatusPage = bEnable;
+    if(pszName && pszName[0])
+        m_sStatusPageName = pszName;
+}
+
+const char *CDomePro::getStatusPageName()
+{
+    return m_sStatusPageName.c_str();
+}
+
+int CDomePro::getStatusPage(DomeStatus &Status)
+{
+    return m_StatusPage.read(Status) == STATUS_OK ? DP2_OK : COMMAND_FAILED;
+}
+
+// The broker's clients do the polling, their azimuth answers also go to the status page.
+int CDomePro::sendRawCommand(const char *pszCmd, char *pszResult, int nResultMaxLen)
+{
+    int nErr;
+    double dAz;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+    nErr = domeCommand(pszCmd, pszResult, nResultMaxLen);
+    if(!nErr && m_nNbStepPerRev && !strcmp(pszCmd, "!DGap;")) {
+        TicksToAz((int)strtoul(pszResult, NULL, 16), dAz);
+        m_StatusPage.setAz(dAz);
+    }
+    return nErr;
+}
+
+// sensor conversion and per-site correction as value = raw * gain + offset
+void CDomePro::getTelemetryConversion(double *dGain, double *dOffset)
+{
+    int i;
+
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++)
+        m_SensorCal.getLinear(i, dGain[i], dOffset[i]);
+}
+
+// call before connecting, the telemetry files get the new conversion when they are (re)opened
+void CDomePro::setSensorCalibration(int nChannel, double dGain, double dOffset)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_SensorCal.setCalibration(nChannel, dGain, dOffset);
+    m_bTelemetryChanged = true;
+}
+
+// raw samples (from the telemetry ring or archive) to values with the current calibration
+void CDomePro::convertTelemetry(int nChannel, const int32_t *pRaw, double *pValues, size_t nCount)
+{
+    m_SensorCal.convert(nChannel, pRaw, pValues, nCount);
+}
+
+// min/max of a channel from the archive, answered from the block index where possible
+int CDomePro::getTelemetryRange(int nChannel, double dStart, double dEnd, double &dMin, double &dMax, int &nCount)
+{
+    int nErr;
+    TelemetryRange Range;
+
+    nCount = 0;
+    nErr = m_TelemetryArchive.queryRange(nChannel, dStart, dEnd, Range);
+    if(nErr)
+        return nErr == TLA_NO_DATA ? DP2_OK : COMMAND_FAILED;
+
+    dMin = m_TelemetryArchive.toValue(nChannel, Range.nMin);
+    dMax = m_TelemetryArchive.toValue(nChannel, Range.nMax);
+    nCount = Range.nCount;
+    return DP2_OK;
+}
+
+// raw ADC ticks (or count for the link errors), see the getters above for the conversion
+int CDomePro::getTelemetryRaw(int nChannel, int &nRaw)
+{
+    int nErr = DP2_OK;
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return COMMAND_FAILED;
+
+    nErr = domeCommand(s_szTelemetryCmd[nChannel], szResp, SERIAL_BUFFER_SIZE);
+    if(nErr)
+        return nErr;
+
+    // convert result hex string
+    nRaw = (int)strtoul(szResp, NULL, 16);
+    if(nChannel == TLM_AZ_SUPPLY || nChannel == TLM_SHUTTER_SUPPLY)
+        m_StatusPage.setSupplyVolts(nChannel, m_SensorCal.toValue(nChannel, nRaw));
+    addDiagSample(nChannel, nRaw);
+
+    return nErr;
+}
+
+// Called by the I/O thread with m_EngineMutex held.
+void CDomePro::openTelemetry()
+{
+    int nErr;
+    double dGain[TLM_CHANNEL_COUNT];
+    double dOffset[TLM_CHANNEL_COUNT];
+
+    m_bTelemetryChanged = false;
+    m_TelemetryRing.close();
+    m_TelemetryArchive.close();
+    getTelemetryConversion(dGain, dOffset);
+
+    if(m_bTelemetryEnabled) {
+        nErr = m_TelemetryRing.create(m_sTelemetryFile.c_str(), (uint32_t)m_nTelemetryRecords, dGain, dOffset);
+        if (m_bDebugLog) {
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::openTelemetry] %s, %d records : %d\n", m_sTelemetryFile.c_str(), m_nTelemetryRecords, nErr);
+            m_pLogger->out(m_szLogBuffer);
+        }
+    }
+    if(m_bTelemetryArchive) {
+        nErr = m_TelemetryArchive.open(m_sTelemetryArchiveFile.c_str(), true, dGain, dOffset);
+        if (m_bDebugLog) {
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::openTelemetry] archive %s : %d\n", m_sTelemetryArchiveFile.c_str(), nErr);
+            m_pLogger->out(m_szLogBuffer);
+        }
+    }
+}
+
+// Called by the I/O thread.
+// Only reads when no operation is running, and at most TLM_MAX_READS commands per pass so the sampling
+// never delays the dome commands by more than a few exchanges.
+// Without telemetry files it only reads while the diag dialog is open, no more often than DIAG_SAMPLE_PERIOD.
+void CDomePro::updateTelemetry()
+{
+    int i;
+    int nReads = 0;
+    int nRaw;
+    double dNow;
+    double dPeriod;
+    bool bFiles;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+
+    if(m_bTelemetryChanged)
+        openTelemetry();
+    bFiles = m_TelemetryRing.isOpen() || m_TelemetryArchive.isOpen();
+    if(!m_bIsConnected || (!bFiles && !(m_bDiagHistory && m_bDiagSampling)) || m_bCalibrating)
+        return;
+    if(m_Op.nState != OP_STATE_IDLE && m_Op.nState != OP_STATE_DONE && m_Op.nState != OP_STATE_FAILED)
+        return;
+
+    dNow = getTimeStamp();
+    m_TelemetryRecord.nValid = 0;
+    for(i = 0; i < TLM_CHANNEL_COUNT && nReads < TLM_MAX_READS; i++) {
+        dPeriod = bFiles ? m_dTelemetryPeriod[i] : std::max(m_dTelemetryPeriod[i], DIAG_SAMPLE_PERIOD);
+        if(m_dTelemetryPeriod[i] <= 0.0 || (dNow - m_dTelemetryLast[i]) < dPeriod)
+            continue;
+        // not on this model
+        if(!(getModelPolicy().nTelemetry & (1 << i)))
+            continue;
+        // nothing to show for a shutter we don't have
+        if(!bFiles && !m_bHasShutter && (i == TLM_SHUTTER_SUPPLY || i == TLM_SHUTTER_MOTOR || i == TLM_SHUTTER_TEMP))
+            continue;
+        nReads++;
+        m_dTelemetryLast[i] = dNow;
+        if(getTelemetryRaw(i, nRaw) == DP2_OK) {
+            m_TelemetryRecord.nRaw[i] = nRaw;
+            m_TelemetryRecord.nValid |= (1 << i);
+            if(i == TLM_LINK_ERRORS)
+                updateLinkHealth(nRaw);
+        }
+    }
+    if(!m_TelemetryRecord.nValid || !bFiles)
+        return;
+
+    m_TelemetryRecord.dTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if(m_TelemetryRing.isOpen())
+        m_TelemetryRing.append(m_TelemetryRecord);
+    if(m_TelemetryArchive.isOpen())
+        m_TelemetryArchive.append(m_TelemetryRecord);
+}
+
+#pragma mark - diag history
+
+void CDomePro::setDiagHistory(bool bEnable)
+{
+    m_bDiagHistory = bEnable;
+    if(!bEnable)
+        m_DiagHistory.clear();
+}
+
+void CDomePro::setDiagSampling(bool bEnable)
+{
+    m_bDiagSampling = bEnable;
+    if(bEnable)
+        wakeIoThread();
+}
+
+// nChannel is a TelemetryChannels, the link errors are the controller running count
+void CDomePro::addDiagSample(int nChannel, int32_t nRaw)
+{
+    if(!m_bDiagHistory)
+        return;
+    if(nChannel == TLM_LINK_ERRORS)
+        m_DiagHistory.addCounter(nChannel, getTimeStamp(), nRaw);
+    else
+        m_DiagHistory.addSample(nChannel, getTimeStamp(), m_SensorCal.toValue(nChannel, nRaw));
+}
+
+bool CDomePro::getDiagSummary(int nChannel, double dWindow, DiagSummary &Summary)
+{
+    return m_DiagHistory.getSummary(nChannel, getTimeStamp(), dWindow, Summary);
+}
+
+void CDomePro::getDiagLinkSummary(double dWindow, DiagLinkSummary &Summary)
+{
+    m_DiagHistory.getLinkSummary(getTimeStamp(), dWindow, Summary);
+}
+
+void CDomePro::getDiagSparkline(int nChannel, double dWindow, char *pszSpark, int nMaxLen)
+{
+    m_DiagHistory.getSparkline(nChannel, getTimeStamp(), dWindow, pszSpark, nMaxLen);
+}
+
+uint32_t CDomePro::getDiagVersion()
+{
+    return m_DiagHistory.getVersion();
+}
+
+#pragma mark - firmware capabilities
+
+// get command of each DomeCapabilities, a NACK means the firmware doesn't have the feature
+static const char *s_szCapabilityProbes[CAP_COUNT] = {"!DGmv;", "!DGma;", "!DGra;", "!DGsh;", "!DGlv;", "!DGce;"};
+
+void CDomePro::setKnownCapabilities(const char *pszFirmware, uint32_t nUnsupported)
+{
+    std::lock_guard<std::mutex> lock(m_CapsMutex);
+    m_sCapsFirmware = pszFirmware ? pszFirmware : "";
+    m_nUnsupported = m_sCapsFirmware.empty() ? 0 : nUnsupported;
+}
+
+bool CDomePro::getCapabilities(std::string &sFirmware, uint32_t &nUnsupported)
+{
+    std::lock_guard<std::mutex> lock(m_CapsMutex);
+    sFirmware = m_sCapsFirmware;
+    nUnsupported = m_nUnsupported;
+    return !m_sCapsFirmware.empty();
+}
+
+bool CDomePro::isSupported(int nCapability)
+{
+    if(nCapability < 0 || nCapability >= CAP_COUNT)
+        return false;
+    return !(m_nUnsupported & CAP_BIT(nCapability));
+}
+
+bool CDomePro::isSettingSupported(int nSetting)
+{
+    switch(nSetting) {
+        case SETTING_SHUT_OP_ON_HOME:
+            return isSupported(CAP_SHUT_OP_AT_HOME);
+        default:
+            return true;
+    }
+}
+
+// Called by Connect before the I/O thread starts. A feature is missing when its get command is NACKed
+// CAP_PROBE_NACKS times in a row. A probe that times out leaves the feature supported and the map unsaved
+// so the next connect probes again.
+void CDomePro::probeCapabilities()
+{
+    int nErr;
+    int i;
+    int j;
+    bool bNack;
+    bool bComplete = true;
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    {
+        std::lock_guard<std::mutex> lock(m_CapsMutex);
+        if(!m_sCapsFirmware.empty() && m_sCapsFirmware == m_szFirmwareVersion) {
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::probeCapabilities] firmware %.*s known, unsupported = 0x%02X\n", 32, m_szFirmwareVersion, m_nUnsupported.load());
+                m_pLogger->out(m_szLogBuffer);
+            }
+            return;
+        }
+        m_sCapsFirmware.clear();
+        m_nUnsupported = 0;
+    }
+
+    for(i = 0; i < CAP_COUNT; i++) {
+        nErr = DP2_OK;
+        bNack = false;
+        for(j = 0; j < CAP_PROBE_NACKS; j++) {
+            nErr = domeCommand(s_szCapabilityProbes[i], szResp, SERIAL_BUFFER_SIZE, &bNack);
+            if(!bNack)
+                break;
+        }
+        if(bNack) {
+            m_nUnsupported |= CAP_BIT(i);
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::probeCapabilities] %s NACKed, feature %d not supported\n", s_szCapabilityProbes[i], i);
+                m_pLogger->out(m_szLogBuffer);
+            }
+        }
+        else if(nErr)
+            bComplete = false;
+    }
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::probeCapabilities] firmware %.*s, unsupported = 0x%02X%s\n", 32, m_szFirmwareVersion, m_nUnsupported.load(), bComplete ? "" : ", incomplete");
+        m_pLogger->out(m_szLogBuffer);
+    }
+    if(bComplete) {
+        std::lock_guard<std::mutex> lock(m_CapsMutex);
+        m_sCapsFirmware = m_szFirmwareVersion;
+    }
+}
+
+// domeCommand for the optional features, fails locally once the connect probe found the feature missing.
+// A NACK here only fails the call, it can be a garbled command or a value the firmware refused.
+int CDomePro::capabilityCommand(int nCapability, const char *pszCmd, char *pszResult, int nResultMaxLen)
+{
+    int nErr;
+    bool bNack;
+
+    if(!isSupported(nCapability))
+        return NOT_SUPPORTED;
+
+    nErr = domeCommand(pszCmd, pszResult, nResultMaxLen, &bNack);
+    if(bNack && m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::capabilityCommand] %s NACKed\n", pszCmd);
+        m_pLogger->out(m_szLogBuffer);
+    }
+    return nErr;
+}
+
+#pragma mark - adaptive polling
+
+void CDomePro::setPollPeriods(double dAzFast, double dAzSlow, double dShutterFast, double dShutterSlow)
+{
+    std::lock_guard<std::mutex> lock(m_PollMutex);
+    m_Poll.dAzFastPeriod = std::max(0.0, dAzFast);
+    m_Poll.dAzSlowPeriod = std::max(0.0, dAzSlow);
+    m_Poll.dShutterFastPeriod = std::max(0.0, dShutterFast);
+    m_Poll.dShutterSlowPeriod = std::max(0.0, dShutterSlow);
+}
+
+void CDomePro::setBackgroundPolls(bool bEnable)
+{
+    m_bBackgroundPolls = bEnable;
+}
+
+// the periods currently in use
+void CDomePro::getPollRates(double &dAzPeriod, double &dShutterPeriod, int &nShutterBackoff)
+{
+    std::lock_guard<std::mutex> lock(m_PollMutex);
+    dAzPeriod = pollPeriod(POLL_AZ_MODE);
+    dShutterPeriod = pollPeriod(POLL_SHUTTER_STATUS);
+    nShutterBackoff = m_Poll.nShutterBackoff;
+}
+
+void CDomePro::getPollStatus(PollScheduler &Poll)
+{
+    std::lock_guard<std::mutex> lock(m_PollMutex);
+    Poll = m_Poll;
+}
+
+// called with m_PollMutex held
+// fast while the dome or the shutter moves, the shutter queries go over the RF link and back off when it has errors
+double CDomePro::pollPeriod(int nQuery)
+{
+    bool bMoving;
+
+    if(nQuery == POLL_SHUTTER_STATUS) {
+        bMoving = (m_Poll.nShutterState == OPENING || m_Poll.nShutterState == CLOSING || m_Poll.nShutterState == SHUT_GOTO);
+        return (bMoving ? m_Poll.dShutterFastPeriod : m_Poll.dShutterSlowPeriod) * m_Poll.nShutterBackoff;
+    }
+    return (m_Poll.nAzMode != FIXED && m_Poll.nAzMode != AZ_TO) ? m_Poll.dAzFastPeriod : m_Poll.dAzSlowPeriod;
+}
+
+// called with m_PollMutex held
+bool CDomePro::isPollFresh(int nQuery)
+{
+    if(m_Poll.dTime[nQuery] == 0.0 || (getTimeStamp() - m_Poll.dTime[nQuery]) >= pollPeriod(nQuery))
+        return false;
+    m_Poll.nCached[nQuery]++;
+    return true;
+}
+
+// called with m_PollMutex held, once the answer is stored
+void CDomePro::setPollAnswer(int nQuery)
+{
+    m_Poll.dTime[nQuery] = getTimeStamp();
+    m_Poll.nReads[nQuery]++;
+}
+
+// called after every command that can change the dome state
+void CDomePro::invalidatePoll()
+{
+    int i;
+
+    std::lock_guard<std::mutex> lock(m_PollMutex);
+    for(i = 0; i < POLL_QUERY_COUNT; i++)
+        m_Poll.dTime[i] = 0.0;
+}
+
+int CDomePro::pollAzMoveMode(int &nMode)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        if(isPollFresh(POLL_AZ_MODE)) {
+            nMode = m_Poll.nAzMode;
+            return DP2_OK;
+        }
+    }
+    return getDomeAzMoveMode(nMode);
+}
+
+int CDomePro::pollAzPosition(double &dAz)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        if(isPollFresh(POLL_AZ_POSITION)) {
+            dAz = m_Poll.dAz;
+            return DP2_OK;
+        }
+    }
+    return getDomeAzPosition(dAz);
+}
+
+int CDomePro::pollShutterStatus(int &nState)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        if(isPollFresh(POLL_SHUTTER_STATUS)) {
+            nState = m_Poll.nShutterState;
+            return DP2_OK;
+        }
+    }
+    return getDomeShutterStatus(nState);
+}
+
+// fed by every read of the link error counter
+void CDomePro::updateLinkHealth(int nLinkErrors)
+{
+    int nBackoff;
+
+    std::lock_guard<std::mutex> lock(m_PollMutex);
+    nBackoff = m_Poll.nShutterBackoff;
+    // a lower count means it was cleared, it's just the new reference
+    if(m_Poll.bHasLinkErrors && nLinkErrors > m_Poll.nLinkErrors)
+        m_Poll.nShutterBackoff = std::min(m_Poll.nShutterBackoff * 2, POLL_MAX_BACKOFF);
+    else if(m_Poll.bHasLinkErrors && nLinkErrors == m_Poll.nLinkErrors)
+        m_Poll.nShutterBackoff = std::max(m_Poll.nShutterBackoff / 2, 1);
+    m_Poll.bHasLinkErrors = true;
+    m_Poll.nLinkErrors = nLinkErrors;
+    m_Poll.dLastLinkCheck = getTimeStamp();
+
+    if (m_bDebugLog && nBackoff != m_Poll.nShutterBackoff) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::updateLinkHealth] %d RF link errors, shutter polling period x%d\n", nLinkErrors, m_Poll.nShutterBackoff);
+        m_pLogger->out(m_szLogBuffer);
+    }
+}
+
+// Called by the I/O thread, so getLastAz follows the dome without dapiGetAzEl doing any I/O. The read is
+// answered from the poll cache within the polling periods. The shutter isn't polled here, the completion
+// calls and the event polls read it when someone needs it and getLastEl follows their answers.
+void CDomePro::updateLastState()
+{
+    double dAz;
+
+    if(!m_bIsConnected || !m_bBackgroundPolls || m_bCalibrating)
+        return;
+    if(getModelPolicy().bAzimuth && m_nNbStepPerRev)
+        pollAzPosition(dAz);
+}
+
+// Called by the I/O thread, checks the RF link error counter (kept by the azimuth controller).
+// Only while the shutter is being polled, the backoff has nothing to slow down otherwise.
+void CDomePro::updatePollRates()
+{
+    int nLinkErrors;
+
+    if(!m_bIsConnected || !m_bBackgroundPolls || !m_bHasShutter || m_bCalibrating)
+        return;
+    if(m_nShutterMove == SHUT_MOVE_NONE && !m_Events.hasSubscribers())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        if(m_Poll.bHasLinkErrors && (getTimeStamp() - m_Poll.dLastLinkCheck) < POLL_LINK_PERIOD)
+            return;
+    }
+    getDomeLinkErrCnt(nLinkErrors);
+}
+
+#pragma mark - events
+
+int CDomePro::subscribeEvents(DomeEventCallback pCallback, void *pUserData, uint32_t nMask)
+{
+    int nId;
+
+    nId = m_Events.subscribe(pCallback, pUserData, nMask);
+    wakeIoThread();
+    return nId;
+}
+
+int CDomePro::subscribeEventQueue(CDomeEventQueue *pQueue, uint32_t nMask)
+{
+    int nId;
+
+    nId = m_Events.subscribeQueue(pQueue, nMask);
+    wakeIoThread();
+    return nId;
+}
+
+void CDomePro::unsubscribeEvents(int nId)
+{
+    m_Events.unsubscribe(nId);
+}
+
+// Called by the I/O thread. The events come from whatever reads the dome state, this only makes sure the
+// limits and the shutter are read often enough when someone subscribed and nobody else does, then calls
+// the callbacks with no lock held. The status page never adds reads, it only shows the answers to the
+// polls that happen anyway.
+void CDomePro::updateEvents(bool bRotating)
+{
+    int nState;
+    bool bShutterMoving;
+    double dPeriod;
+
+    if(m_bIsConnected && !m_bCalibrating && m_Events.hasSubscribers()) {
+        {
+            std::lock_guard<std::mutex> lock(m_PollMutex);
+            nState = m_Poll.nShutterState;
+        }
+        bShutterMoving = m_bHasShutter && (m_nShutterMove != SHUT_MOVE_NONE || nState == OPENING || nState == CLOSING || nState == SHUT_GOTO);
+        dPeriod = (bRotating || bShutterMoving) ? EVT_MOVING_PERIOD : EVT_IDLE_PERIOD;
+        // the shutter status follows the adaptive polling periods
+        if(m_bHasShutter)
+            pollShutterStatus(nState);
+        // the roof status is all a roll-off roof needs, its limits were read at connect
+        if(getModelPolicy().bAzimuth && (getTimeStamp() - m_dLastEventPoll) >= dPeriod) {
+            m_dLastEventPoll = getTimeStamp();
+            getDomeLimits();
+        }
+    }
+    m_Events.dispatch();
+}
+
+#pragma mark - settings cache
+
+// The dialogs show the last known values right away and ask for fresh ones here, the I/O thread reads them
+// a few at a time between its other reads so opening a dialog never stalls the link.
+void CDomePro::requestSettings(uint32_t nSettings)
+{
+    if(!m_bIsConnected)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_SettingsMutex);
+        // the ones that don't apply to the model are never read
+        m_Settings.nPending |= nSettings & getModelPolicy().nSettings;
+    }
+    wakeIoThread();
+}
+
+void CDomePro::getSettings(DomeSettings &Settings)
+{
+    std::lock_guard<std::mutex> lock(m_SettingsMutex);
+    Settings = m_Settings;
+}
+
+// returns true while some settings are still to be read
+bool CDomePro::updateSettings()
+{
+    int i;
+    int nErr;
+    int nReads = 0;
+    uint32_t nPending;
+    double dValue;
+    char szText[SERIAL_BUFFER_SIZE];
+
+    {
+        std::lock_guard<std::mutex> lock(m_SettingsMutex);
+        nPending = m_Settings.nPending;
+    }
+    if(!nPending || !m_bIsConnected || m_bCalibrating)
+        return false;
+
+    for(i = 0; i < SETTING_COUNT && nReads < SETTINGS_MAX_READS; i++) {
+        if(!(nPending & SETTING_BIT(i)))
+            continue;
+        nReads++;
+        szText[0] = 0;
+        nErr = readSetting(i, dValue, szText, SERIAL_BUFFER_SIZE);
+
+        std::lock_guard<std::mutex> lock(m_SettingsMutex);
+        m_Settings.nPending &= ~SETTING_BIT(i);
+        if(nErr) {
+            m_Settings.nFailed |= SETTING_BIT(i);
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::updateSettings] setting %d read error %d\n", i, nErr);
+                m_pLogger->out(m_szLogBuffer);
+            }
+            continue;
+        }
+        m_Settings.dValue[i] = dValue;
+        m_Settings.nValid |= SETTING_BIT(i);
+        m_Settings.nFailed &= ~SETTING_BIT(i);
+        if(i == SETTING_MODEL)
+            snprintf(m_Settings.szModel, SERIAL_BUFFER_SIZE, "%s", szText);
     }
 
-    return err;
+    std::lock_guard<std::mutex> lock(m_SettingsMutex);
+    return m_Settings.nPending != 0;
 }
 
-
-int CDomePro::isParkComplete(bool &bComplete)
+// Writes the DomeSetting bits in one batch and keeps the cache in step, so the dialogs don't have to read
+// them back. A setting that failed is read again by the I/O thread. Returns the first error.
+int CDomePro::writeSettings(uint32_t nSettings, const double *pdValues)
 {
-    int nErr = 0;
-    int nMode;
-    double dDomeAz=0;
-    bool bIsMoving = false;
+    int i;
+    int nErr;
+    int nFirstErr = DP2_OK;
 
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    nErr = getDomeAzMoveMode(nMode);
-    if(nMode == PARKING)
-    {
-        bComplete = false;
-        return nErr;
+    for(i = 0; i < SETTING_COUNT; i++) {
+        if(!(nSettings & SETTING_BIT(i)))
+            continue;
+        nErr = writeSetting(i, pdValues[i]);
+
+        std::lock_guard<std::mutex> lock(m_SettingsMutex);
+        if(nErr) {
+            if(!nFirstErr)
+                nFirstErr = nErr;
+            m_Settings.nPending |= SETTING_BIT(i);
+            if (m_bDebugLog) {
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::writeSettings] setting %d write error %d\n", i, nErr);
+                m_pLogger->out(m_szLogBuffer);
+            }
+            continue;
+        }
+        m_Settings.dValue[i] = pdValues[i];
+        m_Settings.nValid |= SETTING_BIT(i);
+        m_Settings.nFailed &= ~SETTING_BIT(i);
     }
+    if(nFirstErr)
+        wakeIoThread();
+    return nFirstErr;
+}
+
+int CDomePro::writeSetting(int nSetting, double dValue)
+{
+    int nValue = (int)floor(dValue + 0.5);
+    bool bValue = nValue != 0;
+
+    switch(nSetting) {
+        case SETTING_AZ_MOTOR_POLARITY:         return setDomeAzMotorPolarity(nValue);
+        case SETTING_AZ_OCP_LIMIT:              return setDomeAzimuthOCP_Limit(dValue);
+        case SETTING_AZ_CPR:                    return setDomeAzCPR(nValue);
+        case SETTING_AZ_COAST:                  return setDomeAzCoast(dValue);
+        case SETTING_AZ_ENCODER_POLARITY:       return setDomeAzEncoderPolarity(nValue);
+        case SETTING_HOME_DIRECTION:            return setDomeHomeDirection(nValue);
+        case SETTING_HOME_AZ:                   return setHomeAz(dValue);
+        case SETTING_PARK_AZ:                   return setParkAz(dValue);
+
+        case SETTING_SINGLE_SHUTTER:            return setDomeSingleShutterMode(bValue);
+        case SETTING_OPEN_FIRST:                return setDomeShutterOpenFirst(nValue);
+        case SETTING_CLOSE_FIRST:               return setDomeShutterCloseFirst(nValue);
+        case SETTING_SHUT_OP_ON_HOME:           return setDomeShutOpOnHome(bValue);
+        case SETTING_HOME_WITH_SHUTTER_CLOSE:   return setHomeWithShutterClose(bValue);
+        case SETTING_SHUT1_LIMIT_CHECK:         return setShutter1_LimitFaultCheckEnabled(bValue);
+        case SETTING_SHUT2_LIMIT_CHECK:         return setShutter2_LimitFaultCheckEnabled(bValue);
+        case SETTING_SHUT1_OCP_LIMIT:           return setDomeShutter1_OCP_Limit(dValue);
+        case SETTING_SHUT2_OCP_LIMIT:           return setDomeShutter2_OCP_Limit(dValue);
+
+        case SETTING_AZ_TIMEOUT_ENABLED:        return setDomeAzimuthTimeOutEnabled(bValue);
+        case SETTING_AZ_TIMEOUT:                return setDomeAzimuthTimeOut(nValue);
+        case SETTING_SHUT1_TIMEOUT:             return setDomeShutter1_OpTimeOut(nValue);
+        case SETTING_SHUT2_TIMEOUT:             return setDomeShutter2_OpTimeOut(nValue);
+        case SETTING_SHUT_ODIR_TIMEOUT:         return setDomeShutODirTimeOut(nValue);
+        case SETTING_CLOSE_ON_CLIENT_TIMEOUT:   return setDomeShutCloseOnClientTimeOut(bValue);
+        case SETTING_CLOSE_CLIENT_TIMEOUT:      return setDomeShutCloseClientTimeOut(nValue);
+        case SETTING_CLOSE_ON_LINK_TIMEOUT:     return setDomeShutCloseOnLinkTimeOut(bValue);
+        case SETTING_SHUTTER_AUTO_CLOSE:        return setShutterAutoCloseEnabled(bValue);
+
+        // read only
+        default:
+            return INVALID_COMMAND;
+    }
+}
 
-    getDomeAzPosition(dDomeAz);
-    nErr = isDomeMoving(bIsMoving);
-    if(nErr)
-        return nErr;
+int CDomePro::readSetting(int nSetting, double &dValue, char *pszText, int nTextMaxLen)
+{
+    int nErr = DP2_OK;
+    int nTmp = 0;
+    bool bTmp = false;
+    double dTmp = 0.0;
+
+    switch(nSetting) {
+        case SETTING_AZ_MOTOR_POLARITY:         nErr = getDomeAzMotorPolarity(nTmp); dTmp = nTmp; break;
+        case SETTING_AZ_OCP_LIMIT:              nErr = getDomeAzimuthOCP_Limit(dTmp); break;
+        case SETTING_AZ_CPR:                    nErr = getDomeAzCPR(nTmp); dTmp = nTmp; break;
+        case SETTING_AZ_COAST:                  nErr = getDomeAzCoast(dTmp); break;
+        case SETTING_AZ_ENCODER_POLARITY:       nErr = getDomeAzEncoderPolarity(nTmp); dTmp = nTmp; break;
+        case SETTING_AT_HOME:                   nErr = isDomeAtHome(bTmp); dTmp = bTmp; break;
+        case SETTING_HOME_DIRECTION:            nErr = getDomeHomeDirection(nTmp); dTmp = nTmp; break;
+        case SETTING_HOME_AZ:                   nErr = getDomeHomeAz(dTmp); break;
+        case SETTING_PARK_AZ:                   nErr = getDomeParkAz(dTmp); break;
+
+        case SETTING_MODEL:                     nErr = getModel(pszText, nTextMaxLen); dTmp = m_nModel; break;
+        case SETTING_SINGLE_SHUTTER:            nErr = getDomeSingleShutterMode(bTmp); dTmp = bTmp; break;
+        case SETTING_OPEN_FIRST:                nErr = getDomeShutterOpenFirst(nTmp); dTmp = nTmp; break;
+        case SETTING_CLOSE_FIRST:               nErr = getDomeShutterCloseFirst(nTmp); dTmp = nTmp; break;
+        case SETTING_SHUT_OP_ON_HOME:           nErr = getDomeShutOpOnHome(bTmp); dTmp = bTmp; break;
+        case SETTING_HOME_WITH_SHUTTER_CLOSE:   nErr = getHomeWithShutterClose(bTmp); dTmp = bTmp; break;
+        case SETTING_SHUT1_LIMIT_CHECK:         nErr = getShutter1_LimitFaultCheckEnabled(bTmp); dTmp = bTmp; break;
+        case SETTING_SHUT2_LIMIT_CHECK:         nErr = getShutter2_LimitFaultCheckEnabled(bTmp); dTmp = bTmp; break;
+        case SETTING_SHUT1_OCP_LIMIT:           nErr = getDomeShutter1_OCP_Limit(dTmp); break;
+        case SETTING_SHUT2_OCP_LIMIT:           nErr = getDomeShutter2_OCP_Limit(dTmp); break;
+
+        case SETTING_AZ_TIMEOUT_ENABLED:        nErr = getDomeAzimuthTimeOutEnabled(bTmp); dTmp = bTmp; break;
+        case SETTING_AZ_TIMEOUT:                nErr = getDomeAzimuthTimeOut(nTmp); dTmp = nTmp; break;
+        case SETTING_SHUT1_TIMEOUT:             nErr = getDomeShutter1_OpTimeOut(nTmp); dTmp = nTmp; break;
+        case SETTING_SHUT2_TIMEOUT:             nErr = getDomeShutter2_OpTimeOut(nTmp); dTmp = nTmp; break;
+        case SETTING_SHUT_ODIR_TIMEOUT:         nErr = getDomeShutODirTimeOut(nTmp); dTmp = nTmp; break;
+        case SETTING_CLOSE_ON_CLIENT_TIMEOUT:   nErr = getDomeShutCloseOnClientTimeOut(bTmp); dTmp = bTmp; break;
+        case SETTING_CLOSE_CLIENT_TIMEOUT:      nErr = getDomeShutCloseClientTimeOut(nTmp); dTmp = nTmp; break;
+        case SETTING_CLOSE_ON_LINK_TIMEOUT:     nErr = getDomeShutCloseOnLinkTimeOut(bTmp); dTmp = bTmp; break;
+        case SETTING_SHUTTER_AUTO_CLOSE:        nErr = getShutterAutoCloseEnabled(bTmp); dTmp = bTmp; break;
 
-    if(bIsMoving) { // this should not happen
-        bComplete = false;
-        return nErr;
+        default:
+            return INVALID_COMMAND;
     }
+    dValue = dTmp;
+    return nErr;
+}
 
-    if ((floor(m_dParkAz) <= floor(dDomeAz)+1) && (floor(m_dParkAz) >= floor(dDomeAz)-1))
-    {
-        m_bParked = true;
-        bComplete = true;
-    }
-    else {
-        // we're not moving and we're not at the final destination !!!
-        bComplete = false;
-        m_bHomed = false;
-        m_bParked = false;
-        nErr = ERR_CMDFAILED;
-    }
+#pragma mark - shutter battery
 
-    return nErr;
+static const char *s_szShutterMove[] = {"none", "open", "close", "other"};
+
+void CDomePro::setShutterBattery(bool bEnable, const char *pszFile)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    m_Battery.bEnabled = bEnable;
+    if(pszFile && pszFile[0])
+        m_sBatteryFile = pszFile;
 }
 
-int CDomePro::isUnparkComplete(bool &bComplete)
+void CDomePro::setShutterBatteryModel(double dCapacityWh, double dFullVolts, double dEmptyVolts, double dAlertCycles)
 {
-    int nErr = 0;
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    if(dCapacityWh > 0.0)
+        m_Battery.dCapacityWh = dCapacityWh;
+    if(dFullVolts > dEmptyVolts) {
+        m_Battery.dFullVolts = dFullVolts;
+        m_Battery.dEmptyVolts = dEmptyVolts;
+    }
+    m_Battery.dAlertCycles = dAlertCycles;
+    predictShutterBattery();
+}
 
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
+void CDomePro::getShutterBatteryStatus(ShutterBattery &Battery)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    Battery = m_Battery;
+}
 
-    m_bParked = false;
-    bComplete = true;
+const char *CDomePro::getShutterBatteryFile()
+{
+    return m_sBatteryFile.c_str();
+}
 
-    return nErr;
+// called by the shutter commands (and the status when we see a move we didn't start), the I/O thread does the sampling
+void CDomePro::armShutterBattery(int nMove)
+{
+    m_nShutterMove = nMove;
+    wakeIoThread();
 }
 
-int CDomePro::isFindHomeComplete(bool &bComplete)
+// Called by the I/O thread, returns true while a move is being sampled.
+// Integrates V.I on the shutter supply every BATT_SAMPLE_PERIOD until the shutter status shows the move is over,
+// then reads the resting voltage once BATT_REST_DELAY later. Nothing is read when the shutter doesn't move.
+bool CDomePro::updateShutterBattery()
 {
-    int nErr = 0;
-    bool bIsMoving = false;
-    bool bIsAtHome = false;
+    int nErr;
+    int nMove;
+    int nExpected;
+    int nState;
+    FILE *pFile;
+    int nRawVolts;
+    int nRawAmps;
+    double dNow;
+    double dTime;
+    double dVolts;
+    double dAmps;
+    double dPower;
+    bool bMoving;
+
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+
+    nMove = m_nShutterMove;
+    if(!m_Battery.bEnabled || !m_bIsConnected || !m_bHasShutter) {
+        m_Battery.bSampling = false;
+        m_Battery.dRestDue = 0.0;
+        m_nShutterMove = SHUT_MOVE_NONE;
+        return false;
+    }
+    dNow = getTimeStamp();
 
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
+    // direction changed in the middle of a move
+    if(m_Battery.bSampling && nMove != m_Battery.nMove)
+        finishShutterMove(dNow);
 
-    nErr = isDomeMoving(bIsMoving);
-    if(nErr) {
-#if defined ATCL_DEBUG && ATCL_DEBUG >= 2
-        ltime = time(NULL);
-        timestamp = asctime(localtime(&ltime));
-        timestamp[strlen(timestamp) - 1] = 0;
-        fprintf(Logfile, "[%s] [CDomePro::isFindHomeComplete] error checking if dome is moving : %dX\n", timestamp, nErr);
-        fflush(Logfile);
-#endif
-        return nErr;
+    // resting voltage after the last move, not available if the shutter moves again
+    if(m_Battery.dRestDue != 0.0 && (nMove != SHUT_MOVE_NONE || dNow >= m_Battery.dRestDue)) {
+        dVolts = 0.0;
+        if(nMove == SHUT_MOVE_NONE && getTelemetryRaw(TLM_SHUTTER_SUPPLY, nRawVolts) == DP2_OK)
+            dVolts = m_SensorCal.toValue(TLM_SHUTTER_SUPPLY, nRawVolts);
+        m_Battery.dRestDue = 0.0;
+        dTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+        addShutterMove(dTime, m_Battery.nMove, m_Battery.dMoveWh, dVolts);
+        rotateShutterBatteryHistory();
+        pFile = fopen(m_sBatteryFile.c_str(), "a");
+        if(pFile) {
+            if(ftell(pFile) == 0)
+                fprintf(pFile, "# time move Wh seconds min_V peak_A rest_V\n");
+            fprintf(pFile, "%.0f %s %.4f %.1f %.3f %.3f %.3f\n", dTime, s_szShutterMove[m_Battery.nMove], m_Battery.dMoveWh,
+                    m_Battery.dMoveSeconds, m_Battery.dMinVolts, m_Battery.dPeakAmps, dVolts);
+            fclose(pFile);
+        }
     }
-    if(bIsMoving) {
-        m_bHomed = false;
-        bComplete = false;
-        return nErr;
+
+    if(nMove == SHUT_MOVE_NONE)
+        return false;
+
+    if(!m_Battery.bSampling) {
+        m_Battery.nMove = nMove;
+        m_Battery.bSampling = true;
+        m_Battery.bSeenMoving = false;
+        m_Battery.dMoveStart = dNow;
+        m_Battery.dLastSample = 0.0;
+        m_Battery.dLastPower = 0.0;
+        m_Battery.dMoveSeconds = 0.0;
+        m_Battery.dMoveWh = 0.0;
+        m_Battery.dMinVolts = 0.0;
+        m_Battery.dPeakAmps = 0.0;
     }
+    if(m_Battery.dLastSample != 0.0 && (dNow - m_Battery.dLastSample) < BATT_SAMPLE_PERIOD)
+        return true;
 
-    nErr = isDomeAtHome(bIsAtHome);
-    if(nErr)
-        return nErr;
+    nErr = getDomeShutterStatus(nState);
+    if(!nErr)
+        nErr = getTelemetryRaw(TLM_SHUTTER_SUPPLY, nRawVolts);
+    if(!nErr)
+        nErr = getTelemetryRaw(TLM_SHUTTER_MOTOR, nRawAmps);
+    if(!nErr) {
+        dVolts = m_SensorCal.toValue(TLM_SHUTTER_SUPPLY, nRawVolts);
+        dAmps = m_SensorCal.toValue(TLM_SHUTTER_MOTOR, nRawAmps);
+        dPower = dVolts * dAmps;
+        // trapezoidal integration
+        if(m_Battery.dLastSample != 0.0)
+            m_Battery.dMoveWh += (dPower + m_Battery.dLastPower) / 2.0 * (dNow - m_Battery.dLastSample) / 3600.0;
+        else
+            m_Battery.dMinVolts = dVolts;
+        m_Battery.dLastSample = dNow;
+        m_Battery.dLastPower = dPower;
+        m_Battery.dMinVolts = std::min(m_Battery.dMinVolts, dVolts);
+        m_Battery.dPeakAmps = std::max(m_Battery.dPeakAmps, dAmps);
+
+        bMoving = (nState == OPENING || nState == CLOSING || nState == SHUT_GOTO);
+        if(bMoving)
+            m_Battery.bSeenMoving = true;
+        else if(m_Battery.bSeenMoving || (dNow - m_Battery.dMoveStart) > BATT_START_GRACE)
+            finishShutterMove(dNow);
+    }
+    if(m_Battery.bSampling && (dNow - m_Battery.dMoveStart) > BATT_MAX_MOVE_TIME)
+        finishShutterMove(dNow);
 
-    if(bIsAtHome){
-        m_bHomed = true;
-        bComplete = true;
+    if(!m_Battery.bSampling) {
+        // unless a new move was requested meanwhile
+        nExpected = nMove;
+        m_nShutterMove.compare_exchange_strong(nExpected, SHUT_MOVE_NONE);
     }
-    else {
-        // did we just pass home
-        if ((ceil(m_dCurrentAzPosition) <= ceil(m_dHomeAz)+m_dAzCoast) && (ceil(m_dCurrentAzPosition) >= ceil(m_dHomeAz)-m_dAzCoast)) {
-            m_nHomingTries = 0;
-            gotoAzimuth(m_dHomeAz); // back out a bit
-            bComplete = true;
-#if defined ACE_DEBUG && ACE_DEBUG >= 2
-            ltime = time(NULL);
-            timestamp = asctime(localtime(&ltime));
-            timestamp[strlen(timestamp) - 1] = 0;
-            fprintf(Logfile, "[%s] [CDomePro::isFindHomeComplete] Close to home, backing out to %3.2f !!!\n", timestamp, m_dHomeAz);
-            fflush(Logfile);
-#endif
-        }
-        else {
-            // we're not moving and we're not at the home position !!!
+    return m_Battery.bSampling;
+}
+
+// called with m_EngineMutex held, the move is recorded when the resting voltage is read
+void CDomePro::finishShutterMove(double dNow)
+{
+    m_Battery.bSampling = false;
+    if(!m_Battery.bSeenMoving) {
+        // the shutter was already there
+        m_Battery.dMoveWh = 0.0;
+        return;
+    }
+    m_Battery.dMoveSeconds = m_Battery.dLastSample - m_Battery.dMoveStart;
+    m_Battery.dRestDue = dNow + BATT_REST_DELAY;
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::finishShutterMove] %s : %3.2f Wh in %3.1f s, min %3.2f V, peak %3.2f A\n", s_szShutterMove[m_Battery.nMove], m_Battery.dMoveWh, m_Battery.dMoveSeconds, m_Battery.dMinVolts, m_Battery.dPeakAmps);
+        m_pLogger->out(m_szLogBuffer);
+    }
+}
+
+// Called with m_EngineMutex held, for each new move and when the history is reloaded.
+// dRestVolts is 0 when it couldn't be read, dTime in seconds since 1970.
+void CDomePro::addShutterMove(double dTime, int nMove, double dWh, double dRestVolts)
+{
+    BatteryPoint Point;
+    double dRise;
+    double dHours;
+
+    m_Battery.nMoves++;
+    if(nMove == SHUT_MOVE_OPEN)
+        m_Battery.dOpenWh = m_Battery.dOpenWh > 0.0 ? m_Battery.dOpenWh + BATT_EWMA_ALPHA * (dWh - m_Battery.dOpenWh) : dWh;
+    else if(nMove == SHUT_MOVE_CLOSE)
+        m_Battery.dCloseWh = m_Battery.dCloseWh > 0.0 ? m_Battery.dCloseWh + BATT_EWMA_ALPHA * (dWh - m_Battery.dCloseWh) : dWh;
+
+    if(dRestVolts > 0.0) {
+        // the battery went up despite the move, it was charged since the last one
+        dRise = dRestVolts - m_Battery.dRestVolts;
+        if(m_Battery.dRestVolts > 0.0 && dRise > BATT_CHARGE_RISE) {
+            m_Battery.nCharges++;
+            dHours = (dTime - m_Battery.dRestTime) / 3600.0;
+            if(dHours > 0.0)
+                m_Battery.dChargeRate = m_Battery.dChargeRate > 0.0 ? m_Battery.dChargeRate + BATT_EWMA_ALPHA * (dRise / dHours - m_Battery.dChargeRate) : dRise / dHours;
             if (m_bDebugLog) {
-                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::isFindHomeComplete] Not moving and not at home !!!\n");
+                snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::addShutterMove] battery charged %3.2f V -> %3.2f V after %3.2f Wh, %3.3f V/h\n", m_Battery.dRestVolts, dRestVolts, m_Battery.dWhSinceCharge, m_Battery.dChargeRate);
                 m_pLogger->out(m_szLogBuffer);
             }
-            if(m_nHomingTries == 0) {
-                bComplete = false;
-                m_nHomingTries = 1;
-                gotoAzimuth(m_dHomeAz);
-            }
-            else {
-                bComplete = false;
-                m_bHomed = false;
-                m_bParked = false;
-                nErr = ERR_CMDFAILED;
+            m_Battery.dWhSinceCharge = 0.0;
+            m_BatteryPoints.clear();
+        }
+        m_Battery.dWhSinceCharge += dWh;
+        m_Battery.dRestVolts = dRestVolts;
+        m_Battery.dRestTime = dTime;
+        Point.dTime = dTime;
+        Point.dWhSinceCharge = m_Battery.dWhSinceCharge;
+        Point.dRestVolts = dRestVolts;
+        m_BatteryPoints.push_back(Point);
+        if(m_BatteryPoints.size() > BATT_MAX_POINTS)
+            m_BatteryPoints.erase(m_BatteryPoints.begin());
+    }
+    else
+        m_Battery.dWhSinceCharge += dWh;
+
+    predictShutterBattery();
+}
+
+// Least squares line of the resting voltage against the energy used since the last charge, extrapolated to the
+// empty voltage. Until there are enough points the remaining energy comes from the voltage range and capacity.
+void CDomePro::predictShutterBattery()
+{
+    size_t i;
+    size_t nPoints;
+    double dSumX = 0.0;
+    double dSumY = 0.0;
+    double dSumXX = 0.0;
+    double dSumXY = 0.0;
+    double dDenom;
+    double dSlope;
+    double dIntercept;
+    double dCycleWh;
+    bool bAlert;
+
+    nPoints = m_BatteryPoints.size();
+    m_Battery.bCurveFit = false;
+    if(nPoints >= BATT_MIN_POINTS) {
+        for(i = 0; i < nPoints; i++) {
+            dSumX += m_BatteryPoints[i].dWhSinceCharge;
+            dSumY += m_BatteryPoints[i].dRestVolts;
+            dSumXX += m_BatteryPoints[i].dWhSinceCharge * m_BatteryPoints[i].dWhSinceCharge;
+            dSumXY += m_BatteryPoints[i].dWhSinceCharge * m_BatteryPoints[i].dRestVolts;
+        }
+        dDenom = nPoints * dSumXX - dSumX * dSumX;
+        if(dDenom > 1e-9) {
+            dSlope = (nPoints * dSumXY - dSumX * dSumY) / dDenom;
+            dIntercept = (dSumY - dSlope * dSumX) / nPoints;
+            if(dSlope < 0.0) {
+                m_Battery.dRemainingWh = (dIntercept - m_Battery.dEmptyVolts) / -dSlope - m_Battery.dWhSinceCharge;
+                m_Battery.bCurveFit = true;
             }
         }
     }
+    if(!m_Battery.bCurveFit) {
+        if(m_Battery.dRestVolts > 0.0)
+            m_Battery.dRemainingWh = m_Battery.dCapacityWh * std::min(1.0, (m_Battery.dRestVolts - m_Battery.dEmptyVolts) / (m_Battery.dFullVolts - m_Battery.dEmptyVolts));
+        else
+            m_Battery.dRemainingWh = m_Battery.dCapacityWh - m_Battery.dWhSinceCharge;
+    }
+    m_Battery.dRemainingWh = std::max(0.0, m_Battery.dRemainingWh);
 
-    return nErr;
+    // a cycle is an open and a close
+    if(m_Battery.dOpenWh > 0.0 && m_Battery.dCloseWh > 0.0)
+        dCycleWh = m_Battery.dOpenWh + m_Battery.dCloseWh;
+    else
+        dCycleWh = 2.0 * std::max(m_Battery.dOpenWh, m_Battery.dCloseWh);
+    if(dCycleWh <= 0.0) {
+        m_Battery.dCyclesLeft = -1.0;
+        m_Battery.bAlert = false;
+        return;
+    }
+    m_Battery.dCyclesLeft = m_Battery.dRemainingWh / dCycleWh;
+
+    bAlert = m_Battery.dCyclesLeft < m_Battery.dAlertCycles;
+    if(bAlert != m_Battery.bAlert) {
+        m_Battery.bAlert = bAlert;
+        // dispatched at the end of the I/O thread pass
+        m_Events.publish(DOME_EVT_BATTERY_LOW, bAlert ? 1 : 0, bAlert ? 0 : 1, 0, 0.0);
+        m_StatusPage.setBatteryLow(bAlert);
+        if (m_bDebugLog) {
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::predictShutterBattery] %s : %3.1f cycles left (%3.2f Wh, %3.2f Wh per cycle, resting %3.2f V)\n", bAlert ? "battery low, park the shutter at the charger" : "battery ok", m_Battery.dCyclesLeft, m_Battery.dRemainingWh, dCycleWh, m_Battery.dRestVolts);
+            m_pLogger->out(m_szLogBuffer);
+        }
+    }
 }
 
+// called with m_EngineMutex held, rebuilds the averages and the curve since the last charge from the history file
+// (the rotated one first)
+int CDomePro::readShutterBatteryHistory(const char *pszFile)
+{
+    int nErr;
 
-int CDomePro::isLearningCPRComplete(bool &bComplete)
+    m_Battery.nMoves = 0;
+    m_Battery.dOpenWh = 0.0;
+    m_Battery.dCloseWh = 0.0;
+    m_Battery.dWhSinceCharge = 0.0;
+    m_Battery.dRestVolts = 0.0;
+    m_Battery.dRestTime = 0.0;
+    m_Battery.nCharges = 0;
+    m_Battery.dChargeRate = 0.0;
+    m_Battery.bAlert = false;
+    m_BatteryPoints.clear();
+
+    readShutterBatteryFile((std::string(pszFile) + BATT_HISTORY_OLD_SUFFIX).c_str());
+    nErr = readShutterBatteryFile(pszFile);
+    predictShutterBattery();
+    return nErr;
+}
+
+// called with m_EngineMutex held
+int CDomePro::readShutterBatteryFile(const char *pszFile)
 {
-    int nErr = DP2_OK;
-    int nMode;
-    int nSteps;
+    FILE *pFile;
+    char szLine[SERIAL_BUFFER_SIZE * 2];
+    char szMove[16];
+    double dTime, dWh, dRestVolts;
+    int nMove;
 
-    if(!m_bIsConnected)
-        return NOT_CONNECTED;
+    pFile = fopen(pszFile, "r");
+    if(!pFile)
+        return COMMAND_FAILED;
 
-    nErr = getDomeAzMoveMode(nMode);
-    if(nErr) {
-        killDomeAzimuthMovement();
-        m_bCalibrating = false;
-        // restore previous value as there was an error
-        m_nNbStepPerRev = m_nNbStepPerRev_save;
+    while(fgets(szLine, sizeof(szLine), pFile)) {
+        if(szLine[0] == '#')
+            continue;
+        if(sscanf(szLine, "%lf %15s %lf %*f %*f %*f %lf", &dTime, szMove, &dWh, &dRestVolts) != 4)
+            continue;
+        for(nMove = SHUT_MOVE_OTHER; nMove > SHUT_MOVE_NONE; nMove--)
+            if(!strcmp(szMove, s_szShutterMove[nMove]))
+                break;
+        if(nMove == SHUT_MOVE_NONE)
+            continue;
+        addShutterMove(dTime, nMove, dWh, dRestVolts);
     }
+    fclose(pFile);
+    return DP2_OK;
+}
 
-    if(nMode == GAUGING)
-    {
-        bComplete = false;
-        return nErr;
+// called with m_EngineMutex held, the history only needs to go back to the last charges so the file is
+// rotated once it reaches BATT_HISTORY_MAX_SIZE, the previous one is replaced.
+void CDomePro::rotateShutterBatteryHistory()
+{
+    FILE *pFile;
+    long nSize;
+    std::string sOld;
+
+    pFile = fopen(m_sBatteryFile.c_str(), "r");
+    if(!pFile)
+        return;
+    fseek(pFile, 0, SEEK_END);
+    nSize = ftell(pFile);
+    fclose(pFile);
+    if(nSize < BATT_HISTORY_MAX_SIZE)
+        return;
+
+    sOld = m_sBatteryFile + BATT_HISTORY_OLD_SUFFIX;
+    remove(sOld.c_str());
+    rename(m_sBatteryFile.c_str(), sOld.c_str());
+}
+
+#pragma mark - multi-pass CPR calibration
+
+void CDomePro::setCprCalibration(int nPasses, double dMaxSigma)
+{
+    if(nPasses >= 2)
+        m_nCprCalPasses = nPasses;
+    if(dMaxSigma > 0.0)
+        m_dCprCalMaxSigma = dMaxSigma;
+}
+
+void CDomePro::getCprCalibration(CprCalibration &Cal)
+{
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
+    Cal = m_CprCal;
+}
+
+// must be called with m_EngineMutex held
+void CDomePro::addGaugePass(bool bRight, int nSteps)
+{
+    if(bRight)
+        m_CprSamplesRight.push_back(nSteps);
+    else
+        m_CprSamplesLeft.push_back(nSteps);
+    m_CprCal.nDone++;
+
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::addGaugePass] pass %d/%d %s : %d\n", m_CprCal.nDone, m_CprCal.nPasses, bRight?"right":"left", nSteps);
+        m_pLogger->out(m_szLogBuffer);
     }
 
-    // Gauging is done. let's read the value
-    if(m_nLearning == RIGHT) {
-        nErr = getDomeAzGaugeRight(nSteps);
-        m_nRightCPR = nSteps;
-        }
-    else {
-        nErr = getDomeAzGaugeLeft(nSteps);
-        m_nLeftCPR = nSteps;
+    if(m_CprCal.nDone < m_CprCal.nPasses) {
+        m_Op.nTries = 0;
+        setOperationState(OP_STATE_START, 0);
+        return;
     }
-    if(nErr) {
-        killDomeAzimuthMovement();
-        m_bCalibrating = false;
-        m_nLearning = 0;
-        return nErr;
+    computeCprCalibration();
+    setOperationState(OP_STATE_DONE, 0);
+}
+
+// Reject the outliers of one direction using its median absolute deviation.
+// Returns the number of samples kept, their mean and the sum of their squared deviations to the mean.
+int CDomePro::filterCprSamples(const std::vector<int> &Samples, double &dMean, double &dSumSqDev)
+{
+    std::vector<double> Sorted(Samples.begin(), Samples.end());
+    std::vector<double> Deviations;
+    double dMedian;
+    double dLimit;
+    double dSum = 0;
+    int nKept = 0;
+    size_t i;
+
+    dMean = 0;
+    dSumSqDev = 0;
+    if(Samples.empty())
+        return 0;
+
+    std::sort(Sorted.begin(), Sorted.end());
+    dMedian = Sorted[Sorted.size()/2];
+    for(i = 0; i < Sorted.size(); i++)
+        Deviations.push_back(fabs(Sorted[i] - dMedian));
+    std::sort(Deviations.begin(), Deviations.end());
+    // identical passes give a 0 MAD, still allow a tick of jitter
+    dLimit = std::max(CPR_CAL_OUTLIER_K * 1.4826 * Deviations[Deviations.size()/2], 1.0);
+
+    for(i = 0; i < Samples.size(); i++) {
+        if(fabs(Samples[i] - dMedian) > dLimit)
+            continue;
+        dSum += Samples[i];
+        nKept++;
     }
-    bComplete = true;
-    return nErr;
+    dMean = dSum / nKept;
+    for(i = 0; i < Samples.size(); i++) {
+        if(fabs(Samples[i] - dMedian) > dLimit)
+            continue;
+        dSumSqDev += (Samples[i] - dMean) * (Samples[i] - dMean);
+    }
+    return nKept;
 }
 
-int CDomePro::isPassingHomeComplete(bool &bComplete)
+// Outliers are rejected per direction, the CPR is the average of the right and left means (as "Set CPR from
+// Gauged" does), the spread is the pooled standard deviation of both directions. The CPR is only written if
+// the spread is small enough.
+void CDomePro::computeCprCalibration()
 {
-    int nErr = DP2_OK;
-    bComplete = false;
-    nErr = getDomeLimits();
-    if(nErr) {
-        return nErr;
+    double dMeanRight, dMeanLeft;
+    double dSqRight, dSqLeft;
+    int nRight, nLeft;
+    int nDof;
+    int nCpr;
+
+    nRight = filterCprSamples(m_CprSamplesRight, dMeanRight, dSqRight);
+    nLeft = filterCprSamples(m_CprSamplesLeft, dMeanLeft, dSqLeft);
+
+    m_CprCal.bCommitted = false;
+    m_CprCal.nRejected = (int)(m_CprSamplesRight.size() + m_CprSamplesLeft.size()) - nRight - nLeft;
+    if(nRight && nLeft) {
+        m_CprCal.dMean = (dMeanRight + dMeanLeft) / 2.0;
+        m_CprCal.dAsymmetry = dMeanRight - dMeanLeft;
     }
-    if(m_nAtHomeSwitchState != ACTIVE)
-        bComplete = true;
+    else {
+        m_CprCal.dMean = nRight ? dMeanRight : dMeanLeft;
+        m_CprCal.dAsymmetry = 0.0;
+    }
+    // one mean per direction, a single sample in each leaves nothing to measure the spread with
+    nDof = nRight + nLeft - (nRight ? 1 : 0) - (nLeft ? 1 : 0);
+    m_CprCal.dSigma = -1.0;
+    if(nDof > 0)
+        m_CprCal.dSigma = sqrt((dSqRight + dSqLeft) / nDof);
+
+    // the gauge readings changed m_nNbStepPerRev, go back to the previous value unless we commit a new one.
+    m_nNbStepPerRev = m_nNbStepPerRev_save;
+    if(nDof > 0 && m_CprCal.dSigma <= m_dCprCalMaxSigma) {
+        nCpr = (int)floor(0.5 + m_CprCal.dMean);
+        if(setDomeAzCPR(nCpr) == DP2_OK) {
+            getDomeAzCPR(m_nNbStepPerRev);
+            m_CprCal.bCommitted = true;
+        }
+    }
+    m_CprCal.nCpr = m_nNbStepPerRev;
 
-    return nErr;
+    if (m_bDebugLog) {
+        snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::computeCprCalibration] mean = %3.2f, sigma = %3.2f, asymmetry = %3.2f, rejected = %d, committed = %s\n", m_CprCal.dMean, m_CprCal.dSigma, m_CprCal.dAsymmetry, m_CprCal.nRejected, m_CprCal.bCommitted?"Yes":"No");
+        m_pLogger->out(m_szLogBuffer);
+    }
 }
 
-
 #pragma mark - Getter / Setter
 
 int CDomePro::setHomeAz(double dAz)
@@ -1012,24 +3817,31 @@ int CDomePro::setParkAz(double dAz)
 
 double CDomePro::getCurrentAz()
 {
-    if(m_bIsConnected)
-        getDomeAzPosition(m_dCurrentAzPosition);
+    double dAz;
+
+    // a roll-off roof has no azimuth to read
+    if(m_bIsConnected && getModelPolicy().bAzimuth && pollAzPosition(dAz) == DP2_OK)
+        return dAz;
 
     return m_dCurrentAzPosition;
 }
 
 double CDomePro::getCurrentEl()
 {
-    if(m_bIsConnected)
-        getDomeEl(m_dCurrentElPosition);
+    double dEl;
+
+    if(m_bIsConnected && getDomeEl(dEl) == DP2_OK)
+        return dEl;
 
     return m_dCurrentElPosition;
 }
 
 int CDomePro::getCurrentShutterState()
 {
-    if(m_bIsConnected)
-        getDomeShutterStatus(m_nShutterState);
+    int nState;
+
+    if(m_bIsConnected && pollShutterStatus(nState) == DP2_OK)
+        return nState;
 
     return m_nShutterState;
 }
@@ -1067,11 +3879,22 @@ void CDomePro::setDebugLog(bool bEnable)
 
 #pragma mark - dome communication
 
-int CDomePro::domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen)
+int CDomePro::domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen, bool *pbNack)
 {
     int nErr = DP2_OK;
     unsigned char szResp[SERIAL_BUFFER_SIZE];
     unsigned long ulBytesWrite;
+    double dStart;
+    double dEnd;
+
+    // a timeout or a write error isn't a NACK
+    if(pbNack)
+        *pbNack = false;
+    // the I/O thread and TheSkyX calls share the port
+    std::lock_guard<std::mutex> lock(m_IoMutex);
+    // closed by Disconnect while we were waiting
+    if(!m_pSerx->isConnected())
+        return NOT_CONNECTED;
 
     m_pSerx->purgeTxRx();
     if (m_bDebugLog) {
@@ -1087,16 +3910,29 @@ int CDomePro::domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen
     fflush(Logfile);
 #endif
 
+    dStart = getTimeStamp();
     nErr = m_pSerx->writeFile((void *)pszCmd, strlen(pszCmd), ulBytesWrite);
     m_pSerx->flushTx();
-    if(nErr)
+    if(nErr) {
+        if(m_bDiagHistory)
+            m_DiagHistory.addCommand(dStart, 0.0, false);
         return nErr;
+    }
     // read response
     if (m_bDebugLog) {
         snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::domeCommand] Getting response.\n");
         m_pLogger->out(m_szLogBuffer);
     }
     nErr = readResponse(szResp, SERIAL_BUFFER_SIZE);
+    if(pbNack)
+        *pbNack = nErr == DP2_BAD_CMD_RESPONSE && szResp[0] == ATCL_NACK;
+    if(m_bDiagHistory) {
+        dEnd = getTimeStamp();
+        m_DiagHistory.addCommand(dEnd, dEnd - dStart, nErr == DP2_OK);
+    }
+    // whatever the answer, anything but a get may have changed the dome state
+    if(strncmp(pszCmd, "!DG", 3))
+        invalidatePoll();
     if(nErr) {
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
@@ -1190,8 +4026,13 @@ int CDomePro::readResponse(unsigned char *pszRespBuffer, int nBufferLen)
 //	Convert pdAz to number of ticks from home.
 void CDomePro::AzToTicks(double pdAz, int &ticks)
 {
-    if(!m_nNbStepPerRev)
+    if(!m_nNbStepPerRev && getModelPolicy().bAzimuth)
         getDomeAzCPR(m_nNbStepPerRev);
+    // no encoder (roll-off roof) or no CPR read yet
+    if(m_nNbStepPerRev <= 0) {
+        ticks = 0;
+        return;
+    }
 
     ticks = (int) floor(0.5 + (pdAz - m_dHomeAz) * m_nNbStepPerRev / 360.0);
     while (ticks > m_nNbStepPerRev) ticks -= m_nNbStepPerRev;
@@ -1202,8 +4043,13 @@ void CDomePro::AzToTicks(double pdAz, int &ticks)
 // Convert ticks from home to Az
 void CDomePro::TicksToAz(int ticks, double &pdAz)
 {
-    if(!m_nNbStepPerRev)
+    if(!m_nNbStepPerRev && getModelPolicy().bAzimuth)
         getDomeAzCPR(m_nNbStepPerRev);
+    // no encoder (roll-off roof) or no CPR read yet, the last known azimuth
+    if(m_nNbStepPerRev <= 0) {
+        pdAz = m_dCurrentAzPosition;
+        return;
+    }
 
     pdAz = m_dHomeAz + (ticks * 360.0 / m_nNbStepPerRev);
     while (pdAz < 0) pdAz += 360;
@@ -1273,6 +4119,11 @@ int CDomePro::getDomeAzPosition(double &dDomeAz)
     if(m_bCalibrating)
         return nErr;
 
+    if(!getModelPolicy().bAzimuth) {
+        dDomeAz = m_dCurrentAzPosition;
+        return nErr;
+    }
+
     nErr = domeCommand("!DGap;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
@@ -1283,6 +4134,12 @@ int CDomePro::getDomeAzPosition(double &dDomeAz)
     TicksToAz(nTmp, dDomeAz);
 
     m_dCurrentAzPosition = dDomeAz;
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        m_Poll.dAz = dDomeAz;
+        setPollAnswer(POLL_AZ_POSITION);
+    }
+    m_StatusPage.setAz(dDomeAz);
 
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
     ltime = time(NULL);
@@ -1305,7 +4162,7 @@ int CDomePro::getDomeEl(double &dDomeEl)
     if(!m_bIsConnected)
         return NOT_CONNECTED;
 
-    getDomeShutterStatus(nShutterState);
+    pollShutterStatus(nShutterState);
 
     if(!m_bShutterOpened || !m_bHasShutter)
     {
@@ -1355,6 +4212,15 @@ int CDomePro::getDomeShutterStatus(int &nState)
         return nErr;
 
     nShutterState = (int)strtoul(szResp, NULL, 16);
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        m_Poll.nShutterState = nShutterState;
+        setPollAnswer(POLL_SHUTTER_STATUS);
+    }
+    m_nShutterState = nShutterState;
+    m_StatusPage.setShutterState(nShutterState);
+    if(m_Events.setShutterState(nShutterState))
+        wakeIoThread();
 
     switch(nShutterState) {
         case OPEN:
@@ -1365,6 +4231,15 @@ int CDomePro::getDomeShutterStatus(int &nState)
             m_bShutterOpened = false;
             break;
 
+        // moves we didn't start (hand controller, auto close)
+        case OPENING:
+        case CLOSING:
+        case SHUT_GOTO:
+            m_bShutterOpened = false;
+            if(m_nShutterMove == SHUT_MOVE_NONE)
+                armShutterBattery(nShutterState == OPENING ? SHUT_MOVE_OPEN : (nShutterState == CLOSING ? SHUT_MOVE_CLOSE : SHUT_MOVE_OTHER));
+            break;
+
         case NOT_FITTED:
             m_bShutterOpened = false;
             m_bHasShutter = false;
@@ -1373,6 +4248,7 @@ int CDomePro::getDomeShutterStatus(int &nState)
             m_bShutterOpened = false;
 
     }
+    m_dCurrentElPosition = m_bShutterOpened ? 90.0 : 0.0;
 
     nState = nShutterState;
 
@@ -1421,6 +4297,25 @@ int CDomePro::isDomeAtHome(bool &bAtHome)
     return nErr;
 }
 
+int CDomePro::isDomeAtPark(bool &bAtPark)
+{
+    int nErr = DP2_OK;
+
+    if(!m_bIsConnected)
+        return NOT_CONNECTED;
+
+    bAtPark = false;
+
+    nErr = getDomeLimits();
+    if(nErr) {
+        return nErr;
+    }
+    if(m_nAtParkSate == ACTIVE)
+        bAtPark = true;
+
+    return nErr;
+}
+
 #pragma mark - DomePro getter/setter
 
 int CDomePro::setDomeAzCPR(int nValue)
@@ -1468,7 +4363,7 @@ int CDomePro::getRightCPR()
 }
 
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::setDomeMaxVel(int nValue)
 {
     int nErr = DP2_OK;
@@ -1482,18 +4377,18 @@ int CDomePro::setDomeMaxVel(int nValue)
         nValue = 0x7C;
 
     snprintf(szCmd, SERIAL_BUFFER_SIZE, "!DSmv0x%08X;", nValue);
-    nErr = domeCommand(szCmd, szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_MAX_VEL, szCmd, szResp, SERIAL_BUFFER_SIZE);
 
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::getDomeMaxVel(int &nValue)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
 
-    nErr = domeCommand("!DGmv;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_MAX_VEL, "!DGmv;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -1502,7 +4397,7 @@ int CDomePro::getDomeMaxVel(int &nValue)
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::setDomeAccel(int nValue)
 {
     int nErr = DP2_OK;
@@ -1516,18 +4411,18 @@ int CDomePro::setDomeAccel(int nValue)
         nValue = 0xFF;
 
     snprintf(szCmd, SERIAL_BUFFER_SIZE, "!DSma0x%08X;", nValue);
-    nErr = domeCommand(szCmd, szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_ACCEL, szCmd, szResp, SERIAL_BUFFER_SIZE);
 
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::getDomeAccel(int &nValue)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
 
-    nErr = domeCommand("!DGma;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_ACCEL, "!DGma;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -1570,6 +4465,20 @@ int CDomePro::getDomeAzCoast(int &nValue)
     return nErr;
 }
 
+int CDomePro::getDomeAzTicks(int &nTicks)
+{
+    int nErr = DP2_OK;
+    char szResp[SERIAL_BUFFER_SIZE];
+
+    nErr = domeCommand("!DGap;", szResp, SERIAL_BUFFER_SIZE);
+    if(nErr)
+        return nErr;
+
+    // convert result hex string to long
+    nTicks = (int)strtoul(szResp, NULL, 16);
+    return nErr;
+}
+
 int CDomePro::getDomeAzDiagPosition(int &nValue)
 {
     int nErr = DP2_OK;
@@ -1589,7 +4498,9 @@ int CDomePro::clearDomeAzDiagPosition(void)
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
 
+    std::lock_guard<std::mutex> lock(m_EngineMutex);
     nErr = domeCommand("!DCdp;", szResp, SERIAL_BUFFER_SIZE);
+    m_Slip.bHasBaseline = false;
     return nErr;
 }
 
@@ -1597,6 +4508,9 @@ int CDomePro::getDomeAzMoveMode(int &mode)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
+    int nPrevious;
+    bool bNotify;
+    double dAz;
 
     nErr = domeCommand("!DGam;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
@@ -1626,6 +4540,34 @@ int CDomePro::getDomeAzMoveMode(int &mode)
     else if(strstr(szResp, "Parking")) {
         mode = PARKING;
     }
+    else {
+        mode = NONE;
+        if (m_bDebugLog) {
+            snprintf(m_szLogBuffer,DP2_LOG_BUFFER_SIZE,"[CDomePro::getDomeAzMoveMode] unknown move mode '%.*s'\n", 32, szResp);
+            m_pLogger->out(m_szLogBuffer);
+        }
+        return COMMAND_FAILED;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_PollMutex);
+        // a position read while moving is stale once the dome stops
+        if(mode != m_Poll.nAzMode)
+            m_Poll.dTime[POLL_AZ_POSITION] = 0.0;
+        m_Poll.nAzMode = mode;
+        setPollAnswer(POLL_AZ_MODE);
+    }
+
+    m_StatusPage.setMoveMode(mode);
+    bNotify = m_Events.setMoveMode(mode, nPrevious);
+    // the goto is over, FIXED when it reached the target, AZ_TO when it timed out
+    if(nPrevious == GOTO && (mode == FIXED || mode == AZ_TO) && m_Events.hasSubscribers(DOME_EVT_MASK(DOME_EVT_GOTO_COMPLETE))) {
+        dAz = 0.0;
+        getDomeAzPosition(dAz);
+        bNotify = m_Events.publish(DOME_EVT_GOTO_COMPLETE, mode, nPrevious, 0, dAz);
+    }
+    if(bNotify)
+        wakeIoThread();
     return nErr;
 }
 
@@ -1659,6 +4601,10 @@ int CDomePro::getDomeLimits(void)
     m_nAtHomeSwitchState = (nLimits & BitHomeSwitchState ? ACTIVE : INNACTIVE);
     m_nAtParkSate = (nLimits & BitAtPark ? ACTIVE : INNACTIVE);
 
+    m_StatusPage.setLimits(nLimits);
+    if(m_Events.setLimits(nLimits))
+        wakeIoThread();
+
 #if defined ATCL_DEBUG && ATCL_DEBUG >= 2
     ltime = time(NULL);
     timestamp = asctime(localtime(&ltime));
@@ -1853,6 +4799,8 @@ int CDomePro::GoToDomeShutter1_ADC(int nADC)
 
     snprintf(szCmd, SERIAL_BUFFER_SIZE, "!DSg10x%08X;", nADC);
     nErr = domeCommand(szCmd, szResp, SERIAL_BUFFER_SIZE);
+    if(!nErr)
+        armShutterBattery(SHUT_MOVE_OTHER);
 
     return nErr;
 }
@@ -1868,6 +4816,8 @@ int CDomePro::GoToDomeShutter2_ADC(int nADC)
 
     snprintf(szCmd, SERIAL_BUFFER_SIZE, "!DSg20x%08X;", nADC);
     nErr = domeCommand(szCmd, szResp, SERIAL_BUFFER_SIZE);
+    if(!nErr)
+        armShutterBattery(SHUT_MOVE_OTHER);
 
     return nErr;
 }
@@ -2040,7 +4990,9 @@ int CDomePro::getDomeSupplyVoltageAzimuthL(double &dVolts)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dVolts = (double)ulTmp * 0.00812763;
+    dVolts = m_SensorCal.toValue(TLM_AZ_SUPPLY, (int32_t)ulTmp);
+    addDiagSample(TLM_AZ_SUPPLY, (int32_t)ulTmp);
+    m_StatusPage.setSupplyVolts(TLM_AZ_SUPPLY, dVolts);
 
     return nErr;
 }
@@ -2058,7 +5010,9 @@ int CDomePro::getDomeSupplyVoltageShutterL(double &dVolts)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dVolts = (double)ulTmp * 0.00812763;
+    dVolts = m_SensorCal.toValue(TLM_SHUTTER_SUPPLY, (int32_t)ulTmp);
+    addDiagSample(TLM_SHUTTER_SUPPLY, (int32_t)ulTmp);
+    m_StatusPage.setSupplyVolts(TLM_SHUTTER_SUPPLY, dVolts);
     
     return nErr;
 }
@@ -2077,7 +5031,7 @@ int CDomePro::getDomeSupplyVoltageAzimuthM(double &dVolts)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dVolts = (double)ulTmp * 0.00812763;
+    dVolts = CAdcConvert::convert(ADC_SUPPLY_VOLTS, (int32_t)ulTmp);
 
     return nErr;
 }
@@ -2097,19 +5051,19 @@ int CDomePro::getDomeSupplyVoltageShutterM(double &dVolts)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dVolts = (double)ulTmp * 0.00812763;
+    dVolts = CAdcConvert::convert(ADC_SUPPLY_VOLTS, (int32_t)ulTmp);
 
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::getDomeRotationSenseAnalog(double &dVolts)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
     unsigned int ulTmp;
 
-    nErr = domeCommand("!DGra;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_ROTATION_SENSE, "!DGra;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -2405,7 +5359,7 @@ int CDomePro::getShutterAutoCloseEnabled(bool &bEnable)
 }
 
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::setDomeShutOpAtHome(bool bEnable)
 {
     int nErr = DP2_OK;
@@ -2417,12 +5371,12 @@ int CDomePro::setDomeShutOpAtHome(bool bEnable)
     else
         snprintf(szCmd, SERIAL_BUFFER_SIZE, "!DSshNo;");
 
-    nErr = domeCommand(szCmd, szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_SHUT_OP_AT_HOME, szCmd, szResp, SERIAL_BUFFER_SIZE);
 
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::getDomeShutOpAtHome(bool &bEnable)
 {
     int nErr = DP2_OK;
@@ -2430,7 +5384,7 @@ int CDomePro::getDomeShutOpAtHome(bool &bEnable)
 
     bEnable = false;
 
-    nErr = domeCommand("!DGsh;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_SHUT_OP_AT_HOME, "!DGsh;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
     if(strstr(szResp,"Yes"))
@@ -2471,13 +5425,13 @@ int CDomePro::getDomePowerGoodInputState(bool &bEnable)
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::getLastDomeShutdownEvent(void)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
 
-    nErr = domeCommand("!DGlv;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_SHUTDOWN_EVENT, "!DGlv;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -2529,6 +5483,8 @@ int CDomePro::getDomeLinkErrCnt(int &nErrCnt)
 
     // convert result hex string to long
     nErrCnt = (int)strtoul(szResp, NULL, 16);
+    updateLinkHealth(nErrCnt);
+    addDiagSample(TLM_LINK_ERRORS, nErrCnt);
 
     return nErr;
 }
@@ -2545,13 +5501,13 @@ int CDomePro::clearDomeLinkErrCnt(void)
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::getDomeComErr(void)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
 
-    nErr = domeCommand("!DGce;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_COM_ERR, "!DGce;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -2560,13 +5516,13 @@ int CDomePro::getDomeComErr(void)
     return nErr;
 }
 
-#pragma mark not yet implemented in the firmware
+#pragma mark not in every firmware (DomeCapabilities)
 int CDomePro::clearDomeComErr(void)
 {
     int nErr = DP2_OK;
     char szResp[SERIAL_BUFFER_SIZE];
 
-    nErr = domeCommand("!DCce;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_COM_ERR, "!DCce;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -2581,6 +5537,7 @@ int CDomePro::openDomeShutter1(void)
     nErr = domeCommand("!DSo1;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
+    armShutterBattery(SHUT_MOVE_OPEN);
 
     return nErr;
 }
@@ -2593,6 +5550,7 @@ int CDomePro::openDomeShutter2(void)
     nErr = domeCommand("!DSo2;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
+    armShutterBattery(SHUT_MOVE_OPEN);
 
     return nErr;
 }
@@ -2605,6 +5563,7 @@ int CDomePro::closeDomeShutter1(void)
     nErr = domeCommand("!DSc1;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
+    armShutterBattery(SHUT_MOVE_CLOSE);
 
     return nErr;
 }
@@ -2617,6 +5576,7 @@ int CDomePro::closeDomeShutter2(void)
     nErr = domeCommand("!DSc2;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
+    armShutterBattery(SHUT_MOVE_CLOSE);
 
     return nErr;
 }
@@ -2745,10 +5705,8 @@ int CDomePro::getDomeShutterMotorADC(double &dVolts)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dVolts = (double)ulTmp / 1023.0 * 3.3;
-    dVolts = (dVolts - 1.721) / 0.068847;
-    if (dVolts < 0.0)
-        dVolts = 0.0;
+    dVolts = m_SensorCal.toValue(TLM_SHUTTER_MOTOR, (int32_t)ulTmp);
+    addDiagSample(TLM_SHUTTER_MOTOR, (int32_t)ulTmp);
 
     return nErr;
 }
@@ -2766,10 +5724,8 @@ int CDomePro::getDomeAzimuthMotorADC(double &dVolts)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dVolts = (double)ulTmp / 1023.0 * 3.3;
-    dVolts = (dVolts - 1.721) / 0.068847;
-    if (dVolts < 0.0)
-        dVolts = 0.0;
+    dVolts = m_SensorCal.toValue(TLM_AZ_MOTOR, (int32_t)ulTmp);
+    addDiagSample(TLM_AZ_MOTOR, (int32_t)ulTmp);
 
     return nErr;
 }
@@ -2787,8 +5743,8 @@ int CDomePro::getDomeShutterTempADC(double &dTemp)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dTemp = (double)ulTmp / 1023.0 * 3.3 - 0.5;
-    dTemp = dTemp / 0.01;
+    dTemp = m_SensorCal.toValue(TLM_SHUTTER_TEMP, (int32_t)ulTmp);
+    addDiagSample(TLM_SHUTTER_TEMP, (int32_t)ulTmp);
 
     return nErr;
 }
@@ -2806,8 +5762,8 @@ int CDomePro::getDomeAzimuthTempADC(double &dTemp)
     // convert result hex string
     ulTmp = (int)strtoul(szResp, NULL, 16);
 
-    dTemp = (double)ulTmp / 1023.0 * 3.3 - 0.5;
-    dTemp = dTemp / 0.01;
+    dTemp = m_SensorCal.toValue(TLM_AZ_TEMP, (int32_t)ulTmp);
+    addDiagSample(TLM_AZ_TEMP, (int32_t)ulTmp);
 
     return nErr;
 }
@@ -2823,7 +5779,7 @@ int CDomePro::setDomeShutOpOnHome(bool bEnabled)
     else
         snprintf(szCmd, SERIAL_BUFFER_SIZE, "!DSshNo;");
 
-    nErr = domeCommand(szCmd, szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_SHUT_OP_AT_HOME, szCmd, szResp, SERIAL_BUFFER_SIZE);
 
     return nErr;
 }
@@ -2835,7 +5791,7 @@ int CDomePro::getDomeShutOpOnHome(bool &bEnabled)
 
     bEnabled = false;
 
-    nErr = domeCommand("!DGsh;", szResp, SERIAL_BUFFER_SIZE);
+    nErr = capabilityCommand(CAP_SHUT_OP_AT_HOME, "!DGsh;", szResp, SERIAL_BUFFER_SIZE);
     if(nErr)
         return nErr;
 
@@ -22,12 +22,29 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "../../licensedinterfaces/sberrorx.h"
 #include "../../licensedinterfaces/serxinterface.h"
 #include "../../licensedinterfaces/loggerinterface.h"
+#include "../../licensedinterfaces/theskyxfacadefordriversinterface.h"
+
+#include "domegeometry.h"
+#include "domeplanner.h"
+#include "telemetryring.h"
+#include "telemetryarchive.h"
+#include "adcconvert.h"
+#include "sensorcalibration.h"
+#include "domeevents.h"
+#include "domestatus.h"
+#include "diaghistory.h"
 
 // #define ATCL_DEBUG 2   // define this to have log files, 1 = bad stuff only, 2 and up.. full debug
 
@@ -59,13 +76,100 @@
 #define BitHomeSwitchState          (0x1)<<9
 #define BitAtPark                   (0x1)<<10
 
+// predictive slaving
+#define SIDEREAL_RATE           15.041067   // arc-second per second
+#define SLAVING_STEP            15.0        // seconds between trajectory samples
+#define SLAVING_HORIZON         7200.0      // how far ahead we project the track, in seconds
+#define SLAVING_MARGIN          1.0         // degrees kept between the beam and the slit edge
+
+// operation engine
+#define OP_FAST_POLL_MS         250         // I/O thread period while an operation is running
+#define OP_SLOW_POLL_MS         1000        // I/O thread period when idle
+#define OP_MAX_TRIES            2
+#define OP_SETTLE_TIME          1.0         // seconds before we trust the move mode after a command
+#define OP_HOMING_TIMEOUT       300.0
+#define OP_PARKING_TIMEOUT      300.0
+#define OP_CLEARING_TIMEOUT     60.0
+#define OP_GAUGING_TIMEOUT      600.0
+
+// multi-pass CPR calibration
+#define CPR_CAL_PASSES          6
+#define CPR_CAL_MAX_SIGMA       5.0         // ticks
+#define CPR_CAL_OUTLIER_K       3.0         // per direction rejection threshold in robust sigmas (1.4826 * MAD)
+
+// home switch drift monitor
+#define DRIFT_POLL_MS           100         // I/O thread period while the dome rotates
+#define DRIFT_THRESHOLD         2.0         // degrees of drift before we resync the encoder
+#define DRIFT_MAX_BRACKET       1.0         // degrees, ignore edges we didn't catch precisely enough (at most half the threshold)
+#define DRIFT_EWMA_ALPHA        0.5
+
+// encoder slip detector (position vs diagnostic counter)
+#define SLIP_THRESHOLD          0.2         // degrees
+#define SLIP_IDLE_PERIOD        5.0         // seconds between checks when the dome is not rotating
+#define SLIP_BIN_SIZE           10          // degrees
+#define SLIP_BIN_COUNT          36
+#define SLIP_MAX_EVENTS         100
+
+// azimuth motor current signature analysis
+#define CURRENT_BIN_SIZE        5           // degrees
+#define CURRENT_BIN_COUNT       72
+#define CURRENT_SETTLE_TIME     1.5         // seconds, skip the acceleration and the goto deceleration
+#define CURRENT_MIN_BASELINE    30          // samples in a bin before it is checked
+#define CURRENT_SPIKE_SIGMA     4.0         // sample counted as a spike (and kept out of the baseline)
+#define CURRENT_FLAG_SIGMA      3.0         // recent average flagged against the baseline
+#define CURRENT_MIN_SIGMA       0.05        // Amps, floor for the baseline deviation
+#define CURRENT_RECENT_ALPHA    0.2
+
+// shutter battery energy accounting, the shutter supply is only read while the shutter moves
+#define BATT_SAMPLE_PERIOD      0.5         // seconds
+#define BATT_START_GRACE        3.0         // seconds for the shutter status to show the move
+#define BATT_MAX_MOVE_TIME      300.0       // seconds
+#define BATT_REST_DELAY         5.0         // seconds after a move before reading the resting voltage
+#define BATT_CHARGE_RISE        0.1         // Volts, resting voltage rise seen as a charge
+#define BATT_EWMA_ALPHA         0.3
+#define BATT_MIN_POINTS         4           // resting voltages since the last charge before the curve is used
+#define BATT_MAX_POINTS         200
+#define BATT_CAPACITY_WH        200.0       // usable energy between the full and empty voltages
+#define BATT_FULL_VOLTS         12.7
+#define BATT_EMPTY_VOLTS        11.8
+#define BATT_ALERT_CYCLES       3.0
+#define BATT_HISTORY_MAX_SIZE   262144      // bytes, the history file is rotated after that
+#define BATT_HISTORY_OLD_SUFFIX ".old"
+
+// adaptive polling of the status TheSkyX asks for, answers younger than the period are reused
+#define POLL_AZ_FAST_PERIOD     0.5         // seconds, dome rotating
+#define POLL_AZ_SLOW_PERIOD     2.0         // seconds, dome idle
+#define POLL_SHUTTER_FAST_PERIOD    1.0     // seconds, shutter moving
+#define POLL_SHUTTER_SLOW_PERIOD    5.0     // seconds, shutter idle
+#define POLL_LINK_PERIOD        10.0        // seconds between RF link error checks
+#define POLL_MAX_BACKOFF        8           // shutter periods multiplier when the RF link has errors
+
+// state change events, limits and shutter reads done by the I/O thread when someone subscribed
+#define EVT_MOVING_PERIOD       0.5         // seconds, dome or shutter moving
+#define EVT_IDLE_PERIOD         5.0         // seconds
+
+// telemetry sampler
+#define TLM_FAST_PERIOD         1.0         // seconds, motor currents
+#define TLM_SLOW_PERIOD         10.0        // seconds, voltages, temperatures, link errors
+#define TLM_MAX_READS           4           // per I/O thread pass
+#define TLM_ALL_CHANNELS        ((1u << TLM_CHANNEL_COUNT) - 1)
+#define DIAG_SAMPLE_PERIOD      10.0        // seconds, shortest period when the telemetry only feeds the open diag dialog
+
+// settings read in the background for the dialogs
+#define SETTINGS_MAX_READS      6           // per I/O thread pass
+
 
 enum DomePro2_Module {MODULE_AZ = 0, MODULE_SHUT, MODULE_UKNOWN};
 enum DomePro2_Motor {ON_OFF = 0, STEP_DIR, MOTOR_UNKNOWN};
 enum DomePro2_Polarity {POSITIVE = 0, NEGATIVE, POLARITY_UKNOWN};
 enum DomeAzMoveMode {FIXED = 0, LEFT, RIGHT, GOTO, HOMING, AZ_TO, GAUGING, PARKING, NONE, CLEARING_RIGHT, CLEARING_LEFT};
 
-enum DomeProErrors {DP2_OK=0, NOT_CONNECTED, DP2_CANT_CONNECT, DP2_BAD_CMD_RESPONSE, COMMAND_FAILED, INVALID_COMMAND};
+enum DomeProErrors {DP2_OK=0, NOT_CONNECTED, DP2_CANT_CONNECT, DP2_BAD_CMD_RESPONSE, COMMAND_FAILED, INVALID_COMMAND, NOT_SUPPORTED};
+
+// optional firmware features, the commands some firmware versions answer with a NACK
+enum DomeCapabilities {CAP_MAX_VEL = 0, CAP_ACCEL, CAP_ROTATION_SENSE, CAP_SHUT_OP_AT_HOME, CAP_SHUTDOWN_EVENT, CAP_COM_ERR, CAP_COUNT};
+#define CAP_BIT(n)      (1u << (n))
+#define CAP_PROBE_NACKS 2               // NACKs in a row before the connect probe calls a feature missing
 
 enum DomeProShutterState {OPEN=0, CLOSED, OPENING, CLOSING, SHUTTER_ERROR, NO_COM,
                         SHUT1_OPEN_TO, SHUT1_CLOSE_TO, SHUT2_OPEN_TO, SHUT2_CLOSE_TO,
@@ -76,6 +180,194 @@ enum DomeProShutterState {OPEN=0, CLOSED, OPENING, CLOSING, SHUTTER_ERROR, NO_CO
 
 enum SwitchState { INNACTIVE = 0, ACTIVE};
 
+enum DomeOperation {OP_NONE = 0, OP_HOMING, OP_PARKING, OP_LEARN_CPR_RIGHT, OP_LEARN_CPR_LEFT, OP_CALIBRATE_CPR};
+enum DomeOperationState {OP_STATE_IDLE = 0, OP_STATE_START, OP_STATE_CLEAR_HOME, OP_STATE_WAIT, OP_STATE_BACK_OUT, OP_STATE_DONE, OP_STATE_FAILED};
+
+typedef struct {
+    int     nOperation;
+    int     nState;
+    int     nRun;           // bumped on start and cancel, a step that finds it changed stops
+    int     nTries;
+    int     nError;
+    double  dStateTime;     // when we entered the current state
+    double  dDeadline;      // state timeout
+} DomeOperationCtx;
+
+// the home switch has some width so the edge is seen at a different position in each direction
+enum DriftDirection {DRIFT_RIGHT = 0, DRIFT_LEFT, DRIFT_DIR_COUNT};
+
+typedef struct {
+    bool    bEnabled;
+    bool    bCorrect;           // resync automatically
+    double  dThreshold;         // degrees
+    bool    bHasSample;
+    int     nLastSwitchState;
+    int     nLastTicks;
+    int     nHomeTicks;
+    bool    bHasBaseline[DRIFT_DIR_COUNT];
+    double  dBaseline[DRIFT_DIR_COUNT];     // edge position relative to home, in ticks
+    bool    bHasDrift;
+    double  dDrift;             // filtered drift, in ticks
+    int     nEdges;
+    int     nCorrections;
+    double  dLastEdgeTime;
+} HomeDriftMonitor;
+
+typedef struct {
+    double  dTime;
+    double  dAz;            // where the slip was detected
+    double  dMagnitude;     // degrees, positive when the position counter got ahead of the diag counter
+} SlipEvent;
+
+typedef struct {
+    bool    bEnabled;
+    double  dThreshold;     // degrees
+    bool    bHasBaseline;
+    double  dBaseline;      // position - diag counter, in ticks
+    double  dLastOffset;    // ticks, relative to the baseline
+    double  dLastAz;
+    double  dLastCheck;
+    int     nEvents;
+    int     nBinCount[SLIP_BIN_COUNT];
+    double  dBinMagnitude[SLIP_BIN_COUNT];
+} SlipDetector;
+
+// running statistics of the azimuth motor current in one azimuth bin and direction
+typedef struct {
+    int     nCount;         // baseline samples (Welford)
+    double  dMean;
+    double  dM2;
+    double  dRecent;        // exponential average of the last samples
+    int     nSpikes;
+    bool    bFlagged;
+} CurrentBin;
+
+typedef struct {
+    bool    bEnabled;
+    bool    bHasSample;
+    int     nLastTicks;
+    int     nSamples;
+    int     nFlagged;
+} CurrentAnalyzer;
+
+enum PollQueries {POLL_AZ_MODE = 0, POLL_AZ_POSITION, POLL_SHUTTER_STATUS, POLL_QUERY_COUNT};
+
+typedef struct {
+    double  dAzFastPeriod;
+    double  dAzSlowPeriod;
+    double  dShutterFastPeriod;
+    double  dShutterSlowPeriod;
+    int     nShutterBackoff;    // 1 with a clean RF link, doubled each time new link errors show up
+    bool    bHasLinkErrors;
+    int     nLinkErrors;
+    double  dLastLinkCheck;
+    double  dTime[POLL_QUERY_COUNT];    // when the answer was read, 0 when a command made it stale
+    int     nReads[POLL_QUERY_COUNT];
+    int     nCached[POLL_QUERY_COUNT];
+    int     nAzMode;
+    double  dAz;
+    int     nShutterState;
+} PollScheduler;
+
+// controller settings shown in the settings dialogs, grouped by dialog and read in this order
+enum DomeSetting {
+    // main dialog
+    SETTING_AZ_MOTOR_POLARITY = 0, SETTING_AZ_OCP_LIMIT, SETTING_AZ_CPR, SETTING_AZ_COAST, SETTING_AZ_ENCODER_POLARITY,
+    SETTING_AT_HOME, SETTING_HOME_DIRECTION, SETTING_HOME_AZ, SETTING_PARK_AZ,
+    // shutter dialog, the single shutter mode before the sequencing that depends on it
+    SETTING_MODEL, SETTING_SINGLE_SHUTTER, SETTING_OPEN_FIRST, SETTING_CLOSE_FIRST, SETTING_SHUT_OP_ON_HOME,
+    SETTING_HOME_WITH_SHUTTER_CLOSE, SETTING_SHUT1_LIMIT_CHECK, SETTING_SHUT2_LIMIT_CHECK, SETTING_SHUT1_OCP_LIMIT, SETTING_SHUT2_OCP_LIMIT,
+    // timeouts dialog
+    SETTING_AZ_TIMEOUT_ENABLED, SETTING_AZ_TIMEOUT, SETTING_SHUT1_TIMEOUT, SETTING_SHUT2_TIMEOUT, SETTING_SHUT_ODIR_TIMEOUT,
+    SETTING_CLOSE_ON_CLIENT_TIMEOUT, SETTING_CLOSE_CLIENT_TIMEOUT, SETTING_CLOSE_ON_LINK_TIMEOUT, SETTING_SHUTTER_AUTO_CLOSE,
+    SETTING_COUNT
+};
+
+#define SETTING_BIT(n)          (1u << (n))
+#define SETTINGS_RANGE(a, b)    ((SETTING_BIT(b) << 1) - SETTING_BIT(a))
+#define SETTINGS_MAIN           SETTINGS_RANGE(SETTING_AZ_MOTOR_POLARITY, SETTING_PARK_AZ)
+#define SETTINGS_SHUTTER        SETTINGS_RANGE(SETTING_MODEL, SETTING_SHUT2_OCP_LIMIT)
+#define SETTINGS_TIMEOUTS       SETTINGS_RANGE(SETTING_AZ_TIMEOUT_ENABLED, SETTING_SHUTTER_AUTO_CLOSE)
+
+typedef struct {
+    uint32_t    nValid;         // read at least once, the values are the last known ones
+    uint32_t    nPending;       // asked for and not read yet
+    uint32_t    nFailed;        // the last read failed
+    double      dValue[SETTING_COUNT];      // bools as 0 or 1, the controller values otherwise
+    char        szModel[SERIAL_BUFFER_SIZE];
+} DomeSettings;
+
+#define SETTINGS_ALL            (SETTING_BIT(SETTING_COUNT) - 1)
+#define SETTINGS_SEQUENCING     (SETTING_BIT(SETTING_OPEN_FIRST) | SETTING_BIT(SETTING_CLOSE_FIRST))
+#define SETTINGS_SHUTTER2       (SETTING_BIT(SETTING_SINGLE_SHUTTER) | SETTINGS_SEQUENCING | SETTING_BIT(SETTING_SHUT2_LIMIT_CHECK) | \
+                                 SETTING_BIT(SETTING_SHUT2_OCP_LIMIT) | SETTING_BIT(SETTING_SHUT2_TIMEOUT))
+#define SETTINGS_AZIMUTH        (SETTINGS_MAIN | SETTING_BIT(SETTING_SHUT_OP_ON_HOME) | SETTING_BIT(SETTING_HOME_WITH_SHUTTER_CLOSE) | \
+                                 SETTING_BIT(SETTING_AZ_TIMEOUT_ENABLED) | SETTING_BIT(SETTING_AZ_TIMEOUT))
+
+// What applies to a DomePro2 model, selected by getModel at connect. The I/O thread, the completion checks and
+// the dialogs only issue the commands and enable the controls of the installed hardware.
+typedef struct {
+    int         nModel;         // CLASSIC_DOME, CLAMSHELL, ROR, 0 for an unknown model
+    const char  *pszName;
+    bool        bAzimuth;       // rotates : azimuth polls, goto, homing, CPR, drift/slip/current monitors
+    uint32_t    nTelemetry;     // TelemetryChannels bits worth sampling
+    uint32_t    nSettings;      // DomeSetting bits that apply
+} DomeModelPolicy;
+
+enum ShutterMove {SHUT_MOVE_NONE = 0, SHUT_MOVE_OPEN, SHUT_MOVE_CLOSE, SHUT_MOVE_OTHER};
+
+// resting voltage of the shutter battery against the energy used since the last charge
+typedef struct {
+    double  dTime;
+    double  dWhSinceCharge;
+    double  dRestVolts;
+} BatteryPoint;
+
+typedef struct {
+    bool    bEnabled;
+    double  dCapacityWh;
+    double  dFullVolts;
+    double  dEmptyVolts;
+    double  dAlertCycles;
+    // last (or current) move, V.I integrated while the shutter moves
+    int     nMove;
+    bool    bSampling;
+    bool    bSeenMoving;
+    double  dMoveStart;
+    double  dLastSample;
+    double  dLastPower;
+    double  dMoveSeconds;
+    double  dMoveWh;
+    double  dMoveAh;
+    double  dMinVolts;
+    double  dPeakAmps;
+    double  dRestDue;           // 0 when no resting voltage is pending
+    // history and prediction
+    int     nMoves;
+    double  dOpenWh;            // filtered energy per move
+    double  dCloseWh;
+    double  dWhSinceCharge;
+    double  dRestVolts;
+    double  dRestTime;
+    int     nCharges;
+    double  dChargeRate;        // V/h, filtered
+    bool    bCurveFit;          // prediction from the measured discharge curve (else from the voltage range)
+    double  dRemainingWh;
+    double  dCyclesLeft;        // -1 until an open and a close were measured
+    bool    bAlert;
+} ShutterBattery;
+
+typedef struct {
+    int     nPasses;        // requested number of gauging passes, alternating right and left
+    int     nDone;
+    int     nRejected;      // outliers
+    double  dMean;
+    double  dSigma;         // -1 without a second kept sample in one direction, the spread can't be checked
+    double  dAsymmetry;     // mean right - mean left
+    bool    bCommitted;     // CPR was written to the controller
+    int     nCpr;           // CPR in the controller at the end of the calibration
+} CprCalibration;
+
 class CDomePro
 {
 public:
@@ -88,6 +380,7 @@ public:
 
     void    SetSerxPointer(SerXInterface *p) { m_pSerx = p; }
     void    setLogger(LoggerInterface *pLogger) { m_pLogger = pLogger; };
+    void    setTheSkyXFacade(TheSkyXFacadeForDriversInterface *pTheSkyX) { m_pTheSkyX = pTheSkyX; };
 
     // Dome movement commands
     int syncDome(double dAz, double dEl);
@@ -103,11 +396,119 @@ public:
     int goHome();
     int learnAzimuthCprRight();
     int learnAzimuthCprLeft();
+    int calibrateAzimuthCpr();
+
+    // predictive slaving
+    void    setPredictiveSlaving(bool bEnable);
+    bool    isPredictiveSlavingEnabled();
+    void    setSlitWidth(double dSlitWidth);
+    void    setSlavingLeadTime(double dSeconds);
+    void    setAzRotationSpeed(double dDegPerSec);
+    int     slaveToTarget(double dAz, double dEl);
+    int     updatePredictiveSlaving();
+    int     getNextSlavingMove(double &dSecondsToMove, double &dNextAz);
+
+    // dome / mount geometry
+    void    setDomeGeometry(bool bEnable, double dDomeRadius, double dMountEast, double dMountNorth, double dMountUp, double dGemOffset);
+    int     getDomeAzForPointing(double dAz, double dEl, double &dDomeAz);
+
+    // observation plan, uses the rotation speed/acceleration measured on the previous gotos
+    int     planObservation(const std::vector<DomePlanTarget> &Targets, double dStartTime, std::vector<DomePlanStep> &Plan);
+    void    getRotationModel(double &dSpeed, double &dAccel, int &nSamples);
+
+    // home switch drift monitor
+    void    setDriftCorrection(bool bEnable, bool bCorrect, double dThreshold);
+    void    getDriftStatus(double &dDrift, int &nEdges, int &nCorrections);
+
+    // encoder slip detector
+    void    setSlipDetection(bool bEnable, double dThreshold);
+    void    getSlipEvents(std::vector<SlipEvent> &Events);
+    void    getSlipHistogram(std::vector<int> &Counts, std::vector<double> &Magnitudes);
+    void    clearSlipHistory();
+
+    // azimuth motor current signature analysis, nDir is a DriftDirection
+    void    setCurrentAnalysis(bool bEnable, const char *pszFile);
+    void    getCurrentBins(int nDir, std::vector<CurrentBin> &Bins);
+    void    getCurrentStatus(int &nSamples, int &nFlagged);
+    void    clearCurrentAnalysis();
+    int     writeCurrentReport(const char *pszFile);
+    const char *getCurrentReportFile();
+
+    // telemetry sampler, records go to a memory mapped ring file (see telemetryring.h)
+    void    setTelemetry(bool bEnable, const char *pszFile, int nRecords);
+    void    setTelemetryPeriod(int nChannel, double dSeconds);
+    const char *getTelemetryFile();
+    int     getTelemetryRaw(int nChannel, int &nRaw);
+    void    getTelemetryConversion(double *dGain, double *dOffset);
+    // per-site sensor correction (value * gain + offset), nChannel is a TelemetryChannels
+    void    setSensorCalibration(int nChannel, double dGain, double dOffset);
+    void    convertTelemetry(int nChannel, const int32_t *pRaw, double *pValues, size_t nCount);
+    // long term archive of the same samples, times in seconds since 1970
+    void    setTelemetryArchive(bool bEnable, const char *pszFile);
+    const char *getTelemetryArchiveFile();
+    int     getTelemetryRange(int nChannel, double dStart, double dEnd, double &dMin, double &dMax, int &nCount);
+
+    // in memory history for the diagnostic dialog (see diaghistory.h), fed by the reads the driver does anyway,
+    // windows in seconds back from now
+    void    setDiagHistory(bool bEnable);
+    // while the diag dialog is open the telemetry channels are also sampled for it, even without telemetry files
+    void    setDiagSampling(bool bEnable);
+    bool    getDiagSummary(int nChannel, double dWindow, DiagSummary &Summary);
+    void    getDiagLinkSummary(double dWindow, DiagLinkSummary &Summary);
+    void    getDiagSparkline(int nChannel, double dWindow, char *pszSpark, int nMaxLen);
+    uint32_t getDiagVersion();
+
+    // live status page in shared memory for the companion processes (see domestatus.h)
+    void    setStatusPage(bool bEnable, const char *pszName);
+    const char *getStatusPageName();
+    int     getStatusPage(DomeStatus &Status);
+
+    // for the broker (domebroker.h), any ATCL command, the answer without the ';'
+    int     sendRawCommand(const char *pszCmd, char *pszResult, int nResultMaxLen);
+
+    // shutter battery energy accounting and remaining open/close cycles
+    void    setShutterBattery(bool bEnable, const char *pszFile);
+    void    setShutterBatteryModel(double dCapacityWh, double dFullVolts, double dEmptyVolts, double dAlertCycles);
+    void    getShutterBatteryStatus(ShutterBattery &Battery);
+    const char *getShutterBatteryFile();
+
+    // adaptive polling, periods in seconds
+    void    setPollPeriods(double dAzFast, double dAzSlow, double dShutterFast, double dShutterSlow);
+    void    getPollRates(double &dAzPeriod, double &dShutterPeriod, int &nShutterBackoff);
+    void    getPollStatus(PollScheduler &Poll);
+    // rotation and link checks done by the I/O thread on its own, off when the broker polls for everyone
+    void    setBackgroundPolls(bool bEnable);
+
+    // settings cache for the dialogs, requestSettings queues a read of the DomeSetting bits by the I/O thread,
+    // writeSettings writes a batch of them and updates the cache
+    void    requestSettings(uint32_t nSettings);
+    void    getSettings(DomeSettings &Settings);
+    int     writeSettings(uint32_t nSettings, const double *pdValues);
+
+    // state change events (see domeevents.h), returns the subscription id
+    int     subscribeEvents(DomeEventCallback pCallback, void *pUserData, uint32_t nMask);
+    int     subscribeEventQueue(CDomeEventQueue *pQueue, uint32_t nMask);
+    void    unsubscribeEvents(int nId);
+
+    // multi-step operations (homing, parking, CPR learning) run by the I/O thread
+    int     getOperationStatus(int &nOperation, int &nState);
+    bool    isOperationRunning();
+
+    // firmware capabilities, probed at connect once per firmware version. The calls to a feature the firmware
+    // doesn't have return NOT_SUPPORTED without a serial exchange. setKnownCapabilities hands back a map saved
+    // for a firmware version, the probe is skipped when the controller still runs that version.
+    void    setKnownCapabilities(const char *pszFirmware, uint32_t nUnsupported);
+    bool    getCapabilities(std::string &sFirmware, uint32_t &nUnsupported);   // false until probed
+    bool    isSupported(int nCapability);
+    bool    isSettingSupported(int nSetting);
 
     // Dome informations
     int getFirmwareVersion(char *version, int strMaxLen);
     int getModel(char *model, int strMaxLen);
     int getModelType();
+    // policy of the connected model, the unknown model one (everything applies) until getModel
+    const DomeModelPolicy &getModelPolicy();
+    static const DomeModelPolicy &modelPolicy(int nModel);
     int getModuleType(int &nModuleType);
     int getDomeAzMotorType(int &nMotorType);
 
@@ -128,9 +529,11 @@ public:
     int isUnparkComplete(bool &complete);
     int isFindHomeComplete(bool &complete);
     int isLearningCPRComplete(bool &complete);
+    int isCalibratingCPRComplete(bool &complete);
     int isPassingHomeComplete(bool &bComplete);
 
     int isDomeAtHome(bool &bAtHome);
+    int isDomeAtPark(bool &bAtPark);
     // movements
     int isDomeMoving(bool &bIsMoving);
     int setDomeLeftOn(void);
@@ -146,11 +549,17 @@ public:
     
     int setParkAz(double dAz);
 
+    // through the poll cache, the controller is only read when the last answer is too old
     double getCurrentAz();
     double getCurrentEl();
 
     int getCurrentShutterState();
 
+    // last known values, no lock and no serial traffic, the I/O thread keeps them at the polling periods
+    double getLastAz() { return m_dCurrentAzPosition; };
+    double getLastEl() { return m_dCurrentElPosition; };
+    int getLastShutterState() { return m_nShutterState; };
+
     void setShutterAngleCalibration(int nShutter1OpenAngle, int nShutter1rOpenAngleADC,
                                     int nShutter1CloseAngle, int nShutter1CloseAngleADC,
                                     int nShutter2OpenAngle, int nShutter2rOpenAngleADC,
@@ -172,13 +581,15 @@ public:
     int             getDomeAzCPR(int &nValue);
     int             getLeftCPR();
     int             getRightCPR();
+    void            setCprCalibration(int nPasses, double dMaxSigma);
+    void            getCprCalibration(CprCalibration &Cal);
 
     // controller low level data
     int             getDomeSupplyVoltageAzimuthL(double &dVolts);
     int             getDomeSupplyVoltageShutterL(double &dVolts);
     int             getDomeSupplyVoltageAzimuthM(double &dVolts);
     int             getDomeSupplyVoltageShutterM(double &dVolts);
-    // not yet implemented in the firmware
+    // not in every firmware (DomeCapabilities)
     int             getDomeRotationSenseAnalog(double &dVolts);
     //
     int             setDomeShutter1_OpTimeOut(int nTimeout);
@@ -206,7 +617,7 @@ public:
     int             getDomeAzDiagPosition(int &nValue);
     int             clearDomeAzDiagPosition(void);
 
-    // not yet implemented in the firmware
+    // not in every firmware (DomeCapabilities)
     int             setDomeShutOpAtHome(bool bEnable);
     int             getDomeShutOpAtHome(bool &bEnable);
     //
@@ -214,7 +625,7 @@ public:
     int             getDomeShutdownInputState(bool &bEnable);
     int             getDomePowerGoodInputState(bool &bEnable);
 
-    // not yet implemented in the firmware
+    // not in every firmware (DomeCapabilities)
     int             getLastDomeShutdownEvent(void);
     //
     int             setDomeSingleShutterMode(bool bEnable);
@@ -223,7 +634,7 @@ public:
     int             getDomeLinkErrCnt(int &nErrCnt);
     int             clearDomeLinkErrCnt(void);
 
-    // not yet implemented in the firmware
+    // not in every firmware (DomeCapabilities)
     int             getDomeComErr(void);
     int             clearDomeComErr(void);
     //
@@ -265,7 +676,7 @@ public:
 
 protected:
 
-    int             domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen);
+    int             domeCommand(const char *pszCmd, char *pszResult, int nResultMaxLen, bool *pbNack = NULL);
     int             readResponse(unsigned char *pszRespBuffer, int bufferLen);
 
     // conversion functions
@@ -276,7 +687,7 @@ protected:
 
     // DomePro getter / setter
 
-    // not yet implemented in the firmware
+    // not in every firmware (DomeCapabilities)
     int             setDomeMaxVel(int nValue);
     int             getDomeMaxVel(int &nValue);
     int             setDomeAccel(int nValue);
@@ -290,6 +701,7 @@ protected:
 
     int             setDomeHomeAzimuth(int nPos);
     int             getDomeHomeAzimuth(int &nPos);
+    int             getDomeAzTicks(int &nTicks);
     int             homeDomeAzimuth(void);
     int             goToDomeAzimuth(int nPos);
     int             goToDomeElevation(int nADC1, int nADC2);
@@ -319,15 +731,88 @@ protected:
 
 
     void            hexdump(const char *inputData, char *outBuffer, int size);
-    
+
+    // predictive slaving
+    double          getTimeStamp();
+    void            HaDecToAltAz(double dHa, double dDec, double &dAz, double &dAlt);
+    void            AltAzToHaDec(double dAz, double dAlt, double &dHa, double &dDec);
+    double          slitHalfWidthAt(double dAlt);
+    double          trackHa(double dSeconds);
+    void            trackAzAlt(double dSeconds, double &dAz, double &dAlt);
+    void            trackDomeAz(double dSeconds, double &dDomeAz, double &dAlt);
+    void            updateTrackPierSide();
+    bool            isBeamCovered(double dDomeAz, double dFrom, double dTo);
+    void            planSlavingMove(double dDomeAz, double &dTargetAz);
+    void            scheduleNextSlavingMove(double dDomeAz);
+    bool            relockSlaving(std::unique_lock<std::mutex> &lock, int nRun);
+
+    // I/O thread and operation engine
+    void            startIoThread();
+    void            stopIoThread();
+    void            ioThread();
+    void            wakeIoThread();
+    int             startOperation(int nOperation);
+    void            cancelOperation();
+    int             isOperationComplete(int nOperation, bool &bComplete);
+    bool            runOperationStep();
+    void            setOperationState(int nState, double dTimeout);
+    void            retryOperation(int nErr);
+    void            failOperation(int nErr);
+    bool            isStateTimedOut();
+    bool            isStateSettled();
+    bool            relockOperation(std::unique_lock<std::mutex> &lock, int nRun);
+    void            stepHoming(std::unique_lock<std::mutex> &lock);
+    void            stepParking(std::unique_lock<std::mutex> &lock);
+    void            stepLearnCpr(std::unique_lock<std::mutex> &lock);
+    bool            pollAzRotation();
+    void            updateDriftMonitor(bool bRotating);
+    void            resetDriftMonitor();
+    void            correctDrift();
+    void            updateSlipDetector(bool bRotating);
+    void            updateCurrentAnalyzer(bool bRotating);
+    bool            isGotoStopping(double dAz);
+    void            addCurrentSample(int nDir, double dAz, double dAmps);
+    int             readCurrentBaseline(const char *pszFile);
+    void            openTelemetry();
+    void            updateTelemetry();
+    void            addDiagSample(int nChannel, int32_t nRaw);
+    void            probeCapabilities();
+    int             capabilityCommand(int nCapability, const char *pszCmd, char *pszResult, int nResultMaxLen);
+    double          pollPeriod(int nQuery);
+    bool            isPollFresh(int nQuery);
+    void            setPollAnswer(int nQuery);
+    void            invalidatePoll();
+    int             pollAzMoveMode(int &nMode);
+    int             pollAzPosition(double &dAz);
+    int             pollShutterStatus(int &nState);
+    void            updateLinkHealth(int nLinkErrors);
+    void            updatePollRates();
+    void            updateLastState();
+    void            updateEvents(bool bRotating);
+    bool            updateSettings();
+    int             readSetting(int nSetting, double &dValue, char *pszText, int nTextMaxLen);
+    int             writeSetting(int nSetting, double dValue);
+    void            armShutterBattery(int nMove);
+    bool            updateShutterBattery();
+    void            finishShutterMove(double dNow);
+    void            addShutterMove(double dTime, int nMove, double dWh, double dRestVolts);
+    void            predictShutterBattery();
+    int             readShutterBatteryHistory(const char *pszFile);
+    int             readShutterBatteryFile(const char *pszFile);
+    void            rotateShutterBatteryHistory();
+    void            addGaugePass(bool bRight, int nSteps);
+    int             filterCprSamples(const std::vector<int> &Samples, double &dMean, double &dSumSqDev);
+    void            computeCprCalibration();
+
     SerXInterface*  m_pSerx;
     LoggerInterface*    m_pLogger;
-    bool            m_bDebugLog;
+    TheSkyXFacadeForDriversInterface*   m_pTheSkyX;
+    std::atomic<bool>   m_bDebugLog;
 
-    bool            m_bIsConnected;
-    bool            m_bHomed;
-    bool            m_bParked;
-    bool            m_bCalibrating;
+    std::atomic<bool>   m_bIsConnected;
+    std::atomic<bool>   m_bHomed;
+    std::atomic<bool>   m_bParked;
+    std::atomic<bool>   m_bCalibrating;
 
     int             m_nNbStepPerRev;
     int             m_nNbStepPerRev_save;
@@ -338,8 +823,9 @@ protected:
 
     double          m_dHomeAz;
     double          m_dParkAz;
-    double          m_dCurrentAzPosition;
-    double          m_dCurrentElPosition;
+    // last known position and shutter state, read without any lock
+    std::atomic<double> m_dCurrentAzPosition;
+    std::atomic<double> m_dCurrentElPosition;
     double          m_dGotoAz;
     double          m_dGotoEl;
     double          m_dAzCoast;
@@ -347,12 +833,14 @@ protected:
     int             m_nGotoTries;
 
     char            m_szFirmwareVersion[SERIAL_BUFFER_SIZE];
-    int             m_nShutterState;
+    std::atomic<int>    m_nShutterState;
     bool            m_bHasShutter;
-    bool            m_bShutterOpened;
+    std::atomic<bool>   m_bShutterOpened;
 
-    char            m_szLogBuffer[DP2_LOG_BUFFER_SIZE];
-    int             m_nModel;
+    // the I/O thread logs too
+    static thread_local char m_szLogBuffer[DP2_LOG_BUFFER_SIZE];
+    std::atomic<int>    m_nModel;
+    std::atomic<const DomeModelPolicy *>    m_pModelPolicy;
     int             m_nModuleType;
     int             m_nMotorType;
     int             m_nMotorPolarity;
@@ -382,6 +870,100 @@ protected:
 
     bool            m_bShutterGotoEnabled;
 
+    // predictive slaving
+    std::atomic<bool> m_bPredictiveSlaving;
+    std::atomic<bool> m_bTracking;
+    int             m_nSlaveRun;        // bumped on each new target, under m_EngineMutex
+    double          m_dSlitWidth;
+    double          m_dSlavingLeadTime;
+    std::atomic<double> m_dAzRotationSpeed;
+    double          m_dLatitude;
+    double          m_dTrackHa;
+    double          m_dTrackDec;
+    double          m_dTrackTime;
+    double          m_dNextMoveTime;
+    double          m_dNextMoveAz;
+
+    // dome / mount geometry
+    bool            m_bUseGeometry;
+    CDomeGeometry   m_Geometry;
+
+    // measured rotation model, with the goto target and timing under m_GotoMutex
+    CDomeRotationModel  m_RotationModel;
+    bool            m_bTimingGoto;
+    double          m_dGotoStartTime;
+    double          m_dGotoStartAz;
+
+    // I/O thread and operation engine
+    std::thread     m_IoThread;
+    std::mutex      m_IoMutex;          // one command/response on the serial port at a time
+    std::mutex      m_EngineMutex;      // operation and slaving state
+    std::mutex      m_WakeMutex;
+    std::mutex      m_PollMutex;        // poll cache, never held across a command
+    std::mutex      m_GotoMutex;        // goto target, timing and rotation model, never held across a command
+    std::condition_variable m_WakeCond;
+    std::atomic<bool>   m_bIoThreadRunning;
+    bool            m_bWake;
+    DomeOperationCtx    m_Op;
+
+    HomeDriftMonitor    m_Drift;
+    SlipDetector        m_Slip;
+    std::vector<SlipEvent>  m_SlipEvents;
+
+    bool            m_bAzRotating;
+    double          m_dAzRotationStart;
+    CurrentAnalyzer m_Current;
+    std::vector<CurrentBin> m_CurrentBins[DRIFT_DIR_COUNT];
+    std::string     m_sCurrentFile;
+
+    // telemetry sampler, the ring file is only used by the I/O thread
+    CTelemetryRing  m_TelemetryRing;
+    CTelemetryArchive   m_TelemetryArchive;
+    bool            m_bTelemetryEnabled;
+    bool            m_bTelemetryArchive;
+    std::string     m_sTelemetryArchiveFile;
+    bool            m_bTelemetryChanged;
+    std::string     m_sTelemetryFile;
+    int             m_nTelemetryRecords;
+    double          m_dTelemetryPeriod[TLM_CHANNEL_COUNT];
+    double          m_dTelemetryLast[TLM_CHANNEL_COUNT];
+    TelemetryRecord m_TelemetryRecord;
+    CSensorCalibration  m_SensorCal;
+    std::atomic<bool>   m_bDiagHistory;
+    std::atomic<bool>   m_bDiagSampling;
+    CDiagHistory    m_DiagHistory;
+
+    std::atomic<uint32_t>   m_nUnsupported;     // CAP_BIT of the features the connect probe found missing
+    std::mutex      m_CapsMutex;
+    std::string     m_sCapsFirmware;    // firmware version m_nUnsupported is for, empty until probed
+
+    PollScheduler   m_Poll;
+    std::atomic<bool>   m_bBackgroundPolls;
+
+    std::mutex      m_SettingsMutex;    // settings cache, never held across a command
+    DomeSettings    m_Settings;
+
+    CDomeEvents     m_Events;
+    double          m_dLastEventPoll;
+
+    CDomeStatusPage m_StatusPage;
+    bool            m_bStatusPage;
+    std::string     m_sStatusPageName;
+
+    // shutter battery, m_nShutterMove is set by the shutter commands and sampled by the I/O thread
+    std::atomic<int>    m_nShutterMove;
+    ShutterBattery  m_Battery;
+    std::vector<BatteryPoint>   m_BatteryPoints;
+    std::string     m_sBatteryFile;
+    std::string     m_sRotationFile;
+
+    // multi-pass CPR calibration
+    int             m_nCprCalPasses;
+    double          m_dCprCalMaxSigma;
+    std::vector<int>    m_CprSamplesRight;
+    std::vector<int>    m_CprSamplesLeft;
+    CprCalibration  m_CprCal;
+
 #ifdef ATCL_DEBUG
     std::string     m_sLogfilePath;
     // timestamp for logs
@@ -0,0 +1,284 @@
+//
+//  domestatus.cpp
+//  ATCL Dome X2 plugin
+//
+//  Live dome status page in shared memory.
+
+#include "domestatus.h"
+#include "telemetryring.h"
+
+#include <atomic>
+#include <chrono>
+
+#if defined(SB_WIN_BUILD)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static double statusTime()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+CDomeStatusPage::CDomeStatusPage()
+{
+    memset(&m_Status, 0, sizeof(DomeStatus));
+    m_pPage = NULL;
+    m_bWriter = false;
+#if defined(SB_WIN_BUILD)
+    m_hMapping = NULL;
+#else
+    m_nFd = -1;
+#endif
+}
+
+CDomeStatusPage::~CDomeStatusPage()
+{
+    close();
+}
+
+int CDomeStatusPage::map(const char *pszName, bool bWrite)
+{
+#if defined(SB_WIN_BUILD)
+    if(bWrite)
+        m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)sizeof(DomeStatusPage), pszName);
+    else
+        m_hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, pszName);
+    if(!m_hMapping)
+        return STATUS_SHM_ERROR;
+
+    m_pPage = (DomeStatusPage *)MapViewOfFile(m_hMapping, bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, sizeof(DomeStatusPage));
+    if(!m_pPage) {
+        close();
+        return STATUS_SHM_ERROR;
+    }
+#else
+    struct stat st;
+    void *pMap;
+
+    m_nFd = shm_open(pszName, bWrite ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if(m_nFd < 0)
+        return STATUS_SHM_ERROR;
+
+    if(fstat(m_nFd, &st) != 0) {
+        close();
+        return STATUS_SHM_ERROR;
+    }
+    if((size_t)st.st_size != sizeof(DomeStatusPage)) {
+        // new page or older layout
+        if(!bWrite || ftruncate(m_nFd, (off_t)sizeof(DomeStatusPage)) != 0) {
+            close();
+            return bWrite ? STATUS_SHM_ERROR : STATUS_FORMAT_ERROR;
+        }
+    }
+
+    pMap = mmap(NULL, sizeof(DomeStatusPage), bWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_nFd, 0);
+    if(pMap == MAP_FAILED) {
+        close();
+        return STATUS_SHM_ERROR;
+    }
+    m_pPage = (DomeStatusPage *)pMap;
+#endif
+    m_bWriter = bWrite;
+    return STATUS_OK;
+}
+
+int CDomeStatusPage::create(const char *pszName)
+{
+    int nErr;
+
+    close();
+    nErr = map(pszName, true);
+    if(nErr)
+        return nErr;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    memset(&m_Status, 0, sizeof(DomeStatus));
+#if defined(SB_WIN_BUILD)
+    m_Status.nWriterPid = (uint32_t)GetCurrentProcessId();
+#else
+    m_Status.nWriterPid = (uint32_t)getpid();
+#endif
+    // a reader may still have the previous session mapped, keep the sequence going
+    if(strncmp(m_pPage->szMagic, STATUS_MAGIC, sizeof(m_pPage->szMagic)) ||
+       m_pPage->nVersion != STATUS_VERSION || m_pPage->nStatusSize != sizeof(DomeStatus)) {
+        memset(m_pPage, 0, sizeof(DomeStatusPage));
+        m_pPage->nVersion = STATUS_VERSION;
+        m_pPage->nStatusSize = sizeof(DomeStatus);
+        // magic last so readers never see a half initialised header
+        std::atomic_thread_fence(std::memory_order_release);
+        strncpy(m_pPage->szMagic, STATUS_MAGIC, sizeof(m_pPage->szMagic));
+    }
+    commit();
+    return STATUS_OK;
+}
+
+int CDomeStatusPage::open(const char *pszName)
+{
+    int nErr;
+
+    close();
+    nErr = map(pszName, false);
+    if(nErr)
+        return nErr;
+
+    if(strncmp(m_pPage->szMagic, STATUS_MAGIC, sizeof(m_pPage->szMagic)) ||
+       m_pPage->nVersion != STATUS_VERSION || m_pPage->nStatusSize != sizeof(DomeStatus)) {
+        close();
+        return STATUS_FORMAT_ERROR;
+    }
+    return STATUS_OK;
+}
+
+// the page itself stays so readers see the last status and the disconnection
+void CDomeStatusPage::close()
+{
+#if defined(SB_WIN_BUILD)
+    if(m_pPage)
+        UnmapViewOfFile(m_pPage);
+    if(m_hMapping)
+        CloseHandle(m_hMapping);
+    m_hMapping = NULL;
+#else
+    if(m_pPage)
+        munmap(m_pPage, sizeof(DomeStatusPage));
+    if(m_nFd >= 0)
+        ::close(m_nFd);
+    m_nFd = -1;
+#endif
+    m_pPage = NULL;
+    m_bWriter = false;
+}
+
+// called with m_Mutex held, copies m_Status to the page under the sequence lock
+void CDomeStatusPage::commit()
+{
+    volatile uint32_t *pSeq;
+    uint32_t nSeq;
+
+    pSeq = &((volatile DomeStatusPage *)m_pPage)->nSeq;
+    nSeq = *pSeq;
+    *pSeq = nSeq | 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&m_pPage->Status, &m_Status, sizeof(DomeStatus));
+    std::atomic_thread_fence(std::memory_order_release);
+    *pSeq = (nSeq | 1) + 1;
+}
+
+void CDomeStatusPage::setConnected(bool bConnected, bool bHasShutter)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.nFlags = (bConnected ? STATUS_CONNECTED : 0) | (bHasShutter ? STATUS_HAS_SHUTTER : 0) | (m_Status.nFlags & STATUS_BATTERY_LOW);
+    m_Status.dUpdateTime = statusTime();
+    commit();
+}
+
+void CDomeStatusPage::setBatteryLow(bool bLow)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.nFlags = bLow ? (m_Status.nFlags | STATUS_BATTERY_LOW) : (m_Status.nFlags & ~STATUS_BATTERY_LOW);
+    m_Status.dUpdateTime = statusTime();
+    commit();
+}
+
+void CDomeStatusPage::setAz(double dAz)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.dAz = dAz;
+    m_Status.dAzTime = statusTime();
+    m_Status.dUpdateTime = m_Status.dAzTime;
+    commit();
+}
+
+void CDomeStatusPage::setMoveMode(int nMode)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.nMoveMode = nMode;
+    m_Status.dMoveModeTime = statusTime();
+    m_Status.dUpdateTime = m_Status.dMoveModeTime;
+    commit();
+}
+
+void CDomeStatusPage::setLimits(uint32_t nLimits)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.nLimits = nLimits;
+    m_Status.dLimitsTime = statusTime();
+    m_Status.dUpdateTime = m_Status.dLimitsTime;
+    commit();
+}
+
+void CDomeStatusPage::setShutterState(int nState)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.nShutterState = nState;
+    m_Status.dShutterTime = statusTime();
+    m_Status.dUpdateTime = m_Status.dShutterTime;
+    commit();
+}
+
+// nChannel is TLM_AZ_SUPPLY or TLM_SHUTTER_SUPPLY
+void CDomeStatusPage::setSupplyVolts(int nChannel, double dVolts)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pPage || !m_bWriter)
+        return;
+    m_Status.dUpdateTime = statusTime();
+    if(nChannel == TLM_AZ_SUPPLY) {
+        m_Status.dAzSupplyVolts = dVolts;
+        m_Status.dAzSupplyTime = m_Status.dUpdateTime;
+    }
+    else if(nChannel == TLM_SHUTTER_SUPPLY) {
+        m_Status.dShutterSupplyVolts = dVolts;
+        m_Status.dShutterSupplyTime = m_Status.dUpdateTime;
+    }
+    else
+        return;
+    commit();
+}
+
+int CDomeStatusPage::read(DomeStatus &Status)
+{
+    volatile uint32_t *pSeq;
+    uint32_t nSeq;
+    int i;
+
+    if(!m_pPage)
+        return STATUS_NOT_OPEN;
+
+    // the writer process has its own copy
+    if(m_bWriter) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        Status = m_Status;
+        return STATUS_OK;
+    }
+
+    pSeq = &((volatile DomeStatusPage *)m_pPage)->nSeq;
+    for(i = 0; i < STATUS_READ_TRIES; i++) {
+        nSeq = *pSeq;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(nSeq & 1)
+            continue;
+        memcpy(&Status, (const void *)&m_pPage->Status, sizeof(DomeStatus));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(*pSeq == nSeq)
+            return STATUS_OK;
+    }
+    return STATUS_BUSY;
+}
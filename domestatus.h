@@ -0,0 +1,104 @@
+//
+//  domestatus.h
+//  ATCL Dome X2 plugin
+//
+//  Live dome status page in shared memory (POSIX shm on Linux and macOS, a named file mapping on Windows).
+//  The plugin updates it each time it reads the dome state, companion processes (weather watcher, roof safety,
+//  scheduler) map it read only and get the current state at memory speed without touching the serial port.
+//  This doesn't depend on the X2 interfaces so other programs can use the reader side as is.
+//
+//  The block is protected by a sequence lock : nSeq is odd while the writer updates it, readers copy the status
+//  and retry if nSeq was odd or changed during the copy. nVersion changes when DomeStatus changes layout.
+
+#ifndef __DOME_STATUS__
+#define __DOME_STATUS__
+
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+
+#define STATUS_MAGIC            "DPSTA01"
+#define STATUS_VERSION          1
+#if defined(SB_WIN_BUILD)
+#define STATUS_DEFAULT_NAME     "Local\\DomeProStatus"
+#else
+#define STATUS_DEFAULT_NAME     "/DomeProStatus"
+#endif
+#define STATUS_READ_TRIES       1000
+
+enum StatusPageErrors {STATUS_OK = 0, STATUS_SHM_ERROR, STATUS_FORMAT_ERROR, STATUS_NOT_OPEN, STATUS_BUSY};
+
+// nFlags
+#define STATUS_CONNECTED        0x01
+#define STATUS_HAS_SHUTTER      0x02
+#define STATUS_BATTERY_LOW      0x04        // shutter battery prediction below the alert level
+
+// All times are seconds since 1970, 0 until the value is first read.
+typedef struct {
+    double      dUpdateTime;        // last change of any field
+    uint32_t    nFlags;
+    uint32_t    nWriterPid;
+    double      dAz;                // degrees
+    double      dAzTime;
+    int32_t     nMoveMode;          // DomeAzMoveMode (domepro.h)
+    double      dMoveModeTime;
+    uint32_t    nLimits;            // limit bits (Bit* in domepro.h)
+    double      dLimitsTime;
+    int32_t     nShutterState;      // DomeProShutterState (domepro.h)
+    double      dShutterTime;
+    double      dAzSupplyVolts;
+    double      dAzSupplyTime;
+    double      dShutterSupplyVolts;
+    double      dShutterSupplyTime;
+} DomeStatus;
+
+typedef struct {
+    char        szMagic[8];
+    uint32_t    nVersion;
+    uint32_t    nStatusSize;
+    uint32_t    nSeq;               // odd while the status is being written
+    uint32_t    nReserved;
+    DomeStatus  Status;
+} DomeStatusPage;
+
+class CDomeStatusPage
+{
+public:
+    CDomeStatusPage();
+    ~CDomeStatusPage();
+
+    // writer : creates the page if needed, the status starts empty
+    int     create(const char *pszName);
+    // reader
+    int     open(const char *pszName);
+    void    close();
+    bool    isOpen() { return m_pPage != NULL; };
+
+    // writer updates, they do nothing when the page isn't open
+    void    setConnected(bool bConnected, bool bHasShutter);
+    void    setBatteryLow(bool bLow);
+    void    setAz(double dAz);
+    void    setMoveMode(int nMode);
+    void    setLimits(uint32_t nLimits);
+    void    setShutterState(int nState);
+    void    setSupplyVolts(int nChannel, double dVolts);
+
+    // reader, STATUS_BUSY if the writer kept changing it for STATUS_READ_TRIES tries
+    int     read(DomeStatus &Status);
+
+protected:
+    int     map(const char *pszName, bool bWrite);
+    void    commit();
+
+    std::mutex      m_Mutex;        // writers of this process, the page has a single writer process
+    DomeStatus      m_Status;       // writer's copy
+    DomeStatusPage  *m_pPage;
+    bool            m_bWriter;
+#if defined(SB_WIN_BUILD)
+    void            *m_hMapping;
+#else
+    int             m_nFd;
+#endif
+};
+
+#endif
@@ -0,0 +1,92 @@
+//
+//  domstatus.cpp
+//  ATCL Dome X2 plugin
+//
+//  Command line reader for the live status page published by the plugin.
+//  usage : domstatus [-f] [page_name]
+//  Prints the current dome status, -f keeps printing it each time it changes.
+//  Ages are in seconds since the plugin last read the value from the dome.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "domestatus.h"
+
+static void usage(const char *pszName)
+{
+    fprintf(stderr, "usage : %s [-f] [page_name]\n", pszName);
+    fprintf(stderr, "  -f : follow the status\n");
+    fprintf(stderr, "  page_name : default %s\n", STATUS_DEFAULT_NAME);
+}
+
+static double age(double dNow, double dTime)
+{
+    return dTime == 0.0 ? -1.0 : dNow - dTime;
+}
+
+static void printStatus(const DomeStatus &Status)
+{
+    double dNow;
+
+    dNow = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    printf("%.3f pid %u %s%s%s az %.2f (%.1fs) mode %d (%.1fs) limits %04X (%.1fs) shutter %d (%.1fs) supply %.2fV (%.1fs) %.2fV (%.1fs)\n",
+           Status.dUpdateTime, Status.nWriterPid,
+           (Status.nFlags & STATUS_CONNECTED) ? "connected" : "disconnected",
+           (Status.nFlags & STATUS_HAS_SHUTTER) ? "" : " no shutter",
+           (Status.nFlags & STATUS_BATTERY_LOW) ? " battery low" : "",
+           Status.dAz, age(dNow, Status.dAzTime),
+           Status.nMoveMode, age(dNow, Status.dMoveModeTime),
+           Status.nLimits, age(dNow, Status.dLimitsTime),
+           Status.nShutterState, age(dNow, Status.dShutterTime),
+           Status.dAzSupplyVolts, age(dNow, Status.dAzSupplyTime),
+           Status.dShutterSupplyVolts, age(dNow, Status.dShutterSupplyTime));
+}
+
+int main(int argc, char *argv[])
+{
+    int nErr;
+    int i;
+    bool bFollow = false;
+    const char *pszName = STATUS_DEFAULT_NAME;
+    double dLastUpdate = -1.0;
+    CDomeStatusPage Page;
+    DomeStatus Status;
+
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-f"))
+            bFollow = true;
+        else if(argv[i][0] != '-')
+            pszName = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    nErr = Page.open(pszName);
+    if(nErr) {
+        fprintf(stderr, "Error opening %s (%d)\n", pszName, nErr);
+        return 1;
+    }
+
+    while(true) {
+        nErr = Page.read(Status);
+        if(nErr) {
+            fprintf(stderr, "Error reading %s (%d)\n", pszName, nErr);
+            return 1;
+        }
+        if(Status.dUpdateTime != dLastUpdate) {
+            printStatus(Status);
+            dLastUpdate = Status.dUpdateTime;
+        }
+        if(!bFollow)
+            break;
+        fflush(stdout);
+        usleep(100000);
+    }
+
+    return 0;
+}
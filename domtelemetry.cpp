@@ -0,0 +1,168 @@
+//
+//  domtelemetry.cpp
+//  ATCL Dome X2 plugin
+//
+//  Command line reader for the telemetry files written by the plugin.
+//  usage : domtelemetry [-n records] [-f] telemetry_file
+//          domtelemetry -a [-s start] [-e end] [-r] archive_file
+//  Prints the ring file records as CSV, -f keeps following the file as new records are written.
+//  With -a prints the min/max of every channel in the archive between start and end (seconds since 1970),
+//  or the records with -r.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "telemetryring.h"
+#include "telemetryarchive.h"
+
+static void usage(const char *pszName)
+{
+    fprintf(stderr, "usage : %s [-n records] [-f] telemetry_file\n", pszName);
+    fprintf(stderr, "  -n : number of records to print from the end of the file (default all)\n");
+    fprintf(stderr, "  -f : follow the file\n");
+    fprintf(stderr, "       %s -a [-s start] [-e end] [-r] archive_file\n", pszName);
+    fprintf(stderr, "  -a : min/max of every channel in the archive, times in seconds since 1970\n");
+    fprintf(stderr, "  -r : print the archive records instead\n");
+}
+
+template <class T> static void printRecord(T &File, const TelemetryRecord &Record)
+{
+    int i;
+
+    printf("%.3f", Record.dTime);
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        if(Record.nValid & (1 << i))
+            printf(",%.3f", File.toValue(i, Record.nRaw[i]));
+        else
+            printf(",");
+    }
+    printf("\n");
+}
+
+static void printHeader()
+{
+    int i;
+
+    printf("time");
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++)
+        printf(",%s", CTelemetryRing::channelName(i));
+    printf("\n");
+}
+
+static int queryArchive(const char *pszFile, double dStart, double dEnd, bool bRecords)
+{
+    int nErr;
+    int i;
+    CTelemetryArchive Archive;
+    TelemetryRange Range;
+    std::vector<TelemetryRecord> Records;
+
+    nErr = Archive.open(pszFile, false, NULL, NULL);
+    if(nErr) {
+        fprintf(stderr, "Error opening %s (%d)\n", pszFile, nErr);
+        return 1;
+    }
+
+    if(bRecords) {
+        nErr = Archive.readRecords(dStart, dEnd, Records);
+        if(nErr) {
+            fprintf(stderr, "Error reading %s (%d)\n", pszFile, nErr);
+            return 1;
+        }
+        printHeader();
+        for(const TelemetryRecord &Record : Records)
+            printRecord(Archive, Record);
+        return 0;
+    }
+
+    printf("channel,count,min,max\n");
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        nErr = Archive.queryRange(i, dStart, dEnd, Range);
+        if(nErr == TLA_NO_DATA)
+            printf("%s,0,,\n", CTelemetryRing::channelName(i));
+        else if(nErr) {
+            fprintf(stderr, "Error reading %s (%d)\n", pszFile, nErr);
+            return 1;
+        }
+        else
+            printf("%s,%d,%.3f,%.3f\n", CTelemetryRing::channelName(i), Range.nCount,
+                   Archive.toValue(i, Range.nMin), Archive.toValue(i, Range.nMax));
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int nErr;
+    int i;
+    long nLast = -1;
+    bool bFollow = false;
+    bool bArchive = false;
+    bool bRecords = false;
+    double dStart = 0.0;
+    double dEnd = 1e12;
+    const char *pszFile = NULL;
+    uint64_t nRecord;
+    uint64_t nCount;
+    CTelemetryRing Ring;
+    TelemetryRecord Record;
+
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-n") && i + 1 < argc)
+            nLast = atol(argv[++i]);
+        else if(!strcmp(argv[i], "-f"))
+            bFollow = true;
+        else if(!strcmp(argv[i], "-a"))
+            bArchive = true;
+        else if(!strcmp(argv[i], "-r"))
+            bRecords = true;
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            dStart = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-e") && i + 1 < argc)
+            dEnd = atof(argv[++i]);
+        else if(!pszFile)
+            pszFile = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(!pszFile) {
+        usage(argv[0]);
+        return 1;
+    }
+    if(bArchive)
+        return queryArchive(pszFile, dStart, dEnd, bRecords);
+
+    nErr = Ring.open(pszFile);
+    if(nErr) {
+        fprintf(stderr, "Error opening %s (%d)\n", pszFile, nErr);
+        return 1;
+    }
+
+    printHeader();
+
+    nCount = Ring.getWriteCount();
+    nRecord = nCount > Ring.getCapacity() ? nCount - Ring.getCapacity() : 0;
+    if(nLast >= 0 && nCount - nRecord > (uint64_t)nLast)
+        nRecord = nCount - nLast;
+
+    while(true) {
+        nCount = Ring.getWriteCount();
+        // we fell behind the writer
+        if(nCount - nRecord > Ring.getCapacity())
+            nRecord = nCount - Ring.getCapacity();
+        for(; nRecord < nCount; nRecord++) {
+            if(Ring.read(nRecord, Record) == TLM_OK)
+                printRecord(Ring, Record);
+        }
+        if(!bFollow)
+            break;
+        fflush(stdout);
+        usleep(500000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+//
+//  sensorcalibration.cpp
+//  ATCL Dome X2 plugin
+//
+//  Sensor calibration layer, compile time conversion tables and per-site corrections.
+
+#include "sensorcalibration.h"
+
+static constexpr SensorTable s_MotorAmpsTable = sensorMakeTable(SensorMakeIndex<SENSOR_TABLE_SIZE>::type(),
+                                                                 ADC_FULL_SCALE, ADC_REF_VOLTS, MOTOR_ZERO_VOLTS, MOTOR_VOLTS_PER_AMP, true);
+static constexpr SensorTable s_TempDegCTable = sensorMakeTable(SensorMakeIndex<SENSOR_TABLE_SIZE>::type(),
+                                                                ADC_FULL_SCALE, ADC_REF_VOLTS, TEMP_ZERO_VOLTS, TEMP_VOLTS_PER_DEG, false);
+
+static_assert(s_MotorAmpsTable.dValue[0] == 0.0, "motor current below the sensor zero must read 0");
+static_assert(s_TempDegCTable.dValue[0] == -50.0, "temperature sensor reads -50C at 0V");
+
+CSensorCalibration::CSensorCalibration()
+{
+    int i;
+
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++)
+        publish(i, 1.0, 0.0);
+}
+
+CSensorCalibration::~CSensorCalibration()
+{
+    size_t i;
+
+    for(i = 0; i < m_Tables.size(); i++)
+        delete m_Tables[i];
+}
+
+const SensorTable &CSensorCalibration::getDefaultTable(int nConversion)
+{
+    return nConversion == ADC_MOTOR_AMPS ? s_MotorAmpsTable : s_TempDegCTable;
+}
+
+// build the channel calibration and swap it in, readers keep using the old one until they load the pointer again
+void CSensorCalibration::publish(int nChannel, double dGain, double dOffset)
+{
+    int i;
+    int nConversion = CAdcConvert::channelConversion(nChannel);
+    const SensorTable *pDefault;
+    SensorChannelCal *pCal = new SensorChannelCal;
+
+    pCal->dGain = dGain;
+    pCal->dOffset = dOffset;
+    pCal->bTable = (nConversion == ADC_MOTOR_AMPS || nConversion == ADC_TEMP_DEGC);
+    if(pCal->bTable) {
+        pDefault = &getDefaultTable(nConversion);
+        for(i = 0; i < SENSOR_TABLE_SIZE; i++)
+            pCal->Table.dValue[i] = (dGain == 1.0 && dOffset == 0.0) ? pDefault->dValue[i] : pDefault->dValue[i] * dGain + dOffset;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Tables.push_back(pCal);
+    m_pChannel[nChannel].store(pCal, std::memory_order_release);
+}
+
+void CSensorCalibration::setCalibration(int nChannel, double dGain, double dOffset)
+{
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return;
+    publish(nChannel, dGain, dOffset);
+}
+
+void CSensorCalibration::getCalibration(int nChannel, double &dGain, double &dOffset)
+{
+    const SensorChannelCal *pCal;
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT) {
+        dGain = 1.0;
+        dOffset = 0.0;
+        return;
+    }
+    pCal = m_pChannel[nChannel].load(std::memory_order_acquire);
+    dGain = pCal->dGain;
+    dOffset = pCal->dOffset;
+}
+
+void CSensorCalibration::getLinear(int nChannel, double &dGain, double &dOffset)
+{
+    const SensorChannelCal *pCal;
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT) {
+        dGain = 1.0;
+        dOffset = 0.0;
+        return;
+    }
+    pCal = m_pChannel[nChannel].load(std::memory_order_acquire);
+    const AdcConversion &Conv = CAdcConvert::getConversion(CAdcConvert::channelConversion(nChannel));
+    dGain = Conv.dRefVolts / Conv.dFullScale / Conv.dSlope * pCal->dGain;
+    dOffset = -Conv.dZero / Conv.dSlope * pCal->dGain + pCal->dOffset;
+}
+
+double CSensorCalibration::toValue(int nChannel, int32_t nRaw)
+{
+    const SensorChannelCal *pCal;
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return (double)nRaw;
+
+    pCal = m_pChannel[nChannel].load(std::memory_order_acquire);
+    if(pCal->bTable && nRaw >= 0 && nRaw < SENSOR_TABLE_SIZE)
+        return pCal->Table.dValue[nRaw];
+
+    return CAdcConvert::convert(CAdcConvert::channelConversion(nChannel), nRaw) * pCal->dGain + pCal->dOffset;
+}
+
+void CSensorCalibration::convert(int nChannel, const int32_t *pRaw, double *pValues, size_t nCount)
+{
+    size_t i;
+    const SensorChannelCal *pCal;
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return;
+
+    // one calibration for the whole batch
+    pCal = m_pChannel[nChannel].load(std::memory_order_acquire);
+    if(pCal->bTable) {
+        for(i = 0; i < nCount; i++)
+            pValues[i] = (pRaw[i] >= 0 && pRaw[i] < SENSOR_TABLE_SIZE) ? pCal->Table.dValue[pRaw[i]] :
+                         CAdcConvert::convert(CAdcConvert::channelConversion(nChannel), pRaw[i]) * pCal->dGain + pCal->dOffset;
+        return;
+    }
+
+    CAdcConvert::convert(CAdcConvert::channelConversion(nChannel), pRaw, pValues, nCount);
+    if(pCal->dGain == 1.0 && pCal->dOffset == 0.0)
+        return;
+    for(i = 0; i < nCount; i++)
+        pValues[i] = pValues[i] * pCal->dGain + pCal->dOffset;
+}
@@ -0,0 +1,92 @@
+//
+//  sensorcalibration.h
+//  ATCL Dome X2 plugin
+//
+//  Sensor calibration layer.
+//  The motor current and temperature sensors are read with 10 bit ADCs, their conversion is a pure function of
+//  the raw value so it is done with 1024 entry tables generated at compile time from the CAdcConvert constants.
+//  Each telemetry channel can have a per-site correction (value * gain + offset, from the ini file), the channel
+//  tables are rebuilt with it when it is set so a conversion is still a single load.
+//  A rebuilt table is published with an atomic pointer swap so the readers never see a half written one,
+//  the replaced tables are kept until the object goes away (the calibration only changes from the settings).
+
+#ifndef __SENSOR_CALIBRATION__
+#define __SENSOR_CALIBRATION__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+#include "adcconvert.h"
+#include "telemetryring.h"
+
+#define SENSOR_TABLE_SIZE   1024
+
+typedef struct {
+    double  dValue[SENSOR_TABLE_SIZE];
+} SensorTable;
+
+// one channel calibration, never modified once published
+typedef struct {
+    double      dGain;
+    double      dOffset;
+    bool        bTable;         // only for the 10 bit channels (motor currents and temperatures)
+    SensorTable Table;
+} SensorChannelCal;
+
+// compile time 0..N-1 index list (C++11, log depth so it stays under the template depth limit)
+template <int... I> struct SensorIndexSeq {};
+template <class S1, class S2> struct SensorIndexConcat;
+template <int... I1, int... I2> struct SensorIndexConcat<SensorIndexSeq<I1...>, SensorIndexSeq<I2...> > {
+    typedef SensorIndexSeq<I1..., (int)sizeof...(I1) + I2...> type;
+};
+template <int N> struct SensorMakeIndex {
+    typedef typename SensorIndexConcat<typename SensorMakeIndex<N / 2>::type, typename SensorMakeIndex<N - N / 2>::type>::type type;
+};
+template <> struct SensorMakeIndex<0> { typedef SensorIndexSeq<> type; };
+template <> struct SensorMakeIndex<1> { typedef SensorIndexSeq<0> type; };
+
+// same operations in the same order as CAdcConvert::convert
+constexpr double sensorClamp(double dValue, bool bClamp)
+{
+    return (bClamp && dValue < 0.0) ? 0.0 : dValue;
+}
+
+constexpr double sensorConvert(int nRaw, double dFullScale, double dRefVolts, double dZero, double dSlope, bool bClamp)
+{
+    return sensorClamp(((double)nRaw / dFullScale * dRefVolts - dZero) / dSlope, bClamp);
+}
+
+template <int... I> constexpr SensorTable sensorMakeTable(SensorIndexSeq<I...>, double dFullScale, double dRefVolts, double dZero, double dSlope, bool bClamp)
+{
+    return SensorTable{{sensorConvert(I, dFullScale, dRefVolts, dZero, dSlope, bClamp)...}};
+}
+
+class CSensorCalibration
+{
+public:
+    CSensorCalibration();
+    ~CSensorCalibration();
+
+    // per-site correction applied after the sensor conversion
+    void    setCalibration(int nChannel, double dGain, double dOffset);
+    void    getCalibration(int nChannel, double &dGain, double &dOffset);
+    // overall raw to value as a line, for the telemetry files
+    void    getLinear(int nChannel, double &dGain, double &dOffset);
+
+    double  toValue(int nChannel, int32_t nRaw);
+    void    convert(int nChannel, const int32_t *pRaw, double *pValues, size_t nCount);
+
+    static const SensorTable &getDefaultTable(int nConversion);
+
+protected:
+    void    publish(int nChannel, double dGain, double dOffset);
+
+    std::atomic<const SensorChannelCal *>   m_pChannel[TLM_CHANNEL_COUNT];
+    std::mutex                              m_Mutex;        // writers
+    std::vector<SensorChannelCal *>         m_Tables;       // every table ever published
+};
+
+#endif
@@ -0,0 +1,458 @@
+//
+//  telemetryarchive.cpp
+//  ATCL Dome X2 plugin
+//
+//  Append only long term telemetry archive.
+
+#include "telemetryarchive.h"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(SB_WIN_BUILD)
+#include <io.h>
+#define archiveSeek(f, o)       _fseeki64(f, o, SEEK_SET)
+#define archiveSeekEnd(f)       _fseeki64(f, 0, SEEK_END)
+#define archiveTell(f)          _ftelli64(f)
+#define archiveTruncate(f, n)   _chsize_s(_fileno(f), n)
+#else
+#include <unistd.h>
+#define archiveSeek(f, o)       fseeko(f, (off_t)(o), SEEK_SET)
+#define archiveSeekEnd(f)       fseeko(f, 0, SEEK_END)
+#define archiveTell(f)          ((int64_t)ftello(f))
+#define archiveTruncate(f, n)   ftruncate(fileno(f), (off_t)(n))
+#endif
+
+CTelemetryArchive::CTelemetryArchive()
+{
+    m_pFile = NULL;
+    m_bWrite = false;
+    m_nFileEnd = 0;
+    memset(&m_Header, 0, sizeof(TelemetryArchiveHeader));
+    resetPending();
+}
+
+CTelemetryArchive::~CTelemetryArchive()
+{
+    close();
+}
+
+int64_t CTelemetryArchive::toMs(double dTime)
+{
+    return (int64_t)floor(dTime * 1000.0 + 0.5);
+}
+
+void CTelemetryArchive::putVarint(std::vector<uint8_t> &Buffer, uint64_t nValue)
+{
+    while(nValue >= 0x80) {
+        Buffer.push_back((uint8_t)(nValue | 0x80));
+        nValue >>= 7;
+    }
+    Buffer.push_back((uint8_t)nValue);
+}
+
+bool CTelemetryArchive::getVarint(const std::vector<uint8_t> &Buffer, size_t &nPos, uint64_t &nValue)
+{
+    int nShift = 0;
+
+    nValue = 0;
+    while(nPos < Buffer.size() && nShift < 64) {
+        nValue |= (uint64_t)(Buffer[nPos] & 0x7F) << nShift;
+        if(!(Buffer[nPos++] & 0x80))
+            return true;
+        nShift += 7;
+    }
+    return false;
+}
+
+int CTelemetryArchive::open(const char *pszFile, bool bWrite, const double *dGain, const double *dOffset)
+{
+    int nErr;
+    int i;
+
+    close();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    m_pFile = fopen(pszFile, bWrite ? "r+b" : "rb");
+    if(!m_pFile && bWrite)
+        m_pFile = fopen(pszFile, "w+b");
+    if(!m_pFile)
+        return TLA_FILE_ERROR;
+    m_bWrite = bWrite;
+
+    if(fread(&m_Header, sizeof(TelemetryArchiveHeader), 1, m_pFile) != 1) {
+        if(!bWrite) {
+            fclose(m_pFile);
+            m_pFile = NULL;
+            return TLA_FORMAT_ERROR;
+        }
+        // new archive
+        memset(&m_Header, 0, sizeof(TelemetryArchiveHeader));
+        strncpy(m_Header.szMagic, TLA_MAGIC, sizeof(m_Header.szMagic));
+        m_Header.nHeaderSize = sizeof(TelemetryArchiveHeader);
+        m_Header.nBlockHeaderSize = sizeof(TelemetryBlockHeader);
+        m_Header.nChannels = TLM_CHANNEL_COUNT;
+        for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+            m_Header.dGain[i] = dGain ? dGain[i] : 1.0;
+            m_Header.dOffset[i] = dOffset ? dOffset[i] : 0.0;
+        }
+        archiveSeek(m_pFile, 0);
+        if(archiveTruncate(m_pFile, 0) != 0 || fwrite(&m_Header, sizeof(TelemetryArchiveHeader), 1, m_pFile) != 1) {
+            fclose(m_pFile);
+            m_pFile = NULL;
+            return TLA_FILE_ERROR;
+        }
+        fflush(m_pFile);
+    }
+
+    if(strncmp(m_Header.szMagic, TLA_MAGIC, sizeof(m_Header.szMagic)) ||
+       m_Header.nHeaderSize != sizeof(TelemetryArchiveHeader) ||
+       m_Header.nBlockHeaderSize != sizeof(TelemetryBlockHeader) ||
+       m_Header.nChannels != TLM_CHANNEL_COUNT) {
+        fclose(m_pFile);
+        m_pFile = NULL;
+        return TLA_FORMAT_ERROR;
+    }
+
+    // the raw values don't change with the calibration, so the whole archive follows the current one
+    if(bWrite && dGain && dOffset && (memcmp(m_Header.dGain, dGain, sizeof(m_Header.dGain)) || memcmp(m_Header.dOffset, dOffset, sizeof(m_Header.dOffset)))) {
+        memcpy(m_Header.dGain, dGain, sizeof(m_Header.dGain));
+        memcpy(m_Header.dOffset, dOffset, sizeof(m_Header.dOffset));
+        archiveSeek(m_pFile, 0);
+        if(fwrite(&m_Header, sizeof(TelemetryArchiveHeader), 1, m_pFile) != 1) {
+            fclose(m_pFile);
+            m_pFile = NULL;
+            return TLA_FILE_ERROR;
+        }
+        fflush(m_pFile);
+    }
+
+    nErr = scan();
+    if(nErr) {
+        fclose(m_pFile);
+        m_pFile = NULL;
+    }
+    return nErr;
+}
+
+// build the block index from the block headers, drop an incomplete last block (crash while writing it)
+int CTelemetryArchive::scan()
+{
+    int64_t nFileSize;
+    int64_t nOffset;
+    BlockIndex Block;
+
+    m_Index.clear();
+    archiveSeekEnd(m_pFile);
+    nFileSize = archiveTell(m_pFile);
+    nOffset = sizeof(TelemetryArchiveHeader);
+
+    while(nOffset + (int64_t)sizeof(TelemetryBlockHeader) <= nFileSize) {
+        archiveSeek(m_pFile, nOffset);
+        if(fread(&Block.Header, sizeof(TelemetryBlockHeader), 1, m_pFile) != 1)
+            break;
+        if(Block.Header.nMagic != TLA_BLOCK_MAGIC)
+            break;
+        Block.nOffset = nOffset + sizeof(TelemetryBlockHeader);
+        if(Block.nOffset + Block.Header.nSize > nFileSize)
+            break;
+        m_Index.push_back(Block);
+        nOffset = Block.nOffset + Block.Header.nSize;
+    }
+
+    if(nOffset < nFileSize && m_bWrite) {
+        fflush(m_pFile);
+        if(archiveTruncate(m_pFile, nOffset) != 0)
+            return TLA_FILE_ERROR;
+    }
+    m_nFileEnd = nOffset;
+    return TLA_OK;
+}
+
+void CTelemetryArchive::close()
+{
+    flush();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(m_pFile)
+        fclose(m_pFile);
+    m_pFile = NULL;
+    m_bWrite = false;
+    m_Index.clear();
+    resetPending();
+}
+
+bool CTelemetryArchive::isOpen()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_pFile != NULL;
+}
+
+void CTelemetryArchive::resetPending()
+{
+    memset(&m_Pending, 0, sizeof(TelemetryBlockHeader));
+    m_Pending.nMagic = TLA_BLOCK_MAGIC;
+    m_PendingPayload.clear();
+    m_nPendingLastTime = 0;
+    memset(m_nPendingLast, 0, sizeof(m_nPendingLast));
+}
+
+int CTelemetryArchive::append(const TelemetryRecord &Record)
+{
+    int nErr = TLA_OK;
+    int i;
+    int64_t nTime;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pFile || !m_bWrite)
+        return TLA_NOT_OPEN;
+
+    nTime = toMs(Record.dTime);
+    if(!m_Pending.nRecords) {
+        m_Pending.nStart = nTime;
+        m_nPendingLastTime = nTime;
+    }
+
+    putVarint(m_PendingPayload, zigzag(nTime - m_nPendingLastTime));
+    putVarint(m_PendingPayload, Record.nValid);
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        if(!(Record.nValid & (1 << i)))
+            continue;
+        putVarint(m_PendingPayload, zigzag((int64_t)Record.nRaw[i] - m_nPendingLast[i]));
+        m_nPendingLast[i] = Record.nRaw[i];
+        if(!m_Pending.nCount[i] || Record.nRaw[i] < m_Pending.nMin[i])
+            m_Pending.nMin[i] = Record.nRaw[i];
+        if(!m_Pending.nCount[i] || Record.nRaw[i] > m_Pending.nMax[i])
+            m_Pending.nMax[i] = Record.nRaw[i];
+        m_Pending.nCount[i]++;
+    }
+    m_nPendingLastTime = nTime;
+    m_Pending.nValid |= Record.nValid;
+    m_Pending.nEnd = std::max(m_Pending.nEnd, nTime);
+    m_Pending.nRecords++;
+
+    if(m_Pending.nRecords >= TLA_BLOCK_RECORDS || (m_Pending.nEnd - m_Pending.nStart) >= toMs(TLA_BLOCK_MAX_AGE))
+        nErr = writeBlock();
+    return nErr;
+}
+
+int CTelemetryArchive::flush()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pFile || !m_bWrite)
+        return TLA_NOT_OPEN;
+    return writeBlock();
+}
+
+// called with m_Mutex held
+int CTelemetryArchive::writeBlock()
+{
+    BlockIndex Block;
+
+    if(!m_Pending.nRecords)
+        return TLA_OK;
+
+    m_Pending.nSize = (uint32_t)m_PendingPayload.size();
+    archiveSeek(m_pFile, m_nFileEnd);
+    if(fwrite(&m_Pending, sizeof(TelemetryBlockHeader), 1, m_pFile) != 1 ||
+       fwrite(m_PendingPayload.data(), 1, m_PendingPayload.size(), m_pFile) != m_PendingPayload.size()) {
+        // leave the file as it was, the partial block is dropped by scan() next time
+        fflush(m_pFile);
+        archiveTruncate(m_pFile, m_nFileEnd);
+        resetPending();
+        return TLA_FILE_ERROR;
+    }
+    fflush(m_pFile);
+
+    Block.nOffset = m_nFileEnd + sizeof(TelemetryBlockHeader);
+    Block.Header = m_Pending;
+    m_Index.push_back(Block);
+    m_nFileEnd = Block.nOffset + m_Pending.nSize;
+    resetPending();
+    return TLA_OK;
+}
+
+int CTelemetryArchive::loadPayload(const BlockIndex &Block, std::vector<uint8_t> &Payload)
+{
+    Payload.resize(Block.Header.nSize);
+    if(!Block.Header.nSize)
+        return TLA_OK;
+    archiveSeek(m_pFile, Block.nOffset);
+    if(fread(Payload.data(), 1, Block.Header.nSize, m_pFile) != Block.Header.nSize)
+        return TLA_FILE_ERROR;
+    return TLA_OK;
+}
+
+int CTelemetryArchive::decodeBlock(const TelemetryBlockHeader &Header, const std::vector<uint8_t> &Payload, std::vector<TelemetryRecord> &Records)
+{
+    uint32_t n;
+    int i;
+    size_t nPos = 0;
+    uint64_t nValue;
+    int64_t nTime = Header.nStart;
+    int32_t nLast[TLM_CHANNEL_COUNT];
+    TelemetryRecord Record;
+
+    memset(nLast, 0, sizeof(nLast));
+    Records.clear();
+    for(n = 0; n < Header.nRecords; n++) {
+        memset(&Record, 0, sizeof(TelemetryRecord));
+        if(!getVarint(Payload, nPos, nValue))
+            return TLA_FORMAT_ERROR;
+        nTime += unzigzag(nValue);
+        if(!getVarint(Payload, nPos, nValue))
+            return TLA_FORMAT_ERROR;
+        Record.nValid = (uint32_t)nValue;
+        for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+            if(Record.nValid & (1 << i)) {
+                if(!getVarint(Payload, nPos, nValue))
+                    return TLA_FORMAT_ERROR;
+                nLast[i] = (int32_t)(nLast[i] + unzigzag(nValue));
+            }
+            Record.nRaw[i] = nLast[i];
+        }
+        Record.dTime = nTime / 1000.0;
+        Records.push_back(Record);
+    }
+    return TLA_OK;
+}
+
+bool CTelemetryArchive::overlaps(const TelemetryBlockHeader &Header, int64_t nStart, int64_t nEnd)
+{
+    return Header.nRecords && Header.nEnd >= nStart && Header.nStart <= nEnd;
+}
+
+// min/max/count of the raw values of a channel between dStart and dEnd.
+// Blocks entirely in the range are answered from their header.
+int CTelemetryArchive::queryRange(int nChannel, double dStart, double dEnd, TelemetryRange &Range)
+{
+    int nErr;
+    int64_t nStart = toMs(dStart);
+    int64_t nEnd = toMs(dEnd);
+    std::vector<BlockIndex>::iterator it;
+    std::vector<uint8_t> Payload;
+    std::vector<TelemetryRecord> Records;
+    std::vector<const BlockIndex *> Blocks;
+    BlockIndex Pending;
+    size_t j;
+
+    memset(&Range, 0, sizeof(TelemetryRange));
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return TLA_NO_DATA;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pFile)
+        return TLA_NOT_OPEN;
+
+    // blocks are in time order, skip the ones that end before the range
+    it = std::lower_bound(m_Index.begin(), m_Index.end(), nStart,
+                          [](const BlockIndex &Block, int64_t nTime) { return Block.Header.nEnd < nTime; });
+    for(; it != m_Index.end() && it->Header.nStart <= nEnd; ++it)
+        Blocks.push_back(&(*it));
+    if(overlaps(m_Pending, nStart, nEnd)) {
+        // not in the file yet
+        Pending.nOffset = -1;
+        Pending.Header = m_Pending;
+        Blocks.push_back(&Pending);
+    }
+
+    for(j = 0; j < Blocks.size(); j++) {
+        const TelemetryBlockHeader &Header = Blocks[j]->Header;
+        if(!Header.nCount[nChannel])
+            continue;
+
+        if(Header.nStart >= nStart && Header.nEnd <= nEnd) {
+            if(!Range.nCount || Header.nMin[nChannel] < Range.nMin)
+                Range.nMin = Header.nMin[nChannel];
+            if(!Range.nCount || Header.nMax[nChannel] > Range.nMax)
+                Range.nMax = Header.nMax[nChannel];
+            Range.nCount += Header.nCount[nChannel];
+            continue;
+        }
+
+        if(Blocks[j]->nOffset < 0)
+            nErr = decodeBlock(Header, m_PendingPayload, Records);
+        else {
+            nErr = loadPayload(*Blocks[j], Payload);
+            if(!nErr)
+                nErr = decodeBlock(Header, Payload, Records);
+        }
+        if(nErr)
+            return nErr;
+        Range.nBlocksDecoded++;
+
+        for(const TelemetryRecord &Record : Records) {
+            if(!(Record.nValid & (1 << nChannel)) || toMs(Record.dTime) < nStart || toMs(Record.dTime) > nEnd)
+                continue;
+            if(!Range.nCount || Record.nRaw[nChannel] < Range.nMin)
+                Range.nMin = Record.nRaw[nChannel];
+            if(!Range.nCount || Record.nRaw[nChannel] > Range.nMax)
+                Range.nMax = Record.nRaw[nChannel];
+            Range.nCount++;
+        }
+    }
+
+    return Range.nCount ? TLA_OK : TLA_NO_DATA;
+}
+
+int CTelemetryArchive::readRecords(double dStart, double dEnd, std::vector<TelemetryRecord> &Records)
+{
+    int nErr;
+    int64_t nStart = toMs(dStart);
+    int64_t nEnd = toMs(dEnd);
+    std::vector<BlockIndex>::iterator it;
+    std::vector<uint8_t> Payload;
+    std::vector<TelemetryRecord> Block;
+
+    Records.clear();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pFile)
+        return TLA_NOT_OPEN;
+
+    it = std::lower_bound(m_Index.begin(), m_Index.end(), nStart,
+                          [](const BlockIndex &Index, int64_t nTime) { return Index.Header.nEnd < nTime; });
+    for(; it != m_Index.end() && it->Header.nStart <= nEnd; ++it) {
+        nErr = loadPayload(*it, Payload);
+        if(!nErr)
+            nErr = decodeBlock(it->Header, Payload, Block);
+        if(nErr)
+            return nErr;
+        for(const TelemetryRecord &Record : Block)
+            if(toMs(Record.dTime) >= nStart && toMs(Record.dTime) <= nEnd)
+                Records.push_back(Record);
+    }
+    if(overlaps(m_Pending, nStart, nEnd)) {
+        nErr = decodeBlock(m_Pending, m_PendingPayload, Block);
+        if(nErr)
+            return nErr;
+        for(const TelemetryRecord &Record : Block)
+            if(toMs(Record.dTime) >= nStart && toMs(Record.dTime) <= nEnd)
+                Records.push_back(Record);
+    }
+    return TLA_OK;
+}
+
+int CTelemetryArchive::getTimeSpan(double &dFirst, double &dLast)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if(!m_pFile)
+        return TLA_NOT_OPEN;
+    if(m_Index.empty() && !m_Pending.nRecords)
+        return TLA_NO_DATA;
+
+    dFirst = (m_Index.empty() ? m_Pending.nStart : m_Index.front().Header.nStart) / 1000.0;
+    dLast = (m_Pending.nRecords ? m_Pending.nEnd : m_Index.back().Header.nEnd) / 1000.0;
+    return TLA_OK;
+}
+
+double CTelemetryArchive::toValue(int nChannel, int32_t nRaw)
+{
+    double dValue;
+
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return 0.0;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    dValue = nRaw * m_Header.dGain[nChannel] + m_Header.dOffset[nChannel];
+    if((nChannel == TLM_AZ_MOTOR || nChannel == TLM_SHUTTER_MOTOR) && dValue < 0.0)
+        dValue = 0.0;
+    return dValue;
+}
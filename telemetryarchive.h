@@ -0,0 +1,117 @@
+//
+//  telemetryarchive.h
+//  ATCL Dome X2 plugin
+//
+//  Append only long term telemetry archive.
+//  Records are grouped in blocks, each block starts with a fixed size header holding the block time range
+//  and the min/max/count of every channel, followed by the records encoded as zig-zag varint deltas of the raw
+//  values (time in ms, raw ADC ticks). Range queries only decode the blocks that are partially in the range.
+//  This doesn't depend on the X2 interfaces so it can also be used by the domtelemetry command line tool.
+//
+//  File layout : TelemetryArchiveHeader, then blocks (TelemetryBlockHeader + nSize bytes of payload).
+//  Payload, for each record : varint(zigzag(time - previous time)), varint(valid mask),
+//  then for each valid channel varint(zigzag(raw - previous raw of that channel)).
+//  The previous time starts at nStart and the previous raw values at 0 in every block.
+
+#ifndef __TELEMETRY_ARCHIVE__
+#define __TELEMETRY_ARCHIVE__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <mutex>
+
+#include "telemetryring.h"
+
+#define TLA_MAGIC               "DPTLA01"
+#define TLA_BLOCK_MAGIC         0x424C5444  // "DTLB"
+#define TLA_BLOCK_RECORDS       1024
+#define TLA_BLOCK_MAX_AGE       900.0       // seconds, write a partial block after that
+
+enum TelemetryArchiveErrors {TLA_OK = 0, TLA_FILE_ERROR, TLA_FORMAT_ERROR, TLA_NOT_OPEN, TLA_NO_DATA};
+
+typedef struct {
+    char        szMagic[8];
+    uint32_t    nHeaderSize;
+    uint32_t    nBlockHeaderSize;
+    uint32_t    nChannels;
+    uint32_t    nReserved;
+    double      dGain[TLM_CHANNEL_COUNT];
+    double      dOffset[TLM_CHANNEL_COUNT];
+} TelemetryArchiveHeader;
+
+typedef struct {
+    uint32_t    nMagic;
+    uint32_t    nRecords;
+    uint32_t    nValid;             // channels present in at least one record
+    uint32_t    nSize;              // payload bytes
+    int64_t     nStart;             // ms since 1970
+    int64_t     nEnd;
+    int32_t     nMin[TLM_CHANNEL_COUNT];
+    int32_t     nMax[TLM_CHANNEL_COUNT];
+    int32_t     nCount[TLM_CHANNEL_COUNT];
+    uint32_t    nReserved;
+} TelemetryBlockHeader;
+
+typedef struct {
+    int         nCount;
+    int32_t     nMin;
+    int32_t     nMax;
+    int         nBlocksDecoded;     // how many blocks had to be decompressed
+} TelemetryRange;
+
+class CTelemetryArchive
+{
+public:
+    CTelemetryArchive();
+    ~CTelemetryArchive();
+
+    // bWrite creates the file if needed and updates the raw to value conversion in the header to dGain/dOffset
+    int     open(const char *pszFile, bool bWrite, const double *dGain, const double *dOffset);
+    void    close();
+    bool    isOpen();
+
+    int     append(const TelemetryRecord &Record);
+    int     flush();
+
+    // times in seconds since 1970, raw values
+    int     queryRange(int nChannel, double dStart, double dEnd, TelemetryRange &Range);
+    int     readRecords(double dStart, double dEnd, std::vector<TelemetryRecord> &Records);
+    int     getTimeSpan(double &dFirst, double &dLast);
+    double  toValue(int nChannel, int32_t nRaw);
+
+protected:
+    typedef struct {
+        int64_t                 nOffset;    // of the payload in the file
+        TelemetryBlockHeader    Header;
+    } BlockIndex;
+
+    int     scan();
+    int     writeBlock();
+    int     loadPayload(const BlockIndex &Block, std::vector<uint8_t> &Payload);
+    int     decodeBlock(const TelemetryBlockHeader &Header, const std::vector<uint8_t> &Payload, std::vector<TelemetryRecord> &Records);
+    void    resetPending();
+    bool    overlaps(const TelemetryBlockHeader &Header, int64_t nStart, int64_t nEnd);
+
+    static void     putVarint(std::vector<uint8_t> &Buffer, uint64_t nValue);
+    static bool     getVarint(const std::vector<uint8_t> &Buffer, size_t &nPos, uint64_t &nValue);
+    static uint64_t zigzag(int64_t nValue) { return ((uint64_t)nValue << 1) ^ (uint64_t)(nValue >> 63); };
+    static int64_t  unzigzag(uint64_t nValue) { return (int64_t)(nValue >> 1) ^ -(int64_t)(nValue & 1); };
+    static int64_t  toMs(double dTime);
+
+    std::mutex              m_Mutex;
+    FILE                    *m_pFile;
+    bool                    m_bWrite;
+    TelemetryArchiveHeader  m_Header;
+    std::vector<BlockIndex> m_Index;
+    int64_t                 m_nFileEnd;
+
+    // block being built, queries include it
+    TelemetryBlockHeader    m_Pending;
+    std::vector<uint8_t>    m_PendingPayload;
+    int64_t                 m_nPendingLastTime;
+    int32_t                 m_nPendingLast[TLM_CHANNEL_COUNT];
+};
+
+#endif
@@ -0,0 +1,296 @@
+//
+//  telemetryring.cpp
+//  ATCL Dome X2 plugin
+//
+//  Memory mapped time series ring file for the dome telemetry.
+
+#include "telemetryring.h"
+
+#include <atomic>
+
+#if defined(SB_WIN_BUILD)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char *s_szChannelNames[TLM_CHANNEL_COUNT] = {
+    "AzSupply", "ShutterSupply", "AzMotor", "ShutterMotor", "AzTemp", "ShutterTemp", "LinkErrors"
+};
+
+CTelemetryRing::CTelemetryRing()
+{
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+    m_nMapSize = 0;
+    m_bWriter = false;
+#if defined(SB_WIN_BUILD)
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+#else
+    m_nFd = -1;
+#endif
+}
+
+CTelemetryRing::~CTelemetryRing()
+{
+    close();
+}
+
+const char *CTelemetryRing::channelName(int nChannel)
+{
+    if(nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return "";
+    return s_szChannelNames[nChannel];
+}
+
+int CTelemetryRing::map(const char *pszFile, size_t nSize, bool bWrite)
+{
+#if defined(SB_WIN_BUILD)
+    LARGE_INTEGER liSize;
+
+    m_hFile = CreateFileA(pszFile, bWrite ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, bWrite ? OPEN_ALWAYS : OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL, NULL);
+    if(m_hFile == INVALID_HANDLE_VALUE)
+        return TLM_FILE_ERROR;
+
+    if(!GetFileSizeEx(m_hFile, &liSize)) {
+        close();
+        return TLM_FILE_ERROR;
+    }
+    if(!nSize)
+        nSize = (size_t)liSize.QuadPart;
+    if(nSize < sizeof(TelemetryRingHeader)) {
+        close();
+        return TLM_FORMAT_ERROR;
+    }
+
+    m_hMapping = CreateFileMappingA(m_hFile, NULL, bWrite ? PAGE_READWRITE : PAGE_READONLY,
+                                    (DWORD)((uint64_t)nSize >> 32), (DWORD)(nSize & 0xFFFFFFFF), NULL);
+    if(!m_hMapping) {
+        close();
+        return TLM_FILE_ERROR;
+    }
+    m_pHeader = (TelemetryRingHeader *)MapViewOfFile(m_hMapping, bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, nSize);
+    if(!m_pHeader) {
+        close();
+        return TLM_FILE_ERROR;
+    }
+#else
+    struct stat st;
+    void *pMap;
+
+    m_nFd = ::open(pszFile, bWrite ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if(m_nFd < 0)
+        return TLM_FILE_ERROR;
+
+    if(fstat(m_nFd, &st) != 0) {
+        close();
+        return TLM_FILE_ERROR;
+    }
+    if(!nSize)
+        nSize = (size_t)st.st_size;
+    else if((size_t)st.st_size != nSize) {
+        // new file or different layout, start over
+        if(ftruncate(m_nFd, 0) != 0 || ftruncate(m_nFd, (off_t)nSize) != 0) {
+            close();
+            return TLM_FILE_ERROR;
+        }
+    }
+    if(nSize < sizeof(TelemetryRingHeader)) {
+        close();
+        return TLM_FORMAT_ERROR;
+    }
+
+    pMap = mmap(NULL, nSize, bWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_nFd, 0);
+    if(pMap == MAP_FAILED) {
+        close();
+        return TLM_FILE_ERROR;
+    }
+    m_pHeader = (TelemetryRingHeader *)pMap;
+#endif
+    m_nMapSize = nSize;
+    m_pRecords = (TelemetryRecord *)((char *)m_pHeader + sizeof(TelemetryRingHeader));
+    m_bWriter = bWrite;
+    return TLM_OK;
+}
+
+int CTelemetryRing::create(const char *pszFile, uint32_t nCapacity, const double *dGain, const double *dOffset)
+{
+    int nErr;
+    int i;
+    size_t nSize;
+    bool bReuse;
+
+    close();
+    if(!nCapacity)
+        nCapacity = TLM_DEFAULT_CAPACITY;
+    nSize = sizeof(TelemetryRingHeader) + (size_t)nCapacity * sizeof(TelemetryRecord);
+
+    nErr = map(pszFile, nSize, true);
+    if(nErr)
+        return nErr;
+
+    bReuse = !strncmp(m_pHeader->szMagic, TLM_MAGIC, sizeof(m_pHeader->szMagic)) &&
+             m_pHeader->nHeaderSize == sizeof(TelemetryRingHeader) &&
+             m_pHeader->nRecordSize == sizeof(TelemetryRecord) &&
+             m_pHeader->nCapacity == nCapacity &&
+             m_pHeader->nChannels == TLM_CHANNEL_COUNT;
+    if(!bReuse) {
+        memset(m_pHeader, 0, nSize);
+        m_pHeader->nHeaderSize = sizeof(TelemetryRingHeader);
+        m_pHeader->nRecordSize = sizeof(TelemetryRecord);
+        m_pHeader->nCapacity = nCapacity;
+        m_pHeader->nChannels = TLM_CHANNEL_COUNT;
+        m_pHeader->nWriteCount = 0;
+        for(i = 0; i < TLM_CHANNEL_COUNT; i++)
+            strncpy(m_pHeader->szChannel[i], s_szChannelNames[i], TLM_CHANNEL_NAME_SIZE - 1);
+    }
+    // the conversion can change between sessions, the file keeps the last one
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        m_pHeader->dGain[i] = dGain ? dGain[i] : 1.0;
+        m_pHeader->dOffset[i] = dOffset ? dOffset[i] : 0.0;
+    }
+    // magic last so readers never see a half initialised header
+    std::atomic_thread_fence(std::memory_order_release);
+    strncpy(m_pHeader->szMagic, TLM_MAGIC, sizeof(m_pHeader->szMagic));
+    return TLM_OK;
+}
+
+int CTelemetryRing::open(const char *pszFile)
+{
+    int nErr;
+
+    close();
+    nErr = map(pszFile, 0, false);
+    if(nErr)
+        return nErr;
+
+    if(strncmp(m_pHeader->szMagic, TLM_MAGIC, sizeof(m_pHeader->szMagic)) ||
+       m_pHeader->nHeaderSize != sizeof(TelemetryRingHeader) ||
+       m_pHeader->nRecordSize != sizeof(TelemetryRecord) ||
+       m_pHeader->nChannels != TLM_CHANNEL_COUNT ||
+       m_nMapSize < sizeof(TelemetryRingHeader) + (size_t)m_pHeader->nCapacity * sizeof(TelemetryRecord)) {
+        close();
+        return TLM_FORMAT_ERROR;
+    }
+    return TLM_OK;
+}
+
+void CTelemetryRing::close()
+{
+#if defined(SB_WIN_BUILD)
+    if(m_pHeader)
+        UnmapViewOfFile(m_pHeader);
+    if(m_hMapping)
+        CloseHandle(m_hMapping);
+    if(m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+    m_hMapping = NULL;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if(m_pHeader)
+        munmap(m_pHeader, m_nMapSize);
+    if(m_nFd >= 0)
+        ::close(m_nFd);
+    m_nFd = -1;
+#endif
+    m_pHeader = NULL;
+    m_pRecords = NULL;
+    m_nMapSize = 0;
+    m_bWriter = false;
+}
+
+int CTelemetryRing::append(const TelemetryRecord &Record)
+{
+    uint64_t nRecord;
+    volatile TelemetryRecord *pSlot;
+    int i;
+
+    if(!m_pHeader || !m_bWriter)
+        return TLM_NOT_OPEN;
+
+    nRecord = m_pHeader->nWriteCount;
+    pSlot = m_pRecords + (nRecord % m_pHeader->nCapacity);
+
+    pSlot->nSeq = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    pSlot->dTime = Record.dTime;
+    pSlot->nValid = Record.nValid;
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++)
+        pSlot->nRaw[i] = Record.nRaw[i];
+    std::atomic_thread_fence(std::memory_order_release);
+    pSlot->nSeq = nRecord + 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    ((volatile TelemetryRingHeader *)m_pHeader)->nWriteCount = nRecord + 1;
+    return TLM_OK;
+}
+
+uint64_t CTelemetryRing::getWriteCount()
+{
+    uint64_t nCount;
+
+    if(!m_pHeader)
+        return 0;
+    nCount = ((volatile TelemetryRingHeader *)m_pHeader)->nWriteCount;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return nCount;
+}
+
+uint32_t CTelemetryRing::getCapacity()
+{
+    if(!m_pHeader)
+        return 0;
+    return m_pHeader->nCapacity;
+}
+
+// nRecord counts from 0 since the file was created, only the last nCapacity records are available.
+int CTelemetryRing::read(uint64_t nRecord, TelemetryRecord &Record)
+{
+    uint64_t nCount;
+    volatile TelemetryRecord *pSlot;
+    int i;
+
+    if(!m_pHeader)
+        return TLM_NOT_OPEN;
+
+    nCount = getWriteCount();
+    if(nRecord >= nCount || nCount - nRecord > m_pHeader->nCapacity)
+        return TLM_NOT_AVAILABLE;
+
+    pSlot = m_pRecords + (nRecord % m_pHeader->nCapacity);
+    Record.nSeq = pSlot->nSeq;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    Record.dTime = pSlot->dTime;
+    Record.nValid = pSlot->nValid;
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++)
+        Record.nRaw[i] = pSlot->nRaw[i];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten (or being overwritten) while we were copying it
+    if(Record.nSeq != nRecord + 1 || pSlot->nSeq != nRecord + 1)
+        return TLM_NOT_AVAILABLE;
+    return TLM_OK;
+}
+
+double CTelemetryRing::toValue(int nChannel, int32_t nRaw)
+{
+    double dValue;
+
+    if(!m_pHeader || nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return 0.0;
+    dValue = nRaw * m_pHeader->dGain[nChannel] + m_pHeader->dOffset[nChannel];
+    if((nChannel == TLM_AZ_MOTOR || nChannel == TLM_SHUTTER_MOTOR) && dValue < 0.0)
+        dValue = 0.0;
+    return dValue;
+}
+
+const char *CTelemetryRing::getChannelName(int nChannel)
+{
+    if(!m_pHeader || nChannel < 0 || nChannel >= TLM_CHANNEL_COUNT)
+        return "";
+    return m_pHeader->szChannel[nChannel];
+}
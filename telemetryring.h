@@ -0,0 +1,88 @@
+//
+//  telemetryring.h
+//  ATCL Dome X2 plugin
+//
+//  Memory mapped time series ring file for the dome telemetry (supply voltages, motor currents, temperatures,
+//  RF link errors). The plugin appends fixed size records, external tools map the same file read only and can
+//  follow the live data or read the history without touching the serial port.
+//  This doesn't depend on the X2 interfaces so it can also be used by the domtelemetry command line tool.
+//
+//  File layout : one TelemetryRingHeader followed by nCapacity TelemetryRecord.
+//  Record n (counting from 0 since the file was created) is stored in slot n % nCapacity.
+//  A record is being written while its nSeq is 0, readers must copy it and check nSeq is still n+1.
+
+#ifndef __TELEMETRY_RING__
+#define __TELEMETRY_RING__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TLM_MAGIC               "DPTLM01"
+#define TLM_DEFAULT_CAPACITY    86400       // a day at one record per second
+#define TLM_CHANNEL_NAME_SIZE   16
+
+enum TelemetryChannels {TLM_AZ_SUPPLY = 0, TLM_SHUTTER_SUPPLY, TLM_AZ_MOTOR, TLM_SHUTTER_MOTOR,
+                        TLM_AZ_TEMP, TLM_SHUTTER_TEMP, TLM_LINK_ERRORS, TLM_CHANNEL_COUNT};
+
+enum TelemetryErrors {TLM_OK = 0, TLM_FILE_ERROR, TLM_FORMAT_ERROR, TLM_NOT_OPEN, TLM_NOT_AVAILABLE};
+
+// Values are stored as raw ADC ticks (or counts), value = raw * dGain + dOffset.
+// Motor currents below 0 should be read as 0.
+typedef struct {
+    char        szMagic[8];
+    uint32_t    nHeaderSize;
+    uint32_t    nRecordSize;
+    uint32_t    nCapacity;
+    uint32_t    nChannels;
+    uint64_t    nWriteCount;        // records written since the file was created
+    double      dGain[TLM_CHANNEL_COUNT];
+    double      dOffset[TLM_CHANNEL_COUNT];
+    char        szChannel[TLM_CHANNEL_COUNT][TLM_CHANNEL_NAME_SIZE];
+} TelemetryRingHeader;
+
+typedef struct {
+    uint64_t    nSeq;               // record number + 1, 0 while being written
+    double      dTime;              // seconds since 1970
+    uint32_t    nValid;             // bit n is set if channel n was sampled for this record
+    int32_t     nRaw[TLM_CHANNEL_COUNT];    // last known value when the channel wasn't sampled
+} TelemetryRecord;
+
+class CTelemetryRing
+{
+public:
+    CTelemetryRing();
+    ~CTelemetryRing();
+
+    // writer : reuse the file if it has the same layout, otherwise start a new one
+    int     create(const char *pszFile, uint32_t nCapacity, const double *dGain, const double *dOffset);
+    // reader
+    int     open(const char *pszFile);
+    void    close();
+    bool    isOpen() { return m_pHeader != NULL; };
+
+    int     append(const TelemetryRecord &Record);
+    uint64_t getWriteCount();
+    uint32_t getCapacity();
+    int     read(uint64_t nRecord, TelemetryRecord &Record);
+    double  toValue(int nChannel, int32_t nRaw);
+    const char *getChannelName(int nChannel);
+
+    static const char *channelName(int nChannel);
+
+protected:
+    int     map(const char *pszFile, size_t nSize, bool bWrite);
+
+    TelemetryRingHeader *m_pHeader;
+    TelemetryRecord     *m_pRecords;
+    size_t              m_nMapSize;
+    bool                m_bWriter;
+#if defined(SB_WIN_BUILD)
+    void                *m_hFile;
+    void                *m_hMapping;
+#else
+    int                 m_nFd;
+#endif
+};
+
+#endif
@@ -0,0 +1,92 @@
+//
+//  adctest.cpp
+//  ATCL Dome X2 plugin
+//
+//  Batch ADC conversion (adcconvert.h) : every SIMD level the CPU supports must give bit identical results
+//  to the single sample conversion, for every conversion, odd lengths and unaligned buffers.
+//  usage : adctest, exits with the number of failed checks.
+
+#include <string.h>
+#include <vector>
+
+#include "../adcconvert.h"
+#include "testcheck.h"
+
+#define TEST_MAX_COUNT      37          // covers the SIMD tails
+
+// the full ADC range plus out of range and negative raw values
+static void makeRaw(std::vector<int32_t> &Raw)
+{
+    int32_t i;
+
+    for(i = -64; i <= (int32_t)ADC_FULL_SCALE + 64; i++)
+        Raw.push_back(i);
+    Raw.push_back(2147483647);
+    Raw.push_back(-2147483647 - 1);
+    Raw.push_back(100000);
+}
+
+// same bits, not just the same value
+static bool sameBits(const double *pA, const double *pB, size_t nCount)
+{
+    return memcmp(pA, pB, nCount * sizeof(double)) == 0;
+}
+
+int main()
+{
+    int nLevel;
+    int nConversion;
+    size_t i;
+    size_t nCount;
+    size_t nOffset;
+    bool bSame;
+    char szWhat[128];
+    std::vector<int32_t> Raw;
+    std::vector<double> Expected;
+    std::vector<double> Values;
+    std::vector<int32_t> Unaligned;
+
+    makeRaw(Raw);
+    Expected.resize(Raw.size());
+    Values.resize(Raw.size() + 1);
+    printf("CPU supports %s\n", CAdcConvert::simdLevelName(CAdcConvert::getSupportedSimdLevel()));
+
+    for(nLevel = ADC_SIMD_SCALAR; nLevel <= ADC_SIMD_AVX2; nLevel++) {
+        if(nLevel > CAdcConvert::getSupportedSimdLevel()) {
+            printf("skip : %s not supported\n", CAdcConvert::simdLevelName(nLevel));
+            continue;
+        }
+        snprintf(szWhat, sizeof(szWhat), "%s selected", CAdcConvert::simdLevelName(nLevel));
+        check(CAdcConvert::setSimdLevel(nLevel) == nLevel, szWhat);
+
+        for(nConversion = 0; nConversion < ADC_CONVERSION_COUNT; nConversion++) {
+            for(i = 0; i < Raw.size(); i++)
+                Expected[i] = CAdcConvert::convert(nConversion, Raw[i]);
+
+            CAdcConvert::convert(nConversion, Raw.data(), Values.data(), Raw.size());
+            bSame = sameBits(Values.data(), Expected.data(), Raw.size());
+
+            // every short length from every start, so the vector loops and the tails both run
+            for(nCount = 0; bSame && nCount <= TEST_MAX_COUNT; nCount++) {
+                for(nOffset = 0; bSame && nOffset < 8; nOffset++) {
+                    Values[nOffset + nCount] = -1.0;
+                    CAdcConvert::convert(nConversion, Raw.data() + nOffset, Values.data() + nOffset, nCount);
+                    bSame = sameBits(Values.data() + nOffset, Expected.data() + nOffset, nCount) && Values[nOffset + nCount] == -1.0;
+                }
+            }
+
+            // input and output off their natural alignment
+            Unaligned.assign(Raw.begin(), Raw.end());
+            Unaligned.insert(Unaligned.begin(), 0);
+            CAdcConvert::convert(nConversion, Unaligned.data() + 1, Values.data() + 1, Raw.size() - 1);
+            bSame = bSame && sameBits(Values.data() + 1, Expected.data(), Raw.size() - 1);
+
+            snprintf(szWhat, sizeof(szWhat), "%s conversion %d matches the single sample conversion", CAdcConvert::simdLevelName(nLevel), nConversion);
+            check(bSame, szWhat);
+        }
+    }
+    CAdcConvert::setSimdLevel(ADC_SIMD_AUTO);
+
+    printf("%d failed\n", s_nFailed);
+    return s_nFailed;
+}
@@ -0,0 +1,230 @@
+//
+//  alpacatest.cpp
+//  ATCL Dome X2 plugin
+//
+//  Drives the Alpaca Dome endpoints (domealpaca.h) over HTTP against the mock controller (mockserx.h).
+//  usage : alpacatest [port], exits with the number of failed checks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#include "../domealpaca.h"
+#include "mockserx.h"
+
+#define TEST_PORT           18111
+#define TEST_MOVE_TIMEOUT   20.0        // seconds
+#define TEST_AZ_TOLERANCE   0.5         // degrees
+
+class CQuietLogger : public LoggerInterface
+{
+public:
+    virtual int out(const char *szLogThis) { (void)szLogThis; return 0; };
+};
+
+static int s_nPort = TEST_PORT;
+static int s_nFailed = 0;
+static int s_nTransaction = 0;
+
+static void check(bool bOk, const char *pszWhat)
+{
+    printf("%s : %s\n", bOk ? "ok  " : "FAIL", pszWhat);
+    if(!bOk)
+        s_nFailed++;
+}
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// one request per connection, returns the HTTP status or -1, sBody is the answer body
+static int httpRequest(const char *pszMethod, const std::string &sPath, const std::string &sForm, std::string &sBody)
+{
+    struct sockaddr_in Addr;
+    std::string sRequest;
+    std::string sAnswer;
+    char szBuffer[4096];
+    char szLength[32];
+    ssize_t nRead;
+    size_t nHeaderEnd;
+    int nFd;
+    int nStatus = -1;
+
+    nFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(nFd < 0)
+        return -1;
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_port = htons((uint16_t)s_nPort);
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(nFd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0) {
+        ::close(nFd);
+        return -1;
+    }
+
+    snprintf(szLength, sizeof(szLength), "%u", (unsigned int)sForm.size());
+    sRequest = std::string(pszMethod) + " " + sPath + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n";
+    if(!sForm.empty())
+        sRequest += std::string("Content-Type: application/x-www-form-urlencoded\r\nContent-Length: ") + szLength + "\r\n";
+    sRequest += "\r\n" + sForm;
+    if(send(nFd, sRequest.data(), sRequest.size(), 0) != (ssize_t)sRequest.size()) {
+        ::close(nFd);
+        return -1;
+    }
+
+    while((nRead = recv(nFd, szBuffer, sizeof(szBuffer), 0)) > 0)
+        sAnswer.append(szBuffer, (size_t)nRead);
+    ::close(nFd);
+
+    nHeaderEnd = sAnswer.find("\r\n\r\n");
+    if(nHeaderEnd == std::string::npos || sscanf(sAnswer.c_str(), "HTTP/1.1 %d", &nStatus) != 1)
+        return -1;
+    sBody = sAnswer.substr(nHeaderEnd + 4);
+    return nStatus;
+}
+
+static int alpacaGet(const char *pszMember, std::string &sBody)
+{
+    char szPath[256];
+
+    snprintf(szPath, sizeof(szPath), "/api/v1/dome/0/%s?ClientID=7&ClientTransactionID=%d", pszMember, ++s_nTransaction);
+    return httpRequest("GET", szPath, "", sBody);
+}
+
+static int alpacaPut(const char *pszMember, const char *pszParams, std::string &sBody)
+{
+    char szForm[256];
+
+    snprintf(szForm, sizeof(szForm), "ClientID=7&ClientTransactionID=%d%s%s", ++s_nTransaction, pszParams[0] ? "&" : "", pszParams);
+    return httpRequest("PUT", std::string("/api/v1/dome/0/") + pszMember, szForm, sBody);
+}
+
+// the raw JSON text of a member, empty when it isn't there
+static std::string jsonMember(const std::string &sBody, const char *pszName)
+{
+    std::string sKey = std::string("\"") + pszName + "\":";
+    size_t nStart;
+    size_t nEnd;
+
+    nStart = sBody.find(sKey);
+    if(nStart == std::string::npos)
+        return "";
+    nStart += sKey.size();
+    nEnd = sBody.find_first_of(",}", nStart);
+    return sBody.substr(nStart, nEnd == std::string::npos ? std::string::npos : nEnd - nStart);
+}
+
+static int errorNumber(const std::string &sBody)
+{
+    std::string sError = jsonMember(sBody, "ErrorNumber");
+
+    return sError.empty() ? -1 : atoi(sError.c_str());
+}
+
+// polls a GET until its value is sValue
+static bool waitForValue(const char *pszMember, const char *pszValue)
+{
+    std::string sBody;
+    double dStart = now();
+
+    while(now() - dStart < TEST_MOVE_TIMEOUT) {
+        if(alpacaGet(pszMember, sBody) == 200 && jsonMember(sBody, "Value") == pszValue)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+static bool waitForAzimuth(double dAz)
+{
+    std::string sBody;
+    double dStart = now();
+
+    while(now() - dStart < TEST_MOVE_TIMEOUT) {
+        if(alpacaGet("azimuth", sBody) == 200 && fabs(atof(jsonMember(sBody, "Value").c_str()) - dAz) < TEST_AZ_TOLERANCE)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    int nErr;
+    int nStatus;
+    char szWhat[128];
+    std::string sBody;
+    CMockSerX Serial;
+    CQuietLogger Logger;
+    CDomePro DomePro;
+
+    if(argc > 1)
+        s_nPort = atoi(argv[1]);
+
+    DomePro.SetSerxPointer(&Serial);
+    DomePro.setLogger(&Logger);
+    DomePro.setCurrentAnalysis(false, NULL);
+    DomePro.setShutterBattery(false, NULL);
+    nErr = DomePro.Connect("mock");
+    check(nErr == DP2_OK, "connect to the mock controller");
+    if(nErr)
+        return 1;
+
+    CDomeAlpaca Alpaca(DomePro);
+    nErr = Alpaca.start(s_nPort);
+    snprintf(szWhat, sizeof(szWhat), "Alpaca server on port %d", s_nPort);
+    check(nErr == SB_OK, szWhat);
+    if(nErr) {
+        DomePro.Disconnect();
+        return 1;
+    }
+
+    // management and the cached GETs
+    nStatus = httpRequest("GET", "/management/apiversions", "", sBody);
+    check(nStatus == 200 && jsonMember(sBody, "Value") == "[1]", "GET /management/apiversions");
+    nStatus = alpacaGet("connected", sBody);
+    check(nStatus == 200 && jsonMember(sBody, "Value") == "true", "GET connected");
+    check(atoi(jsonMember(sBody, "ClientTransactionID").c_str()) == s_nTransaction, "ClientTransactionID echoed");
+    nStatus = alpacaGet("shutterstatus", sBody);
+    check(nStatus == 200 && jsonMember(sBody, "Value") == "1", "GET shutterstatus is closed");
+    nStatus = alpacaGet("altitude", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_NOT_IMPLEMENTED, "GET altitude not implemented");
+    nStatus = alpacaGet("nosuchmember", sBody);
+    check(nStatus == 400, "GET unknown member is a 400");
+
+    // parameter checks
+    nStatus = alpacaPut("slewtoazimuth", "Azimuth=400", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_INVALID_VALUE, "PUT slewtoazimuth out of range");
+    nStatus = alpacaPut("slewtoazimuth", "", sBody);
+    check(nStatus == 400, "PUT slewtoazimuth without an azimuth is a 400");
+
+    // moves
+    nStatus = alpacaPut("slewtoazimuth", "Azimuth=200", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_OK, "PUT slewtoazimuth 200");
+    check(waitForValue("slewing", "false") && waitForAzimuth(200.0), "slew ends at 200");
+    nStatus = alpacaPut("synctoazimuth", "Azimuth=10", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_OK, "PUT synctoazimuth 10");
+    check(waitForAzimuth(10.0), "azimuth synced to 10");
+    nStatus = alpacaPut("park", "", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_OK, "PUT park");
+    check(waitForValue("atpark", "true"), "at park");
+    nStatus = alpacaPut("openshutter", "", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_OK, "PUT openshutter");
+    check(waitForValue("shutterstatus", "0"), "shutter open");
+    nStatus = alpacaPut("closeshutter", "", sBody);
+    check(nStatus == 200 && errorNumber(sBody) == ALPACA_OK, "PUT closeshutter");
+    check(waitForValue("shutterstatus", "1"), "shutter closed");
+
+    Alpaca.stop();
+    DomePro.Disconnect();
+    printf("%d failed\n", s_nFailed);
+    return s_nFailed;
+}
@@ -0,0 +1,170 @@
+//
+//  archivetest.cpp
+//  ATCL Dome X2 plugin
+//
+//  Telemetry archive (telemetryarchive.h) : varint/zig-zag round trip over several blocks and range queries
+//  against a brute force scan of the same records.
+//  usage : archivetest [file], exits with the number of failed checks.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <vector>
+
+#include "../telemetryarchive.h"
+#include "testcheck.h"
+
+#define TEST_RECORDS        (TLA_BLOCK_RECORDS * 3 + 100)
+#define TEST_START_TIME     1700000000.0
+#define TEST_PERIOD         0.5         // seconds
+
+static int64_t ms(double dTime)
+{
+    return (int64_t)floor(dTime * 1000.0 + 0.5);
+}
+
+// deterministic values with large jumps both ways and channels that aren't always sampled
+static void makeRecords(std::vector<TelemetryRecord> &Records)
+{
+    int i, j;
+    TelemetryRecord Record;
+
+    srand(1);
+    for(i = 0; i < TEST_RECORDS; i++) {
+        memset(&Record, 0, sizeof(TelemetryRecord));
+        Record.dTime = TEST_START_TIME + i * TEST_PERIOD;
+        for(j = 0; j < TLM_CHANNEL_COUNT; j++) {
+            if(j != TLM_AZ_SUPPLY && (rand() % 4) == 0)
+                continue;
+            Record.nValid |= 1 << j;
+            Record.nRaw[j] = (rand() % 2048) - 1024;
+            if((i % 500) == 0)
+                Record.nRaw[j] = (i % 1000) ? -2000000000 : 2000000000;
+        }
+        Records.push_back(Record);
+    }
+}
+
+static bool sameRecord(const TelemetryRecord &A, const TelemetryRecord &B)
+{
+    int j;
+
+    if(ms(A.dTime) != ms(B.dTime) || A.nValid != B.nValid)
+        return false;
+    for(j = 0; j < TLM_CHANNEL_COUNT; j++)
+        if((A.nValid & (1 << j)) && A.nRaw[j] != B.nRaw[j])
+            return false;
+    return true;
+}
+
+static void bruteRange(const std::vector<TelemetryRecord> &Records, int nChannel, double dStart, double dEnd, TelemetryRange &Range)
+{
+    memset(&Range, 0, sizeof(TelemetryRange));
+    for(const TelemetryRecord &Record : Records) {
+        if(!(Record.nValid & (1 << nChannel)) || ms(Record.dTime) < ms(dStart) || ms(Record.dTime) > ms(dEnd))
+            continue;
+        if(!Range.nCount || Record.nRaw[nChannel] < Range.nMin)
+            Range.nMin = Record.nRaw[nChannel];
+        if(!Range.nCount || Record.nRaw[nChannel] > Range.nMax)
+            Range.nMax = Record.nRaw[nChannel];
+        Range.nCount++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int nErr;
+    int i, j;
+    bool bSame;
+    char szFile[256];
+    char szWhat[128];
+    double dGain[TLM_CHANNEL_COUNT];
+    double dOffset[TLM_CHANNEL_COUNT];
+    double dFirst, dLast;
+    double dStart, dEnd;
+    std::vector<TelemetryRecord> Records;
+    std::vector<TelemetryRecord> Read;
+    TelemetryRange Range;
+    TelemetryRange Expected;
+    CTelemetryArchive Archive;
+
+    if(argc > 1)
+        snprintf(szFile, sizeof(szFile), "%s", argv[1]);
+    else
+        snprintf(szFile, sizeof(szFile), "/tmp/archivetest_%d.tla", (int)getpid());
+    unlink(szFile);
+    for(j = 0; j < TLM_CHANNEL_COUNT; j++) {
+        dGain[j] = 0.01 * (j + 1);
+        dOffset[j] = -1.0 * j;
+    }
+    makeRecords(Records);
+
+    nErr = Archive.open(szFile, true, dGain, dOffset);
+    check(nErr == TLA_OK, "create the archive");
+    if(nErr)
+        return s_nFailed;
+    for(i = 0; i < (int)Records.size() && !nErr; i++)
+        nErr = Archive.append(Records[i]);
+    check(nErr == TLA_OK, "append the records");
+
+    // the block still being built is part of the queries
+    nErr = Archive.readRecords(TEST_START_TIME, TEST_START_TIME + TEST_RECORDS * TEST_PERIOD, Read);
+    check(nErr == TLA_OK && Read.size() == Records.size(), "read back before the last flush");
+    Archive.close();
+
+    nErr = Archive.open(szFile, false, NULL, NULL);
+    check(nErr == TLA_OK, "open the archive read only");
+    if(nErr)
+        return s_nFailed;
+
+    nErr = Archive.getTimeSpan(dFirst, dLast);
+    check(nErr == TLA_OK && ms(dFirst) == ms(Records.front().dTime) && ms(dLast) == ms(Records.back().dTime), "time span");
+    check(fabs(Archive.toValue(2, 100) - (100 * dGain[2] + dOffset[2])) < 1e-9, "gain and offset kept in the header");
+
+    nErr = Archive.readRecords(dFirst, dLast, Read);
+    bSame = (nErr == TLA_OK && Read.size() == Records.size());
+    for(i = 0; bSame && i < (int)Records.size(); i++)
+        bSame = sameRecord(Records[i], Read[i]);
+    check(bSame, "every record round trips, extreme deltas included");
+
+    // ranges inside a block, across block boundaries, over whole blocks and outside of the data
+    for(i = 0; i < 4; i++) {
+        switch(i) {
+            case 0:
+                dStart = TEST_START_TIME + 10 * TEST_PERIOD;
+                dEnd = TEST_START_TIME + 20 * TEST_PERIOD;
+                break;
+            case 1:
+                dStart = TEST_START_TIME + (TLA_BLOCK_RECORDS - 10) * TEST_PERIOD;
+                dEnd = TEST_START_TIME + (2 * TLA_BLOCK_RECORDS + 10) * TEST_PERIOD;
+                break;
+            case 2:
+                dStart = dFirst - 100.0;
+                dEnd = dLast + 100.0;
+                break;
+            default:
+                dStart = dLast + 10.0;
+                dEnd = dLast + 20.0;
+                break;
+        }
+        for(j = 0; j < TLM_CHANNEL_COUNT; j++) {
+            Archive.queryRange(j, dStart, dEnd, Range);
+            bruteRange(Records, j, dStart, dEnd, Expected);
+            if(Range.nCount != Expected.nCount || (Expected.nCount && (Range.nMin != Expected.nMin || Range.nMax != Expected.nMax)))
+                break;
+        }
+        snprintf(szWhat, sizeof(szWhat), "range query %d matches a full scan", i);
+        check(j == TLM_CHANNEL_COUNT, szWhat);
+        // only the blocks partially in the range get decoded
+        if(i == 2)
+            check(Range.nBlocksDecoded == 0, "whole blocks answered from their headers");
+        if(i == 1)
+            check(Range.nBlocksDecoded == 2, "two partial blocks decoded across a boundary");
+    }
+
+    Archive.close();
+    unlink(szFile);
+    printf("%d failed\n", s_nFailed);
+    return s_nFailed;
+}
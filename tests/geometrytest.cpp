@@ -0,0 +1,132 @@
+//
+//  geometrytest.cpp
+//  ATCL Dome X2 plugin
+//
+//  Dome geometry (domegeometry.h) : the interpolated table against the direct computation, a centered mount
+//  against the plain telescope azimuth and the pier side hysteresis around the meridian.
+//  usage : geometrytest, exits with the number of failed checks.
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "../domegeometry.h"
+#include "testcheck.h"
+
+#define TEST_LATITUDE       45.0
+#define TEST_MAX_ALT        60.0        // near the zenith the azimuth changes too fast to interpolate
+#define TEST_LUT_TOLERANCE  0.05        // degrees
+#define TEST_AZ_TOLERANCE   0.001       // degrees, the table is stored as float
+
+static double azDiff(double dAz1, double dAz2)
+{
+    return fabs(remainder(dAz1 - dAz2, 360.0));
+}
+
+// plain HA/Dec to Alt/Az, azimuth from the North through the East
+static void telescopeAltAz(double dHa, double dDec, double &dAlt, double &dAz)
+{
+    double dH = dHa * 15.0 * M_PI / 180.0;
+    double dD = dDec * M_PI / 180.0;
+    double dL = TEST_LATITUDE * M_PI / 180.0;
+
+    dAlt = asin(sin(dL) * sin(dD) + cos(dL) * cos(dD) * cos(dH)) * 180.0 / M_PI;
+    dAz = atan2(-cos(dD) * sin(dH), cos(dL) * sin(dD) - sin(dL) * cos(dD) * cos(dH)) * 180.0 / M_PI;
+    if(dAz < 0)
+        dAz += 360.0;
+}
+
+static void testCentered()
+{
+    CDomeGeometry Geometry;
+    double dHa, dDec;
+    double dAlt, dAz;
+    double dMaxError = 0;
+    int nSide;
+
+    Geometry.setGeometry(3.0, 0.0, 0.0, 0.0, 0.0);
+    Geometry.setLatitude(TEST_LATITUDE);
+    for(nSide = 0; nSide < PIER_SIDE_COUNT; nSide++) {
+        for(dHa = -11.5; dHa <= 11.5; dHa += 0.5) {
+            for(dDec = -60.0; dDec <= 85.0; dDec += 5.0) {
+                telescopeAltAz(dHa, dDec, dAlt, dAz);
+                if(dAlt > TEST_MAX_ALT)
+                    continue;
+                dMaxError = fmax(dMaxError, azDiff(Geometry.computeDomeAzimuth(dHa, dDec, nSide), dAz));
+            }
+        }
+    }
+    printf("centered mount, largest difference %.6f deg\n", dMaxError);
+    check(dMaxError < TEST_AZ_TOLERANCE, "centered mount without offset gives the telescope azimuth");
+}
+
+static void testLUT()
+{
+    CDomeGeometry Geometry;
+    double dHa, dDec;
+    double dAlt, dAz;
+    double dMaxError = 0;
+    int nSide;
+    int i;
+
+    check(Geometry.domeAzimuth(1.0, 10.0, PIER_EAST) < 0, "no table without a dome radius");
+
+    Geometry.setGeometry(3.0, 0.15, -0.1, 0.4, 0.45);
+    Geometry.setLatitude(TEST_LATITUDE);
+    Geometry.rebuildLUT();
+    check(Geometry.isValid(), "table built");
+
+    // off grid points, between the HA and Dec steps
+    srand(1);
+    for(i = 0; i < 20000; i++) {
+        dHa = -12.0 + 24.0 * rand() / (double)RAND_MAX;
+        dDec = -60.0 + 145.0 * rand() / (double)RAND_MAX;
+        nSide = rand() % PIER_SIDE_COUNT;
+        telescopeAltAz(dHa, dDec, dAlt, dAz);
+        if(dAlt < 0.0 || dAlt > TEST_MAX_ALT)
+            continue;
+        dMaxError = fmax(dMaxError, azDiff(Geometry.domeAzimuth(dHa, dDec, nSide), Geometry.computeDomeAzimuth(dHa, dDec, nSide)));
+    }
+    printf("table against direct, largest difference %.4f deg\n", dMaxError);
+    check(dMaxError < TEST_LUT_TOLERANCE, "table matches the direct computation");
+
+    check(azDiff(Geometry.domeAzimuth(13.05, 20.5, PIER_WEST), Geometry.domeAzimuth(-10.95, 20.5, PIER_WEST)) < 1e-9, "HA wraps around 24h");
+    check(azDiff(Geometry.domeAzimuth(2.0, 95.0, PIER_EAST), Geometry.domeAzimuth(2.0, 90.0, PIER_EAST)) < 1e-9, "Dec clamped to the pole");
+}
+
+static void testPierSide()
+{
+    CDomeGeometry Geometry;
+    double dHa;
+    bool bOk;
+
+    check(Geometry.getPierSide() == PIER_SIDE_COUNT, "no pier side before the first lookup");
+    check(Geometry.pierSideForHa(0.1) == PIER_EAST && Geometry.getPierSide() == PIER_SIDE_COUNT, "inside the band without a side is a guess that isn't kept");
+
+    // the projections don't touch the kept side
+    check(Geometry.pierSideForHa(-1.0) == PIER_WEST, "west side east of the meridian");
+    check(Geometry.pierSideForHa(3.0, PIER_WEST) == PIER_EAST && Geometry.getPierSide() == PIER_WEST, "projection past the band leaves the kept side");
+    check(Geometry.pierSideForHa(0.1, PIER_EAST) == PIER_EAST && Geometry.getPierSide() == PIER_WEST, "projection inside the band uses the side passed in");
+    check(Geometry.pierSideForHa(0.1, PIER_SIDE_COUNT) == PIER_EAST && Geometry.pierSideForHa(-0.1, PIER_SIDE_COUNT) == PIER_WEST, "projection without a side guesses from the HA sign");
+
+    // tracking through the meridian keeps the side until the end of the band, then back doesn't flip it
+    bOk = true;
+    for(dHa = -1.0; dHa < GEOM_PIER_HYSTERESIS - 0.001; dHa += 0.01)
+        bOk = bOk && Geometry.pierSideForHa(dHa) == PIER_WEST;
+    check(bOk, "side kept while tracking across the meridian");
+    check(Geometry.pierSideForHa(GEOM_PIER_HYSTERESIS) == PIER_EAST, "side changes at the end of the band");
+    bOk = true;
+    for(dHa = GEOM_PIER_HYSTERESIS; dHa > -GEOM_PIER_HYSTERESIS + 0.001; dHa -= 0.01)
+        bOk = bOk && Geometry.pierSideForHa(dHa) == PIER_EAST;
+    check(bOk, "side kept coming back inside the band");
+    check(Geometry.pierSideForHa(-GEOM_PIER_HYSTERESIS) == PIER_WEST && Geometry.getPierSide() == PIER_WEST, "side changes at the other end of the band");
+}
+
+int main()
+{
+    testCentered();
+    testLUT();
+    testPierSide();
+
+    printf("%d failed\n", s_nFailed);
+    return s_nFailed;
+}
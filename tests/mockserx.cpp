@@ -0,0 +1,236 @@
+//
+//  mockserx.cpp
+//  ATCL Dome X2 plugin
+//
+//  Mock DomePro2 controller, see mockserx.h.
+
+#include "mockserx.h"
+
+CMockSerX::CMockSerX()
+{
+    m_bConnected = false;
+    m_dPosition = 0.0;
+    m_dTarget = 0.0;
+    m_sMode = "Fixed";
+    m_dLastMove = now();
+    m_nShutterState = CLOSED;
+    m_dShutterEnd = 0.0;
+}
+
+CMockSerX::~CMockSerX()
+{
+}
+
+int CMockSerX::getCommandCount(const char *pszCmd)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Counts[pszCmd];
+}
+
+int CMockSerX::open(const char *pszPort, const unsigned long &dwBaudRate, const Parity &parity, const char *pszSessionPrefix)
+{
+    (void)pszPort;
+    (void)dwBaudRate;
+    (void)parity;
+    (void)pszSessionPrefix;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_bConnected = true;
+    return SB_OK;
+}
+
+int CMockSerX::close()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_bConnected = false;
+    return SB_OK;
+}
+
+bool CMockSerX::isConnected(void) const
+{
+    return m_bConnected;
+}
+
+int CMockSerX::flushTx(void)
+{
+    return SB_OK;
+}
+
+int CMockSerX::purgeTxRx(void)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_sTx.clear();
+    m_Rx.clear();
+    return SB_OK;
+}
+
+// the answer is queued as soon as the command is written
+int CMockSerX::waitForBytesRx(const int &nNumBytes, const int &nTimeOutMs)
+{
+    (void)nTimeOutMs;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return (int)m_Rx.size() >= nNumBytes ? SB_OK : ERR_CMDFAILED;
+}
+
+int CMockSerX::readFile(void *lpBuffer, const unsigned long dwTotalBytesToRead, unsigned long &dwBytesRead, const unsigned long &dwTimeOut)
+{
+    uint8_t *pBytes = (uint8_t *)lpBuffer;
+
+    (void)dwTimeOut;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    dwBytesRead = 0;
+    while(dwBytesRead < dwTotalBytesToRead && !m_Rx.empty()) {
+        pBytes[dwBytesRead++] = m_Rx.front();
+        m_Rx.pop_front();
+    }
+    return SB_OK;
+}
+
+int CMockSerX::writeFile(void *lpBuffer, const unsigned long &dwBytesToWrite, unsigned long &dwBytesWritten)
+{
+    size_t nEnd;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_sTx.append((const char *)lpBuffer, dwBytesToWrite);
+    dwBytesWritten = dwBytesToWrite;
+    while((nEnd = m_sTx.find(';')) != std::string::npos) {
+        handleCommand(m_sTx.substr(0, nEnd + 1));
+        m_sTx.erase(0, nEnd + 1);
+    }
+    return SB_OK;
+}
+
+int CMockSerX::bytesWaitingRx(int &nBytesWaiting)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    nBytesWaiting = (int)m_Rx.size();
+    return SB_OK;
+}
+
+#pragma mark - controller
+
+// called with m_Mutex held
+void CMockSerX::handleCommand(const std::string &sCmd)
+{
+    uint32_t nLimits;
+
+    m_Counts[sCmd]++;
+    moveDome();
+    moveShutter();
+
+    if(sCmd == "!DGfv;")
+        answerHex(0x105);
+    else if(sCmd == "!DGhc;")
+        answerHex(CLASSIC_DOME);
+    else if(sCmd == "!DGcp;")
+        answerHex(MOCK_CPR);
+    else if(sCmd == "!DGpa;")
+        answerHex(MOCK_PARK_TICKS);
+    else if(sCmd == "!DGap;")
+        answerHex((uint32_t)m_dPosition);
+    else if(sCmd == "!DGam;")
+        answer(m_sMode.c_str());
+    else if(sCmd == "!DGsx;")
+        answerHex((uint32_t)m_nShutterState);
+    else if(sCmd == "!DGdl;") {
+        nLimits = 0;
+        if(m_nShutterState == OPEN)
+            nLimits |= BitShutter1_Opened;
+        if(m_nShutterState == CLOSED)
+            nLimits |= BitShutter1_Closed;
+        if(m_dPosition < 1.0 || m_dPosition > MOCK_CPR - 1.0)
+            nLimits |= BitAtHome | BitHomeSwitchState;
+        if(fabs(m_dPosition - MOCK_PARK_TICKS) < 1.0)
+            nLimits |= BitAtPark;
+        answerHex(nLimits);
+    }
+    else if(sCmd.compare(0, 7, "!DSgo0x") == 0) {
+        m_dTarget = strtoul(sCmd.c_str() + 7, NULL, 16) % MOCK_CPR;
+        m_sMode = "GoTo";
+        ack();
+    }
+    else if(sCmd.compare(0, 7, "!DSca0x") == 0) {
+        m_dPosition = strtoul(sCmd.c_str() + 7, NULL, 16) % MOCK_CPR;
+        ack();
+    }
+    else if(sCmd == "!DSgp;") {
+        m_dTarget = MOCK_PARK_TICKS;
+        m_sMode = "Parking";
+        ack();
+    }
+    else if(sCmd == "!DSah;") {
+        m_dTarget = 0.0;
+        m_sMode = "Homing";
+        ack();
+    }
+    else if(sCmd == "!DXxa;") {
+        m_sMode = "Fixed";
+        ack();
+    }
+    else if(sCmd == "!DSso;") {
+        if(m_nShutterState != OPEN) {
+            m_nShutterState = OPENING;
+            m_dShutterEnd = now() + MOCK_SHUTTER_TIME;
+        }
+        ack();
+    }
+    else if(sCmd == "!DSsc;") {
+        if(m_nShutterState != CLOSED) {
+            m_nShutterState = CLOSING;
+            m_dShutterEnd = now() + MOCK_SHUTTER_TIME;
+        }
+        ack();
+    }
+    else if(sCmd.compare(0, 3, "!DG") == 0)
+        answerHex(0);
+    else
+        ack();
+}
+
+// shortest way to the target at MOCK_AZ_SPEED
+void CMockSerX::moveDome()
+{
+    double dTime = now();
+    double dStep = (dTime - m_dLastMove) * MOCK_AZ_SPEED;
+    double dDiff;
+
+    m_dLastMove = dTime;
+    if(m_sMode == "Fixed")
+        return;
+    dDiff = remainder(m_dTarget - m_dPosition, MOCK_CPR);
+    if(fabs(dDiff) <= dStep) {
+        m_dPosition = m_dTarget;
+        m_sMode = "Fixed";
+        return;
+    }
+    m_dPosition = fmod(m_dPosition + (dDiff > 0 ? dStep : -dStep) + MOCK_CPR, MOCK_CPR);
+}
+
+void CMockSerX::moveShutter()
+{
+    if((m_nShutterState == OPENING || m_nShutterState == CLOSING) && now() >= m_dShutterEnd)
+        m_nShutterState = m_nShutterState == OPENING ? OPEN : CLOSED;
+}
+
+void CMockSerX::answer(const char *pszAnswer)
+{
+    m_Rx.insert(m_Rx.end(), pszAnswer, pszAnswer + strlen(pszAnswer));
+    m_Rx.push_back(';');
+}
+
+void CMockSerX::answerHex(uint32_t nValue)
+{
+    char szAnswer[16];
+
+    snprintf(szAnswer, sizeof(szAnswer), "%08X", nValue);
+    answer(szAnswer);
+}
+
+void CMockSerX::ack()
+{
+    m_Rx.push_back(ATCL_ACK);
+}
+
+double CMockSerX::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
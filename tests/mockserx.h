@@ -0,0 +1,65 @@
+//
+//  mockserx.h
+//  ATCL Dome X2 plugin
+//
+//  Mock DomePro2 controller behind a SerXInterface, for the tests. A classic dome with one shutter : the
+//  azimuth moves at MOCK_AZ_SPEED toward the goto, park or home target, the shutter takes MOCK_SHUTTER_TIME
+//  to open or close. Every other read answers 0 and every other set command is ACKed.
+
+#ifndef __MOCK_SERX__
+#define __MOCK_SERX__
+
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include "../domepro.h"
+
+#define MOCK_CPR            36000       // ticks per revolution
+#define MOCK_AZ_SPEED       18000.0     // ticks per second
+#define MOCK_SHUTTER_TIME   1.0         // seconds
+#define MOCK_PARK_TICKS     9000        // 90 deg
+
+class CMockSerX : public SerXInterface
+{
+public:
+    CMockSerX();
+    virtual ~CMockSerX();
+
+    int     getCommandCount(const char *pszCmd);
+
+    virtual int     open(const char *pszPort, const unsigned long &dwBaudRate = 9600, const Parity &parity = B_NOPARITY, const char *pszSessionPrefix = 0);
+    virtual int     close();
+    virtual bool    isConnected(void) const;
+    virtual int     flushTx(void);
+    virtual int     purgeTxRx(void);
+    virtual int     waitForBytesRx(const int &nNumBytes, const int &nTimeOutMs);
+    virtual int     readFile(void *lpBuffer, const unsigned long dwTotalBytesToRead, unsigned long &dwBytesRead, const unsigned long &dwTimeOut = 1000);
+    virtual int     writeFile(void *lpBuffer, const unsigned long &dwBytesToWrite, unsigned long &dwBytesWritten);
+    virtual int     bytesWaitingRx(int &nBytesWaiting);
+
+protected:
+    void    handleCommand(const std::string &sCmd);
+    void    moveDome();
+    void    moveShutter();
+    void    answer(const char *pszAnswer);
+    void    answerHex(uint32_t nValue);
+    void    ack();
+    double  now();
+
+    std::mutex          m_Mutex;
+    bool                m_bConnected;
+    std::string         m_sTx;
+    std::deque<uint8_t> m_Rx;
+    std::map<std::string, int>  m_Counts;
+
+    double              m_dPosition;        // ticks
+    double              m_dTarget;
+    std::string         m_sMode;            // !DGam; answer
+    double              m_dLastMove;
+    int                 m_nShutterState;    // DomeProShutterState
+    double              m_dShutterEnd;
+};
+
+#endif
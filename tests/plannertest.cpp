@@ -0,0 +1,244 @@
+//
+//  plannertest.cpp
+//  ATCL Dome X2 plugin
+//
+//  Observation plan optimizer (domeplanner.h) : the exact search against every order on small plans, the
+//  greedy + local search on larger ones, full circle windows and the rotation model fit and file.
+//  usage : plannertest, exits with the number of failed checks.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+
+#include "../domeplanner.h"
+#include "testcheck.h"
+
+#define TEST_BRUTE_PLANS    300
+#define TEST_BRUTE_MAX      7           // targets, 5040 orders
+#define TEST_GREEDY_TARGETS 20
+
+// access to the order evaluation to check the planner against
+class CTestPlanner : public CDomePlanner
+{
+public:
+    // best of all the orders, with the same ranking as the planner
+    int bruteForce(const std::vector<DomePlanTarget> &Targets, double dStartAz, double dStartTime, double &dBestMove, double &dBestEnd)
+    {
+        std::vector<int> Order;
+        int i;
+        int nCount, nBestCount = -1;
+        double dMove, dEnd;
+
+        m_pTargets = &Targets;
+        m_dStartAz = dStartAz;
+        m_dStartTime = dStartTime;
+        for(i = 0; i < (int)Targets.size(); i++)
+            Order.push_back(i);
+        do {
+            nCount = evaluate(Order, NULL, dMove, dEnd);
+            if(nBestCount < 0 || isBetter(nCount, dMove, dEnd, nBestCount, dBestMove, dBestEnd)) {
+                nBestCount = nCount;
+                dBestMove = dMove;
+                dBestEnd = dEnd;
+            }
+        } while(std::next_permutation(Order.begin(), Order.end()));
+        m_pTargets = NULL;
+        return nBestCount;
+    };
+
+    // the greedy order alone, before the local search
+    double greedyMoveTime(const std::vector<DomePlanTarget> &Targets, double dStartAz, double dStartTime)
+    {
+        std::vector<int> Order;
+        double dMove, dEnd;
+
+        m_pTargets = &Targets;
+        m_dStartAz = dStartAz;
+        m_dStartTime = dStartTime;
+        planGreedy(Order);
+        evaluate(Order, NULL, dMove, dEnd);
+        m_pTargets = NULL;
+        return dMove;
+    };
+};
+
+static double frand(double dMin, double dMax)
+{
+    return dMin + (dMax - dMin) * rand() / (double)RAND_MAX;
+}
+
+static bool inRange(double dAz, const DomePlanTarget &Target)
+{
+    if(Target.dAzMin == Target.dAzMax)
+        return true;
+    return fmod(dAz - Target.dAzMin + 360.0, 360.0) <= fmod(Target.dAzMax - Target.dAzMin + 360.0, 360.0) + 1e-9;
+}
+
+// every step in its window and its azimuth range, after the previous one and the rotation, each target once
+static bool validPlan(const std::vector<DomePlanTarget> &Targets, const std::vector<DomePlanStep> &Plan, double dStartTime)
+{
+    std::vector<bool> Used(Targets.size(), false);
+    std::vector<DomePlanStep>::const_iterator it;
+    double dTime = dStartTime;
+
+    for(it = Plan.begin(); it != Plan.end(); ++it) {
+        const DomePlanTarget &Target = Targets[it->nTarget];
+        if(Used[it->nTarget] || !inRange(it->dDomeAz, Target))
+            return false;
+        if(it->dStart < Target.dEarliest || it->dStart > Target.dLatest || it->dStart < dTime + it->dMoveTime - 1e-9)
+            return false;
+        Used[it->nTarget] = true;
+        dTime = it->dEnd;
+    }
+    return true;
+}
+
+static void makeTargets(std::vector<DomePlanTarget> &Targets, int nCount, double dWindow)
+{
+    int i;
+    DomePlanTarget Target;
+
+    Targets.clear();
+    for(i = 0; i < nCount; i++) {
+        Target.sName = "T" + std::to_string(i);
+        Target.dEarliest = frand(0.0, 600.0);
+        Target.dLatest = Target.dEarliest + frand(0.0, dWindow);
+        Target.dDuration = frand(30.0, 200.0);
+        Target.dAzMin = floor(frand(0.0, 360.0));
+        Target.dAzMax = fmod(Target.dAzMin + floor(frand(10.0, 120.0)), 360.0);
+        // some targets at the zenith, any azimuth
+        if((rand() % 8) == 0)
+            Target.dAzMax = Target.dAzMin;
+        Targets.push_back(Target);
+    }
+}
+
+static void testExact()
+{
+    CTestPlanner Planner;
+    std::vector<DomePlanTarget> Targets;
+    std::vector<DomePlanStep> Plan;
+    int i;
+    int nBestCount;
+    int nMismatch = 0;
+    int nInvalid = 0;
+    double dStartAz;
+    double dBestMove = 0.0, dBestEnd = 0.0;
+    double dEnd;
+
+    srand(1);
+    for(i = 0; i < TEST_BRUTE_PLANS; i++) {
+        makeTargets(Targets, 2 + i % (TEST_BRUTE_MAX - 1), 600.0);
+        dStartAz = floor(frand(0.0, 360.0));
+        Planner.plan(Targets, dStartAz, 0.0, Plan);
+        nBestCount = Planner.bruteForce(Targets, dStartAz, 0.0, dBestMove, dBestEnd);
+        dEnd = Plan.empty() ? 0.0 : Plan.back().dEnd;
+        if((int)Plan.size() != nBestCount || fabs(Planner.getTotalMoveTime() - dBestMove) > 1e-6 || fabs(dEnd - dBestEnd) > 1e-6)
+            nMismatch++;
+        if(!validPlan(Targets, Plan, 0.0))
+            nInvalid++;
+    }
+    printf("%d plans, %d differ from the best order, %d invalid\n", TEST_BRUTE_PLANS, nMismatch, nInvalid);
+    check(nMismatch == 0, "exact search finds the best order");
+    check(nInvalid == 0, "exact search plans are valid");
+}
+
+static void testGreedy()
+{
+    CTestPlanner Planner;
+    std::vector<DomePlanTarget> Targets;
+    std::vector<DomePlanStep> Plan;
+    int i;
+    int nMissing = 0;
+    int nInvalid = 0;
+    int nWorse = 0;
+
+    srand(2);
+    for(i = 0; i < 20; i++) {
+        // windows long enough for any order
+        makeTargets(Targets, TEST_GREEDY_TARGETS, 1e6);
+        Planner.plan(Targets, 0.0, 0.0, Plan);
+        if(Plan.size() != Targets.size())
+            nMissing++;
+        if(!validPlan(Targets, Plan, 0.0))
+            nInvalid++;
+        if(Planner.getTotalMoveTime() > Planner.greedyMoveTime(Targets, 0.0, 0.0) + 1e-6)
+            nWorse++;
+    }
+    check(nMissing == 0, "large plans schedule every feasible target");
+    check(nInvalid == 0, "large plans are valid");
+    check(nWorse == 0, "local search never adds rotation to the greedy order");
+}
+
+static void testFullCircle()
+{
+    CDomePlanner Planner;
+    std::vector<DomePlanTarget> Targets;
+    std::vector<DomePlanStep> Plan;
+    DomePlanTarget Target;
+
+    Target.sName = "zenith";
+    Target.dEarliest = 0.0;
+    Target.dLatest = 100.0;
+    Target.dDuration = 60.0;
+    Target.dAzMin = 100.0;
+    Target.dAzMax = 100.0;
+    Targets.push_back(Target);
+    Target.sName = "circle";
+    Target.dAzMin = 0.0;
+    Target.dAzMax = 360.0;
+    Targets.push_back(Target);
+
+    check(Planner.plan(Targets, 250.0, 0.0, Plan) == PLAN_OK && Plan.size() == 2, "full circle targets scheduled");
+    check(Plan.size() == 2 && Plan[0].dDomeAz == 250.0 && Plan[1].dDomeAz == 250.0 && Planner.getTotalMoveTime() == 0.0, "full circle windows don't move the dome");
+
+    Targets.clear();
+    check(Planner.plan(Targets, 0.0, 0.0, Plan) == PLAN_NO_TARGET, "empty plan");
+}
+
+static void testRotationModel()
+{
+    CDomeRotationModel Model;
+    CDomeRotationModel Loaded;
+    double dDistance;
+    char szFile[64];
+    FILE *pFile;
+
+    Model.setDefaults(2.5, 0.8);
+    Model.addSample(50.0, 20.0);
+    Model.addSample(90.0, 30.0);
+    check(Model.getSpeed() == 2.5 && Model.getAccel() == 0.8, "defaults until there are enough samples");
+
+    // t = d/v + v/a with v = 4 deg/s and a = 2 deg/s^2, the short moves are left out
+    Model = CDomeRotationModel();
+    for(dDistance = 5.0; dDistance <= 180.0; dDistance += 5.0)
+        Model.addSample(dDistance, dDistance / 4.0 + 4.0 / 2.0);
+    printf("fit speed %.6f accel %.6f from %d samples\n", Model.getSpeed(), Model.getAccel(), Model.getSampleCount());
+    check(fabs(Model.getSpeed() - 4.0) < 1e-6 && fabs(Model.getAccel() - 2.0) < 1e-6, "fit recovers the speed and acceleration");
+    check(fabs(Model.moveTime(100.0) - 27.0) < 1e-6 && fabs(Model.moveTime(2.0) - 2.0) < 1e-6, "trapezoidal and triangular move times");
+
+    snprintf(szFile, sizeof(szFile), "/tmp/plannertest_%d.txt", (int)getpid());
+    check(Model.writeFile(szFile) == PLAN_OK && Loaded.readFile(szFile) == PLAN_OK, "model written and read back");
+    check(Loaded.getSampleCount() == Model.getSampleCount() && fabs(Loaded.getSpeed() - 4.0) < 1e-4 && fabs(Loaded.getAccel() - 2.0) < 1e-4, "model round trip");
+
+    pFile = fopen(szFile, "w");
+    if(pFile) {
+        fprintf(pFile, "# not a model\n3.0 1.0\n");
+        fclose(pFile);
+    }
+    check(Loaded.readFile(szFile) == PLAN_PARSE_ERROR, "bad model file rejected");
+    unlink(szFile);
+    check(Loaded.readFile(szFile) == PLAN_FILE_ERROR, "missing model file");
+}
+
+int main()
+{
+    testExact();
+    testGreedy();
+    testFullCircle();
+    testRotationModel();
+
+    printf("%d failed\n", s_nFailed);
+    return s_nFailed;
+}
@@ -0,0 +1,114 @@
+//
+//  statustest.cpp
+//  ATCL Dome X2 plugin
+//
+//  Live status page (domestatus.h) : a reader mapping polls the page while a writer thread keeps updating it,
+//  every read must be a status the writer actually committed, or STATUS_BUSY when the writer was preempted
+//  in the middle of an update.
+//  usage : statustest, exits with the number of failed checks.
+
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#if !defined(SB_WIN_BUILD)
+#include <sys/mman.h>
+#endif
+
+#include "../domestatus.h"
+#include "testcheck.h"
+
+#define TEST_WRITES         200000
+
+static std::atomic<bool> s_bWriterDone(false);
+
+// setMoveMode(i) then setAz(i + 1), so a committed status has dAz - nMoveMode of 0 or 1
+// and its update time is the time of the last field written.
+static void writer(CDomeStatusPage *pWriter)
+{
+    int i;
+
+    for(i = 0; i < TEST_WRITES; i++) {
+        pWriter->setMoveMode(i);
+        pWriter->setAz(i + 1);
+    }
+    s_bWriterDone = true;
+}
+
+static bool committed(const DomeStatus &Status)
+{
+    double dStep = Status.dAz - Status.nMoveMode;
+
+    if(dStep == 1.0)
+        return Status.dUpdateTime == Status.dAzTime;
+    if(dStep == 0.0)
+        return Status.dUpdateTime == Status.dMoveModeTime;
+    return false;
+}
+
+int main()
+{
+    CDomeStatusPage Writer;
+    CDomeStatusPage Reader;
+    DomeStatus Status;
+    DomeStatus Last;
+    std::thread Thread;
+    char szName[64];
+    int nErr;
+    int nReads = 0;
+    int nChanges = 0;
+    int nBusy = 0;
+    int nNotOk = 0;
+    int nTorn = 0;
+    int nBackwards = 0;
+
+    snprintf(szName, sizeof(szName), "/DomeProStatusTest_%d", (int)getpid());
+
+    check(Reader.read(Status) == STATUS_NOT_OPEN, "read before open");
+    check(Reader.open(szName) == STATUS_SHM_ERROR, "no page before the writer creates it");
+    check(Writer.create(szName) == STATUS_OK, "writer creates the page");
+    check(Reader.open(szName) == STATUS_OK, "reader maps the page");
+    Reader.setAz(123.0);
+    check(Reader.read(Status) == STATUS_OK && Status.dAz == 0.0 && Status.dUpdateTime == 0.0, "new page is empty and readers can't write");
+
+    Writer.setConnected(true, true);
+    memset(&Last, 0, sizeof(DomeStatus));
+    Thread = std::thread(writer, &Writer);
+    while(!s_bWriterDone) {
+        nErr = Reader.read(Status);
+        nReads++;
+        if(nErr == STATUS_BUSY)
+            nBusy++;
+        if(nErr != STATUS_OK) {
+            nNotOk += (nErr != STATUS_BUSY);
+            continue;
+        }
+        if(Status.dAz == 0.0)
+            continue;
+        if(!committed(Status) || Status.nFlags != (STATUS_CONNECTED | STATUS_HAS_SHUTTER))
+            nTorn++;
+        if(Status.dAz < Last.dAz || Status.nMoveMode < Last.nMoveMode)
+            nBackwards++;
+        if(Status.dAz != Last.dAz || Status.nMoveMode != Last.nMoveMode)
+            nChanges++;
+        Last = Status;
+    }
+    Thread.join();
+
+    printf("%d reads, %d busy, %d changes seen, %d errors, %d torn, %d backwards\n", nReads, nBusy, nChanges, nNotOk, nTorn, nBackwards);
+    check(nChanges > 1, "reads overlapped the writes");
+    check(nNotOk == 0 && nBusy < nReads, "reads succeed or report the writer busy");
+    check(nTorn == 0, "every read is a committed status");
+    check(nBackwards == 0, "reads never go back in time");
+
+    check(Reader.read(Status) == STATUS_OK && Status.dAz == TEST_WRITES && Status.nMoveMode == TEST_WRITES - 1, "reader sees the last write");
+    Writer.close();
+    check(Reader.read(Status) == STATUS_OK && Status.dAz == TEST_WRITES, "status stays after the writer closes");
+    Reader.close();
+    check(Reader.read(Status) == STATUS_NOT_OPEN, "read after close");
+#if !defined(SB_WIN_BUILD)
+    shm_unlink(szName);
+#endif
+
+    printf("%d failed\n", s_nFailed);
+    return s_nFailed;
+}
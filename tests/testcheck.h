@@ -0,0 +1,21 @@
+//
+//  testcheck.h
+//  ATCL Dome X2 plugin
+//
+//  Check helper shared by the module tests, each test exits with its number of failed checks.
+
+#ifndef __TEST_CHECK__
+#define __TEST_CHECK__
+
+#include <stdio.h>
+
+static int s_nFailed = 0;
+
+static void check(bool bOk, const char *pszWhat)
+{
+    printf("%s : %s\n", bOk ? "ok  " : "FAIL", pszWhat);
+    if(!bOk)
+        s_nFailed++;
+}
+
+#endif
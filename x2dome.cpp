@@ -12,7 +12,7 @@ X2Dome::X2Dome(const char* pszSelection,
 					BasicIniUtilInterface*			pIniUtil,
 					LoggerInterface*					pLogger,
 					MutexInterface*						pIOMutex,
-					TickCountInterface*					pTickCount)
+					TickCountInterface*					pTickCount) : m_Alpaca(m_DomePro)
 {
 
     m_nPrivateISIndex				= nISIndex;
@@ -27,12 +27,25 @@ X2Dome::X2Dome(const char* pszSelection,
 	m_bLinked = false;
     m_nLearningDomeCPR = NONE;
     m_bBattRequest = 0;
+    m_nSettingsWaiting = 0;
+    m_nSettingsFresh = 0;
+    m_nDiagVersion = 0;
+    m_nDiagWindow = 15;
     m_bShutterGotoEnabled = false;
+    m_bAlpaca = false;
+    m_nAlpacaPort = ALPACA_DEFAULT_PORT;
     m_DomePro.SetSerxPointer(pSerX);
     m_DomePro.setLogger(pLogger);
+    m_DomePro.setTheSkyXFacade(pTheSkyXFacadeForDriversInterface);
 
     if (m_pIniUtil)
     {
+        char szFilePath[LOG_BUFFER_SIZE];
+        char szGainKey[LOG_BUFFER_SIZE];
+        char szOffsetKey[LOG_BUFFER_SIZE];
+        double dFastPeriod;
+        double dSlowPeriod;
+
         // read home Az
         m_DomePro.setHomeAz( m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_HOME_AZ, 0));
 
@@ -56,6 +69,104 @@ X2Dome::X2Dome(const char* pszSelection,
                                              m_Shutter2OpenAngle, m_Shutter2OpenAngle_ADC,
                                              m_Shutter2CloseAngle, m_Shutter2CloseAngle_ADC,
                                              m_bShutterGotoEnabled);
+
+        // predictive slaving
+        m_DomePro.setPredictiveSlaving(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_PREDICTIVE_SLAVING, false));
+        m_DomePro.setSlitWidth(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_SLIT_WIDTH, 20.0));
+        m_DomePro.setSlavingLeadTime(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_SLAVING_LEAD_TIME, 60.0));
+        m_DomePro.setAzRotationSpeed(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_AZ_ROTATION_SPEED, 3.0));
+
+        // multi-pass CPR calibration
+        m_DomePro.setCprCalibration(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_CPR_CAL_PASSES, CPR_CAL_PASSES),
+                                    m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_CPR_CAL_MAX_SIGMA, CPR_CAL_MAX_SIGMA));
+
+        // home switch drift monitor, threshold in degrees
+        m_DomePro.setDriftCorrection(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_DRIFT_MONITOR, true),
+                                     m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_DRIFT_CORRECTION, false),
+                                     m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_DRIFT_THRESHOLD, DRIFT_THRESHOLD));
+
+        // encoder slip detector, threshold in degrees
+        m_DomePro.setSlipDetection(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SLIP_DETECTION, false),
+                                   m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_SLIP_THRESHOLD, SLIP_THRESHOLD));
+
+        // azimuth motor current analysis, off unless CurrentAnalysis is set, the report also keeps the baseline between sessions
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_CURRENT_REPORT_FILE, m_DomePro.getCurrentReportFile(), szFilePath, LOG_BUFFER_SIZE);
+        m_DomePro.setCurrentAnalysis(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_CURRENT_ANALYSIS, false), szFilePath);
+
+        // how long a dome or shutter status read for TheSkyX is reused, moving and idle
+        m_DomePro.setPollPeriods(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_POLL_AZ_FAST, POLL_AZ_FAST_PERIOD),
+                                 m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_POLL_AZ_SLOW, POLL_AZ_SLOW_PERIOD),
+                                 m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_POLL_SHUTTER_FAST, POLL_SHUTTER_FAST_PERIOD),
+                                 m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_POLL_SHUTTER_SLOW, POLL_SHUTTER_SLOW_PERIOD));
+
+        // shutter battery accounting, the history file keeps the discharge curve between sessions
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_SHUTTER_BATTERY_FILE, m_DomePro.getShutterBatteryFile(), szFilePath, LOG_BUFFER_SIZE);
+        m_DomePro.setShutterBattery(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_SHUTTER_BATTERY, true), szFilePath);
+        m_DomePro.setShutterBatteryModel(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_BATTERY_CAPACITY, BATT_CAPACITY_WH),
+                                         m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_BATTERY_FULL_VOLTS, BATT_FULL_VOLTS),
+                                         m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_BATTERY_EMPTY_VOLTS, BATT_EMPTY_VOLTS),
+                                         m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_BATTERY_ALERT_CYCLES, BATT_ALERT_CYCLES));
+
+        // live status page for the companion processes
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_STATUS_PAGE_NAME, m_DomePro.getStatusPageName(), szFilePath, LOG_BUFFER_SIZE);
+        m_DomePro.setStatusPage(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_STATUS_PAGE, false), szFilePath);
+
+        // history shown in the diag dialog
+        m_DomePro.setDiagHistory(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_DIAG_HISTORY, true));
+
+        // firmware features found missing by a previous connect, probed again if the firmware changed
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_CAPS_FIRMWARE, "", szFilePath, LOG_BUFFER_SIZE);
+        m_DomePro.setKnownCapabilities(szFilePath, (uint32_t)m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_CAPS_UNSUPPORTED, 0));
+
+        // telemetry ring file, motor currents at the fast period, everything else at the slow one
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_TELEMETRY_FILE, m_DomePro.getTelemetryFile(), szFilePath, LOG_BUFFER_SIZE);
+        m_DomePro.setTelemetry(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TELEMETRY, false),
+                               szFilePath,
+                               m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TELEMETRY_RECORDS, TLM_DEFAULT_CAPACITY));
+        dFastPeriod = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_TELEMETRY_FAST_PERIOD, TLM_FAST_PERIOD);
+        dSlowPeriod = m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_TELEMETRY_SLOW_PERIOD, TLM_SLOW_PERIOD);
+        for(int i = 0; i < TLM_CHANNEL_COUNT; i++)
+            m_DomePro.setTelemetryPeriod(i, (i == TLM_AZ_MOTOR || i == TLM_SHUTTER_MOTOR) ? dFastPeriod : dSlowPeriod);
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_TELEMETRY_ARCHIVE_FILE, m_DomePro.getTelemetryArchiveFile(), szFilePath, LOG_BUFFER_SIZE);
+        m_DomePro.setTelemetryArchive(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TELEMETRY_ARCHIVE, false), szFilePath);
+
+        // per-site sensor calibration
+        for(int i = 0; i < TLM_CHANNEL_COUNT; i++) {
+            snprintf(szGainKey, LOG_BUFFER_SIZE, CHILD_KEY_SENSOR_GAIN, CTelemetryRing::channelName(i));
+            snprintf(szOffsetKey, LOG_BUFFER_SIZE, CHILD_KEY_SENSOR_OFFSET, CTelemetryRing::channelName(i));
+            m_DomePro.setSensorCalibration(i, m_pIniUtil->readDouble(PARENT_KEY, szGainKey, 1.0),
+                                              m_pIniUtil->readDouble(PARENT_KEY, szOffsetKey, 0.0));
+        }
+
+        // dome / mount geometry, all distances in meters
+        m_DomePro.setDomeGeometry(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_USE_GEOMETRY, false),
+                                  m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_DOME_RADIUS, 0.0),
+                                  m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOUNT_EAST, 0.0),
+                                  m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOUNT_NORTH, 0.0),
+                                  m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOUNT_UP, 0.0),
+                                  m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_GEM_OFFSET, 0.0));
+
+        // the dombroker daemon owns the serial port, it also runs the status page, telemetry, reports and monitors
+        if(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_BROKER, false)) {
+            m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_BROKER_SOCKET, m_BrokerSerial.getSocket(), szFilePath, LOG_BUFFER_SIZE);
+            m_BrokerSerial.setSocket(szFilePath);
+            m_DomePro.SetSerxPointer(&m_BrokerSerial);
+            m_DomePro.setStatusPage(false, NULL);
+            m_DomePro.setCurrentAnalysis(false, NULL);
+            m_DomePro.setShutterBattery(false, NULL);
+            m_DomePro.setTelemetry(false, NULL, 0);
+            m_DomePro.setTelemetryArchive(false, NULL);
+            // the broker's own driver already monitors and polls the dome
+            m_DomePro.setPredictiveSlaving(false);
+            m_DomePro.setDriftCorrection(false, false, 0.0);
+            m_DomePro.setSlipDetection(false, 0.0);
+            m_DomePro.setDiagHistory(false);
+            m_DomePro.setBackgroundPolls(false);
+        }
+
+        // Alpaca Dome device on localhost, started with the link
+        m_bAlpaca = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_ALPACA, false);
+        m_nAlpacaPort = m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_ALPACA_PORT, ALPACA_DEFAULT_PORT);
     }
 }
 
@@ -94,13 +205,37 @@ int X2Dome::establishLink(void)
     else
         m_bLinked = true;
 
+    if(m_bLinked)
+        saveCapabilities();
+
+    // not fatal, TheSkyX still has the dome
+    if(m_bLinked && m_bAlpaca)
+        m_Alpaca.start(m_nAlpacaPort);
+
     m_bHasShutterControl = m_DomePro.hasShutterUnit();
 	return nErr;
 }
 
+// keeps the capability map of the firmware so the next connect doesn't probe it
+void X2Dome::saveCapabilities()
+{
+    std::string sFirmware;
+    uint32_t nUnsupported;
+    char szSaved[LOG_BUFFER_SIZE];
+
+    if(!m_pIniUtil || !m_DomePro.getCapabilities(sFirmware, nUnsupported))
+        return;
+    m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_CAPS_FIRMWARE, "", szSaved, LOG_BUFFER_SIZE);
+    if(sFirmware == szSaved && (uint32_t)m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_CAPS_UNSUPPORTED, 0) == nUnsupported)
+        return;
+    m_pIniUtil->writeString(PARENT_KEY, CHILD_KEY_CAPS_FIRMWARE, sFirmware.c_str());
+    m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_CAPS_UNSUPPORTED, (int)nUnsupported);
+}
+
 int X2Dome::terminateLink(void)					
 {
     X2MutexLocker ml(GetMutex());
+    m_Alpaca.stop();
     m_DomePro.Disconnect();
 	m_bLinked = false;
 	return SB_OK;
@@ -138,10 +273,9 @@ int X2Dome::execModalSettingsDialog()
     X2GUIExchangeInterface*			dx = NULL;//Comes after ui is loaded
     bool bPressedOK = false;
     char szTmpBuf[SERIAL_BUFFER_SIZE];
-    int nTmp = 0;
     double dTmp = 0;
-    bool bTmp = false;
-    bool bIsAtHome = false;
+    uint32_t nChanged = 0;
+    bool bAzimuth;
 
     if (NULL == ui)
         return ERR_POINTER;
@@ -155,54 +289,22 @@ int X2Dome::execModalSettingsDialog()
 
     memset(szTmpBuf,0,SERIAL_BUFFER_SIZE);
 
-    X2MutexLocker ml(GetMutex());
-
+    // no X2 mutex here, CDomePro serializes the serial port and TheSkyX keeps polling while the dialog is up
     // set controls state depending on the connection state
     if(m_bLinked) {
-        // Az Motors
-        dx->setEnabled(MOTOR_POLARITY, true);
-        nErr = m_DomePro.getDomeAzMotorPolarity(nTmp);
-        dx->setChecked(MOTOR_POLARITY,nTmp==POSITIVE?true:false);
-
-        dx->setEnabled(OVER_CURRENT_PROTECTION, true);
-        m_DomePro.getDomeAzimuthOCP_Limit(dTmp);
-        dx->setPropertyDouble(OVER_CURRENT_PROTECTION, "value", dTmp);
-
-        // Az Encoders
-        dx->setEnabled(TICK_PER_REV, true);
-        nErr = m_DomePro.getDomeAzCPR(nTmp);
-        dx->setPropertyInt(TICK_PER_REV, "value", nTmp);
-
-        dx->setEnabled(ROTATION_COAST, true);
-        nErr = m_DomePro.getDomeAzCoast(dTmp);
-        dx->setPropertyDouble(ROTATION_COAST, "value", dTmp);
-
-        dx->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, true);
-        dx->setEnabled(LEARN_AZIMUTH_CPR_LEFT, true);
+        // last known values right away, each control is enabled when its fresh value comes in (on_timer)
+        beginSettings(dx, SETTINGS_MAIN);
+
+        // nothing to learn on a model that doesn't rotate
+        bAzimuth = m_DomePro.getModelPolicy().bAzimuth;
+        dx->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, bAzimuth);
+        dx->setEnabled(LEARN_AZIMUTH_CPR_LEFT, bAzimuth);
         dx->setPropertyString(L_CPR_VALUE, "text", ": not learned");
         dx->setPropertyString(R_CPR_VALUE, "text", ": not learned");
 
-        dx->setEnabled(ENCODDER_POLARITY, true);
-        nErr = m_DomePro.getDomeAzEncoderPolarity(nTmp);
-        dx->setPropertyDouble(ENCODDER_POLARITY, "value", dTmp);
-
-        dx->setEnabled(SET_AZIMUTH_CPR, true);
-
-        m_DomePro.isDomeAtHome(bIsAtHome);
-        dx->setPropertyString(IS_AT_HOME, "text", bIsAtHome?"Yes":"No");
-
-        // Homing
-        dx->setEnabled(HOMING_DIR, true); // no corresponding function, need to ping Chris
-        nErr = m_DomePro.getDomeHomeDirection(nTmp);
-        dx->setCurrentIndex(HOMING_DIR, nTmp-1);
-
-        dx->setEnabled(HOME_POS, true);
-        nErr = m_DomePro.getDomeHomeAz(dTmp);
-        dx->setPropertyDouble(HOME_POS, "value", dTmp);
-
-        dx->setEnabled(PARK_POS, true);
-        nErr = m_DomePro.getDomeParkAz(dTmp);
-        dx->setPropertyDouble(PARK_POS, "value", dTmp);
+        dx->setEnabled(SET_AZIMUTH_CPR, bAzimuth);
+        dx->setEnabled(CALIBRATE_CPR, bAzimuth);
+        dx->setPropertyString(CALIBRATE_CPR_STATUS, "text", "");
 
         dx->setEnabled(SHUTTER_BUTTON, true);
         dx->setEnabled(TIMEOUTS_BUTTON, true);
@@ -210,28 +312,16 @@ int X2Dome::execModalSettingsDialog()
 
     }
     else { // not connected, disable all controls
-        // Az motor
-        dx->setEnabled(MOTOR_POLARITY, false);
-        dx->setEnabled(OVER_CURRENT_PROTECTION, false);
-
-        // Az Encoders
-        dx->setEnabled(TICK_PER_REV, false);
-        dx->setEnabled(ROTATION_COAST, false);
+        disableSettings(dx, SETTINGS_MAIN);
 
         dx->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, false);
         dx->setEnabled(LEARN_AZIMUTH_CPR_LEFT, false);
         dx->setPropertyString(L_CPR_VALUE, "text", ": --");
         dx->setPropertyString(R_CPR_VALUE, "text", ": --");
 
-        dx->setEnabled(ENCODDER_POLARITY, false);
         dx->setEnabled(SET_AZIMUTH_CPR, false);
-
-        dx->setPropertyString(IS_AT_HOME, "text","--");
-
-        // Homing
-        dx->setEnabled(HOMING_DIR, false);
-        dx->setEnabled(HOME_POS, false);
-        dx->setEnabled(PARK_POS, false);
+        dx->setEnabled(CALIBRATE_CPR, false);
+        dx->setPropertyString(CALIBRATE_CPR_STATUS, "text", "");
 
         dx->setEnabled(SHUTTER_BUTTON, false);
         dx->setEnabled(TIMEOUTS_BUTTON, false);
@@ -252,42 +342,25 @@ int X2Dome::execModalSettingsDialog()
     {
         if(m_bLinked)
         {
-            // read all controls and set new values
-            // Az Motor
-            bTmp = dx->isChecked(MOTOR_POLARITY);
-            m_DomePro.setDomeAzMotorPolarity(bTmp?POSITIVE:NEGATIVE);
-
-            dx->propertyDouble(OVER_CURRENT_PROTECTION, "value", dTmp);
-            m_DomePro.setDomeAzimuthOCP_Limit(dTmp);
-
-            // Az Encoders
-            dx->propertyInt(TICK_PER_REV, "value", nTmp);
-            m_DomePro.setDomeAzCPR(nTmp);
-
-            dx->propertyDouble(ROTATION_COAST, "value", dTmp);
-            m_DomePro.setDomeAzCoast(dTmp);
-
-            bTmp = dx->isChecked(ENCODDER_POLARITY);
-            m_DomePro.setDomeAzEncoderPolarity(bTmp?POSITIVE:NEGATIVE);
-
-            // Homing
-            nTmp = dx->currentIndex(HOMING_DIR);
-            m_DomePro.setDomeHomeDirection(nTmp+1);
-
-            dx->propertyDouble(HOME_POS, "value", dTmp);
-            m_DomePro.setHomeAz(dTmp);
-            nErr = m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_HOME_AZ, dTmp);
-
-            dx->propertyDouble(PARK_POS, "value", dTmp);
-            m_DomePro.setParkAz(dTmp);
+            // only the settings the user changed go to the controller
+            nErr = applySettings(dx, SETTINGS_MAIN, m_nSettingsFresh, nChanged);
+            if(nChanged & SETTING_BIT(SETTING_HOME_AZ)) {
+                dx->propertyDouble(HOME_POS, "value", dTmp);
+                nErr |= m_pIniUtil->writeDouble(PARENT_KEY, CHILD_KEY_HOME_AZ, dTmp);
+            }
         }
     }
+    m_nSettingsWaiting = 0;
+    m_nSettingsFresh = 0;
     return nErr;
 
 }
 
 void X2Dome::uiEvent(X2GUIExchangeInterface* uiex, const char* pszEvent)
 {
+    // fresh settings read by the CDomePro I/O thread for the current dialog
+    if (!strcmp(pszEvent, "on_timer") && m_nSettingsWaiting)
+        showFreshSettings(uiex);
 
     switch(m_nCurrentDialog) {
         case MAIN:
@@ -319,7 +392,7 @@ int X2Dome::doMainDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
 
     int nTmp, nTmp2;
     bool bPressedOK = false;
-    bool bIsAtHome;
+    CprCalibration CprCal;
 
     if (!strcmp(pszEvent, "on_pushButtonCancel_clicked") && m_nLearningDomeCPR != NONE) {
         m_DomePro.abortCurrentCommand();
@@ -372,22 +445,45 @@ int X2Dome::doMainDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
                     m_nLearningDomeCPR = NONE;
                     break;
 
-                case CLEARING_LEFT :
-                    m_DomePro.isDomeAtHome(bIsAtHome);
-                    if(!bIsAtHome) {
-                        m_DomePro.abortCurrentCommand();
-                        m_DomePro.learnAzimuthCprLeft();
-                        m_nLearningDomeCPR = LEFT;
+                case GAUGING:
+                    // multi-pass calibration running in the I/O thread, just show the progress
+                    bComplete = false;
+                    nErr = m_DomePro.isCalibratingCPRComplete(bComplete);
+                    m_DomePro.getCprCalibration(CprCal);
+                    if(nErr) {
+                        setCalibrateCprControlState(uiex, true);
+                        uiex->setPropertyString(CALIBRATE_CPR_STATUS, "text", "Failed");
+                        snprintf(szErrorMessage, LOG_BUFFER_SIZE, "Error calibrating dome CPR : Error %d", nErr);
+                        uiex->messageBox("DomePro Calibrate CPR", szErrorMessage);
+                        m_nLearningDomeCPR = NONE;
+                        return nErr;
                     }
-                    break;
 
-                case CLEARING_RIGHT :
-                    m_DomePro.isDomeAtHome(bIsAtHome);
-                    if(!bIsAtHome) {
-                        m_DomePro.abortCurrentCommand();
-                        m_DomePro.learnAzimuthCprRight();
-                        m_nLearningDomeCPR = RIGHT;
+                    if(!bComplete) {
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "Pass %d/%d", CprCal.nDone + 1, CprCal.nPasses);
+                        uiex->setPropertyString(CALIBRATE_CPR_STATUS, "text", szTmpBuf);
+                        return nErr;
+                    }
+
+                    setCalibrateCprControlState(uiex, true);
+                    if(CprCal.bCommitted)
+                        uiex->setPropertyInt(TICK_PER_REV, "value", CprCal.nCpr);
+                    // no spread without a second sample in one direction
+                    if(CprCal.dSigma < 0) {
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "%3.1f", CprCal.dMean);
+                        snprintf(szErrorMessage, LOG_BUFFER_SIZE, "%d passes, %d rejected\nMean : %3.2f\nStandard deviation : n/a\nRight - Left asymmetry : %3.2f\n%s",
+                                 CprCal.nDone, CprCal.nRejected, CprCal.dMean, CprCal.dAsymmetry,
+                                 "Not enough passes to check the spread, the CPR was not changed.");
                     }
+                    else {
+                        snprintf(szTmpBuf, SERIAL_BUFFER_SIZE, "%3.1f +/- %3.1f", CprCal.dMean, CprCal.dSigma);
+                        snprintf(szErrorMessage, LOG_BUFFER_SIZE, "%d passes, %d rejected\nMean : %3.2f\nStandard deviation : %3.2f\nRight - Left asymmetry : %3.2f\n%s",
+                                 CprCal.nDone, CprCal.nRejected, CprCal.dMean, CprCal.dSigma, CprCal.dAsymmetry,
+                                 CprCal.bCommitted ? "The new CPR was set." : "The spread is too large, the CPR was not changed.");
+                    }
+                    uiex->setPropertyString(CALIBRATE_CPR_STATUS, "text", szTmpBuf);
+                    uiex->messageBox("DomePro Calibrate CPR", szErrorMessage);
+                    m_nLearningDomeCPR = NONE;
                     break;
 
                 default:
@@ -396,6 +492,21 @@ int X2Dome::doMainDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
         }
     }
 
+    if (!strcmp(pszEvent, CALIBRATE_CPR_CLICKED) )
+    {
+        if(m_bLinked) {
+            nErr = m_DomePro.calibrateAzimuthCpr();
+            if(nErr) {
+                snprintf(szErrorMessage, LOG_BUFFER_SIZE, "Error starting dome CPR calibration : Error %d", nErr);
+                uiex->messageBox("DomePro Calibrate CPR", szErrorMessage);
+                return nErr;
+            }
+            setCalibrateCprControlState(uiex, false);
+            uiex->setPropertyString(CALIBRATE_CPR_STATUS, "text", "Starting");
+            m_nLearningDomeCPR = GAUGING;
+        }
+    }
+
     if (!strcmp(pszEvent, LEARN_AZIMUTH_CPR_RIGHT_CLICKED) )
     {
         if(m_bLinked) {
@@ -403,15 +514,9 @@ int X2Dome::doMainDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
             uiex->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, false);
             uiex->setEnabled(LEARN_AZIMUTH_CPR_LEFT, false);
             uiex->setEnabled(BUTTON_OK, false);
-            m_DomePro.isDomeAtHome(bIsAtHome);
-            if(bIsAtHome) {
-                m_DomePro.learnAzimuthCprRight();
-                m_nLearningDomeCPR = RIGHT;
-            }
-            else {
-                m_DomePro.setDomeLeftOn();
-                m_nLearningDomeCPR = CLEARING_RIGHT;
-            }
+            // the I/O thread gets the dome off the home switch if needed and runs the gauging
+            m_DomePro.learnAzimuthCprRight();
+            m_nLearningDomeCPR = RIGHT;
         }
     }
 
@@ -422,15 +527,8 @@ int X2Dome::doMainDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
             uiex->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, false);
             uiex->setEnabled(LEARN_AZIMUTH_CPR_LEFT, false);
             uiex->setEnabled(BUTTON_OK, false);
-            m_DomePro.isDomeAtHome(bIsAtHome);
-            if(bIsAtHome) {
-                m_DomePro.learnAzimuthCprLeft();
-                m_nLearningDomeCPR = LEFT;
-            }
-            else {
-                m_DomePro.setDomeRightOn();
-                m_nLearningDomeCPR = CLEARING_LEFT;
-            }
+            m_DomePro.learnAzimuthCprLeft();
+            m_nLearningDomeCPR = LEFT;
         }
     }
 
@@ -485,11 +583,27 @@ int X2Dome::doMainDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
     return nErr;
 }
 
+// the dialog stays usable while the calibration runs, only the CPR controls and OK are disabled.
+void X2Dome::setCalibrateCprControlState(X2GUIExchangeInterface* uiex, bool enabled)
+{
+    bool bAzimuth = enabled && m_DomePro.getModelPolicy().bAzimuth;
+
+    uiex->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, bAzimuth);
+    uiex->setEnabled(LEARN_AZIMUTH_CPR_LEFT, bAzimuth);
+    uiex->setEnabled(SET_AZIMUTH_CPR, bAzimuth);
+    uiex->setEnabled(CALIBRATE_CPR, bAzimuth);
+    uiex->setEnabled(TICK_PER_REV, bAzimuth);
+    uiex->setEnabled(BUTTON_OK, enabled);
+}
+
 void X2Dome::setMainDialogControlState(X2GUIExchangeInterface* uiex, bool enabled)
 {
-    uiex->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, enabled);
-    uiex->setEnabled(LEARN_AZIMUTH_CPR_LEFT, enabled);
-    uiex->setEnabled(SET_AZIMUTH_CPR, enabled);
+    bool bAzimuth = enabled && m_DomePro.getModelPolicy().bAzimuth;
+
+    uiex->setEnabled(LEARN_AZIMUTH_CPR_RIGHT, bAzimuth);
+    uiex->setEnabled(LEARN_AZIMUTH_CPR_LEFT, bAzimuth);
+    uiex->setEnabled(SET_AZIMUTH_CPR, bAzimuth);
+    uiex->setEnabled(CALIBRATE_CPR, bAzimuth);
     uiex->setEnabled(SHUTTER_BUTTON, enabled);
     uiex->setEnabled(TIMEOUTS_BUTTON, enabled);
     uiex->setEnabled(DIAG_BUTTON, enabled);
@@ -498,16 +612,260 @@ void X2Dome::setMainDialogControlState(X2GUIExchangeInterface* uiex, bool enable
 
 }
 
+// dialog control of each controller setting, row i is DomeSetting i
+static constexpr SettingBinding s_SettingBindings[SETTING_COUNT] = {
+    // setting                          control                     type            scale   flags
+    // main dialog
+    {SETTING_AZ_MOTOR_POLARITY,         MOTOR_POLARITY,             BIND_POLARITY,  1.0,    0},
+    {SETTING_AZ_OCP_LIMIT,              OVER_CURRENT_PROTECTION,    BIND_DOUBLE,    1.0,    0},
+    {SETTING_AZ_CPR,                    TICK_PER_REV,               BIND_INT,       1.0,    0},
+    {SETTING_AZ_COAST,                  ROTATION_COAST,             BIND_DOUBLE,    1.0,    0},
+    {SETTING_AZ_ENCODER_POLARITY,       ENCODDER_POLARITY,          BIND_POLARITY,  1.0,    0},
+    {SETTING_AT_HOME,                   IS_AT_HOME,                 BIND_YES_NO,    1.0,    BIND_READ_ONLY},
+    {SETTING_HOME_DIRECTION,            HOMING_DIR,                 BIND_INDEX,     1.0,    0},
+    {SETTING_HOME_AZ,                   HOME_POS,                   BIND_DOUBLE,    1.0,    0},
+    {SETTING_PARK_AZ,                   PARK_POS,                   BIND_DOUBLE,    1.0,    0},
+    // shutter dialog
+    {SETTING_MODEL,                     DOMEPRO_MODEL,              BIND_TEXT,      1.0,    BIND_READ_ONLY},
+    {SETTING_SINGLE_SHUTTER,            SINGLE_SHUTTER,             BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_OPEN_FIRST,                OPEN_FIRST,                 BIND_INDEX,     1.0,    BIND_SHUTTER | BIND_SEQUENCING},
+    {SETTING_CLOSE_FIRST,               CLOSE_FIRST,                BIND_INDEX,     1.0,    BIND_SHUTTER | BIND_SEQUENCING},
+    {SETTING_SHUT_OP_ON_HOME,           SHUTTER_OPERATE_AT_HOME,    BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_HOME_WITH_SHUTTER_CLOSE,   HOME_ON_SHUTTER_CLOSE,      BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_SHUT1_LIMIT_CHECK,         UPPER_SHUTTER_LIMIT_CHECK,  BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_SHUT2_LIMIT_CHECK,         LOWER_SHUTTER_LIMIT_CHECK,  BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_SHUT1_OCP_LIMIT,           SHUTTER1_OCP,               BIND_DOUBLE,    1.0,    BIND_SHUTTER},
+    {SETTING_SHUT2_OCP_LIMIT,           SHUTTER2_OCP,               BIND_DOUBLE,    1.0,    BIND_SHUTTER},
+    // timeouts dialog
+    {SETTING_AZ_TIMEOUT_ENABLED,        AZ_TIMEOUT_EN,              BIND_CHECK,     1.0,    0},
+    {SETTING_AZ_TIMEOUT,                AZ_TIMEOUT_VAL,             BIND_INT,       1.0,    0},
+    {SETTING_SHUT1_TIMEOUT,             FIST_SHUTTER_TIMEOUT_VAL,   BIND_INT,       1.0,    BIND_SHUTTER},
+    {SETTING_SHUT2_TIMEOUT,             SECOND_SHUTTER_TIMEOUT_VAL, BIND_INT,       1.0,    BIND_SHUTTER},
+    {SETTING_SHUT_ODIR_TIMEOUT,         OPPOSITE_DIR_TIMEOUT,       BIND_INT,       1.0,    BIND_SHUTTER},
+    {SETTING_CLOSE_ON_CLIENT_TIMEOUT,   CLOSE_NO_COMM,              BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_CLOSE_CLIENT_TIMEOUT,      CLOSE_NO_COMM_VAL,          BIND_INT,       1.0,    BIND_SHUTTER},
+    {SETTING_CLOSE_ON_LINK_TIMEOUT,     CLOSE_ON_RADIO_TIMEOUT,     BIND_CHECK,     1.0,    BIND_SHUTTER},
+    {SETTING_SHUTTER_AUTO_CLOSE,        CLOSE_ON_POWER_FAIL,        BIND_CHECK,     1.0,    BIND_SHUTTER},
+};
+
+static constexpr bool settingBindingsInOrder(int i)
+{
+    return i == SETTING_COUNT || (s_SettingBindings[i].nSetting == i && settingBindingsInOrder(i + 1));
+}
+static_assert(settingBindingsInOrder(0), "s_SettingBindings rows must follow the DomeSetting order");
+
+// Shows the last known values of the settings and asks CDomePro for fresh ones, the controls stay disabled
+// until showFreshSettings gets their value. Only the settings with a fresh value are written back on OK.
+void X2Dome::beginSettings(X2GUIExchangeInterface* uiex, uint32_t nSettings)
+{
+    DomeSettings Settings;
+    int i;
+
+    m_DomePro.getSettings(Settings);
+    for(i = 0; i < SETTING_COUNT; i++) {
+        if(!(nSettings & SETTING_BIT(i)))
+            continue;
+        // the firmware doesn't have it, no control and no read
+        if(!m_DomePro.isSettingSupported(i)) {
+            uiex->setPropertyInt(s_SettingBindings[i].pszControl, "visible", 0);
+            nSettings &= ~SETTING_BIT(i);
+            continue;
+        }
+        showSetting(uiex, i, Settings, false);
+    }
+    m_nSettingsWaiting = nSettings;
+    m_nSettingsFresh = 0;
+    m_DomePro.requestSettings(nSettings);
+}
+
+void X2Dome::showFreshSettings(X2GUIExchangeInterface* uiex)
+{
+    DomeSettings Settings;
+    uint32_t nArrived;
+    int i;
+
+    m_DomePro.getSettings(Settings);
+    nArrived = m_nSettingsWaiting & ~Settings.nPending;
+    if(!nArrived)
+        return;
+
+    // in DomeSetting order, the single shutter mode is known before the sequencing controls
+    for(i = 0; i < SETTING_COUNT; i++) {
+        if(!(nArrived & SETTING_BIT(i)))
+            continue;
+        // a failed read leaves the control disabled with the last known value
+        if(Settings.nFailed & SETTING_BIT(i))
+            continue;
+        m_nSettingsFresh |= SETTING_BIT(i);
+        showSetting(uiex, i, Settings, true);
+    }
+    m_nSettingsWaiting &= ~nArrived;
+}
+
+void X2Dome::showSetting(X2GUIExchangeInterface* uiex, int nSetting, const DomeSettings &Settings, bool bEnable)
+{
+    const SettingBinding &Bind = s_SettingBindings[nSetting];
+    bool bValid;
+    bool bSingleShutter;
+    double dValue;
+
+    bValid = (Settings.nValid & SETTING_BIT(nSetting)) != 0;
+    dValue = Settings.dValue[nSetting];
+
+    switch(Bind.nType) {
+        case BIND_CHECK:
+            if(bValid)
+                uiex->setChecked(Bind.pszControl, dValue != 0);
+            break;
+        case BIND_POLARITY:
+            if(bValid)
+                uiex->setChecked(Bind.pszControl, (int)dValue == POSITIVE);
+            break;
+        case BIND_INT:
+            if(bValid)
+                uiex->setPropertyInt(Bind.pszControl, "value", (int)floor(dValue * Bind.dScale + 0.5));
+            break;
+        case BIND_DOUBLE:
+            if(bValid)
+                uiex->setPropertyDouble(Bind.pszControl, "value", dValue * Bind.dScale);
+            break;
+        case BIND_INDEX:
+            if(bValid)
+                uiex->setCurrentIndex(Bind.pszControl, (int)dValue - 1);
+            break;
+        case BIND_YES_NO:
+            uiex->setPropertyString(Bind.pszControl, "text", bValid ? (dValue != 0 ? "Yes" : "No") : "--");
+            return;
+        case BIND_TEXT:
+            uiex->setPropertyString(Bind.pszControl, "text", bValid ? Settings.szModel : "");
+            // the shutter angle calibration isn't a controller setting but it depends on the model
+            if(nSetting == SETTING_MODEL && bEnable)
+                setShutterAngleControlState(uiex, (int)dValue == CLAMSHELL);
+            return;
+    }
+
+    bSingleShutter = (m_nSettingsFresh & SETTING_BIT(SETTING_SINGLE_SHUTTER)) && Settings.dValue[SETTING_SINGLE_SHUTTER] != 0;
+    uiex->setEnabled(Bind.pszControl, bEnable && isSettingEnabled(Bind, settingsModel(Settings), bSingleShutter));
+}
+
+// not connected
+void X2Dome::disableSettings(X2GUIExchangeInterface* uiex, uint32_t nSettings)
+{
+    int i;
+
+    for(i = 0; i < SETTING_COUNT; i++) {
+        if(!(nSettings & SETTING_BIT(i)))
+            continue;
+        const SettingBinding &Bind = s_SettingBindings[i];
+        if(!m_DomePro.isSettingSupported(i))
+            uiex->setPropertyInt(Bind.pszControl, "visible", 0);
+        else if(Bind.nType == BIND_YES_NO || Bind.nType == BIND_TEXT)
+            uiex->setPropertyString(Bind.pszControl, "text", "--");
+        else
+            uiex->setEnabled(Bind.pszControl, false);
+    }
+}
+
+// Reads back the enabled controls that got a fresh value and writes the ones that differ from the controller
+// in one batch. nChanged has the DomeSetting bits that were written.
+int X2Dome::applySettings(X2GUIExchangeInterface* uiex, uint32_t nSettings, uint32_t nFresh, uint32_t &nChanged)
+{
+    DomeSettings Settings;
+    double dValues[SETTING_COUNT];
+    bool bSingleShutter;
+    int nModel;
+    int nTmp;
+    double dTmp;
+    int i;
+
+    nChanged = 0;
+    m_DomePro.getSettings(Settings);
+    nModel = settingsModel(Settings);
+    // the sequencing follows the single shutter box as the user left it
+    if(nFresh & SETTING_BIT(SETTING_SINGLE_SHUTTER))
+        bSingleShutter = uiex->isChecked(SINGLE_SHUTTER) != 0;
+    else
+        bSingleShutter = (Settings.nValid & SETTING_BIT(SETTING_SINGLE_SHUTTER)) && Settings.dValue[SETTING_SINGLE_SHUTTER] != 0;
+
+    for(i = 0; i < SETTING_COUNT; i++) {
+        if(!(nSettings & nFresh & SETTING_BIT(i)))
+            continue;
+        const SettingBinding &Bind = s_SettingBindings[i];
+        if(!isSettingEnabled(Bind, nModel, bSingleShutter))
+            continue;
+
+        switch(Bind.nType) {
+            case BIND_CHECK:
+                dValues[i] = uiex->isChecked(Bind.pszControl) ? 1 : 0;
+                break;
+            case BIND_POLARITY:
+                dValues[i] = uiex->isChecked(Bind.pszControl) ? POSITIVE : NEGATIVE;
+                break;
+            case BIND_INT:
+                uiex->propertyInt(Bind.pszControl, "value", nTmp);
+                dValues[i] = nTmp / Bind.dScale;
+                break;
+            case BIND_DOUBLE:
+                uiex->propertyDouble(Bind.pszControl, "value", dTmp);
+                dValues[i] = dTmp / Bind.dScale;
+                break;
+            case BIND_INDEX:
+                dValues[i] = uiex->currentIndex(Bind.pszControl) + 1;
+                break;
+            default:
+                continue;
+        }
+        if(!(Settings.nValid & SETTING_BIT(i)) || fabs(dValues[i] - Settings.dValue[i]) > BIND_TOLERANCE)
+            nChanged |= SETTING_BIT(i);
+    }
+
+    if(!nChanged)
+        return SB_OK;
+    return m_DomePro.writeSettings(nChanged, dValues);
+}
+
+bool X2Dome::isSettingEnabled(const SettingBinding &Bind, int nModel, bool bSingleShutter)
+{
+    if(Bind.nFlags & BIND_READ_ONLY)
+        return false;
+    if((Bind.nFlags & BIND_SHUTTER) && !m_DomePro.hasShutterUnit())
+        return false;
+    if((Bind.nFlags & BIND_SEQUENCING) && bSingleShutter)
+        return false;
+    // the model policy, an unknown model doesn't hide anything
+    return (CDomePro::modelPolicy(nModel).nSettings & SETTING_BIT(Bind.nSetting)) != 0;
+}
+
+int X2Dome::settingsModel(const DomeSettings &Settings)
+{
+    if(Settings.nValid & SETTING_BIT(SETTING_MODEL))
+        return (int)Settings.dValue[SETTING_MODEL];
+    return m_DomePro.getModelType();
+}
+
+// the angle calibration is only used with a clamshell
+void X2Dome::setShutterAngleControlState(X2GUIExchangeInterface* uiex, bool enabled)
+{
+    uiex->setEnabled(SHUT1_OPEN_ANGLE, enabled);
+    uiex->setEnabled(SHUT1_OPEN_ANGLE_ADC, enabled);
+    uiex->setEnabled(SHUT1_CLOSE_ANGLE, enabled);
+    uiex->setEnabled(SHUT1_CLOSE_ANGLE_ADC, enabled);
+    uiex->setEnabled(SHUT2_OPEN_ANGLE, enabled);
+    uiex->setEnabled(SHUT2_OPEN_ANGLE_ADC, enabled);
+    uiex->setEnabled(SHUT2_CLOSE_ANGLE, enabled);
+    uiex->setEnabled(SHUT2_CLOSE_ANGLE_ADC, enabled);
+}
+
 //
 // Shutter settings UI
 //
 int X2Dome::doDomeProShutter(bool& bPressedOK)
 {
     int nErr = SB_OK;
-    char szTmpBuf[SERIAL_BUFFER_SIZE];
-    bool bTmp;
-    int nTmp;
-    double dTmp;
+    uint32_t nMainWaiting;
+    uint32_t nMainFresh;
+    uint32_t nShutterFresh;
+    uint32_t nChanged;
 
     X2ModalUIUtil uiutil(this, GetTheSkyXFacadeForDrivers());
     X2GUIInterface*                    ui = uiutil.X2UI();
@@ -525,118 +883,45 @@ int X2Dome::doDomeProShutter(bool& bPressedOK)
         return ERR_POINTER;
 
     m_nCurrentDialog = SHUTTER;
-    // sequencing
+    // the main dialog may still be waiting for some of its settings
+    nMainWaiting = m_nSettingsWaiting;
+    nMainFresh = m_nSettingsFresh;
+    m_nSettingsWaiting = 0;
+    m_nSettingsFresh = 0;
     if(m_bLinked) {
-        m_DomePro.getModel(szTmpBuf, SERIAL_BUFFER_SIZE);
-        dx->setPropertyString(DOMEPRO_MODEL, "text", szTmpBuf);
-        // sequencing
+        dx->setEnabled(INHIBIT_SIMULT, false); // no corresponding function, need to ping Chris
+        // the shutter angle calibration is in the ini file, it's enabled once we know the model
+        dx->setPropertyInt(SHUT1_OPEN_ANGLE, "value", m_Shutter1OpenAngle);
+        dx->setPropertyInt(SHUT1_OPEN_ANGLE_ADC, "value", m_Shutter1OpenAngle_ADC);
+        dx->setPropertyInt(SHUT1_CLOSE_ANGLE, "value", m_Shutter1CloseAngle);
+        dx->setPropertyInt(SHUT1_CLOSE_ANGLE_ADC, "value", m_Shutter1CloseAngle_ADC);
+        dx->setPropertyInt(SHUT2_OPEN_ANGLE, "value", m_Shutter2OpenAngle);
+        dx->setPropertyInt(SHUT2_OPEN_ANGLE_ADC, "value", m_Shutter2OpenAngle_ADC);
+        dx->setPropertyInt(SHUT2_CLOSE_ANGLE, "value", m_Shutter2CloseAngle);
+        dx->setPropertyInt(SHUT2_CLOSE_ANGLE_ADC, "value", m_Shutter2CloseAngle_ADC);
+        setShutterAngleControlState(dx, false);
+
+        // controller settings
         if(m_DomePro.hasShutterUnit()) {
-            dx->setEnabled(SINGLE_SHUTTER, true);
-            m_DomePro.getDomeSingleShutterMode(bTmp);
-            if(bTmp) {
-                dx->setEnabled(OPEN_FIRST, false);
-                dx->setEnabled(CLOSE_FIRST, false);
-                dx->setEnabled(INHIBIT_SIMULT, false);
-
-            }
-            else { // 2 shutters
-                dx->setEnabled(OPEN_FIRST, true);
-                m_DomePro.getDomeShutterOpenFirst(nTmp);
-                dx->setCurrentIndex(OPEN_FIRST, nTmp-1);
-
-                dx->setEnabled(CLOSE_FIRST, true);
-                m_DomePro.getDomeShutterCloseFirst(nTmp);
-                dx->setCurrentIndex(CLOSE_FIRST, nTmp-1);
-
-                dx->setEnabled(INHIBIT_SIMULT, false); // no corresponding function, need to ping Chris
-
-                dx->setEnabled(SHUTTER_OPERATE_AT_HOME, true);
-                m_DomePro.getDomeShutOpOnHome(bTmp);
-                dx->setChecked(SHUTTER_OPERATE_AT_HOME, bTmp);
-
-                dx->setEnabled(HOME_ON_SHUTTER_CLOSE, true);
-                m_DomePro.getHomeWithShutterClose(bTmp);
-                dx->setChecked(HOME_ON_SHUTTER_CLOSE, bTmp);
-
-                m_DomePro.getShutter1_LimitFaultCheckEnabled(bTmp);
-                dx->setChecked(UPPER_SHUTTER_LIMIT_CHECK, bTmp);
-                m_DomePro.getShutter2_LimitFaultCheckEnabled(bTmp);
-                dx->setChecked(LOWER_SHUTTER_LIMIT_CHECK, bTmp);
-
-                // shutter angle calibration
-                if(m_DomePro.getModelType() == CLAMSHELL) {
-                    dx->setPropertyInt(SHUT1_OPEN_ANGLE, "value", m_Shutter1OpenAngle);
-                    dx->setPropertyInt(SHUT1_OPEN_ANGLE_ADC, "value", m_Shutter1OpenAngle_ADC);
-
-                    dx->setPropertyInt(SHUT1_CLOSE_ANGLE, "value", m_Shutter1CloseAngle);
-                    dx->setPropertyInt(SHUT1_CLOSE_ANGLE_ADC, "value", m_Shutter1CloseAngle_ADC);
-
-                    dx->setPropertyInt(SHUT2_OPEN_ANGLE, "value", m_Shutter2OpenAngle);
-                    dx->setPropertyInt(SHUT2_OPEN_ANGLE_ADC, "value", m_Shutter2OpenAngle_ADC);
-
-                    dx->setPropertyInt(SHUT2_CLOSE_ANGLE, "value", m_Shutter2CloseAngle);
-                    dx->setPropertyInt(SHUT2_CLOSE_ANGLE_ADC, "value", m_Shutter2CloseAngle_ADC);
-                }
-                else {
-                    dx->setEnabled(SHUT1_OPEN_ANGLE, false);
-                    dx->setEnabled(SHUT1_OPEN_ANGLE_ADC, false);
-                    dx->setEnabled(SHUT1_CLOSE_ANGLE, false);
-                    dx->setEnabled(SHUT1_CLOSE_ANGLE_ADC, false);
-                    dx->setEnabled(SHUT2_OPEN_ANGLE, false);
-                    dx->setEnabled(SHUT2_OPEN_ANGLE_ADC, false);
-                    dx->setEnabled(SHUT2_CLOSE_ANGLE, false);
-                    dx->setEnabled(SHUT2_CLOSE_ANGLE_ADC, false);
-                }
-
-                m_DomePro.getDomeShutter1_OCP_Limit(dTmp);
-                dx->setPropertyDouble(SHUTTER1_OCP, "value", dTmp);
-                m_DomePro.getDomeShutter2_OCP_Limit(dTmp);
-                dx->setPropertyDouble(SHUTTER2_OCP, "value", dTmp);
-            }
+            beginSettings(dx, SETTINGS_SHUTTER);
         }
-        else { // no shutter unit
+        else { // no shutter unit, only the model is worth reading
+            disableSettings(dx, SETTINGS_SHUTTER & ~SETTING_BIT(SETTING_MODEL));
+            beginSettings(dx, SETTING_BIT(SETTING_MODEL));
             dx->setChecked(SINGLE_SHUTTER,false);
-            dx->setEnabled(OPEN_FIRST, false);
-            dx->setEnabled(CLOSE_FIRST, false);
-            dx->setEnabled(INHIBIT_SIMULT, false);
-            dx->setEnabled(SHUTTER_OPERATE_AT_HOME, false);
-            dx->setEnabled(HOME_ON_SHUTTER_CLOSE, false);
-            dx->setEnabled(UPPER_SHUTTER_LIMIT_CHECK, false);
-            dx->setEnabled(LOWER_SHUTTER_LIMIT_CHECK, false);
-            dx->setEnabled(SHUT1_OPEN_ANGLE, false);
-            dx->setEnabled(SHUT1_OPEN_ANGLE_ADC, false);
-            dx->setEnabled(SHUT1_CLOSE_ANGLE, false);
-            dx->setEnabled(SHUT1_CLOSE_ANGLE_ADC, false);
-            dx->setEnabled(SHUT2_OPEN_ANGLE, false);
-            dx->setEnabled(SHUT2_OPEN_ANGLE_ADC, false);
-            dx->setEnabled(SHUT2_CLOSE_ANGLE, false);
-            dx->setEnabled(SHUT2_CLOSE_ANGLE_ADC, false);
-            dx->setEnabled(SHUTTER1_OCP, false);
-            dx->setEnabled(SHUTTER2_OCP, false);
         }
 
     } else {
+        disableSettings(dx, SETTINGS_SHUTTER);
         dx->setChecked(SINGLE_SHUTTER,false);
-        dx->setEnabled(OPEN_FIRST, false);
-        dx->setEnabled(CLOSE_FIRST, false);
         dx->setEnabled(INHIBIT_SIMULT, false);
-        dx->setEnabled(SHUTTER_OPERATE_AT_HOME, false);
-        dx->setEnabled(HOME_ON_SHUTTER_CLOSE, false);
-        dx->setEnabled(UPPER_SHUTTER_LIMIT_CHECK, false);
-        dx->setEnabled(LOWER_SHUTTER_LIMIT_CHECK, false);
-        dx->setEnabled(SHUT1_OPEN_ANGLE, false);
-        dx->setEnabled(SHUT1_OPEN_ANGLE_ADC, false);
-        dx->setEnabled(SHUT1_CLOSE_ANGLE, false);
-        dx->setEnabled(SHUT1_CLOSE_ANGLE_ADC, false);
-        dx->setEnabled(SHUT2_OPEN_ANGLE, false);
-        dx->setEnabled(SHUT2_OPEN_ANGLE_ADC, false);
-        dx->setEnabled(SHUT2_CLOSE_ANGLE, false);
-        dx->setEnabled(SHUT2_CLOSE_ANGLE_ADC, false);
-        dx->setEnabled(SHUTTER1_OCP, false);
-        dx->setEnabled(SHUTTER2_OCP, false);
+        setShutterAngleControlState(dx, false);
     }
 
     nErr = ui->exec(bPressedOK);
+    m_nSettingsWaiting = nMainWaiting;
+    nShutterFresh = m_nSettingsFresh;
+    m_nSettingsFresh = nMainFresh;
     if (nErr )
         return nErr;
 
@@ -645,32 +930,10 @@ int X2Dome::doDomeProShutter(bool& bPressedOK)
     {
         if(m_bLinked)
         {
-            // read all controls and set new values
-            bTmp = dx->isChecked(SINGLE_SHUTTER);
-            m_DomePro.setDomeSingleShutterMode(bTmp);
-
-            if(!bTmp) {
-                nTmp = dx->currentIndex(OPEN_FIRST);
-                m_DomePro.setDomeShutterOpenFirst(nTmp+1);
-
-                nTmp = dx->currentIndex(CLOSE_FIRST);
-                m_DomePro.setDomeShutterCloseFirst(nTmp+1);
-            }
-
-            // no command for Inhibit simultaneous shutter motion
-
-            bTmp = dx->isChecked(SHUTTER_OPERATE_AT_HOME);
-            m_DomePro.setDomeShutOpOnHome(bTmp);
-
-            bTmp = dx->isChecked(HOME_ON_SHUTTER_CLOSE);
-            m_DomePro.setHomeWithShutterClose(bTmp);
-
-            bTmp = dx->isChecked(UPPER_SHUTTER_LIMIT_CHECK);
-            m_DomePro.setShutter1_LimitFaultCheckEnabled(bTmp);
-
-            bTmp = dx->isChecked(LOWER_SHUTTER_LIMIT_CHECK);
-            m_DomePro.setShutter2_LimitFaultCheckEnabled(bTmp);
+            // only the settings the user changed go to the controller, no command for Inhibit simultaneous shutter motion
+            nErr = applySettings(dx, SETTINGS_SHUTTER, nShutterFresh, nChanged);
 
+            // the shutter angle calibration is kept in the ini file
             dx->propertyInt(SHUT1_OPEN_ANGLE, "value", m_Shutter1OpenAngle);
             dx->propertyInt(SHUT1_OPEN_ANGLE_ADC, "value", m_Shutter1OpenAngle_ADC);
             dx->propertyInt(SHUT1_CLOSE_ANGLE, "value", m_Shutter1CloseAngle);
@@ -685,7 +948,6 @@ int X2Dome::doDomeProShutter(bool& bPressedOK)
 
             m_bShutterGotoEnabled = dx->isChecked(SHUT_ANGLE_GOTO);
             
-            nErr = SB_OK;
             nErr |= m_pIniUtil->writeInt(PARENT_KEY, SHUT1_OPEN_ANGLE, m_Shutter1OpenAngle);
             nErr |= m_pIniUtil->writeInt(PARENT_KEY, SHUT1_OPEN_ANGLE_ADC, m_Shutter1OpenAngle_ADC);
             nErr |= m_pIniUtil->writeInt(PARENT_KEY, SHUT1_CLOSE_ANGLE, m_Shutter1CloseAngle);
@@ -695,13 +957,6 @@ int X2Dome::doDomeProShutter(bool& bPressedOK)
             nErr |= m_pIniUtil->writeInt(PARENT_KEY, SHUT2_CLOSE_ANGLE, m_Shutter2CloseAngle);
             nErr |= m_pIniUtil->writeInt(PARENT_KEY, SHUT2_CLOSE_ANGLE_ADC, m_Shutter2CloseAngle_ADC);
             nErr |= m_pIniUtil->writeInt(PARENT_KEY, CHILD_KEY_SHUTTER_GOTO, m_bShutterGotoEnabled);
-
-
-            dx->propertyDouble(SHUTTER1_OCP, "value", dTmp);
-            m_DomePro.setDomeShutter1_OCP_Limit(dTmp);
-
-            dx->propertyDouble(SHUTTER2_OCP, "value", dTmp);
-            m_DomePro.setDomeShutter2_OCP_Limit(dTmp);
         }
     }
 
@@ -728,8 +983,10 @@ int X2Dome::doShutterDialogEvents(X2GUIExchangeInterface* uiex, const char* pszE
 int X2Dome::doDomeProTimeouts(bool& bPressedOK)
 {
     int nErr = SB_OK;
-    int nTmp;
-    bool bTmp;
+    uint32_t nMainWaiting;
+    uint32_t nMainFresh;
+    uint32_t nTimeoutsFresh;
+    uint32_t nChanged;
 
     X2ModalUIUtil uiutil(this, GetTheSkyXFacadeForDrivers());
     X2GUIInterface*                    ui = uiutil.X2UI();
@@ -747,57 +1004,21 @@ int X2Dome::doDomeProTimeouts(bool& bPressedOK)
         return ERR_POINTER;
 
     m_nCurrentDialog = TIMEOUTS;
+    // the main dialog may still be waiting for some of its settings
+    nMainWaiting = m_nSettingsWaiting;
+    nMainFresh = m_nSettingsFresh;
+    m_nSettingsWaiting = 0;
+    m_nSettingsFresh = 0;
     if(m_bLinked) {
-        // Az timout
-        dx->setEnabled(AZ_TIMEOUT_EN, true);
-        m_DomePro.getDomeAzimuthTimeOutEnabled(bTmp);
-        dx->setChecked(AZ_TIMEOUT_EN, bTmp);
-
-        dx->setEnabled(AZ_TIMEOUT_VAL, true);
-        m_DomePro.getDomeAzimuthTimeOut(nTmp);
-        dx->setPropertyInt(AZ_TIMEOUT_VAL, "value", nTmp);
-
-        dx->setEnabled(FIST_SHUTTER_TIMEOUT_VAL, true);
-        m_DomePro.getDomeShutter1_OpTimeOut(nTmp);
-        dx->setPropertyInt(FIST_SHUTTER_TIMEOUT_VAL, "value", nTmp);
-
-        dx->setEnabled(SECOND_SHUTTER_TIMEOUT_VAL, true);
-        m_DomePro.getDomeShutter2_OpTimeOut(nTmp);
-        dx->setPropertyInt(SECOND_SHUTTER_TIMEOUT_VAL, "value", nTmp);
-
-        dx->setEnabled(OPPOSITE_DIR_TIMEOUT, true);
-        m_DomePro.getDomeShutODirTimeOut(nTmp);
-        dx->setPropertyInt(OPPOSITE_DIR_TIMEOUT, "value", nTmp);
-
-        dx->setEnabled(CLOSE_NO_COMM, true);
-        m_DomePro.getDomeShutCloseOnClientTimeOut(bTmp);
-        dx->setChecked(CLOSE_NO_COMM, bTmp);
-
-        dx->setEnabled(CLOSE_NO_COMM_VAL, true);
-        m_DomePro.getDomeShutCloseClientTimeOut(nTmp);
-        dx->setPropertyInt(CLOSE_NO_COMM_VAL, "value", nTmp);
-
-        dx->setEnabled(CLOSE_ON_RADIO_TIMEOUT, true);
-        m_DomePro.getDomeShutCloseOnLinkTimeOut(bTmp);
-        dx->setChecked(CLOSE_ON_RADIO_TIMEOUT, bTmp);
-
-        dx->setEnabled(CLOSE_ON_POWER_FAIL, true);
-        m_DomePro.getShutterAutoCloseEnabled(bTmp);
-        dx->setChecked(CLOSE_ON_POWER_FAIL, bTmp);
-
+        beginSettings(dx, SETTINGS_TIMEOUTS);
     } else {
-        dx->setEnabled(AZ_TIMEOUT_EN, false);
-        dx->setEnabled(AZ_TIMEOUT_VAL, false);
-        dx->setEnabled(FIST_SHUTTER_TIMEOUT_VAL, false);
-        dx->setEnabled(SECOND_SHUTTER_TIMEOUT_VAL, false);
-        dx->setEnabled(OPPOSITE_DIR_TIMEOUT, false);
-        dx->setEnabled(CLOSE_NO_COMM, false);
-        dx->setEnabled(CLOSE_NO_COMM_VAL, false);
-        dx->setEnabled(CLOSE_ON_RADIO_TIMEOUT, false);
-        dx->setEnabled(CLOSE_ON_POWER_FAIL, false);
+        disableSettings(dx, SETTINGS_TIMEOUTS);
     }
 
     nErr = ui->exec(bPressedOK);
+    m_nSettingsWaiting = nMainWaiting;
+    nTimeoutsFresh = m_nSettingsFresh;
+    m_nSettingsFresh = nMainFresh;
     if (nErr )
         return nErr;
 
@@ -806,32 +1027,8 @@ int X2Dome::doDomeProTimeouts(bool& bPressedOK)
     {
         if(m_bLinked)
         {
-            bTmp = dx->isChecked(AZ_TIMEOUT_EN);
-            m_DomePro.setDomeAzimuthTimeOutEnabled(bTmp);
-            dx->propertyInt(AZ_TIMEOUT_VAL, "value", nTmp);
-            m_DomePro.setDomeAzimuthTimeOut(nTmp);
-
-            dx->propertyInt(FIST_SHUTTER_TIMEOUT_VAL, "value", nTmp);
-            m_DomePro.setDomeShutter1_OpTimeOut(nTmp);
-
-            dx->propertyInt(SECOND_SHUTTER_TIMEOUT_VAL, "value", nTmp);
-            m_DomePro.setDomeShutter2_OpTimeOut(nTmp);
-
-            dx->propertyInt(OPPOSITE_DIR_TIMEOUT, "value", nTmp);
-            m_DomePro.setDomeShutODirTimeOut(nTmp);
-
-            bTmp = dx->isChecked(CLOSE_NO_COMM);
-            m_DomePro.setDomeShutCloseOnClientTimeOut(bTmp);
-
-            dx->propertyInt(CLOSE_NO_COMM_VAL, "value", nTmp);
-            m_DomePro.setDomeShutCloseClientTimeOut(nTmp);
-
-            bTmp = dx->isChecked(CLOSE_ON_RADIO_TIMEOUT);
-            m_DomePro.setDomeShutCloseOnLinkTimeOut(bTmp);
-
-            bTmp = dx->isChecked(CLOSE_ON_POWER_FAIL);
-            m_DomePro.setShutterAutoCloseEnabled(bTmp);
-
+            // only the settings the user changed go to the controller
+            nErr = applySettings(dx, SETTINGS_TIMEOUTS, nTimeoutsFresh, nChanged);
         }
     }
 
@@ -848,6 +1045,107 @@ int X2Dome::doTimeoutsDialogEvents(X2GUIExchangeInterface* uiex, const char* psz
     return nErr;
 }
 
+// diag dialog labels of each telemetry channel, in TelemetryChannels order
+static const DiagBinding s_DiagBindings[TLM_CHANNEL_COUNT] = {
+    {TLM_AZ_SUPPLY,         AZ_SUPPLY_VOLTAGE,      AZ_SUPPLY_HISTORY,      AZ_SUPPLY_SPARK,    2,  "V",    false},
+    {TLM_SHUTTER_SUPPLY,    SHUT_SUPPLY_VOLTAGE,    SHUT_SUPPLY_HISTORY,    SHUT_SUPPLY_SPARK,  2,  "V",    true},
+    {TLM_AZ_MOTOR,          AZ_MOTOR_CURRENT,       AZ_MOTOR_HISTORY,       AZ_MOTOR_SPARK,     2,  "A",    false},
+    {TLM_SHUTTER_MOTOR,     SHUT_SUPPLY_CURRENT,    SHUT_MOTOR_HISTORY,     SHUT_MOTOR_SPARK,   2,  "A",    true},
+    {TLM_AZ_TEMP,           AZ_TEMP,                AZ_TEMP_HISTORY,        AZ_TEMP_SPARK,      2,  "ºC",   false},
+    {TLM_SHUTTER_TEMP,      SHUT_TEMPERATURE,       SHUT_TEMP_HISTORY,      SHUT_TEMP_SPARK,    2,  "ºC",   true},
+    {TLM_LINK_ERRORS,       NB_REF_LINK_ERROR,      LINK_ERRORS_HISTORY,    LINK_ERRORS_SPARK,  0,  "",     false}
+};
+
+// history window choices in minutes, DIAG_HISTORY_WINDOW index order
+static const int s_nDiagWindows[] = {5, 15, 60};
+
+static int diagWindow(int nIndex)
+{
+    if(nIndex < 0 || nIndex >= (int)(sizeof(s_nDiagWindows) / sizeof(s_nDiagWindows[0])))
+        nIndex = 1;
+    return s_nDiagWindows[nIndex];
+}
+
+int X2Dome::readDiagValue(int nChannel, double &dValue)
+{
+    int nErr;
+    int nTmp;
+
+    switch(nChannel) {
+        case TLM_AZ_SUPPLY:
+            return m_DomePro.getDomeSupplyVoltageAzimuthL(dValue);
+        case TLM_SHUTTER_SUPPLY:
+            return m_DomePro.getDomeSupplyVoltageShutterL(dValue);
+        case TLM_AZ_MOTOR:
+            return m_DomePro.getDomeAzimuthMotorADC(dValue);
+        case TLM_SHUTTER_MOTOR:
+            return m_DomePro.getDomeShutterMotorADC(dValue);
+        case TLM_AZ_TEMP:
+            return m_DomePro.getDomeAzimuthTempADC(dValue);
+        case TLM_SHUTTER_TEMP:
+            return m_DomePro.getDomeShutterTempADC(dValue);
+        case TLM_LINK_ERRORS:
+            nErr = m_DomePro.getDomeLinkErrCnt(nTmp);
+            dValue = nTmp;
+            return nErr;
+    }
+    return ERR_CMDFAILED;
+}
+
+void X2Dome::showDiagValue(X2GUIExchangeInterface* uiex, const DiagBinding &Bind, double dValue)
+{
+    char szBuffer[LOG_BUFFER_SIZE];
+
+    snprintf(szBuffer, LOG_BUFFER_SIZE, "%.*f%s%s", Bind.nDecimals, dValue, Bind.pszUnit[0] ? " " : "", Bind.pszUnit);
+    uiex->setText(Bind.pszValue, szBuffer);
+}
+
+// everything comes from the CDomePro diag history, no serial read
+void X2Dome::showDiagHistory(X2GUIExchangeInterface* uiex)
+{
+    int i;
+    double dWindow;
+    char szBuffer[LOG_BUFFER_SIZE];
+    char szSpark[DIAG_SPARK_SIZE];
+    DiagSummary Summary;
+    DiagLinkSummary Link;
+
+    m_nDiagVersion = m_DomePro.getDiagVersion();
+    dWindow = m_nDiagWindow * 60.0;
+
+    for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+        const DiagBinding &Bind = s_DiagBindings[i];
+
+        m_DomePro.getDiagSummary(Bind.nChannel, dWindow, Summary);
+        if(Summary.bHasLast)
+            showDiagValue(uiex, Bind, Summary.dLast);
+
+        if(!Summary.nCount)
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "no sample");
+        else if(Bind.nChannel == TLM_LINK_ERRORS)
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "%d in %d min (%3.1f /h)", (int)Summary.dSum, m_nDiagWindow, Summary.dSum * 60.0 / m_nDiagWindow);
+        else
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "%.*f / %.*f / %.*f %s", Bind.nDecimals, Summary.dMin, Bind.nDecimals, Summary.dMean,
+                     Bind.nDecimals, Summary.dMax, Bind.pszUnit);
+        uiex->setText(Bind.pszHistory, szBuffer);
+
+        m_DomePro.getDiagSparkline(Bind.nChannel, dWindow, szSpark, DIAG_SPARK_SIZE);
+        uiex->setText(Bind.pszSpark, szSpark);
+    }
+
+    m_DomePro.getDiagLinkSummary(dWindow, Link);
+    if(Link.nCommands)
+        snprintf(szBuffer, LOG_BUFFER_SIZE, "%u, %3.1f %% failed", Link.nCommands, Link.nFailed * 100.0 / Link.nCommands);
+    else
+        snprintf(szBuffer, LOG_BUFFER_SIZE, "none");
+    uiex->setText(COMMANDS_HISTORY, szBuffer);
+    if(Link.nRtt)
+        snprintf(szBuffer, LOG_BUFFER_SIZE, "%.0f / %.0f / %.0f ms (p50/p90/p99)", Link.dRttP50, Link.dRttP90, Link.dRttP99);
+    else
+        snprintf(szBuffer, LOG_BUFFER_SIZE, "no answer");
+    uiex->setText(ROUND_TRIP_HISTORY, szBuffer);
+}
+
 int X2Dome::doDomeProDiag(bool& bPressedOK)
 {
     int nErr = SB_OK;
@@ -857,7 +1155,12 @@ int X2Dome::doDomeProDiag(bool& bPressedOK)
     double dTmp;
     int nTmp;
     int nCPR;
+    int i;
+    ShutterBattery Battery;
+    DiagSummary Summary;
     char szBuffer[SERIAL_BUFFER_SIZE];
+    uint32_t nMainWaiting;
+    uint32_t nMainFresh;
 
     bPressedOK = false;
     if (NULL == ui)
@@ -871,50 +1174,59 @@ int X2Dome::doDomeProDiag(bool& bPressedOK)
         return ERR_POINTER;
 
     m_nCurrentDialog = DIAG;
+    // the main dialog may still be waiting for some of its settings
+    nMainWaiting = m_nSettingsWaiting;
+    nMainFresh = m_nSettingsFresh;
+    m_nSettingsWaiting = 0;
+    m_nSettingsFresh = 0;
 
+    m_nDiagWindow = diagWindow(dx->currentIndex(DIAG_HISTORY_WINDOW));
     if(m_bLinked) {
-        m_DomePro.getDomeSupplyVoltageAzimuthL(dTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f V", dTmp);
-        dx->setText(AZ_SUPPLY_VOLTAGE, szBuffer);
-
-        m_DomePro.getDomeAzimuthMotorADC(dTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f A", dTmp);
-        dx->setText(AZ_MOTOR_CURRENT, szBuffer);
-
-        m_DomePro.getDomeAzimuthTempADC(dTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f ºC", dTmp);
-        dx->setText(AZ_TEMP, szBuffer);
-
-        m_DomePro.getDomeAzDiagPosition(nTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%d", nTmp);
-        dx->setText(AZ_DIAG_COUNT, szBuffer);
-
-        m_DomePro.getDomeAzCPR(nCPR);
-        dTmp = (nTmp * 360.0 / nCPR);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2fº", dTmp);
-        dx->setText(AZ_DIAG_DEG, szBuffer);
-
-        m_DomePro.getDomeSupplyVoltageShutterL(dTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f V", dTmp);
-        dx->setText(SHUT_SUPPLY_VOLTAGE, szBuffer);
+        // only what the history doesn't have yet (just connected or history disabled) is read, once
+        for(i = 0; i < TLM_CHANNEL_COUNT; i++) {
+            if(s_DiagBindings[i].bShutter && !m_DomePro.hasShutterUnit())
+                continue;
+            if(!(m_DomePro.getModelPolicy().nTelemetry & (1 << s_DiagBindings[i].nChannel)))
+                continue;
+            m_DomePro.getDiagSummary(s_DiagBindings[i].nChannel, m_nDiagWindow * 60.0, Summary);
+            if(!Summary.bHasLast && readDiagValue(s_DiagBindings[i].nChannel, dTmp) == SB_OK)
+                showDiagValue(dx, s_DiagBindings[i], dTmp);
+        }
 
-        m_DomePro.getDomeShutterMotorADC(dTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f A", dTmp);
-        dx->setText(SHUT_SUPPLY_CURRENT, szBuffer);
+        // nothing rotates on a roll-off roof
+        dx->setEnabled(AZ_DIAG_COUNT_CLEAR, m_DomePro.getModelPolicy().bAzimuth);
+        dx->setEnabled(AX_DIAG_DEG_CLEAN, m_DomePro.getModelPolicy().bAzimuth);
+        if(m_DomePro.getModelPolicy().bAzimuth) {
+            m_DomePro.getDomeAzDiagPosition(nTmp);
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "%d", nTmp);
+            dx->setText(AZ_DIAG_COUNT, szBuffer);
+
+            m_DomePro.getDomeAzCPR(nCPR);
+            dTmp = nCPR ? (nTmp * 360.0 / nCPR) : 0.0;
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2fº", dTmp);
+            dx->setText(AZ_DIAG_DEG, szBuffer);
+        }
 
-        m_DomePro.getDomeShutterTempADC(dTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f ºC", dTmp);
-        dx->setText(SHUT_TEMPERATURE, szBuffer);
+        // from the last shutter moves, no extra read
+        m_DomePro.getShutterBatteryStatus(Battery);
+        if(Battery.dCyclesLeft < 0)
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "no shutter move measured yet");
+        else
+            snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2f V, %s%d cycles left", Battery.dRestVolts, Battery.bAlert ? "LOW, " : "", (int)Battery.dCyclesLeft);
+        dx->setText(SHUT_BATTERY_STATUS, szBuffer);
 
-        m_DomePro.getDomeLinkErrCnt(nTmp);
-        snprintf(szBuffer, LOG_BUFFER_SIZE, "%d", nTmp);
-        dx->setText(NB_REF_LINK_ERROR, szBuffer);
+        showDiagHistory(dx);
     }
     else {
 
     }
 
+    // the history only gets the reads done anyway, plus these while the dialog is up
+    m_DomePro.setDiagSampling(true);
     nErr = ui->exec(bPressedOK);
+    m_DomePro.setDiagSampling(false);
+    m_nSettingsWaiting = nMainWaiting;
+    m_nSettingsFresh = nMainFresh;
     if (nErr )
         return nErr;
 
@@ -932,16 +1244,25 @@ int X2Dome::doDiagDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEven
     double dTmp;
     int nTmp;
     int nCPR;
+    int nWindow;
+
+    // the I/O thread keeps the history, only redraw when it moved or the window changed
+    if (!strcmp(pszEvent, "on_timer") && m_bLinked) {
+        nWindow = diagWindow(uiex->currentIndex(DIAG_HISTORY_WINDOW));
+        if(nWindow != m_nDiagWindow || m_DomePro.getDiagVersion() != m_nDiagVersion) {
+            m_nDiagWindow = nWindow;
+            showDiagHistory(uiex);
+        }
+    }
 
-
-    if (!strcmp(pszEvent, CLEAR_DIAG_COUNT_CLICKED) || !strcmp(pszEvent, CLEAR_DIAG_DEG_CLICKED)) {
+    if ((!strcmp(pszEvent, CLEAR_DIAG_COUNT_CLICKED) || !strcmp(pszEvent, CLEAR_DIAG_DEG_CLICKED)) && m_DomePro.getModelPolicy().bAzimuth) {
         nErr = m_DomePro.clearDomeAzDiagPosition();
         nErr |= m_DomePro.getDomeAzDiagPosition(nTmp);
         snprintf(szBuffer, LOG_BUFFER_SIZE, "%d", nTmp);
         uiex->setText(AZ_DIAG_COUNT, szBuffer);
 
         nErr |= m_DomePro.getDomeAzCPR(nCPR);
-        dTmp = (nTmp * 360.0 / nCPR);
+        dTmp = nCPR ? (nTmp * 360.0 / nCPR) : 0.0;
         snprintf(szBuffer, LOG_BUFFER_SIZE, "%3.2fº", dTmp);
         uiex->setText(AZ_DIAG_DEG, szBuffer);
 
@@ -982,7 +1303,6 @@ void X2Dome::deviceInfoDetailedDescription(BasicStringInterface& str) const
 
  void X2Dome::deviceInfoFirmwareVersion(BasicStringInterface& str)					
 {
-    X2MutexLocker ml(GetMutex());
     if(m_bLinked) {
         char cFirmware[SERIAL_BUFFER_SIZE];
         m_DomePro.getFirmwareVersion(cFirmware, SERIAL_BUFFER_SIZE);
@@ -995,7 +1315,6 @@ void X2Dome::deviceInfoDetailedDescription(BasicStringInterface& str) const
 
 void X2Dome::deviceInfoModel(BasicStringInterface& str)
 {
-    X2MutexLocker ml(GetMutex());
     if(m_bLinked) {
         char cModel[SERIAL_BUFFER_SIZE];
         m_DomePro.getModel(cModel, SERIAL_BUFFER_SIZE);
@@ -1025,15 +1344,18 @@ double	X2Dome::driverInfoVersion(void) const
 //
 #pragma mark - DomeDriverInterface
 
+// No X2 mutex in the dapi calls : CDomePro serializes the serial port itself (the I/O thread uses it too) and the
+// positions come from its poll cache, so TheSkyX never waits behind a dialog or another call for a cached answer.
+// Only establishLink and terminateLink take the X2 mutex.
+
 int X2Dome::dapiGetAzEl(double* pdAz, double* pdEl)
 {
-    X2MutexLocker ml(GetMutex());
-
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    *pdAz = m_DomePro.getCurrentAz();
-    *pdEl = m_DomePro.getCurrentEl();
+    // no I/O here, the driver's I/O thread keeps these up to date
+    *pdAz = m_DomePro.getLastAz();
+    *pdEl = m_DomePro.getLastEl();
     return SB_OK;
 }
 
@@ -1041,12 +1363,10 @@ int X2Dome::dapiGotoAzEl(double dAz, double dEl)
 {
     int nErr = SB_OK;
 
-    X2MutexLocker ml(GetMutex());
-
     if(!m_bLinked)
         return ERR_NOLINK;
 
-    nErr = m_DomePro.gotoAzimuth(dAz);
+    nErr = m_DomePro.slaveToTarget(dAz, dEl);
     if(nErr)
         return ERR_CMDFAILED;
 
@@ -1059,8 +1379,6 @@ int X2Dome::dapiGotoAzEl(double dAz, double dEl)
 int X2Dome::dapiAbort(void)
 {
 
-    X2MutexLocker ml(GetMutex());
-
     if(!m_bLinked)
         return ERR_NOLINK;
 
@@ -1072,7 +1390,6 @@ int X2Dome::dapiAbort(void)
 int X2Dome::dapiOpen(void)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1090,7 +1407,6 @@ int X2Dome::dapiOpen(void)
 int X2Dome::dapiClose(void)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1108,7 +1424,6 @@ int X2Dome::dapiClose(void)
 int X2Dome::dapiPark(void)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1123,7 +1438,6 @@ int X2Dome::dapiPark(void)
 int X2Dome::dapiUnpark(void)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1138,7 +1452,6 @@ int X2Dome::dapiUnpark(void)
 int X2Dome::dapiFindHome(void)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1154,7 +1467,6 @@ int X2Dome::dapiIsGotoComplete(bool* pbComplete)
 {
     int nErr;
     bool bAzGotoDone, bElGotoDone = false;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1178,7 +1490,6 @@ int X2Dome::dapiIsGotoComplete(bool* pbComplete)
 int X2Dome::dapiIsOpenComplete(bool* pbComplete)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1199,7 +1510,6 @@ int X2Dome::dapiIsOpenComplete(bool* pbComplete)
 int	X2Dome::dapiIsCloseComplete(bool* pbComplete)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1220,7 +1530,6 @@ int	X2Dome::dapiIsCloseComplete(bool* pbComplete)
 int X2Dome::dapiIsParkComplete(bool* pbComplete)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1235,7 +1544,6 @@ int X2Dome::dapiIsParkComplete(bool* pbComplete)
 int X2Dome::dapiIsUnparkComplete(bool* pbComplete)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1250,7 +1558,6 @@ int X2Dome::dapiIsUnparkComplete(bool* pbComplete)
 int X2Dome::dapiIsFindHomeComplete(bool* pbComplete)
 {
     int nErr;
-    X2MutexLocker ml(GetMutex());
 
     if(!m_bLinked)
         return ERR_NOLINK;
@@ -1266,8 +1573,6 @@ int X2Dome::dapiSync(double dAz, double dEl)
 {
     int nErr;
 
-    X2MutexLocker ml(GetMutex());
-
     if(!m_bLinked)
         return ERR_NOLINK;
 
@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 
 #include "../../licensedinterfaces/sberrorx.h"
 #include "../../licensedinterfaces/basicstringinterface.h"
@@ -22,6 +23,8 @@
 #include "../../licensedinterfaces/x2guiinterface.h"
 
 #include "domepro.h"
+#include "domebroker.h"
+#include "domealpaca.h"
 #include "UI_map.h"
 
 
@@ -47,6 +50,68 @@
 
 #define CHILD_KEY_SHUTTER_GOTO  "ShutterGotoEnabled"
 
+#define CHILD_KEY_PREDICTIVE_SLAVING    "PredictiveSlaving"
+#define CHILD_KEY_SLIT_WIDTH            "SlitWidth"
+#define CHILD_KEY_SLAVING_LEAD_TIME     "SlavingLeadTime"
+#define CHILD_KEY_AZ_ROTATION_SPEED     "AzRotationSpeed"
+
+#define CHILD_KEY_CPR_CAL_PASSES        "CprCalibrationPasses"
+#define CHILD_KEY_CPR_CAL_MAX_SIGMA     "CprCalibrationMaxSigma"
+
+#define CHILD_KEY_DRIFT_MONITOR         "DriftMonitor"
+#define CHILD_KEY_DRIFT_CORRECTION      "DriftCorrection"
+#define CHILD_KEY_DRIFT_THRESHOLD       "DriftThreshold"
+
+#define CHILD_KEY_SLIP_DETECTION        "SlipDetection"
+#define CHILD_KEY_SLIP_THRESHOLD        "SlipThreshold"
+
+#define CHILD_KEY_CURRENT_ANALYSIS      "CurrentAnalysis"
+#define CHILD_KEY_CURRENT_REPORT_FILE   "CurrentReportFile"
+
+#define CHILD_KEY_POLL_AZ_FAST          "PollAzFastPeriod"
+#define CHILD_KEY_POLL_AZ_SLOW          "PollAzSlowPeriod"
+#define CHILD_KEY_POLL_SHUTTER_FAST     "PollShutterFastPeriod"
+#define CHILD_KEY_POLL_SHUTTER_SLOW     "PollShutterSlowPeriod"
+
+#define CHILD_KEY_SHUTTER_BATTERY       "ShutterBattery"
+#define CHILD_KEY_SHUTTER_BATTERY_FILE  "ShutterBatteryFile"
+#define CHILD_KEY_BATTERY_CAPACITY      "BatteryCapacityWh"
+#define CHILD_KEY_BATTERY_FULL_VOLTS    "BatteryFullVolts"
+#define CHILD_KEY_BATTERY_EMPTY_VOLTS   "BatteryEmptyVolts"
+#define CHILD_KEY_BATTERY_ALERT_CYCLES  "BatteryAlertCycles"
+
+#define CHILD_KEY_STATUS_PAGE           "StatusPage"
+#define CHILD_KEY_STATUS_PAGE_NAME      "StatusPageName"
+
+#define CHILD_KEY_BROKER                "Broker"
+#define CHILD_KEY_BROKER_SOCKET         "BrokerSocket"
+
+#define CHILD_KEY_ALPACA                "Alpaca"
+#define CHILD_KEY_ALPACA_PORT           "AlpacaPort"
+
+#define CHILD_KEY_DIAG_HISTORY          "DiagHistory"
+
+#define CHILD_KEY_CAPS_FIRMWARE         "CapabilitiesFirmware"
+#define CHILD_KEY_CAPS_UNSUPPORTED      "UnsupportedFeatures"
+
+#define CHILD_KEY_TELEMETRY             "Telemetry"
+#define CHILD_KEY_TELEMETRY_FILE        "TelemetryFile"
+#define CHILD_KEY_TELEMETRY_RECORDS     "TelemetryRecords"
+#define CHILD_KEY_TELEMETRY_FAST_PERIOD "TelemetryFastPeriod"
+#define CHILD_KEY_TELEMETRY_SLOW_PERIOD "TelemetrySlowPeriod"
+#define CHILD_KEY_TELEMETRY_ARCHIVE     "TelemetryArchive"
+#define CHILD_KEY_TELEMETRY_ARCHIVE_FILE "TelemetryArchiveFile"
+// per channel sensor correction, "AzTempGain", "AzTempOffset" ... (channel names from telemetryring.cpp)
+#define CHILD_KEY_SENSOR_GAIN           "%sGain"
+#define CHILD_KEY_SENSOR_OFFSET         "%sOffset"
+
+#define CHILD_KEY_USE_GEOMETRY  "UseGeometry"
+#define CHILD_KEY_DOME_RADIUS   "DomeRadius"
+#define CHILD_KEY_MOUNT_EAST    "MountEastOffset"
+#define CHILD_KEY_MOUNT_NORTH   "MountNorthOffset"
+#define CHILD_KEY_MOUNT_UP      "MountUpOffset"
+#define CHILD_KEY_GEM_OFFSET    "GemAxisOffset"
+
 #if defined(SB_WIN_BUILD)
 #define DEF_PORT_NAME					"COM1"
 #elif defined(SB_MAC_BUILD)
@@ -59,6 +124,34 @@
 
 enum DIALOGS {MAIN, SHUTTER, TIMEOUTS, DIAG };
 
+// binding of the dialog controls (UI_map.h) to the controller settings (DomeSetting in domepro.h)
+enum SettingControlType {BIND_CHECK = 0, BIND_POLARITY, BIND_INT, BIND_DOUBLE, BIND_INDEX, BIND_YES_NO, BIND_TEXT};
+
+#define BIND_READ_ONLY          0x01    // shown, never written
+#define BIND_SHUTTER            0x02    // needs a shutter unit
+#define BIND_SEQUENCING         0x04    // disabled in single shutter mode
+
+#define BIND_TOLERANCE          1e-6    // smaller differences between a control and the controller are no change
+
+typedef struct {
+    int         nSetting;       // DomeSetting
+    const char  *pszControl;
+    int         nType;          // SettingControlType
+    double      dScale;         // control value = controller value * dScale, for BIND_INT and BIND_DOUBLE
+    int         nFlags;         // BIND_READ_ONLY ...
+} SettingBinding;
+
+// diag dialog labels of a telemetry channel, filled from the CDomePro diag history
+typedef struct {
+    int         nChannel;       // TelemetryChannels
+    const char  *pszValue;      // last value
+    const char  *pszHistory;    // min / mean / max over the window
+    const char  *pszSpark;
+    int         nDecimals;
+    const char  *pszUnit;
+    bool        bShutter;       // read by the shutter unit
+} DiagBinding;
+
 class X2Dome: public DomeDriverInterface, public SerialPortParams2Interface, public ModalSettingsDialogInterface, public X2GUIEventInterface
 {
 public:
@@ -171,19 +264,45 @@ private:
     int doDomeProDiag(bool& bPressedOK);
     int doDiagDialogEvents(X2GUIExchangeInterface* uiex, const char* pszEvent);
 
+    void setCalibrateCprControlState(X2GUIExchangeInterface* uiex, bool enabled);
     void setMainDialogControlState(X2GUIExchangeInterface* uiex, bool enabled);
+    void setShutterAngleControlState(X2GUIExchangeInterface* uiex, bool enabled);
+
+    // settings shown from the CDomePro cache, refreshed in the background, and written back on OK
+    void beginSettings(X2GUIExchangeInterface* uiex, uint32_t nSettings);
+    void showFreshSettings(X2GUIExchangeInterface* uiex);
+    void showSetting(X2GUIExchangeInterface* uiex, int nSetting, const DomeSettings &Settings, bool bEnable);
+    void disableSettings(X2GUIExchangeInterface* uiex, uint32_t nSettings);
+    int  applySettings(X2GUIExchangeInterface* uiex, uint32_t nSettings, uint32_t nFresh, uint32_t &nChanged);
+    bool isSettingEnabled(const SettingBinding &Bind, int nModel, bool bSingleShutter);
+    int  settingsModel(const DomeSettings &Settings);
+
+    // diag dialog, refreshed from the history on on_timer without any serial read
+    int  readDiagValue(int nChannel, double &dValue);
+    void showDiagValue(X2GUIExchangeInterface* uiex, const DiagBinding &Bind, double dValue);
+    void showDiagHistory(X2GUIExchangeInterface* uiex);
+
+    void saveCapabilities();
     
     void portNameOnToCharPtr(char* pszPort, const int& nMaxSize) const;
 
 
 	int         m_nPrivateISIndex;
-	bool        m_bLinked;
+	std::atomic<bool>   m_bLinked;      // the dapi calls read it without the X2 mutex
+    CDomeBrokerSerial   m_BrokerSerial;     // before m_DomePro, it's used until m_DomePro is gone
     CDomePro    m_DomePro;
-    bool        m_bHasShutterControl;
+    CDomeAlpaca m_Alpaca;           // after m_DomePro, it must stop first
+    bool        m_bAlpaca;
+    int         m_nAlpacaPort;
+    std::atomic<bool>   m_bHasShutterControl;
     bool        m_bOpenUpperShutterOnly;
     int         m_nLearningDomeCPR;
     int         m_bBattRequest;
     int         m_nCurrentDialog;
+    uint32_t    m_nSettingsWaiting;     // DomeSetting bits the current dialog is waiting for
+    uint32_t    m_nSettingsFresh;       // shown with a fresh value, the only ones written back on OK
+    uint32_t    m_nDiagVersion;         // diag history shown in the diag dialog
+    int         m_nDiagWindow;          // minutes
 
     int         m_Shutter1OpenAngle;
     int         m_Shutter1OpenAngle_ADC;
@@ -197,7 +316,7 @@ private:
     int         m_Shutter2CloseAngle_ADC;
     double      m_ADC_Ratio2;
 
-    bool        m_bShutterGotoEnabled;
+    std::atomic<bool>   m_bShutterGotoEnabled;
 
 
 };